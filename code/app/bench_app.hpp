@@ -0,0 +1,1833 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <stb_image.h>
+#include <stb_image_write.h>
+#include <reactive/reactive.hpp>
+
+#include "../../shader/bsdf.h"
+#include "../filepath.hpp"
+#include "../loader/hdr_reader.hpp"
+#include "../output/frame_sink.hpp"
+#include "../output/jpeg_encoder.hpp"
+#include "../output/yuv.hpp"
+#include "../post/bloom.hpp"
+#include "../post/color_lut.hpp"
+#include "../post/composite.hpp"
+#include "../post/denoiser.hpp"
+#include "../render_pass.hpp"
+#include "../scene/env_light_sampler.hpp"
+#include "../scene/env_light_sh.hpp"
+#include "../scene/env_texture.hpp"
+#include "../scene/light_sampler.hpp"
+#include "../scene/material_texture.hpp"
+#include "../scene/texture_atlas.hpp"
+#include "../shader_variant.hpp"
+#include "../sobol_sampler.hpp"
+#include "../spectrum_table.hpp"
+#include "../thread_pool.hpp"
+
+// GPUを使わないCPU側処理のベンチマーク
+// 正しさの検証は expect() で行い、1 つでも失敗すると run() が false を返す (終了コードが 1 になる)
+class BenchApp {
+public:
+    // gpuMilliPerSample: 1280x720 で 1 spp をトレースする GPU の時間 (デノイザーの等時間比較に使う)
+    BenchApp(uint32_t width, uint32_t height, double gpuMilliPerSample = 2.0)
+        : m_width{width}, m_height{height}, m_gpuMilliPerSample{gpuMilliPerSample} {
+        spdlog::set_pattern("[%^%l%$] %v");
+        spdlog::info("Threads: {}", ThreadPool::getShared().getThreadCount());
+    }
+
+    bool run() {
+        benchJpegEncoder();
+        benchFrameSinks();
+        benchDenoiser();
+        benchColorLut();
+        benchBloom();
+        benchSampler();
+        benchEnvLightSampler();
+        benchLightSampler();
+        benchPathWeights();
+        benchSpectrum();
+        benchShaderVariants();
+        benchEnvTexture();
+        benchHdrReader();
+        benchEnvLightSH();
+        benchMaterialTexture();
+        benchTextureAtlas();
+
+        if (m_failureCount > 0) {
+            spdlog::error("{} checks failed", m_failureCount);
+            return false;
+        }
+        spdlog::info("All checks passed");
+        return true;
+    }
+
+private:
+    void beginSection(const std::string& name) {
+        m_section = name;
+        spdlog::info("--- {} ---", name);
+    }
+
+    // 失敗したときだけ what (測った値を含める) を出力する
+    void expect(bool passed, const std::string& what) {
+        if (!passed) {
+            spdlog::error("[{}] check failed: {}", m_section, what);
+            m_failureCount++;
+        }
+    }
+
+    template <typename Func>
+    static double measure(int iterations, Func&& func) {
+        func();  // warm up
+        rv::CPUTimer timer;
+        for (int i = 0; i < iterations; i++) {
+            func();
+        }
+        return timer.elapsedInMilli() / iterations;
+    }
+
+    static double computePSNR(const uint8_t* rgba, const uint8_t* rgb, size_t pixelCount) {
+        double squaredError = 0.0;
+        for (size_t i = 0; i < pixelCount; i++) {
+            for (int c = 0; c < 3; c++) {
+                const double diff = static_cast<double>(rgba[i * 4 + c]) - rgb[i * 3 + c];
+                squaredError += diff * diff;
+            }
+        }
+        const double mse = std::max(squaredError / (pixelCount * 3), 1e-10);
+        return 10.0 * std::log10(255.0 * 255.0 / mse);
+    }
+
+    // 実際の出力フレーム (000.jpg, ...) があればそれを使い、なければ合成画像を使う
+    std::vector<std::vector<uint8_t>> loadFrames(uint32_t width, uint32_t height) const {
+        std::vector<std::vector<uint8_t>> frames;
+        for (uint32_t frame = 0; frame < 8; frame++) {
+            const fs::path path = std::format("{:03}.jpg", frame);
+            int w, h, c;
+            uint8_t* pixels = fs::exists(path)
+                                  ? stbi_load(path.string().c_str(), &w, &h, &c, 4)
+                                  : nullptr;
+            if (pixels && w == static_cast<int>(width) && h == static_cast<int>(height)) {
+                frames.emplace_back(pixels, pixels + width * height * 4);
+            }
+            stbi_image_free(pixels);
+        }
+        if (!frames.empty()) {
+            spdlog::info("Use {} rendered frames", frames.size());
+            return frames;
+        }
+
+        std::mt19937 rng{0};
+        std::normal_distribution<float> noise{0.0f, 12.0f};
+        for (uint32_t frame = 0; frame < 4; frame++) {
+            std::vector<uint8_t> pixels(width * height * 4);
+            for (uint32_t y = 0; y < height; y++) {
+                for (uint32_t x = 0; x < width; x++) {
+                    const float fx = static_cast<float>(x) / width;
+                    const float fy = static_cast<float>(y) / height;
+                    const float wave = std::sin((fx * 9.0f + frame) * 3.0f) * std::cos(fy * 7.0f);
+                    const float base[3] = {fx * 200.0f, fy * 180.0f, 128.0f + 90.0f * wave};
+                    for (int c = 0; c < 3; c++) {
+                        const float value = base[c] + noise(rng);
+                        pixels[(y * width + x) * 4 + c] =
+                            static_cast<uint8_t>(std::clamp(value, 0.0f, 255.0f));
+                    }
+                    pixels[(y * width + x) * 4 + 3] = 255;
+                }
+            }
+            frames.push_back(std::move(pixels));
+        }
+        spdlog::info("Use {} synthetic frames", frames.size());
+        return frames;
+    }
+
+    void benchJpegEncoder() {
+        const auto sizes = {std::pair{m_width, m_height}, std::pair{3840u, 2160u}};
+        for (const auto& [width, height] : sizes) {
+            beginSection(std::format("JPEG encoder {}x{}", width, height));
+            const auto frames = loadFrames(width, height);
+            const size_t pixelCount = static_cast<size_t>(width) * height;
+            JpegEncoder encoder{width, height, 90};
+
+            std::vector<uint8_t> stbBytes;
+            const auto writeToVector = [](void* context, void* data, int size) {
+                auto* bytes = static_cast<std::vector<uint8_t>*>(context);
+                bytes->insert(bytes->end(), static_cast<uint8_t*>(data),
+                              static_cast<uint8_t*>(data) + size);
+            };
+
+            double stbTime = 0.0;
+            double singleTime = 0.0;
+            double parallelTime = 0.0;
+            double stbPSNR = 0.0;
+            double ourPSNR = 0.0;
+            size_t stbSize = 0;
+            size_t ourSize = 0;
+            bool identical = true;
+            for (const auto& frame : frames) {
+                stbTime += measure(3, [&] {
+                    stbBytes.clear();
+                    stbi_write_jpg_to_func(writeToVector, &stbBytes, width, height, 4,
+                                           frame.data(), 90);
+                });
+                std::vector<uint8_t> single;
+                std::vector<uint8_t> parallel;
+                singleTime += measure(3, [&] { single = encoder.encode(frame.data(), nullptr); });
+                parallelTime += measure(3, [&] {
+                    parallel = encoder.encode(frame.data(), &ThreadPool::getShared());
+                });
+
+                // ストリップ分割の並列化で出力が変わらないこと
+                identical = identical && single == parallel;
+
+                // 同じデコーダー (stb_image) で両方を復号して元画像と比較する
+                int w, h, c;
+                uint8_t* decoded = stbi_load_from_memory(
+                    parallel.data(), static_cast<int>(parallel.size()), &w, &h, &c, 3);
+                if (!decoded || w != static_cast<int>(width) || h != static_cast<int>(height)) {
+                    expect(false, "the encoded JPEG can be decoded");
+                    stbi_image_free(decoded);
+                    return;
+                }
+                ourPSNR += computePSNR(frame.data(), decoded, pixelCount);
+                stbi_image_free(decoded);
+
+                decoded = stbi_load_from_memory(stbBytes.data(), static_cast<int>(stbBytes.size()),
+                                                &w, &h, &c, 3);
+                stbPSNR += computePSNR(frame.data(), decoded, pixelCount);
+                stbi_image_free(decoded);
+
+                stbSize += stbBytes.size();
+                ourSize += parallel.size();
+            }
+
+            const double n = static_cast<double>(frames.size());
+            spdlog::info("stb_image_write: {:.2f} ms/frame, {:.0f} KB", stbTime / n,
+                         stbSize / n / 1024.0);
+            spdlog::info("JpegEncoder x1:  {:.2f} ms/frame", singleTime / n);
+            spdlog::info("JpegEncoder xN:  {:.2f} ms/frame, {:.0f} KB ({} strips)",
+                         parallelTime / n, ourSize / n / 1024.0, encoder.getStripCount());
+
+            // 同じ品質の stb_image_write と同程度の画質で、ストリップ分割しても出力は変わらない
+            expect(identical, "single/parallel output is byte-identical");
+            expect(ourPSNR / n >= stbPSNR / n - 0.5,
+                   std::format("PSNR {:.2f} dB >= stb {:.2f} dB - 0.5", ourPSNR / n, stbPSNR / n));
+        }
+    }
+
+    static std::vector<uint8_t> readBytes(const fs::path& path) {
+        std::ifstream file{path, std::ios::binary};
+        return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    }
+
+    // I420 はベクトルの部分と端数の列 (スカラー) の比較、Y4M と AVI は書いたファイルを読み戻す
+    void benchFrameSinks() {
+        beginSection("Frame sinks");
+
+        // 幅 22 は 8 の倍数でなく、高さ 9 は奇数
+        constexpr uint32_t kWidth = 22;
+        constexpr uint32_t kHeight = 9;
+        std::mt19937 rng{0};
+        std::uniform_int_distribution<int> byte{0, 255};
+        std::vector<uint8_t> frames[2];
+        for (auto& frame : frames) {
+            frame.resize(kWidth * kHeight * 4);
+            for (uint8_t& value : frame) {
+                value = static_cast<uint8_t>(byte(rng));
+            }
+        }
+
+        // 6 列ずつの帯はスカラーの列だけで変換される。全体の変換とバイト単位で一致すること
+        std::vector<uint8_t> whole(yuv::getI420Size(kWidth, kHeight));
+        yuv::convertRGBAToI420(frames[0].data(), kWidth, kHeight, whole.data(), nullptr);
+        const uint32_t chromaWidth = yuv::getChromaWidth(kWidth);
+        const uint32_t chromaHeight = yuv::getChromaHeight(kHeight);
+        bool stripsMatch = true;
+        for (uint32_t x0 = 0; x0 < kWidth; x0 += 6) {
+            const uint32_t width = std::min(6u, kWidth - x0);
+            std::vector<uint8_t> rgba(width * kHeight * 4);
+            for (uint32_t y = 0; y < kHeight; y++) {
+                std::copy_n(&frames[0][(y * kWidth + x0) * 4], width * 4, &rgba[y * width * 4]);
+            }
+            std::vector<uint8_t> strip(yuv::getI420Size(width, kHeight));
+            yuv::convertRGBAToI420(rgba.data(), width, kHeight, strip.data(), nullptr);
+            for (uint32_t y = 0; y < kHeight; y++) {
+                for (uint32_t x = 0; x < width; x++) {
+                    stripsMatch &= strip[y * width + x] == whole[y * kWidth + x0 + x];
+                }
+            }
+            const uint32_t stripChromaWidth = yuv::getChromaWidth(width);
+            for (uint32_t plane = 0; plane < 2; plane++) {
+                const uint8_t* stripPlane =
+                    strip.data() + width * kHeight + plane * stripChromaWidth * chromaHeight;
+                const uint8_t* wholePlane =
+                    whole.data() + kWidth * kHeight + plane * chromaWidth * chromaHeight;
+                for (uint32_t y = 0; y < chromaHeight; y++) {
+                    for (uint32_t x = 0; x < stripChromaWidth; x++) {
+                        stripsMatch &= stripPlane[y * stripChromaWidth + x] ==
+                                       wholePlane[y * chromaWidth + x0 / 2 + x];
+                    }
+                }
+            }
+        }
+        expect(stripsMatch, "I420: the SIMD loop matches the scalar columns byte for byte");
+
+        {
+            const std::vector<uint8_t> image = loadFrames(m_width, m_height).front();
+            std::vector<uint8_t> single(yuv::getI420Size(m_width, m_height));
+            std::vector<uint8_t> parallel(single.size());
+            const double singleTime = measure(5, [&] {
+                yuv::convertRGBAToI420(image.data(), m_width, m_height, single.data(), nullptr);
+            });
+            const double parallelTime = measure(5, [&] {
+                yuv::convertRGBAToI420(image.data(), m_width, m_height, parallel.data(),
+                                       &ThreadPool::getShared());
+            });
+            spdlog::info("I420 {}x{}: {:.2f} ms (1 thread) / {:.2f} ms", m_width, m_height,
+                         singleTime, parallelTime);
+            expect(single == parallel, "I420: single/parallel output is byte-identical");
+        }
+
+        // Y4M: ヘッダ、FRAME と I420 の繰り返し (同一のフレームも書く)
+        const fs::path y4mPath = fs::temp_directory_path() / "bench_frame_sink.y4m";
+        {
+            Y4mSink sink{y4mPath.string(), kWidth, kHeight, 30, false};
+            sink.write(0, sink.encode(frames[0].data()));
+            sink.writeDuplicate(1);
+            sink.finish();
+        }
+        const std::string y4mHeader =
+            std::format("YUV4MPEG2 W{} H{} F30:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", kWidth,
+                        kHeight);
+        std::vector<uint8_t> expectedY4m(y4mHeader.begin(), y4mHeader.end());
+        for (int i = 0; i < 2; i++) {
+            for (const char c : std::string{"FRAME\n"}) {
+                expectedY4m.push_back(static_cast<uint8_t>(c));
+            }
+            expectedY4m.insert(expectedY4m.end(), whole.begin(), whole.end());
+        }
+        const std::vector<uint8_t> y4m = readBytes(y4mPath);
+        expect(y4m == expectedY4m,
+               std::format("Y4M: header + 2 x (FRAME + I420) ({} bytes, expected {})",
+                           y4m.size(), expectedY4m.size()));
+        fs::remove(y4mPath);
+
+        // AVI: frame 1 は frame 0 と同一。チャンクは 2 つで、idx1 は 3 つ
+        const fs::path aviPath = fs::temp_directory_path() / "bench_frame_sink.avi";
+        std::vector<uint8_t> jpegs[2];
+        {
+            AviMjpegSink sink{aviPath, kWidth, kHeight, 30};
+            jpegs[0] = sink.encode(frames[0].data());
+            jpegs[1] = sink.encode(frames[1].data());
+            sink.write(0, jpegs[0]);
+            sink.writeDuplicate(1);
+            sink.write(2, jpegs[1]);
+            sink.finish();
+        }
+        const std::vector<uint8_t> avi = readBytes(aviPath);
+        fs::remove(aviPath);
+        const auto u32 = [&](size_t offset) {
+            if (offset + 4 > avi.size()) {
+                return 0u;
+            }
+            return avi[offset] | avi[offset + 1] << 8 | avi[offset + 2] << 16 |
+                   static_cast<uint32_t>(avi[offset + 3]) << 24;
+        };
+        const auto fourcc = [&](size_t offset) {
+            return offset + 4 > avi.size()
+                       ? std::string{}
+                       : std::string{reinterpret_cast<const char*>(&avi[offset]), 4};
+        };
+        const auto padded = [](size_t size) { return size + size % 2; };
+
+        // 後から確定するフィールド (frame_sink.cpp の k*Offset)
+        expect(fourcc(0) == "RIFF" && fourcc(8) == "AVI " && u32(4) == avi.size() - 8,
+               std::format("AVI: RIFF size {} = file size {} - 8", u32(4), avi.size()));
+        expect(u32(48) == 3 && u32(140) == 3,
+               std::format("AVI: avih/strh frame count {}/{} = 3", u32(48), u32(140)));
+        const size_t maxSize = std::max(jpegs[0].size(), jpegs[1].size());
+        expect(u32(60) == maxSize && u32(144) == maxSize,
+               std::format("AVI: suggested buffer size {} = largest chunk {}", u32(60), maxSize));
+
+        // idx1 のオフセットは 'movi' の位置から
+        constexpr size_t kMoviPosition = 220;
+        const size_t moviSize = 4 + 8 + padded(jpegs[0].size()) + 8 + padded(jpegs[1].size());
+        expect(fourcc(kMoviPosition - 8) == "LIST" && fourcc(kMoviPosition) == "movi" &&
+                   u32(kMoviPosition - 4) == moviSize,
+               std::format("AVI: movi holds 2 chunks ({} bytes, expected {})",
+                           u32(kMoviPosition - 4), moviSize));
+        const size_t indexPosition = kMoviPosition + moviSize;
+        expect(fourcc(indexPosition) == "idx1" && u32(indexPosition + 4) == 3 * 16 &&
+                   indexPosition + 8 + 3 * 16 == avi.size(),
+               "AVI: idx1 with 3 entries ends the file");
+        const int chunks[3] = {0, 0, 1};
+        for (uint32_t i = 0; i < 3; i++) {
+            const size_t entry = indexPosition + 8 + i * 16;
+            const std::vector<uint8_t>& jpeg = jpegs[chunks[i]];
+            const size_t chunk = kMoviPosition + u32(entry + 8);
+            const bool valid =
+                fourcc(entry) == "00dc" && u32(entry + 4) == 0x10 &&
+                u32(entry + 12) == jpeg.size() && fourcc(chunk) == "00dc" &&
+                u32(chunk + 4) == jpeg.size() && chunk + 8 + jpeg.size() <= avi.size() &&
+                std::equal(jpeg.begin(), jpeg.end(), avi.begin() + chunk + 8);
+            expect(valid, std::format("AVI: idx1 entry {} points at the JPEG of frame {}", i,
+                                      chunks[i] * 2));
+        }
+        expect(u32(indexPosition + 16) == u32(indexPosition + 32),
+               "AVI: the duplicate reuses the offset of the previous chunk");
+    }
+
+    // デノイザー用の合成シーン: 法線・深度の異なる3枚の面とチェッカー模様のアルベド
+    struct DenoiserScene {
+        std::vector<float> radiance;  // ground truth
+        std::vector<float> albedo;
+        std::vector<float> normalDepth;
+    };
+
+    static DenoiserScene createDenoiserScene(uint32_t width, uint32_t height) {
+        const size_t pixelCount = static_cast<size_t>(width) * height;
+        DenoiserScene scene{std::vector<float>(pixelCount * 4), std::vector<float>(pixelCount * 4),
+                            std::vector<float>(pixelCount * 4)};
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                const size_t i = (static_cast<size_t>(y) * width + x) * 4;
+                const float fx = static_cast<float>(x) / width;
+                const float fy = static_cast<float>(y) / height;
+                const int face = fy > 0.7f ? 0 : (fx < 0.5f ? 1 : 2);  // floor, left, right wall
+                const float normals[3][3] = {{0.0f, 1.0f, 0.0f}, {1.0f, 0.0f, 0.0f},
+                                             {0.0f, 0.0f, 1.0f}};
+                const float depth = face == 0 ? 2.0f + (1.0f - fy) * 20.0f : 8.0f + fx * 4.0f;
+                const bool checker = ((x / 16) + (y / 16)) % 2 == 0;
+                const float albedo[3] = {checker ? 0.8f : 0.2f, 0.5f, checker ? 0.3f : 0.7f};
+                // 滑らかな照明 (最大 4 程度の HDR)
+                const float distance2 = (fx - 0.3f) * (fx - 0.3f) + (fy - 0.4f) * (fy - 0.4f);
+                const float irradiance = 0.5f + 3.5f * std::exp(-8.0f * distance2);
+                for (int c = 0; c < 3; c++) {
+                    scene.albedo[i + c] = albedo[c];
+                    scene.normalDepth[i + c] = normals[face][c];
+                    scene.radiance[i + c] = albedo[c] * irradiance;
+                }
+                scene.normalDepth[i + 3] = depth;
+                scene.albedo[i + 3] = 1.0f;
+                scene.radiance[i + 3] = 1.0f;
+            }
+        }
+        return scene;
+    }
+
+    // samples spp の推定値: 1サンプルの相対標準偏差を kSampleDeviation とした平均
+    static std::vector<float> addSamplingNoise(const std::vector<float>& radiance,
+                                               uint32_t samples,
+                                               uint32_t seed) {
+        constexpr float kSampleDeviation = 1.5f;
+        std::mt19937 rng{seed};
+        const float deviation = kSampleDeviation / std::sqrt(static_cast<float>(samples));
+        std::normal_distribution<float> normal{0.0f, deviation};
+        std::vector<float> noisy(radiance.size());
+        for (size_t i = 0; i < radiance.size(); i += 4) {
+            // 輝度ノイズ (チャンネル間で相関) のほうが実際のパストレースに近い
+            const float scale = std::max(0.0f, 1.0f + normal(rng));
+            for (int c = 0; c < 3; c++) {
+                noisy[i + c] = radiance[i + c] * scale;
+            }
+            noisy[i + 3] = 1.0f;
+        }
+        return noisy;
+    }
+
+    static double computeRMSE(const std::vector<float>& a, const std::vector<float>& b) {
+        double squaredError = 0.0;
+        for (size_t i = 0; i < a.size(); i += 4) {
+            for (int c = 0; c < 3; c++) {
+                const double diff = static_cast<double>(a[i + c]) - b[i + c];
+                squaredError += diff * diff;
+            }
+        }
+        return std::sqrt(squaredError / (a.size() / 4 * 3));
+    }
+
+    // 時間と、同じ時間で GPU がサンプルを追加した場合との誤差の比較 (合成ノイズ)
+    void benchDenoiser() {
+        const auto sizes = {std::pair{m_width, m_height}, std::pair{3840u, 2160u}};
+        for (const auto& [width, height] : sizes) {
+            beginSection(std::format("Denoiser {}x{}", width, height));
+            const DenoiserScene scene = createDenoiserScene(width, height);
+            const double megaPixels = static_cast<double>(width) * height / 1e6;
+            const Denoiser denoiser{width, height, DenoiserSettings{.enabled = true}};
+            std::vector<float> output(scene.radiance.size());
+
+            const std::vector<float> noisy = addSamplingNoise(scene.radiance, 16, 0);
+            const auto denoise = [&](const std::vector<float>& color, ThreadPool* pool) {
+                denoiser.denoise(color.data(), scene.albedo.data(), scene.normalDepth.data(),
+                                 output.data(), pool);
+            };
+            const double singleTime = measure(1, [&] { denoise(noisy, nullptr); });
+            const std::vector<float> singleOutput = output;
+            const double parallelTime =
+                measure(1, [&] { denoise(noisy, &ThreadPool::getShared()); });
+            spdlog::info("Denoiser x1: {:.2f} ms/frame ({:.2f} ms/MP)", singleTime,
+                         singleTime / megaPixels);
+            spdlog::info("Denoiser xN: {:.2f} ms/frame ({:.2f} ms/MP)", parallelTime,
+                         parallelTime / megaPixels);
+            expect(output == singleOutput, "single/parallel output is identical");
+
+            // 等時間比較: デノイズにかかる時間で GPU が追加できたサンプル数
+            const double gpuMilliPerSample = m_gpuMilliPerSample * megaPixels / 0.9216;
+            const uint32_t extraSamples =
+                static_cast<uint32_t>(std::floor(parallelTime / gpuMilliPerSample));
+            spdlog::info("Equal time: {:.2f} ms/spp on GPU, denoise = +{} spp", gpuMilliPerSample,
+                         extraSamples);
+
+            // 同じ spp のノイズのある画像より誤差が 2 割以上小さく、サンプルを足した画像にも勝つ
+            // 4 spp では固定の colorSigma でノイズを辺と見なしてしまうので等時間では勝てない
+            for (uint32_t samples : {4u, 16u, 64u}) {
+                const auto noisyN = addSamplingNoise(scene.radiance, samples, samples);
+                const auto noisyMore =
+                    addSamplingNoise(scene.radiance, samples + extraSamples, samples + 1);
+                denoise(noisyN, &ThreadPool::getShared());
+                const double noisyError = computeRMSE(noisyN, scene.radiance);
+                const double moreError = computeRMSE(noisyMore, scene.radiance);
+                const double denoisedError = computeRMSE(output, scene.radiance);
+                expect(denoisedError < noisyError * 0.8,
+                       std::format("{} spp: RMSE denoised {:.4f} < noisy {:.4f} x 0.8", samples,
+                                   denoisedError, noisyError));
+                expect(samples < 16 || denoisedError < moreError,
+                       std::format("{} spp: RMSE denoised {:.4f} < {} spp {:.4f}", samples,
+                                   denoisedError, samples + extraSamples, moreError));
+            }
+        }
+    }
+
+    void benchColorLut() {
+        const CompositeConstants info{};
+        ColorLut lut;
+        const double bakeSingle = measure(10, [&] { lut.bake(info, nullptr); });
+        const double bakeParallel = measure(10, [&] { lut.bake(info, &ThreadPool::getShared()); });
+        beginSection(std::format("Color LUT {0}x{0}x{0}", ColorLut::kSize));
+        spdlog::info("Bake x1: {:.3f} ms, xN: {:.3f} ms", bakeSingle, bakeParallel);
+
+        const auto sizes = {std::pair{m_width, m_height}, std::pair{3840u, 2160u}};
+        for (const auto& [width, height] : sizes) {
+            const DenoiserScene scene = createDenoiserScene(width, height);
+            std::vector<uint8_t> direct(static_cast<size_t>(width) * height * 4);
+            std::vector<uint8_t> baked(direct.size());
+            auto& pool = ThreadPool::getShared();
+            const double directTime = measure(3, [&] {
+                composite::toneMapToRGBA8(scene.radiance.data(), direct.data(), width, height,
+                                          info, &pool);
+            });
+            const double lutTime = measure(
+                3, [&] { lut.apply(scene.radiance.data(), baked.data(), width, height, &pool); });
+
+            int maxError = 0;
+            double errorSum = 0.0;
+            for (size_t i = 0; i < direct.size(); i++) {
+                const int error = std::abs(static_cast<int>(direct[i]) - baked[i]);
+                maxError = std::max(maxError, error);
+                errorSum += error;
+            }
+            spdlog::info("{}x{}: direct {:.2f} ms, LUT {:.2f} ms", width, height, directTime,
+                         lutTime);
+            // 8-bit の誤差 (最大は暗く彩度の高い色で、ACES の彩度の処理が滑らかでないところ)
+            const double meanError = errorSum / direct.size();
+            expect(meanError < 0.5 && maxError <= 8,
+                   std::format("{}x{}: LUT error mean {:.3f} < 0.5, max {} <= 8", width, height,
+                               meanError, maxError));
+        }
+    }
+
+    // ブルームのピラミッド (post/bloom.cpp、bloom.comp と同じ計算)
+    // 一様な画像は変わらず、インパルスのエネルギー (画素値の和) は広がっても保たれる
+    // levelCount は 1 以上、画像に収まるレベル数以下に丸められる
+    void benchBloom() {
+        beginSection("Bloom");
+        const auto sizes = {std::pair{m_width, m_height}, std::pair{333u, 197u},
+                            std::pair{7u, 5u}};
+        for (const auto& [width, height] : sizes) {
+            const size_t valueCount = static_cast<size_t>(width) * height * 4;
+            const uint32_t maxLevelCount = bloom::computeLevelCount(width, height);
+            const auto run = [&](std::vector<float> image, int levelCount, ThreadPool* pool) {
+                bloom::filter(image.data(), width, height, {.levelCount = levelCount}, pool);
+                return image;
+            };
+
+            std::vector<float> constant(valueCount);
+            std::vector<float> impulse(valueCount, 0.0f);
+            for (size_t i = 0; i < valueCount; i++) {
+                constant[i] = i % 4 == 3 ? 1.0f : 0.25f * (1 + i % 4);
+            }
+            const size_t center = (static_cast<size_t>(height / 2) * width + width / 2) * 4;
+            impulse[center] = impulse[center + 1] = impulse[center + 2] = 1000.0f;
+            for (size_t i = 3; i < valueCount; i += 4) {
+                impulse[i] = 1.0f;
+            }
+
+            const double time = measure(3, [&] { run(impulse, 6, &ThreadPool::getShared()); });
+            spdlog::info("{}x{} ({} levels): {:.2f} ms", width, height, maxLevelCount, time);
+
+            for (const int levelCount : {1, 3, static_cast<int>(maxLevelCount)}) {
+                float maxError = 0.0f;
+                const std::vector<float> flat = run(constant, levelCount, nullptr);
+                for (size_t i = 0; i < valueCount; i++) {
+                    maxError = std::max(maxError, std::abs(flat[i] - constant[i]));
+                }
+                expect(maxError < 1e-5f,
+                       std::format("{}x{}, {} levels: constant changes by {:.2e}", width, height,
+                                   levelCount, maxError));
+
+                const std::vector<float> spread = run(impulse, levelCount, nullptr);
+                double energy = 0.0;
+                for (size_t i = 0; i < valueCount; i += 4) {
+                    energy += spread[i] / 1000.0;
+                }
+                expect(std::abs(energy - 1.0) < 0.01,
+                       std::format("{}x{}, {} levels: impulse energy {:.4f} == 1", width, height,
+                                   levelCount, energy));
+                expect(run(impulse, levelCount, &ThreadPool::getShared()) == spread,
+                       std::format("{}x{}, {} levels: single/parallel output is identical", width,
+                                   height, levelCount));
+            }
+
+            // 範囲外の levelCount
+            expect(run(impulse, 0, nullptr) == impulse && run(impulse, -3, nullptr) == impulse,
+                   std::format("{}x{}: levelCount <= 1 leaves the image unchanged", width,
+                               height));
+            expect(run(impulse, 100, nullptr) == run(impulse, maxLevelCount, nullptr),
+                   std::format("{}x{}: levelCount 100 is clamped to {}", width, height,
+                               maxLevelCount));
+        }
+    }
+
+    // L2 star discrepancy of 2D points (Warnock)
+    static double computeStarDiscrepancy(const std::vector<std::pair<double, double>>& points) {
+        const double n = static_cast<double>(points.size());
+        double sum1 = 0.0;
+        double sum2 = 0.0;
+        for (const auto& [x, y] : points) {
+            sum1 += (1.0 - x * x) * (1.0 - y * y);
+            for (const auto& [x2, y2] : points) {
+                sum2 += (1.0 - std::max(x, x2)) * (1.0 - std::max(y, y2));
+            }
+        }
+        return std::sqrt(1.0 / 9.0 - sum1 / (2.0 * n) + sum2 / (n * n));
+    }
+
+    // PCG (mt19937 で代用) と Owen-scrambled Sobol の比較 (kSamplerSeedCount 個の seed の平均)
+    // dimensions (0, 1) は同じ Sobol 点、(4, 5) は別のグループ、(2, 5) はグループをまたぐ組
+    void benchSampler() {
+        beginSection("Sampler");
+        const SobolSampler sampler;
+        const std::array<std::pair<uint32_t, uint32_t>, 3> dimensionPairs = {{
+            {0, 1},
+            {4, 5},
+            {2, 5},
+        }};
+        // 滑らかな被積分関数 (参照値は中点則で求める)
+        const auto integrand = [](double x, double y) { return std::exp(-x * y) * (x + y); };
+        double reference = 0.0;
+        for (int i = 0; i < 1024; i++) {
+            for (int j = 0; j < 1024; j++) {
+                reference += integrand((i + 0.5) / 1024.0, (j + 0.5) / 1024.0);
+            }
+        }
+        reference /= 1024.0 * 1024.0;
+
+        for (const uint32_t count : {64u, 256u, 1024u}) {
+            std::vector<std::pair<double, double>> points(count);
+            const auto evaluate = [&](double& discrepancy, double& squaredError) {
+                double estimate = 0.0;
+                for (const auto& [x, y] : points) {
+                    estimate += integrand(x, y);
+                }
+                estimate /= count;
+                discrepancy += computeStarDiscrepancy(points);
+                squaredError += (estimate - reference) * (estimate - reference);
+            };
+
+            double randomDiscrepancy = 0.0;
+            double randomError = 0.0;
+            std::array<double, 3> sobolDiscrepancy{};
+            std::array<double, 3> sobolError{};
+            for (uint32_t seed = 0; seed < kSamplerSeedCount; seed++) {
+                std::mt19937 engine{seed};
+                std::uniform_real_distribution<double> dist{0.0, 1.0};
+                for (auto& point : points) {
+                    point = {dist(engine), dist(engine)};
+                }
+                evaluate(randomDiscrepancy, randomError);
+
+                for (size_t pair = 0; pair < dimensionPairs.size(); pair++) {
+                    const auto [dimX, dimY] = dimensionPairs[pair];
+                    for (uint32_t i = 0; i < count; i++) {
+                        points[i] = {sampler.sample(i, dimX, seed), sampler.sample(i, dimY, seed)};
+                    }
+                    evaluate(sobolDiscrepancy[pair], sobolError[pair]);
+                }
+            }
+
+            // 分散の比 = 同じ誤差に必要な Random のサンプル数の倍率 (Random は N^-1/2 で収束)
+            // 同じグループの組は 1 桁以上良く、グループをまたぐ組も Random より悪くならない
+            const double randomRMSE = std::sqrt(randomError / kSamplerSeedCount);
+            for (size_t pair = 0; pair < dimensionPairs.size(); pair++) {
+                const auto [dimX, dimY] = dimensionPairs[pair];
+                const bool sameGroup = dimX / SOBOL_DIMENSIONS == dimY / SOBOL_DIMENSIONS;
+                const double rmse = std::sqrt(sobolError[pair] / kSamplerSeedCount);
+                const double ratio = (randomRMSE / rmse) * (randomRMSE / rmse);
+                expect(ratio > (sameGroup ? 10.0 : 1.0),
+                       std::format("N={} dims {},{}: variance ratio to random {:.1f} > {}", count,
+                                   dimX, dimY, ratio, sameGroup ? 10 : 1));
+                const double discrepancy = sobolDiscrepancy[pair] / kSamplerSeedCount;
+                const double randomDiscrepancyMean = randomDiscrepancy / kSamplerSeedCount;
+                expect(discrepancy < randomDiscrepancyMean * (sameGroup ? 0.5 : 1.0),
+                       std::format("N={} dims {},{}: L2* {:.5f} < random {:.5f} x {}", count,
+                                   dimX, dimY, discrepancy, randomDiscrepancyMean,
+                                   sameGroup ? 0.5 : 1.0));
+            }
+        }
+    }
+
+    static constexpr uint32_t kSamplerSeedCount = 32;
+
+    // 環境マップ (asset にあればそれを、なければ空 + 小さな太陽の合成画像)
+    static std::vector<float> loadEnvironment(uint32_t& width, uint32_t& height) {
+        const fs::path path = getAssetDirectory() / "environments" / "studio_small_03_4k.hdr";
+        int w, h, c;
+        if (float* pixels = fs::exists(path) ? stbi_loadf(path.string().c_str(), &w, &h, &c, 4)
+                                             : nullptr) {
+            width = w;
+            height = h;
+            std::vector<float> data(pixels, pixels + static_cast<size_t>(w) * h * 4);
+            stbi_image_free(pixels);
+            spdlog::info("Use {}", path.filename().string());
+            return data;
+        }
+
+        width = 4096;
+        height = 2048;
+        const glm::vec3 sun = glm::normalize(glm::vec3{0.3f, 0.6f, 0.4f});
+        std::vector<float> data(static_cast<size_t>(width) * height * 4);
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                const glm::vec2 uv = {(x + 0.5f) / width, (y + 0.5f) / height};
+                const glm::vec3 direction = env_light::envLightUvToDirection(uv, 0.0f);
+                const float sky = std::max(direction.y, 0.0f) * 0.8f + 0.2f;
+                const float sunRadiance = glm::dot(direction, sun) > 0.9998f ? 20000.0f : 0.0f;
+                float* pixel = data.data() + (static_cast<size_t>(y) * width + x) * 4;
+                pixel[0] = sky * 0.5f + sunRadiance;
+                pixel[1] = sky * 0.7f + sunRadiance;
+                pixel[2] = sky + sunRadiance;
+                pixel[3] = 1.0f;
+            }
+        }
+        spdlog::info("Use synthetic environment (sky + sun)");
+        return data;
+    }
+
+    // テーブルの検証 (pdf の正規化、sample() と getPdf() の一致、ヒストグラム) と
+    // 上向きの面の放射照度を cosine / 環境マップ / MIS で推定した誤差の比較
+    void benchEnvLightSampler() {
+        beginSection("Env light sampler");
+        uint32_t width = 0;
+        uint32_t height = 0;
+        const std::vector<float> pixels = loadEnvironment(width, height);
+
+        EnvLightSampler sampler;
+        const double buildSingle =
+            measure(3, [&] { sampler.build(pixels.data(), width, height, 4, nullptr); });
+        const double buildParallel = measure(3, [&] {
+            sampler.build(pixels.data(), width, height, 4, &ThreadPool::getShared());
+        });
+        const uint32_t tableWidth = sampler.getWidth();
+        const uint32_t tableHeight = sampler.getHeight();
+        spdlog::info("Build {}x{} -> {}x{}: x1 {:.2f} ms, xN {:.2f} ms", width, height,
+                     tableWidth, tableHeight, buildSingle, buildParallel);
+
+        // pdf over uv integrates to 1
+        double uvIntegral = 0.0;
+        for (uint32_t y = 0; y < tableHeight; y++) {
+            for (uint32_t x = 0; x < tableWidth; x++) {
+                uvIntegral += sampler.getPdf({(x + 0.5f) / tableWidth, (y + 0.5f) / tableHeight});
+            }
+        }
+        uvIntegral /= static_cast<double>(tableWidth) * tableHeight;
+
+        // pdf over solid angle integrates to 1 (uniform sphere directions)
+        std::mt19937 engine{0};
+        std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+        const float phi = 30.0f;
+        constexpr int kSphereSamples = 1 << 22;
+        double sphereIntegral = 0.0;
+        double sphereSquared = 0.0;
+        for (int i = 0; i < kSphereSamples; i++) {
+            const float z = 1.0f - 2.0f * dist(engine);
+            const float azimuth = 2.0f * ENV_LIGHT_PI * dist(engine);
+            const float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            const glm::vec3 direction = {r * std::cos(azimuth), z, r * std::sin(azimuth)};
+            const glm::vec2 uv = env_light::envLightDirectionToUv(direction, phi);
+            const double pdf = env_light::envLightUvPdfToSolidAngle(sampler.getPdf(uv), uv.y);
+            sphereIntegral += pdf;
+            sphereSquared += pdf * pdf;
+        }
+        sphereIntegral /= kSphereSamples;
+        const double sphereError =
+            4.0 * ENV_LIGHT_PI *
+            std::sqrt((sphereSquared / kSphereSamples - sphereIntegral * sphereIntegral) /
+                      kSphereSamples);
+        sphereIntegral *= 4.0 * ENV_LIGHT_PI;
+
+        // sample() の pdf と方向から求めた pdf (セルの境界では隣のセルになることがある)、
+        // ヒストグラム (64x32) と pdf の期待値
+        constexpr uint32_t kBinsX = 64;
+        constexpr uint32_t kBinsY = 32;
+        constexpr int kHistogramSamples = 1 << 22;
+        std::vector<double> histogram(kBinsX * kBinsY, 0.0);
+        int mismatchCount = 0;
+        for (int i = 0; i < kHistogramSamples; i++) {
+            float pdf = 0.0f;
+            const glm::vec2 uv = sampler.sample({dist(engine), dist(engine)}, pdf);
+            const glm::vec3 direction = env_light::envLightUvToDirection(uv, phi);
+            const glm::vec2 roundTrip = env_light::envLightDirectionToUv(direction, phi);
+            mismatchCount += static_cast<int>(sampler.getPdf(roundTrip) != pdf);
+            const uint32_t bx = std::min(static_cast<uint32_t>(uv.x * kBinsX), kBinsX - 1);
+            const uint32_t by = std::min(static_cast<uint32_t>(uv.y * kBinsY), kBinsY - 1);
+            histogram[by * kBinsX + bx] += 1.0;
+        }
+        std::vector<double> expected(kBinsX * kBinsY, 0.0);
+        for (uint32_t y = 0; y < tableHeight; y++) {
+            for (uint32_t x = 0; x < tableWidth; x++) {
+                const glm::vec2 uv = {(x + 0.5f) / tableWidth, (y + 0.5f) / tableHeight};
+                expected[(y * kBinsY / tableHeight) * kBinsX + x * kBinsX / tableWidth] +=
+                    sampler.getPdf(uv) * kHistogramSamples /
+                    (static_cast<double>(tableWidth) * tableHeight);
+            }
+        }
+        double chiSquare = 0.0;
+        uint32_t bins = 0;
+        for (uint32_t i = 0; i < histogram.size(); i++) {
+            if (expected[i] >= 5.0) {
+                const double diff = histogram[i] - expected[i];
+                chiSquare += diff * diff / expected[i];
+                bins++;
+            }
+        }
+        expect(std::abs(uvIntegral - 1.0) < 1e-3,
+               std::format("pdf integral over uv {:.5f} == 1", uvIntegral));
+        expect(std::abs(sphereIntegral - 1.0) < 4.0 * sphereError,
+               std::format("pdf integral over the sphere {:.4f} == 1 +- 4 x {:.4f} (MC)",
+                           sphereIntegral, sphereError));
+        expect(mismatchCount < kHistogramSamples / 1000,
+               std::format("sample() / lookup pdf mismatch {} / {} < 0.1%", mismatchCount,
+                           kHistogramSamples));
+        const double chiSquarePerDof = chiSquare / std::max(bins - 1, 1u);
+        expect(chiSquarePerDof < 1.2,
+               std::format("histogram chi^2 / dof {:.3f} < 1.2 ({} bins)", chiSquarePerDof, bins));
+
+        // 上向きの面 (法線 +Y) の放射照度 E = ∫ L cosθ dω を 16 サンプルで推定
+        const auto radiance = [&](const glm::vec3& direction) {
+            const glm::vec2 uv = env_light::envLightDirectionToUv(direction, phi);
+            const uint32_t x = std::min(static_cast<uint32_t>(uv.x * width), width - 1);
+            const uint32_t y = std::min(static_cast<uint32_t>(uv.y * height), height - 1);
+            const float* pixel = pixels.data() + (static_cast<size_t>(y) * width + x) * 4;
+            return 0.2126 * pixel[0] + 0.7152 * pixel[1] + 0.0722 * pixel[2];
+        };
+        const auto lightPdf = [&](const glm::vec3& direction) {
+            const glm::vec2 uv = env_light::envLightDirectionToUv(direction, phi);
+            return env_light::envLightUvPdfToSolidAngle(sampler.getPdf(uv), uv.y);
+        };
+        const auto powerHeuristic = [](double pdf, double otherPdf) {
+            return pdf * pdf / std::max(pdf * pdf + otherPdf * otherPdf, 1e-30);
+        };
+        const auto cosineSample = [&](float u, float v) {
+            const float r = std::sqrt(u);
+            const float azimuth = 2.0f * ENV_LIGHT_PI * v;
+            return glm::vec3{r * std::cos(azimuth), std::sqrt(1.0f - u), r * std::sin(azimuth)};
+        };
+
+        constexpr int kSampleCount = 16;
+        constexpr int kTrials = 20000;
+        std::array<std::vector<double>, 3> estimates;  // cosine, light, MIS
+        for (int trial = 0; trial < kTrials; trial++) {
+            std::array<double, 3> sums{};
+            for (int i = 0; i < kSampleCount; i++) {
+                // BSDF (cosine) sampling
+                const glm::vec3 bsdfDirection = cosineSample(dist(engine), dist(engine));
+                const double bsdfPdf = bsdfDirection.y / ENV_LIGHT_PI;
+                const double bsdfValue = radiance(bsdfDirection) * bsdfDirection.y / bsdfPdf;
+                sums[0] += bsdfValue;
+                sums[2] += bsdfValue * powerHeuristic(bsdfPdf, lightPdf(bsdfDirection));
+
+                // Light sampling
+                float pdf = 0.0f;
+                const glm::vec2 uv = sampler.sample({dist(engine), dist(engine)}, pdf);
+                const glm::vec3 direction = env_light::envLightUvToDirection(uv, phi);
+                const double solidAnglePdf = env_light::envLightUvPdfToSolidAngle(pdf, uv.y);
+                if (direction.y > 0.0f && solidAnglePdf > 0.0) {
+                    const double value = radiance(direction) * direction.y / solidAnglePdf;
+                    sums[1] += value;
+                    sums[2] += value * powerHeuristic(solidAnglePdf, direction.y / ENV_LIGHT_PI);
+                }
+            }
+            for (int method = 0; method < 3; method++) {
+                estimates[method].push_back(sums[method] / kSampleCount);
+            }
+        }
+        std::array<double, 3> means{};
+        std::array<double, 3> deviations{};
+        for (int method = 0; method < 3; method++) {
+            for (const double estimate : estimates[method]) {
+                means[method] += estimate / kTrials;
+            }
+            for (const double estimate : estimates[method]) {
+                deviations[method] += (estimate - means[method]) * (estimate - means[method]);
+            }
+            deviations[method] = std::sqrt(deviations[method] / kTrials);
+        }
+        // 3 つとも同じ値の不偏推定で、環境マップのサンプリングと MIS は cosine より分散が小さい
+        const char* names[3] = {"cosine", "light", "MIS"};
+        for (int method = 1; method < 3; method++) {
+            const double variance =
+                deviations[0] * deviations[0] + deviations[method] * deviations[method];
+            const double standardError = std::sqrt(variance / kTrials);
+            expect(std::abs(means[method] - means[0]) < 4.0 * standardError,
+                   std::format("irradiance {} {:.3f} == cosine {:.3f} +- 4 x {:.3f}",
+                               names[method], means[method], means[0], standardError));
+            expect(deviations[method] < deviations[0],
+                   std::format("{} spp deviation {} {:.3f} < cosine {:.3f}", kSampleCount,
+                               names[method], deviations[method], deviations[0]));
+        }
+    }
+
+    // 発光三角形のエイリアステーブル: 構築時間 (アニメーションでは毎フレーム) と確率の検証
+    void benchLightSampler() {
+        beginSection("Light sampler");
+
+        // 形の不揃いな三角形のメッシュ (ランダムに揺らした格子) を複数のインスタンスで使う
+        std::mt19937 engine{0};
+        std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+        constexpr uint32_t kGridSize = 256;
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        for (uint32_t y = 0; y <= kGridSize; y++) {
+            for (uint32_t x = 0; x <= kGridSize; x++) {
+                positions.push_back({x + 0.8f * dist(engine), y + 0.8f * dist(engine), 0.0f});
+            }
+        }
+        for (uint32_t y = 0; y < kGridSize; y++) {
+            for (uint32_t x = 0; x < kGridSize; x++) {
+                const uint32_t i = y * (kGridSize + 1) + x;
+                indices.insert(indices.end(), {i, i + 1, i + kGridSize + 1});
+                indices.insert(indices.end(), {i + 1, i + kGridSize + 2, i + kGridSize + 1});
+            }
+        }
+        const auto createSources = [&](uint32_t instanceCount, float time) {
+            std::vector<LightSampler::Source> sources;
+            for (uint32_t i = 0; i < instanceCount; i++) {
+                const float scale = 0.01f * (1.0f + i % 7) * (1.0f + 0.5f * std::sin(time + i));
+                const glm::vec3 emission = {1.0f + i % 3, 0.5f * (i % 5), 10.0f * (i % 11 == 0)};
+                sources.push_back({
+                    .transform = glm::mat4{scale} * glm::mat4{1.0f, 0.0f, 0.0f, 0.0f,  //
+                                                              0.0f, 1.0f, 0.0f, 0.0f,  //
+                                                              0.0f, 0.0f, 1.0f, 0.0f,  //
+                                                              float(i), 0.0f, 0.0f, 1.0f},
+                    .positions = positions.data(),
+                    .indices = indices.data(),
+                    .triangleCount = static_cast<uint32_t>(indices.size() / 3),
+                    .emission = emission,
+                });
+            }
+            return sources;
+        };
+
+        LightSampler sampler;
+        for (const uint32_t instanceCount : {1u, 16u}) {
+            const auto sources = createSources(instanceCount, 0.0f);
+            const double single = measure(3, [&] { sampler.build(sources, nullptr); });
+            float time = 0.0f;
+            const double parallel = measure(3, [&] {
+                sampler.build(createSources(instanceCount, time += 0.1f), &ThreadPool::getShared());
+            });
+            spdlog::info("{} triangles ({} chunks): build x1 {:.2f} ms, xN {:.2f} ms",
+                         sampler.getTriangleCount(), sampler.getChunkCount(), single, parallel);
+        }
+
+        // 確率の合計、面積あたりの pdf (mesh_light.glsl の luminance / total) との一致
+        double probabilitySum = 0.0;
+        double maxAreaPdfError = 0.0;
+        const auto& triangles = sampler.getTriangles();
+        for (uint32_t i = 0; i < sampler.getTriangleCount(); i++) {
+            const auto& triangle = triangles[i];
+            const glm::vec3 edge1 = triangle.position1 - triangle.position0;
+            const glm::vec3 edge2 = triangle.position2 - triangle.position0;
+            const float area = 0.5f * glm::length(glm::cross(edge1, edge2));
+            const double probability = sampler.getProbability(i);
+            probabilitySum += probability;
+            const double areaPdf =
+                LightSampler::computeLuminance(triangle.emission) / sampler.getTotalPower();
+            if (probability > 0.0) {
+                maxAreaPdfError =
+                    std::max(maxAreaPdfError, std::abs(probability / area - areaPdf) / areaPdf);
+            }
+        }
+        expect(std::abs(probabilitySum - 1.0) < 1e-5,
+               std::format("probability sum {:.6f} == 1", probabilitySum));
+        expect(maxAreaPdfError < 1e-3,
+               std::format("area pdf relative error {:.2e} < 1e-3", maxAreaPdfError));
+
+        // サンプルした三角形の頻度 (チャンクごと・三角形ごと) と確率の chi^2
+        constexpr int kSampleCount = 1 << 24;
+        std::vector<double> counts(sampler.getTriangleCount(), 0.0);
+        for (int i = 0; i < kSampleCount; i++) {
+            counts[sampler.sample(dist(engine), dist(engine))] += 1.0;
+        }
+        const auto chiSquarePerDof = [&](uint32_t binSize) {
+            double chiSquare = 0.0;
+            uint32_t bins = 0;
+            for (uint32_t first = 0; first < counts.size(); first += binSize) {
+                double observed = 0.0;
+                double expected = 0.0;
+                const uint32_t last = std::min(first + binSize, sampler.getTriangleCount());
+                for (uint32_t i = first; i < last; i++) {
+                    observed += counts[i];
+                    expected += sampler.getProbability(i) * kSampleCount;
+                }
+                if (expected >= 5.0) {
+                    chiSquare += (observed - expected) * (observed - expected) / expected;
+                    bins++;
+                }
+            }
+            return chiSquare / std::max(bins - 1, 1u);
+        };
+        for (const uint32_t binSize : {LightSampler::kChunkSize, 16u}) {
+            const double value = chiSquarePerDof(binSize);
+            expect(value < 1.2,
+                   std::format("histogram chi^2 / dof {:.3f} < 1.2 ({} triangles per bin)", value,
+                               binSize));
+        }
+    }
+
+    // bsdf.h のサンプリングの重みと、base.rgen のパスのループ (ロシアンルーレット) の検証
+    void benchPathWeights() {
+        beginSection("Path weights");
+        std::mt19937 engine{0};
+        std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+        constexpr int kSampleCount = 1 << 20;
+
+        // White furnace: 吸収のない BSDF の重みの平均 (滑らかな面は 1)
+        // 粗い面は多重散乱を無視するので 1 より小さくなるが、1 を超えてはいけない
+        const glm::vec3 i = {std::sqrt(0.75f), 0.0f, 0.5f};
+        for (const float roughness : {0.0f, 0.25f, 0.5f, 1.0f}) {
+            double metal = 0.0;
+            double glass = 0.0;
+            for (int s = 0; s < kSampleCount; s++) {
+                const glm::vec2 u = {dist(engine), dist(engine)};
+                metal += bsdf::sampleMetalBsdf(i, glm::vec3{1.0f}, roughness, u).weight.x;
+                const glm::vec3 u3 = {dist(engine), dist(engine), dist(engine)};
+                glass += bsdf::sampleGlassBsdf(i, roughness, 1.0f / 1.5f, u3).weight.x;
+            }
+            for (const auto& [name, weight] : {std::pair{"metal", metal / kSampleCount},
+                                               std::pair{"glass", glass / kSampleCount}}) {
+                expect(roughness == 0.0f ? std::abs(weight - 1.0) < 1e-3 : weight < 1.001,
+                       std::format("roughness {:.2f}: mean {} weight {:.4f} {}", roughness, name,
+                                   weight, roughness == 0.0f ? "== 1" : "<= 1"));
+            }
+        }
+
+        // 一様に発光する拡散反射の球の内側 (どのヒットでも放射 1)
+        // 期待値は sum_{k < PATH_MAX_DEPTH} albedo^k。ロシアンルーレットでも変わらないはず
+        const auto tracePath = [&](float albedo, bool roulette, int& vertexCount) {
+            double radiance = 0.0;
+            glm::vec3 throughput{1.0f};
+            for (int depth = 1;; depth++) {
+                vertexCount++;
+                radiance += throughput.x;
+                if (depth >= PATH_MAX_DEPTH) {
+                    break;
+                }
+                const glm::vec2 u = {dist(engine), dist(engine)};
+                throughput *= bsdf::sampleDiffuseBsdf(glm::vec3{albedo}, u).weight;
+                const float probability =
+                    roulette ? bsdf::getRouletteProbability(throughput, depth) : 1.0f;
+                if (probability < 1.0f) {
+                    if (dist(engine) >= probability) {
+                        break;
+                    }
+                    throughput /= probability;
+                }
+            }
+            return radiance;
+        };
+        for (const float albedo : {0.5f, 0.8f, 0.95f}) {
+            const double expected = (1.0 - std::pow(albedo, PATH_MAX_DEPTH)) / (1.0 - albedo);
+            for (const bool roulette : {false, true}) {
+                double sum = 0.0;
+                double squaredSum = 0.0;
+                int vertexCount = 0;
+                for (int s = 0; s < kSampleCount; s++) {
+                    const double radiance = tracePath(albedo, roulette, vertexCount);
+                    sum += radiance;
+                    squaredSum += radiance * radiance;
+                }
+                const double mean = sum / kSampleCount;
+                const double variance = squaredSum / kSampleCount - mean * mean;
+                const double standardError = std::sqrt(std::max(variance, 0.0) / kSampleCount);
+                expect(std::abs(mean - expected) <= std::max(4.0 * standardError, 1e-5 * expected),
+                       std::format("albedo {:.2f}, roulette {}: {:.4f} == {:.4f} +- 4 x {:.4f}",
+                                   albedo, roulette, mean, expected, standardError));
+                // ロシアンルーレットでパスが短くなる
+                const double vertices = static_cast<double>(vertexCount) / kSampleCount;
+                expect(!roulette || vertices < PATH_MAX_DEPTH * 0.75,
+                       std::format("albedo {:.2f}: {:.2f} vertices/path < {}", albedo, vertices,
+                                   PATH_MAX_DEPTH * 0.75));
+            }
+        }
+    }
+
+    // Hero wavelength sampling: 波長 -> RGB のテーブルと、分散するガラスでの色の重みの分散
+    void benchSpectrum() {
+        beginSection("Spectrum");
+        const SpectrumTable table;
+        std::mt19937 engine{0};
+        std::uniform_real_distribution<float> dist{0.0f, 1.0f};
+        constexpr int kSampleCount = 1 << 20;
+        const auto isWhite = [](const glm::dvec3& rgb, double tolerance) {
+            return std::max({std::abs(rgb.x - 1.0), std::abs(rgb.y - 1.0),
+                             std::abs(rgb.z - 1.0)}) < tolerance;
+        };
+
+        // 平坦なスペクトルは白になるはず (companion 波長で層別化した推定)
+        glm::dvec3 white{0.0};
+        for (int s = 0; s < kSampleCount; s++) {
+            glm::vec4 weights;
+            const glm::vec4 wavelengths = table.sampleHeroWavelengths(dist(engine), weights);
+            white += glm::dvec3{table.toRgb(wavelengths, weights)};
+        }
+        white /= kSampleCount;
+        expect(isWhite(white, 5e-3),
+               std::format("flat spectrum ({:.4f}, {:.4f}, {:.4f}) == 1", white.x, white.y,
+                           white.z));
+
+        // n = A + B / λ^2 (λ in µm)
+        const glm::vec4 ior =
+            spectrum::computeCauchyIor(1.5f, 0.02f, glm::vec4{400.0f, 500.0f, 600.0f, 700.0f});
+        expect(std::abs(ior.x - 1.625f) < 1e-5f && std::abs(ior.w - (1.5f + 0.02f / 0.49f)) < 1e-5f,
+               std::format("Cauchy IOR (1.5, 0.02): 400 nm {:.4f}, 700 nm {:.4f}", ior.x, ior.w));
+
+        // 分散するガラスに斜めに入って出るまでの色の重み。以前の RGB から 1 つ選ぶ方法と比べる
+        // 平均はどちらも (1, 1, 1) に近く、分散が小さいほど同じ時間でノイズが少ない
+        const glm::vec3 i = {std::sqrt(0.5f), 0.0f, std::sqrt(0.5f)};
+        for (const float roughness : {0.0f, 0.3f}) {
+            glm::dvec3 rgbSum{0.0};
+            glm::dvec3 rgbSquared{0.0};
+            glm::dvec3 heroSum{0.0};
+            glm::dvec3 heroSquared{0.0};
+            for (int s = 0; s < kSampleCount; s++) {
+                const glm::vec3 u = {dist(engine), dist(engine), dist(engine)};
+
+                const int channel = std::min(static_cast<int>(dist(engine) * 3.0f), 2);
+                const float wavelength = glm::vec3{700.0f, 546.1f, 435.8f}[channel];
+                const float eta = 1.0f / spectrum::computeCauchyIor(1.5f, 0.02f,
+                                                                    glm::vec4{wavelength})[0];
+                glm::dvec3 rgb{0.0};
+                rgb[channel] = 3.0 * bsdf::sampleGlassBsdf(i, roughness, eta, u).weight.x;
+                rgbSum += rgb;
+                rgbSquared += rgb * rgb;
+
+                glm::vec4 weights;
+                const glm::vec4 wavelengths = table.sampleHeroWavelengths(dist(engine), weights);
+                const glm::vec4 etas =
+                    1.0f / spectrum::computeCauchyIor(1.5f, 0.02f, wavelengths);
+                const auto sample = bsdf::sampleDispersiveGlassBsdf(i, roughness, etas, true, u);
+                const glm::dvec3 hero{table.toRgb(wavelengths, weights * sample.weight)};
+                heroSum += hero;
+                heroSquared += hero * hero;
+            }
+            // チャンネル平均の分散
+            const auto variance = [](const glm::dvec3& sum, const glm::dvec3& squared) {
+                const glm::dvec3 mean = sum / static_cast<double>(kSampleCount);
+                const glm::dvec3 v = squared / static_cast<double>(kSampleCount) - mean * mean;
+                return (v.x + v.y + v.z) / 3.0;
+            };
+            const glm::dvec3 rgbMean = rgbSum / static_cast<double>(kSampleCount);
+            const glm::dvec3 heroMean = heroSum / static_cast<double>(kSampleCount);
+            const auto means = {std::pair{"RGB", rgbMean}, std::pair{"hero", heroMean}};
+            for (const auto& [name, mean] : means) {
+                expect(isWhite(mean, 0.01),
+                       std::format("roughness {:.1f}: {} mean ({:.3f}, {:.3f}, {:.3f}) == 1",
+                                   roughness, name, mean.x, mean.y, mean.z));
+            }
+            const double rgbVariance = variance(rgbSum, rgbSquared);
+            const double heroVariance = variance(heroSum, heroSquared);
+            expect(heroVariance < rgbVariance,
+                   std::format("roughness {:.1f}: hero variance {:.4f} < RGB {:.4f}", roughness,
+                               heroVariance, rgbVariance));
+        }
+    }
+
+    void benchShaderVariants() {
+        beginSection("Shader variants");
+        Material diffuse;
+        Material textured;
+        textured.baseColorTextureIndex = 0;
+        Material metal;
+        metal.metallicFactor = 1.0f;
+        Material glass;
+        glass.baseColorFactor.a = 0.0f;
+        Material prism = glass;
+        prism.dispersion = 0.02f;
+
+        struct Case {
+            const char* name;
+            std::vector<Material> materials;
+            bool hasInfiniteLight;
+            bool hasEnvLightTexture;
+            bool hasMeshLights;
+            uint32_t expected;
+        };
+        const std::vector<Case> cases = {
+            {"Diffuse + sun", {diffuse}, true, false, false, SHADER_FEATURE_INFINITE_LIGHT},
+            {"Textured + env map", {diffuse, textured}, false, true, false,
+             SHADER_FEATURE_TEXTURE_2D | SHADER_FEATURE_ENV_LIGHT},
+            {"Metal + mesh lights", {diffuse, metal}, false, false, true,
+             SHADER_FEATURE_METAL | SHADER_FEATURE_MESH_LIGHT},
+            {"Dispersive glass + env map", {diffuse, glass, prism}, false, true, false,
+             SHADER_FEATURE_GLASS | SHADER_FEATURE_DISPERSION | SHADER_FEATURE_ENV_LIGHT},
+            {"Everything (2D textures)", {textured, metal, prism}, true, true, true,
+             SHADER_FEATURES_ALL & ~SHADER_FEATURE_TEXTURE_3D},
+        };
+
+        std::vector<ShaderSource> sources = {getShaderVariantSource(SHADER_FEATURES_ALL)};
+        for (const auto& c : cases) {
+            const uint32_t features = detectShaderFeatures(c.materials, c.hasInfiniteLight,
+                                                           c.hasEnvLightTexture, c.hasMeshLights);
+            expect(features == c.expected,
+                   std::format("{}: features {} == {}", c.name, getShaderVariantKey(features),
+                               getShaderVariantKey(c.expected)));
+            sources.push_back(getShaderVariantSource(features));
+        }
+
+        // シェーダーのソースが無ければ (ビルドツリーの外で実行した場合) 省略
+        if (!fs::exists(getShaderSourceDirectory() / "closest_hit.glsl")) {
+            return;
+        }
+        try {
+            // 1 回目はディスクのキャッシュ (無ければ並列にコンパイル)、2 回目はメモリから読む
+            ShaderCache& cache = ShaderCache::getShared();
+            const ShaderCache::Statistics first = cache.build(sources);
+            const ShaderCache::Statistics second = cache.build(sources);
+            spdlog::info("Build: {:.1f} ms ({} compiled), rebuild: {:.1f} ms",
+                         first.milliseconds, first.compileCount, second.milliseconds);
+            expect(second.compileCount == 0,
+                   std::format("rebuild compiles nothing ({} compiled)", second.compileCount));
+
+            // 機能を減らした variant は全ての機能を含む base.rchit より小さい
+            const size_t fullSize = cache.get(sources[0]).size();
+            for (size_t i = 1; i < sources.size(); i++) {
+                const size_t size = cache.get(sources[i]).size();
+                expect(size < fullSize, std::format("{}: SPIR-V {} < {} words", cases[i - 1].name,
+                                                    size, fullSize));
+            }
+        } catch (const std::exception& e) {
+            expect(false, e.what());
+        }
+    }
+
+    void benchEnvTexture() {
+        beginSection("Env texture");
+        // 空のグラデーション + 明るい太陽 + 細かい模様 (2:1 の equirectangular)
+        constexpr uint32_t kWidth = 2048;
+        constexpr uint32_t kHeight = 1024;
+        std::vector<float> pixels(kWidth * kHeight * 4);
+        for (uint32_t y = 0; y < kHeight; y++) {
+            for (uint32_t x = 0; x < kWidth; x++) {
+                const float u = (x + 0.5f) / kWidth;
+                const float v = (y + 0.5f) / kHeight;
+                const float sun = std::exp(-((u - 0.3f) * (u - 0.3f) + (v - 0.25f) * (v - 0.25f)) *
+                                           20000.0f);
+                const float detail = 0.5f + 0.5f * std::sin(x * 0.7f) * std::sin(y * 0.3f);
+                float* pixel = &pixels[(y * kWidth + x) * 4];
+                pixel[0] = (0.3f + 0.7f * v) * detail + 5000.0f * sun;
+                pixel[1] = (0.5f + 0.4f * v) * detail + 4500.0f * sun;
+                pixel[2] = (1.0f - 0.5f * v) * detail + 4000.0f * sun;
+                pixel[3] = 1.0f;
+            }
+        }
+        const double sourceSize = pixels.size() * sizeof(float) / (1024.0 * 1024.0);
+        spdlog::info("Source RGBA32F {}x{}: {:.1f} MB (no mips)", kWidth, kHeight, sourceSize);
+
+        for (const auto format : {EnvTexture::Format::RGBA16F, EnvTexture::Format::BC6H}) {
+            const char* name = format == EnvTexture::Format::BC6H ? "BC6H" : "RGBA16F";
+            EnvTexture texture;
+            rv::CPUTimer timer;
+            texture.build(pixels.data(), kWidth, kHeight, 4, format, nullptr);
+            const float single = timer.elapsedInMilli();
+            const std::vector<EnvTexture::Level> singleLevels = texture.getLevels();
+            timer.restart();
+            texture.build(pixels.data(), kWidth, kHeight, 4, format, &ThreadPool::getShared());
+            const float parallel = timer.elapsedInMilli();
+            bool identical = singleLevels.size() == texture.getLevelCount();
+            for (uint32_t i = 0; identical && i < singleLevels.size(); i++) {
+                identical = singleLevels[i].data == texture.getLevels()[i].data;
+            }
+            expect(identical, std::format("{}: single/parallel output is identical", name));
+            spdlog::info("{}: {} levels, {:.1f} MB, build {:.1f} ms (1 thread) / {:.1f} ms "
+                         "({:.0f} Mtexel/s)",
+                         name, texture.getLevelCount(), texture.getByteSize() / (1024.0 * 1024.0),
+                         single, parallel, kWidth * kHeight / (parallel * 1000.0));
+            if (format != EnvTexture::Format::BC6H) {
+                continue;
+            }
+
+            // レベル 0 の誤差 (対数空間の RMSE と相対誤差の平均)
+            const EnvTexture::Level& level = texture.getLevels()[0];
+            double logSquared = 0.0;
+            double relative = 0.0;
+            std::array<glm::vec3, 16> decoded;
+            for (uint32_t by = 0; by < kHeight / 4; by++) {
+                for (uint32_t bx = 0; bx < kWidth / 4; bx++) {
+                    EnvTexture::decodeBc6hBlock(&level.data[(by * (kWidth / 4) + bx) * 16],
+                                                decoded.data());
+                    for (uint32_t i = 0; i < 16; i++) {
+                        const float* pixel =
+                            &pixels[((by * 4 + i / 4) * kWidth + bx * 4 + i % 4) * 4];
+                        for (int c = 0; c < 3; c++) {
+                            const double d = std::log(decoded[i][c] + 1e-3) -
+                                             std::log(pixel[c] + 1e-3);
+                            logSquared += d * d;
+                            relative += std::abs(decoded[i][c] - pixel[c]) / (pixel[c] + 1e-3);
+                        }
+                    }
+                }
+            }
+            const double count = kWidth * kHeight * 3.0;
+            const double logRMSE = std::sqrt(logSquared / count);
+            expect(logRMSE < 0.08 && relative / count < 0.05,
+                   std::format("BC6H error: log RMSE {:.4f} < 0.08, mean relative {:.4f} < 0.05",
+                               logRMSE, relative / count));
+        }
+    }
+
+    void benchHdrReader() {
+        for (const auto& [width, height] : {std::pair{4096, 2048}, std::pair{8192, 4096}}) {
+            beginSection(std::format("HDR reader {}x{}", width, height));
+            // 空 (細かい模様で RLE が効きにくい) + 一様な地面 (ランになる) + 太陽
+            const fs::path path = fs::temp_directory_path() / std::format("bench_{}.hdr", width);
+            {
+                std::vector<float> pixels(static_cast<size_t>(width) * height * 3);
+                for (int y = 0; y < height; y++) {
+                    for (int x = 0; x < width; x++) {
+                        const float u = (x + 0.5f) / width;
+                        const float v = (y + 0.5f) / height;
+                        const float sun = std::exp(
+                            -((u - 0.3f) * (u - 0.3f) + (v - 0.25f) * (v - 0.25f)) * 20000.0f);
+                        const float detail = 0.5f + 0.5f * std::sin(x * 0.7f) * std::sin(y * 0.3f);
+                        float* pixel = &pixels[(static_cast<size_t>(y) * width + x) * 3];
+                        if (v > 0.6f) {
+                            pixel[0] = 0.2f;
+                            pixel[1] = 0.15f;
+                            pixel[2] = 0.1f;
+                        } else {
+                            pixel[0] = (0.3f + 0.7f * v) * detail + 5000.0f * sun;
+                            pixel[1] = (0.5f + 0.4f * v) * detail + 4500.0f * sun;
+                            pixel[2] = (1.0f - 0.5f * v) * detail + 4000.0f * sun;
+                        }
+                    }
+                }
+                stbi_write_hdr(path.string().c_str(), width, height, 3, pixels.data());
+            }
+            spdlog::info("File: {:.1f} MB", fs::file_size(path) / (1024.0 * 1024.0));
+
+            rv::CPUTimer timer;
+            int w, h, c;
+            float* stbPixels = stbi_loadf(path.string().c_str(), &w, &h, &c, 4);
+            const float stbTime = timer.elapsedInMilli();
+
+            const size_t valueCount = static_cast<size_t>(width) * height * 4;
+            const auto pixels = std::make_unique_for_overwrite<float[]>(valueCount);
+            float times[2];
+            for (int i = 0; i < 2; i++) {
+                timer.restart();
+                const HdrReader reader{path};
+                reader.decode(pixels.get(), i == 0 ? nullptr : &ThreadPool::getShared());
+                times[i] = timer.elapsedInMilli();
+                expect(std::memcmp(stbPixels, pixels.get(), valueCount * sizeof(float)) == 0,
+                       std::format("output ({}) is identical to stb", i == 0 ? "x1" : "xN"));
+            }
+            stbi_image_free(stbPixels);
+            fs::remove(path);
+
+            spdlog::info("stb: {:.1f} ms, HdrReader: {:.1f} ms (1 thread) / {:.1f} ms ({:.1f}x)",
+                         stbTime, times[0], times[1], stbTime / times[1]);
+        }
+    }
+
+    // SH9 の放射照度 (近似モードの打ち切り) と、画素ごとに cos をかけて足した放射照度の比較
+    // 1 次までの環境 (一様、方向の 1 次式) は SH9 で厳密に表せるので誤差は 0 に近いはず
+    // 1 次式は y 軸まわりに回すと変わるので、envLightPhi の回転も確かめられる
+    // 2 次で打ち切った核との比較は環境によらず 0 に近いので、基底の定数や回転の誤りはここで落ちる
+    void benchEnvLightSH() {
+        beginSection("Env light SH9");
+        constexpr uint32_t kWidth = 512;
+        constexpr uint32_t kHeight = 256;
+        constexpr float kPhi = 37.0f;
+
+        // maxError: cos の総当たりとの差の上限 (平均の放射照度に対する比)
+        struct Environment {
+            const char* name;
+            glm::vec3 (*radiance)(glm::vec3);
+            double maxError;
+        };
+        const Environment environments[] = {
+            {"Constant", [](glm::vec3) { return glm::vec3{1.0f}; }, 1e-4},
+            {"Linear", [](glm::vec3 d) { return glm::vec3{1.0f + 0.3f * d.x + 0.5f * d.y}; },
+             1e-4},
+            {"Sky",
+             [](glm::vec3 d) {
+                 const float sky = std::max(d.y, 0.0f);
+                 return d.y > 0.0f ? glm::vec3{0.3f, 0.5f, 1.0f} * (0.5f + sky)
+                                   : glm::vec3{0.2f, 0.15f, 0.1f};
+             },
+             0.01},
+            // 太陽のような鋭い光源は SH9 では表せない (打ち切りの誤差は平均の 26% ほど)
+            {"Sky + sun",
+             [](glm::vec3 d) {
+                 const float sun = std::exp((glm::dot(d, glm::normalize(glm::vec3{1, 2, 1})) -
+                                             1.0f) * 2000.0f);
+                 const glm::vec3 sky = d.y > 0.0f ? glm::vec3{0.3f, 0.5f, 1.0f} * (0.5f + d.y)
+                                                  : glm::vec3{0.2f, 0.15f, 0.1f};
+                 return sky + 5000.0f * sun;
+             },
+             0.3},
+        };
+
+        std::mt19937 engine{0};
+        std::uniform_real_distribution<float> dist{-1.0f, 1.0f};
+        std::vector<glm::vec3> normals;
+        while (normals.size() < 64) {
+            const glm::vec3 n{dist(engine), dist(engine), dist(engine)};
+            if (glm::dot(n, n) <= 1.0f && glm::dot(n, n) > 1e-4f) {
+                normals.push_back(glm::normalize(n));
+            }
+        }
+
+        for (const auto& [name, radiance, errorBound] : environments) {
+            // テクスチャは回転前のフレーム。シーンでは envLightPhi だけ回して見る
+            std::vector<float> pixels(kWidth * kHeight * 4);
+            for (uint32_t y = 0; y < kHeight; y++) {
+                for (uint32_t x = 0; x < kWidth; x++) {
+                    const glm::vec2 uv{(x + 0.5f) / kWidth, (y + 0.5f) / kHeight};
+                    const glm::vec3 color = radiance(env_light::envLightUvToDirection(uv, 0.0f));
+                    float* pixel = &pixels[(y * kWidth + x) * 4];
+                    pixel[0] = color.r;
+                    pixel[1] = color.g;
+                    pixel[2] = color.b;
+                    pixel[3] = 1.0f;
+                }
+            }
+
+            EnvLightSH sh;
+            rv::CPUTimer timer;
+            sh.project(pixels.data(), kWidth, kHeight, 4, &ThreadPool::getShared());
+            const float projectTime = timer.elapsedInMilli();
+
+            // 総当たり: 回したテクスチャの各画素の方向から cos をかけて足す
+            // truncated: cos の代わりに 2 次までで打ち切った核 K2(t) で足す。SH9 が表す値そのもの
+            std::vector<glm::dvec3> expectedIrradiance;
+            std::vector<glm::dvec3> truncatedIrradiance;
+            std::vector<glm::vec3> actualIrradiance;
+            glm::dvec3 meanIrradiance{0.0};
+            for (const glm::vec3& normal : normals) {
+                glm::dvec3 expected{0.0};
+                glm::dvec3 truncated{0.0};
+                for (uint32_t y = 0; y < kHeight; y++) {
+                    const double solidAngle =
+                        (std::cos(ENV_LIGHT_PI * y / kHeight) -
+                         std::cos(ENV_LIGHT_PI * (y + 1) / kHeight)) *
+                        (2.0 * ENV_LIGHT_PI / kWidth);
+                    for (uint32_t x = 0; x < kWidth; x++) {
+                        const glm::vec2 uv{(x + 0.5f) / kWidth, (y + 0.5f) / kHeight};
+                        const glm::vec3 direction = env_light::envLightUvToDirection(uv, kPhi);
+                        const float cosTheta = glm::dot(normal, direction);
+                        const float* pixel = &pixels[(y * kWidth + x) * 4];
+                        const glm::dvec3 color{pixel[0], pixel[1], pixel[2]};
+                        if (cosTheta > 0.0f) {
+                            expected += color * (cosTheta * solidAngle);
+                        }
+                        // A_l (2l + 1) / 4π P_l(t) の和
+                        const double kernel = 0.25 + 0.5 * cosTheta +
+                                              (15.0 * cosTheta * cosTheta - 5.0) / 32.0;
+                        truncated += color * (kernel * solidAngle);
+                    }
+                }
+                expectedIrradiance.push_back(expected);
+                truncatedIrradiance.push_back(truncated);
+                actualIrradiance.push_back(
+                    sh.getIrradiance(env_light::envLightShDirection(normal, kPhi)));
+                meanIrradiance += expected / static_cast<double>(normals.size());
+            }
+
+            // 誤差は全ての法線の平均の放射照度に対する比 (太陽の反対側の小さな値で割らない)
+            double maxError = 0.0;
+            double maxTruncationError = 0.0;
+            for (size_t i = 0; i < normals.size(); i++) {
+                for (int c = 0; c < 3; c++) {
+                    const double actual = actualIrradiance[i][c];
+                    maxError = std::max(
+                        maxError, std::abs(actual - expectedIrradiance[i][c]) / meanIrradiance[c]);
+                    // getIrradiance() は負の値を 0 にするので、その法線は比べない
+                    if (truncatedIrradiance[i][c] > 0.0) {
+                        maxTruncationError = std::max(
+                            maxTruncationError,
+                            std::abs(actual - truncatedIrradiance[i][c]) / meanIrradiance[c]);
+                    }
+                }
+            }
+            spdlog::info("{}: project {:.2f} ms", name, projectTime);
+            expect(maxError < errorBound,
+                   std::format("{}: max error {:.4f} < {} (relative to the mean irradiance)",
+                               name, maxError, errorBound));
+            expect(maxTruncationError < 1e-3,
+                   std::format("{}: max error {:.5f} < 0.001 against the order 2 kernel", name,
+                               maxTruncationError));
+        }
+    }
+
+    void benchMaterialTexture() {
+        beginSection("Material texture");
+        // 色: グラデーション + 細かい模様 + ノイズ、法線: 凹凸 (RGBA8, 1024x1024)
+        constexpr uint32_t kSize = 1024;
+        std::mt19937 engine{0};
+        std::uniform_int_distribution<int> noise{-8, 8};
+        std::vector<uint8_t> color(kSize * kSize * 4);
+        std::vector<uint8_t> normal(kSize * kSize * 4);
+        for (uint32_t y = 0; y < kSize; y++) {
+            for (uint32_t x = 0; x < kSize; x++) {
+                const float u = (x + 0.5f) / kSize;
+                const float v = (y + 0.5f) / kSize;
+                const float detail = 0.5f + 0.5f * std::sin(x * 0.21f) * std::sin(y * 0.13f);
+                uint8_t* pixel = &color[(y * kSize + x) * 4];
+                pixel[0] = static_cast<uint8_t>(std::clamp(255.0f * u * detail + noise(engine),
+                                                           0.0f, 255.0f));
+                pixel[1] = static_cast<uint8_t>(std::clamp(255.0f * v * (1.0f - detail) +
+                                                               noise(engine),
+                                                           0.0f, 255.0f));
+                pixel[2] = static_cast<uint8_t>(160 + noise(engine));
+                pixel[3] = (x / 64 + y / 64) % 2 ? 255 : 128;
+
+                const glm::vec3 n = glm::normalize(glm::vec3{0.5f * std::cos(x * 0.05f),
+                                                             0.5f * std::cos(y * 0.07f), 1.0f});
+                uint8_t* texel = &normal[(y * kSize + x) * 4];
+                for (int c = 0; c < 3; c++) {
+                    texel[c] = static_cast<uint8_t>((n[c] * 0.5f + 0.5f) * 255.0f + 0.5f);
+                }
+                texel[3] = 255;
+            }
+        }
+
+        using Usage = MaterialTexture::Usage;
+        using Format = MaterialTexture::Format;
+        const std::tuple<const char*, const std::vector<uint8_t>*, Usage, Format> cases[] = {
+            {"Color RGBA8", &color, Usage::Color, Format::RGBA8},
+            {"Color BC7", &color, Usage::Color, Format::BC7},
+            {"Normal BC5", &normal, Usage::Normal, Format::BC5},
+        };
+        for (const auto& [name, source, usage, format] : cases) {
+            MaterialTexture texture;
+            rv::CPUTimer timer;
+            texture.build(source->data(), kSize, kSize, usage, format, nullptr);
+            const float single = timer.elapsedInMilli();
+            const std::vector<uint8_t> singleLevel0 = texture.getLevels()[0].data;
+            timer.restart();
+            texture.build(source->data(), kSize, kSize, usage, format, &ThreadPool::getShared());
+            const float parallel = timer.elapsedInMilli();
+            expect(texture.getLevels()[0].data == singleLevel0,
+                   std::format("{}: single/parallel output is identical", name));
+
+            // キャッシュの往復
+            const std::filesystem::path cachePath =
+                std::filesystem::temp_directory_path() / "bench_material_texture.mtex";
+            timer.restart();
+            texture.save(cachePath, 1);
+            MaterialTexture loaded;
+            const bool valid = loaded.load(cachePath, 1, usage, format) &&
+                               loaded.getLevelCount() == texture.getLevelCount() &&
+                               loaded.getLevels().back().data == texture.getLevels().back().data;
+            const float cacheTime = timer.elapsedInMilli();
+            std::filesystem::remove(cachePath);
+
+            spdlog::info("{}: {} levels, {:.2f} MB, build {:.1f} ms (1 thread) / {:.1f} ms, "
+                         "cache {:.1f} ms",
+                         name, texture.getLevelCount(), texture.getByteSize() / (1024.0 * 1024.0),
+                         single, parallel, cacheTime);
+            expect(valid, std::format("{}: the cache round trip restores the texture", name));
+            if (format == Format::RGBA8) {
+                continue;
+            }
+
+            // レベル 0 の誤差 (BC7: RGBA の PSNR、BC5: 法線の角度)
+            const MaterialTexture::Level& level = texture.getLevels()[0];
+            double squared = 0.0;
+            double maxAngle = 0.0;
+            double meanAngle = 0.0;
+            std::array<uint8_t, 64> decoded;
+            for (uint32_t by = 0; by < kSize / 4; by++) {
+                for (uint32_t bx = 0; bx < kSize / 4; bx++) {
+                    const uint8_t* block = &level.data[(by * (kSize / 4) + bx) * 16];
+                    if (format == Format::BC7) {
+                        MaterialTexture::decodeBc7Block(block, decoded.data());
+                    } else {
+                        MaterialTexture::decodeBc5Block(block, decoded.data());
+                    }
+                    for (uint32_t i = 0; i < 16; i++) {
+                        const uint8_t* texel =
+                            &(*source)[((by * 4 + i / 4) * kSize + bx * 4 + i % 4) * 4];
+                        if (format == Format::BC7) {
+                            for (int c = 0; c < 4; c++) {
+                                const double d = decoded[i * 4 + c] - texel[c];
+                                squared += d * d;
+                            }
+                            continue;
+                        }
+                        // BC5 は xy だけなので z は xy から求める
+                        const auto unpack = [](const uint8_t* rg) {
+                            const glm::vec2 xy = glm::vec2{rg[0], rg[1]} / 255.0f * 2.0f - 1.0f;
+                            return glm::vec3{xy, std::sqrt(std::max(1.0f - glm::dot(xy, xy),
+                                                                    0.0f))};
+                        };
+                        const float cosAngle =
+                            glm::dot(glm::normalize(unpack(&decoded[i * 4])),
+                                     glm::normalize(unpack(texel)));
+                        const double angle =
+                            glm::degrees(std::acos(std::clamp(cosAngle, -1.0f, 1.0f)));
+                        maxAngle = std::max(maxAngle, angle);
+                        meanAngle += angle / (kSize * kSize);
+                    }
+                }
+            }
+            if (format == Format::BC7) {
+                const double mse = squared / (kSize * kSize * 4.0);
+                const double psnr = 10.0 * std::log10(255.0 * 255.0 / mse);
+                expect(psnr > 35.0, std::format("BC7 PSNR {:.2f} dB > 35 dB", psnr));
+            } else {
+                expect(meanAngle < 0.25 && maxAngle < 2.0,
+                       std::format("BC5 normal angle mean {:.3f} < 0.25 deg, max {:.3f} < 2 deg",
+                                   meanAngle, maxAngle));
+            }
+        }
+    }
+
+    void benchTextureAtlas() {
+        beginSection("Texture atlas");
+        // 大きさがばらばらの小さなテクスチャ
+        constexpr uint32_t kTextureCount = 300;
+        constexpr uint32_t kAtlasSize = 2048;
+        std::mt19937 engine{0};
+        std::uniform_int_distribution<uint32_t> sizeDist{1, TextureAtlas::kMaxTextureSize};
+        std::uniform_int_distribution<int> byteDist{0, 255};
+        std::vector<TextureAtlas::Size> sizes(kTextureCount);
+        std::vector<std::vector<uint8_t>> textures(kTextureCount);
+        for (uint32_t i = 0; i < kTextureCount; i++) {
+            // 小さいものを多めにする
+            sizes[i] = {std::min(sizeDist(engine), sizeDist(engine)),
+                        std::min(sizeDist(engine), sizeDist(engine))};
+            textures[i].resize(sizes[i].width * sizes[i].height * 4);
+            for (auto& value : textures[i]) {
+                value = static_cast<uint8_t>(byteDist(engine));
+            }
+        }
+
+        TextureAtlas atlas;
+        rv::CPUTimer timer;
+        atlas.pack(sizes, kAtlasSize);
+        const float packTime = timer.elapsedInMilli();
+        double usedArea = 0.0;
+        double atlasArea = 0.0;
+        for (uint32_t a = 0; a < atlas.getAtlasCount(); a++) {
+            atlasArea += atlas.getAtlasSize(a).width * atlas.getAtlasSize(a).height;
+        }
+        for (const auto& size : sizes) {
+            usedArea += size.width * size.height;
+        }
+        spdlog::info("Descriptors: {} -> {} ({} atlases, {:.0f}% texels used): pack {:.2f} ms",
+                     kTextureCount, atlas.getAtlasCount(), atlas.getAtlasCount(),
+                     100.0 * usedArea / atlasArea, packTime);
+
+        // 重なり: セルがアトラスの中にあり、揃っていて、他のセルと重ならない
+        const auto& placements = atlas.getPlacements();
+        uint32_t overlapErrors = 0;
+        for (uint32_t i = 0; i < kTextureCount; i++) {
+            const auto& p = placements[i];
+            const auto& size = atlas.getAtlasSize(p.atlas);
+            const uint32_t x0 = p.x - TextureAtlas::kPadding;
+            const uint32_t y0 = p.y - TextureAtlas::kPadding;
+            if (x0 % TextureAtlas::kAlignment || y0 % TextureAtlas::kAlignment ||
+                x0 + TextureAtlas::getCellSize(p.width) > size.width ||
+                y0 + TextureAtlas::getCellSize(p.height) > size.height ||
+                p.width != sizes[i].width || p.height != sizes[i].height) {
+                overlapErrors++;
+            }
+            for (uint32_t j = i + 1; j < kTextureCount; j++) {
+                const auto& q = placements[j];
+                if (p.atlas == q.atlas &&
+                    p.x < q.x + TextureAtlas::getCellSize(q.width) - TextureAtlas::kPadding &&
+                    q.x < p.x + TextureAtlas::getCellSize(p.width) - TextureAtlas::kPadding &&
+                    p.y < q.y + TextureAtlas::getCellSize(q.height) - TextureAtlas::kPadding &&
+                    q.y < p.y + TextureAtlas::getCellSize(p.height) - TextureAtlas::kPadding) {
+                    overlapErrors++;
+                }
+            }
+        }
+        expect(overlapErrors == 0, std::format("{} cells overlap or are misplaced", overlapErrors));
+
+        // バイリニア (RGBA8, wrap: repeat、それ以外は clamp)
+        const auto sample = [](const uint8_t* texels, uint32_t width, uint32_t height, float u,
+                               float v, bool wrap, int c) {
+            const float x = u * width - 0.5f;
+            const float y = v * height - 0.5f;
+            const int x0 = static_cast<int>(std::floor(x));
+            const int y0 = static_cast<int>(std::floor(y));
+            const auto texel = [&](int tx, int ty) {
+                if (wrap) {
+                    tx = (tx % static_cast<int>(width) + width) % width;
+                    ty = (ty % static_cast<int>(height) + height) % height;
+                } else {
+                    tx = std::clamp(tx, 0, static_cast<int>(width) - 1);
+                    ty = std::clamp(ty, 0, static_cast<int>(height) - 1);
+                }
+                return static_cast<float>(texels[(ty * width + tx) * 4 + c]);
+            };
+            const float fx = x - x0;
+            const float fy = y - y0;
+            return (texel(x0, y0) * (1 - fx) + texel(x0 + 1, y0) * fx) * (1 - fy) +
+                   (texel(x0, y0 + 1) * (1 - fx) + texel(x0 + 1, y0 + 1) * fx) * fy;
+        };
+        // 端を多めに含む UV (fract で境界をまたぐ)
+        std::uniform_real_distribution<float> uvDist{-0.02f, 0.02f};
+        std::uniform_real_distribution<float> innerDist{0.0f, 1.0f};
+        std::vector<std::pair<float, float>> uvs;
+        for (int i = 0; i < 64; i++) {
+            const float u = i % 2 ? innerDist(engine) : uvDist(engine);
+            const float v = i % 3 ? innerDist(engine) : 1.0f + uvDist(engine);
+            uvs.push_back({u, v});
+        }
+        const auto atlasUv = [](glm::vec4 rect, float u, float v) {
+            return std::pair{rect.x + (u - std::floor(u)) * rect.z,
+                             rect.y + (v - std::floor(v)) * rect.w};
+        };
+
+        // にじみ 1: レベル 0 はアトラスから引いても repeat で引いた元のテクスチャと一致する
+        float maxError = 0.0f;
+        std::vector<const uint8_t*> pointers(kTextureCount);
+        for (uint32_t i = 0; i < kTextureCount; i++) {
+            pointers[i] = textures[i].data();
+        }
+        std::vector<std::vector<uint8_t>> atlases(atlas.getAtlasCount());
+        timer.restart();
+        for (uint32_t a = 0; a < atlas.getAtlasCount(); a++) {
+            atlases[a] = atlas.compose(a, pointers, &ThreadPool::getShared());
+        }
+        const float composeTime = timer.elapsedInMilli();
+        for (uint32_t i = 0; i < kTextureCount; i++) {
+            const auto& p = placements[i];
+            const auto& size = atlas.getAtlasSize(p.atlas);
+            for (const auto& [u, v] : uvs) {
+                const auto [au, av] = atlasUv(atlas.getRect(i), u, v);
+                for (int c = 0; c < 4; c++) {
+                    const float expected =
+                        sample(textures[i].data(), p.width, p.height, u, v, true, c);
+                    const float actual =
+                        sample(atlases[p.atlas].data(), size.width, size.height, au, av, false, c);
+                    maxError = std::max(maxError, std::abs(expected - actual));
+                }
+            }
+        }
+        spdlog::info("Compose: {:.2f} ms", composeTime);
+        expect(maxError < 0.5f,
+               std::format("level 0 matches repeat sampling: max error {:.4f} < 0.5", maxError));
+
+        // にじみ 2: 単色のテクスチャを詰めてミップマップを作ると、どのレベルでも他の色が混ざらない
+        // BC7 mode 6 は p-bit を RGBA で共有するので、単色でも 1 程度ずれることがある
+        using Format = MaterialTexture::Format;
+        for (const Format format : {Format::RGBA8, Format::BC7}) {
+            std::vector<std::vector<uint8_t>> flats(kTextureCount);
+            for (uint32_t i = 0; i < kTextureCount; i++) {
+                flats[i].resize(sizes[i].width * sizes[i].height * 4);
+                for (size_t t = 0; t < flats[i].size(); t += 4) {
+                    flats[i][t] = static_cast<uint8_t>(i * 97);
+                    flats[i][t + 1] = static_cast<uint8_t>(i * 57 + 31);
+                    flats[i][t + 2] = static_cast<uint8_t>(i * 151 + 200);
+                    flats[i][t + 3] = 255;
+                }
+                pointers[i] = flats[i].data();
+            }
+            const float tolerance = format == Format::BC7 ? 2.0f : 0.01f;
+            uint32_t bleedCount = 0;
+            uint32_t sampleCount = 0;
+            for (uint32_t a = 0; a < atlas.getAtlasCount(); a++) {
+                const auto& size = atlas.getAtlasSize(a);
+                const std::vector<uint8_t> rgba = atlas.compose(a, pointers, nullptr);
+                MaterialTexture texture;
+                texture.build(rgba.data(), size.width, size.height,
+                              MaterialTexture::Usage::Linear, format, &ThreadPool::getShared(),
+                              TextureAtlas::kLevelCount);
+                for (uint32_t level = 0; level < texture.getLevelCount(); level++) {
+                    const MaterialTexture::Level& levelData = texture.getLevels()[level];
+                    std::vector<uint8_t> texels = levelData.data;
+                    if (format == Format::BC7) {
+                        texels.resize(levelData.width * levelData.height * 4);
+                        std::array<uint8_t, 64> block;
+                        for (uint32_t by = 0; by < levelData.height / 4; by++) {
+                            for (uint32_t bx = 0; bx < levelData.width / 4; bx++) {
+                                MaterialTexture::decodeBc7Block(
+                                    &levelData.data[(by * (levelData.width / 4) + bx) * 16],
+                                    block.data());
+                                for (uint32_t t = 0; t < 16; t++) {
+                                    std::copy_n(&block[t * 4], 4,
+                                                &texels[((by * 4 + t / 4) * levelData.width +
+                                                         bx * 4 + t % 4) *
+                                                        4]);
+                                }
+                            }
+                        }
+                    }
+                    for (uint32_t i = 0; i < kTextureCount; i++) {
+                        if (placements[i].atlas != a) {
+                            continue;
+                        }
+                        for (const auto& [u, v] : uvs) {
+                            const auto [au, av] = atlasUv(atlas.getRect(i), u, v);
+                            for (int c = 0; c < 4; c++) {
+                                const float actual = sample(texels.data(), levelData.width,
+                                                            levelData.height, au, av, false, c);
+                                if (std::abs(actual - flats[i][c]) > tolerance) {
+                                    bleedCount++;
+                                    break;
+                                }
+                            }
+                            sampleCount++;
+                        }
+                    }
+                }
+            }
+            expect(bleedCount == 0,
+                   std::format("{}, {} levels: {} / {} samples bleed",
+                               format == Format::BC7 ? "BC7" : "RGBA8", TextureAtlas::kLevelCount,
+                               bleedCount, sampleCount));
+        }
+    }
+
+    uint32_t m_width;
+    uint32_t m_height;
+    double m_gpuMilliPerSample;
+    std::string m_section;
+    uint32_t m_failureCount = 0;
+};
@@ -1,7 +1,9 @@
 #pragma once
+#include <fstream>
 #include <random>
 #include <reactive/reactive.hpp>
 
+#include "convergence_monitor.hpp"
 #include "image_writer.hpp"
 #include "render_pass.hpp"
 #include "renderer.hpp"
@@ -12,7 +14,12 @@ public:
     HeadlessApp(bool enableValidation,
                 uint32_t width,
                 uint32_t height,
-                const std::filesystem::path& scenePath)
+                const std::filesystem::path& scenePath,
+                const std::string& output = "",
+                std::optional<ImageWriter::HdrOutput> hdrOutput = std::nullopt,
+                bool enableTemporal = false,
+                std::optional<TileScheduler::Settings> adaptiveSampling = std::nullopt,
+                std::optional<ConvergenceMonitor::Settings> earlyTermination = std::nullopt)
         : m_width{width}, m_height{height} {
         spdlog::set_pattern("[%^%l%$] %v");
 
@@ -79,53 +86,145 @@ public:
         featuresChain.add(rayQueryFeatures);
 
         m_context.initDevice(deviceExtensions, deviceFeatures, featuresChain.pFirst, true);
-        m_commandBuffers.resize(m_imageCount);
+        m_commandBuffers.resize(m_queueDepth);
         for (auto& commandBuffer : m_commandBuffers) {
             commandBuffer = m_context.allocateCommandBuffer();
         }
 
-        m_renderer = std::make_unique<Renderer>(m_context, width, height, scenePath);
-        m_imageWriter = std::make_unique<ImageWriter>(m_context, width, height, m_imageCount);
+        // 合成結果は読み戻しスロットごとのバッファに直接書く (出力画像とそのコピーを省く)
+        m_renderer = std::make_unique<Renderer>(m_context, width, height, scenePath,
+                                                CompositeTarget::Buffer, m_queueDepth);
+        std::unique_ptr<Denoiser> denoiser;
+        if (const auto& settings = m_renderer->m_scene.getDenoiserSettings(); settings.enabled) {
+            denoiser = std::make_unique<Denoiser>(width, height, settings);
+        }
+        m_imageWriter = std::make_unique<ImageWriter>(
+            m_context, ImageWriter::CreateInfo{
+                           .width = width,
+                           .height = height,
+                           .queueDepth = m_queueDepth,
+                           .sink = createFrameSink(output, width, height, readFrameRate()),
+                           .hdrOutput = hdrOutput,
+                           .denoiser = std::move(denoiser),
+                           .compositeInfo = m_renderer->m_compositeInfo,
+                           .outputBuffers = m_renderer->getOutputBuffers(),
+                       });
+        m_renderer->setAOVEnabled(m_imageWriter->getHdrLayerCount() > 1);
+        m_renderer->setTemporalEnabled(enableTemporal);
+        if (adaptiveSampling) {
+            m_renderer->setAdaptiveSamplingEnabled(true, *adaptiveSampling);
+        }
+        if (enableTemporal) {
+            spdlog::info("Temporal accumulation: up to {} frames",
+                         m_renderer->m_temporalInfo.maxHistoryLength);
+        }
+        if (earlyTermination) {
+            m_monitor.emplace(*earlyTermination);
+        }
 
         m_totalFrames = m_renderer->m_scene.getMaxFrame();
+        m_outputTimer = m_context.createGPUTimer({});
     }
 
     void run() {
         rv::CPUTimer renderTimer;
 
         for (uint32_t i = 0; i < m_totalFrames; i++) {
-            m_imageWriter->wait(m_imageIndex);
+            // エンコードが追いつかずキューが埋まっている場合のみ待つ
+            const uint32_t slot = m_imageWriter->acquireSlot();
 
             m_renderer->update({0.0f, 0.0f}, 0.0f);
 
-            auto& commandBuffer = m_commandBuffers[m_imageIndex];
-            commandBuffer->begin();
-
+            auto& commandBuffer = m_commandBuffers[slot];
             bool enableBloom = false;
-            int blurIteration = 32;
-            m_renderer->render(commandBuffer, m_frame, enableBloom, blurIteration);
+            m_renderer->m_pushConstants.enableBloom = static_cast<int>(enableBloom);
+
+            // 1フレームを複数のパスで蓄積する (パスごとに誤差を読み戻して続けるか決める)
+            // 適応サンプリング: 全タイルが収束するまで、未収束のタイルだけにパスを追加する
+            // 早期終了: フレーム全体のノイズが目標を下回ったら、残りの時間を後のフレームに回す
+            const bool adaptive = m_renderer->isAdaptiveSamplingEnabled();
+            const bool multiPass = adaptive || m_monitor;
+            if (multiPass) {
+                // 前のフレームのサンプルや統計が残っていると、収束の判定がこのフレームを見ない
+                m_renderer->restartAccumulation();
+                if (adaptive) {
+                    m_renderer->getTileScheduler().beginFrame();
+                }
+                if (m_monitor) {
+                    const double remaining = kTimeLimit - m_timer.elapsedInMilli();
+                    m_monitor->beginFrame(remaining / (m_totalFrames - i));
+                }
+                bool done = false;
+                while (!done) {
+                    commandBuffer->begin();
+                    m_renderer->trace(commandBuffer, m_frame);
+                    if (m_monitor) {
+                        m_renderer->readbackNoiseSamples(commandBuffer);
+                    }
+                    commandBuffer->end();
+                    m_context.submit(commandBuffer);
+                    m_context.getQueue().waitIdle();
+
+                    done = adaptive && m_renderer->updateConvergence();
+                    if (m_monitor) {
+                        const auto& readback = m_renderer->getNoiseReadback();
+                        const bool reached =
+                            m_monitor->update(readback.getSamples(), readback.getSampleCount());
+                        done = done || reached;
+                    }
+                }
+                if (adaptive) {
+                    m_renderer->getTileScheduler().logStatistics(m_frame);
+                }
+                if (m_monitor) {
+                    m_monitor->endFrame(m_frame);
+                }
+            }
 
-            commandBuffer->imageBarrier(
-                m_renderer->m_compositePass.getOutputImageRGBA(),  //
-                vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer,
-                vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+            commandBuffer->begin();
+            if (!multiPass) {
+                m_renderer->trace(commandBuffer, m_frame);
+            }
 
-            // Copy to buffer
-            rv::ImageHandle outputImage = m_renderer->m_compositePass.getOutputImageRGBA();
-            commandBuffer->transitionLayout(outputImage, vk::ImageLayout::eTransferSrcOptimal);
-            commandBuffer->copyImageToBuffer(outputImage, m_imageWriter->getBuffer(m_imageIndex));
-            commandBuffer->transitionLayout(outputImage, vk::ImageLayout::eGeneral);
+            // 合成結果はこのスロットのバッファに直接書かれる (画像からのコピーは不要)
+            commandBuffer->beginTimestamp(m_outputTimer);
+            m_renderer->setOutputSlot(slot);
+            m_renderer->postProcess(commandBuffer, enableBloom);
+
+            // HDR: 蓄積バッファ (とAOV) をトーンマップ前のまま同じスロットに読み戻す
+            // (EXR出力とデノイザー用)
+            const auto aovImages = m_renderer->getAOVImages();
+            for (uint32_t layer = 0; layer < m_imageWriter->getHdrLayerCount(); layer++) {
+                const rv::ImageHandle& image =
+                    layer == 0 ? m_renderer->m_baseImage : aovImages[layer - 1];
+                // baseImage はテンポラル蓄積が有効ならコンピュートで書かれる
+                commandBuffer->imageBarrier(
+                    image,  //
+                    vk::PipelineStageFlagBits::eRayTracingShaderKHR |
+                        vk::PipelineStageFlagBits::eComputeShader,
+                    vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eShaderWrite,
+                    vk::AccessFlagBits::eTransferRead);
+                commandBuffer->transitionLayout(image, vk::ImageLayout::eTransferSrcOptimal);
+                commandBuffer->copyImageToBuffer(
+                    image,
+                    m_imageWriter->getHdrBuffer(slot,
+                                                static_cast<ImageWriter::HdrLayer>(layer)));
+                commandBuffer->transitionLayout(image, vk::ImageLayout::eGeneral);
+            }
+            commandBuffer->endTimestamp(m_outputTimer);
 
             // End command buffer
-            m_commandBuffers[m_imageIndex]->end();
+            commandBuffer->end();
 
             // Submit
             m_context.submit(commandBuffer);
             m_context.getQueue().waitIdle();
+            m_totalOutputTime += m_outputTimer->elapsedInMilli();
 
-            m_imageWriter->writeImage(m_imageIndex, m_frame);
+            m_imageWriter->writeImage(slot, m_frame);
+            spdlog::debug("Rendered: {} (queue depth: {})", m_frame,
+                          m_imageWriter->getQueueDepth());
 
-            m_imageIndex = (m_imageIndex + 1) % m_imageCount;
             m_frame++;
 
             if (m_timer.elapsedInMilli() > kTimeLimit) {
@@ -135,24 +234,53 @@ public:
         }
 
         m_context.getDevice().waitIdle();
-        m_imageWriter->waitAll();
+        m_imageWriter->finish();
+        m_imageWriter->logStatistics();
+        logReadbackStatistics();
+        if (m_monitor) {
+            m_monitor->logStatistics();
+        }
 
         spdlog::info("Total render time: {} s", renderTimer.elapsedInMilli() / 1000);
     }
 
 private:
+    // 動画の出力時のフレームレート (fps.txt は実行ファイルの隣にコピーされる)
+    static uint32_t readFrameRate() {
+        uint32_t frameRate = 30;
+        std::ifstream file{getExecutableDirectory() / "fps.txt"};
+        if (!(file >> frameRate) || frameRate == 0) {
+            frameRate = 30;
+        }
+        return frameRate;
+    }
+
+    // LDR は合成パスが直接書くのでコピーなし。HDR レイヤーは copyImageToBuffer で読み戻す
+    void logReadbackStatistics() const {
+        const double pixelCount = static_cast<double>(m_width) * m_height;
+        const uint32_t hdrLayerCount = m_imageWriter->getHdrLayerCount();
+        const double ldrBytes = pixelCount * 4;
+        const double hdrBytes = pixelCount * 4 * sizeof(float) * hdrLayerCount;
+        spdlog::info("Readback: {:.2f} MB/frame (LDR {:.2f} MB packed, {} HDR layers {:.2f} MB)",
+                     (ldrBytes + hdrBytes) / 1e6, ldrBytes / 1e6, hdrLayerCount, hdrBytes / 1e6);
+        spdlog::info("Readback: post process + output {:.3f} ms/frame on GPU",
+                     m_totalOutputTime / std::max(m_frame, 1));
+    }
+
     static constexpr float kTimeLimit = 250000.0f;  // [ms]
     rv::CPUTimer m_timer;
 
     rv::Context m_context;
     std::unique_ptr<Renderer> m_renderer;
     std::unique_ptr<ImageWriter> m_imageWriter;
+    std::optional<ConvergenceMonitor> m_monitor;  // frame-level early termination
+    rv::GPUTimerHandle m_outputTimer;             // post process + readback of a frame
+    double m_totalOutputTime = 0.0;               // [ms]
 
     uint32_t m_width;
     uint32_t m_height;
     uint32_t m_totalFrames = 0;
-    uint32_t m_imageCount = 3;
-    uint32_t m_imageIndex = 0;
+    uint32_t m_queueDepth = 4;  // number of readback slots in flight
     std::vector<rv::CommandBufferHandle> m_commandBuffers{};
     std::vector<rv::ImageHandle> m_images{};
     int m_frame = 0;
@@ -3,6 +3,7 @@
 #include <reactive/reactive.hpp>
 
 #include "image_writer.hpp"
+#include "post/bloom.hpp"
 #include "render_pass.hpp"
 #include "renderer.hpp"
 #include "scene/scene.hpp"
@@ -28,32 +29,16 @@ public:
         spdlog::info("SPIR-V directory: {}", getSpvDirectory().string());
         fs::create_directory(getSpvDirectory());
 
-        if (shouldRecompile("base.rgen", "main")) {
-            compileShader("base.rgen", "main");
-        }
-        if (shouldRecompile("base.rchit", "main")) {
-            compileShader("base.rchit", "main");
-        }
-        if (shouldRecompile("base.rmiss", "main")) {
-            compileShader("base.rmiss", "main");
-        }
-        if (shouldRecompile("shadow.rmiss", "main")) {
-            compileShader("shadow.rmiss", "main");
-        }
-        if (shouldRecompile("blur.comp", "main")) {
-            compileShader("blur.comp", "main");
-        }
-        if (shouldRecompile("composite.comp", "main")) {
-            compileShader("composite.comp", "main");
-        }
-
+        // シェーダーは Renderer が ShaderCache でビルドする
         m_renderer = std::make_unique<Renderer>(context,                  //
                                                 rv::Window::getWidth(),   //
                                                 rv::Window::getHeight(),  //
                                                 scenePath);
-        m_imageWriter = std::make_unique<ImageWriter>(context,                 //
-                                                      rv::Window::getWidth(),  //
-                                                      rv::Window::getHeight(), 1);
+        m_imageWriter = std::make_unique<ImageWriter>(context,
+                                                      ImageWriter::CreateInfo{
+                                                          .width = rv::Window::getWidth(),
+                                                          .height = rv::Window::getHeight(),
+                                                      });
     }
 
     void onStart() override { m_gpuTimer = context.createGPUTimer({}); }
@@ -70,10 +55,7 @@ public:
 
     void recompile() const {
         try {
-            compileShader("base.rgen", "main");
-            compileShader("base.rchit", "main");
-            compileShader("base.rmiss", "main");
-            compileShader("shadow.rmiss", "main");
+            // ソースの内容が変わったシェーダーだけコンパイルされる
             m_renderer->createPipelines(context);
             m_renderer->reset();
         } catch (const std::exception& e) {
@@ -86,13 +68,20 @@ public:
 
         static int imageIndex = 0;
         static bool enableBloom = false;
-        static int blurIteration = 16;
         static bool playAnimation = true;
         static bool open = true;
         if (open) {
             ImGui::Begin("Settings", &open);
             ImGui::Combo("Image", &imageIndex, "Render\0Bloom");
             ImGui::SliderInt("Sample count", &pushConstants.sampleCount, 1, 512);
+            int samplerType = m_renderer->getSamplerType();
+            if (ImGui::Combo("Sampler", &samplerType, "PCG\0Sobol")) {
+                m_renderer->setSamplerType(samplerType);
+            }
+            if (ImGui::Checkbox("Enable env light NEE",
+                                reinterpret_cast<bool*>(&pushConstants.enableNEE))) {
+                m_renderer->reset();
+            }
 
             // Accumulation
             if (ImGui::Checkbox("Enable accum",
@@ -101,9 +90,25 @@ public:
             }
 
             // Adaptive sampling
-            if (ImGui::Checkbox("Enable adaptive sampling",
-                                reinterpret_cast<bool*>(&pushConstants.enableAdaptiveSampling))) {
-                m_renderer->reset();
+            bool enableAdaptiveSampling = m_renderer->isAdaptiveSamplingEnabled();
+            if (ImGui::Checkbox("Enable adaptive sampling", &enableAdaptiveSampling)) {
+                m_renderer->setAdaptiveSamplingEnabled(enableAdaptiveSampling);
+            }
+            if (enableAdaptiveSampling && pushConstants.accumCount > 0) {
+                m_renderer->updateConvergence();
+                const auto& stats = m_renderer->getTileScheduler().getStatistics();
+                ImGui::Text("Converged tiles: %u / %u (max error %.4f)", stats.convergedTiles,
+                            m_renderer->getTileScheduler().getTileCount(), stats.maxError);
+            }
+
+            // Temporal accumulation
+            bool enableTemporal = m_renderer->isTemporalEnabled();
+            if (ImGui::Checkbox("Enable temporal accum", &enableTemporal)) {
+                m_renderer->setTemporalEnabled(enableTemporal);
+            }
+            if (enableTemporal) {
+                ImGui::SliderInt("Max history", &m_renderer->m_temporalInfo.maxHistoryLength, 1,
+                                 256);
             }
 
             // Animation
@@ -112,7 +117,10 @@ public:
             if (playAnimation) {
                 if (maxFrame > 0) {
                     m_frame = (m_frame + 1) % maxFrame;
-                    m_renderer->reset();
+                    // テンポラル蓄積では動いた部分だけ履歴が棄却される
+                    if (!enableTemporal) {
+                        m_renderer->reset();
+                    }
                 }
             }
 
@@ -128,8 +136,9 @@ public:
 
             // Save button
             if (ImGui::Button("Save image")) {
-                m_imageWriter->wait(0);
-                m_imageWriter->writeImage(0, m_frame);
+                // スロットは1つだけなので、前回の保存が終わるまで待つ
+                const uint32_t slot = m_imageWriter->acquireSlot();
+                m_imageWriter->writeImage(slot, m_frame);
             }
 
             // Recompile button
@@ -139,6 +148,7 @@ public:
 
             // Scene
             if (m_renderer->m_scene.drawAttributes()) {
+                m_renderer->updateShaderVariant(context);
                 m_renderer->reset();
             }
 
@@ -155,8 +165,9 @@ public:
                                      0.0f, 10.0f, "%.6f");
                     ImGui::SliderFloat("Bloom threshold", &pushConstants.bloomThreshold,  //
                                        0.0f, 10.0f);
-                    ImGui::SliderInt("Blur iteration", &blurIteration, 0, 64);
-                    ImGui::SliderInt("Blur size", &bloomInfo.blurSize, 0, 64);
+                    ImGui::SliderInt("Bloom levels", &bloomInfo.levelCount, 1,
+                                     static_cast<int>(bloom::kMaxLevelCount));
+                    ImGui::SliderFloat("Bloom scatter", &bloomInfo.scatter, 0.0f, 1.0f);
                 }
 
                 // Tone mapping
@@ -184,7 +195,7 @@ public:
         }
 
         commandBuffer->beginTimestamp(m_gpuTimer);
-        m_renderer->render(commandBuffer, m_frame, enableBloom, blurIteration);
+        m_renderer->render(commandBuffer, m_frame, enableBloom);
         commandBuffer->endTimestamp(m_gpuTimer);
 
         // Copy to swapchain image
@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+#include <reactive/reactive.hpp>
+
+// フレーム単位の早期終了
+// 間引いて読み戻した baseImage の相対誤差 (baseImage.a, convergence.h) からフレーム全体の
+// ノイズを見積もり、目標を下回るか、パス数・時間の上限に達したらそのフレームを終える
+// 早く終わったフレームの残り時間は、以降のフレームの時間予算に回る
+// 呼び出し側はフレームごとに蓄積をやり直し (Renderer::restartAccumulation())、
+// 誤差がそのフレームのサンプルだけから求まるようにする
+class ConvergenceMonitor {
+public:
+    struct Settings {
+        float targetError = 0.02f;  // RMS relative error of the mean luminance
+        uint32_t maxPasses = 64;
+    };
+
+    struct Statistics {
+        uint32_t frames = 0;
+        uint64_t totalPasses = 0;
+        uint32_t convergedFrames = 0;  // reached the target
+        uint32_t budgetLimitedFrames = 0;
+        double totalTime = 0.0;  // [ms]
+    };
+
+    ConvergenceMonitor() = default;
+
+    explicit ConvergenceMonitor(const Settings& settings) : m_settings{settings} {}
+
+    // budget: このフレームに使える時間 [ms]
+    void beginFrame(double budget) {
+        m_budget = budget;
+        m_passes = 0;
+        m_error = 0.0f;
+        m_converged = false;
+        m_overBudget = false;
+        m_timer = {};
+    }
+
+    // パスが完了するたびに呼ぶ。戻り値はフレームを終えてよいか
+    bool update(const float* samples, uint32_t sampleCount) {
+        m_passes++;
+        m_error = computeError(samples, sampleCount);
+        m_converged = m_error <= m_settings.targetError;
+        m_overBudget = m_timer.elapsedInMilli() >= m_budget;
+        return m_converged || m_overBudget || m_passes >= m_settings.maxPasses;
+    }
+
+    // 他の理由 (適応サンプリングの完了など) で終えた場合も含めて、フレームの結果を集計する
+    void endFrame(int frame) {
+        const double time = m_timer.elapsedInMilli();
+        m_statistics.frames++;
+        m_statistics.totalPasses += m_passes;
+        m_statistics.convergedFrames += static_cast<uint32_t>(m_converged);
+        m_statistics.budgetLimitedFrames += static_cast<uint32_t>(!m_converged && m_overBudget);
+        m_statistics.totalTime += time;
+        spdlog::info("Frame {}: {} passes, error {:.4f} (target {:.4f}), {:.1f} / {:.1f} ms",
+                     frame, m_passes, m_error, m_settings.targetError, time, m_budget);
+    }
+
+    // RGBA32F samples, a = per-pixel relative error. RMS over the samples
+    // 未収束 (サンプル不足) のピクセルは 1e4 なので、そのままでは目標を下回らない
+    static float computeError(const float* samples, uint32_t sampleCount) {
+        double squaredErrorSum = 0.0;
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < sampleCount; i++) {
+            const float error = samples[i * 4 + 3];
+            if (std::isfinite(error)) {
+                squaredErrorSum += static_cast<double>(error) * error;
+                count++;
+            }
+        }
+        return count > 0 ? static_cast<float>(std::sqrt(squaredErrorSum / count)) : 0.0f;
+    }
+
+    void logStatistics() const {
+        const uint32_t frames = std::max(m_statistics.frames, 1u);
+        spdlog::info("Early termination: {:.2f} passes/frame (max {}), {:.1f} ms/frame",
+                     static_cast<double>(m_statistics.totalPasses) / frames,
+                     m_settings.maxPasses, m_statistics.totalTime / frames);
+        spdlog::info("Early termination: {} / {} frames reached the target, {} hit the budget",
+                     m_statistics.convergedFrames, m_statistics.frames,
+                     m_statistics.budgetLimitedFrames);
+    }
+
+    const Settings& getSettings() const { return m_settings; }
+    const Statistics& getStatistics() const { return m_statistics; }
+
+private:
+    Settings m_settings;
+    Statistics m_statistics;
+
+    rv::CPUTimer m_timer;
+    double m_budget = 0.0;
+    uint32_t m_passes = 0;
+    float m_error = 0.0f;
+    bool m_converged = false;
+    bool m_overBudget = false;
+};
@@ -17,13 +17,6 @@ inline fs::path getSpvDirectory() {
     return getExecutableDirectory() / "spv";
 }
 
-inline fs::path getSpvFilePath(const std::string& shaderFileName, const std::string& entryPoint) {
-    auto glslFile = getShaderSourceDirectory() / shaderFileName;
-    std::string spvFileName =
-        glslFile.stem().string() + "_" + entryPoint + glslFile.extension().string() + ".spv";
-    return getSpvDirectory() / spvFileName;
-}
-
 inline fs::path getAssetDirectory() {
     return getExecutableDirectory() / "asset";
 }
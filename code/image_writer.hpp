@@ -1,59 +1,434 @@
 ﻿#pragma once
 
-#include <future>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <spdlog/spdlog.h>
-#include <stb_image_write.h>
 #include <glm/glm.hpp>
 #include <reactive/reactive.hpp>
 
+#include "filepath.hpp"
+#include "output/exr_writer.hpp"
+#include "output/frame_sink.hpp"
+#include "post/color_lut.hpp"
+#include "post/denoiser.hpp"
+#include "render_pass.hpp"
+#include "thread_pool.hpp"
+
 // 画像フォーマットはRGBA8とする
+//
+// Render loop -> acquireSlot() -> (GPU readback) -> writeImage()
+//   -> encoder workers (out of order) -> writer thread (in submission order) -> FrameSink
+// acquireSlot() はすべてのスロットが使用中のときだけブロックする
+// HDR出力が有効な場合は、同じスロットで baseImage (RGBA32F) と AOV も読み戻して EXR に書き出す
+// デノイザーが有効な場合は、エンコーダーワーカー上で HDR をデノイズしてからトーンマップし直す
 class ImageWriter {
 public:
-    ImageWriter(const rv::Context& context, uint32_t width, uint32_t height, uint32_t imageCount)
-        : m_width{width}, m_height{height} {
-        m_writeTasks.resize(imageCount);
-        m_imageSavingBuffers.resize(imageCount);
-        for (uint32_t i = 0; i < imageCount; i++) {
-            m_imageSavingBuffers[i] = context.createBuffer({
-                .usage = rv::BufferUsage::Staging,
-                .memory = rv::MemoryUsage::Host,
-                .size = m_width * m_height * 4 * sizeof(uint8_t),
-                .debugName = "imageSavingBuffer",
-            });
+    struct Statistics {
+        uint32_t submittedFrames = 0;
+        uint32_t committedFrames = 0;
+        uint32_t duplicatedFrames = 0;
+        uint32_t maxQueueDepth = 0;
+        uint64_t totalQueueDepth = 0;  // acquireSlot() 時点の使用中スロット数の合計
+        uint32_t stallCount = 0;
+        double totalStallTime = 0.0;   // [ms]
+        double totalEncodeTime = 0.0;  // [ms] worker time summed over frames
+    };
+
+    // 読み戻すRGBA32Fの画像。Beauty 以外は AOV (Renderer::getAOVImages() の順)
+    enum class HdrLayer {
+        Beauty,
+        Albedo,
+        NormalDepth,
+        MotionId,
+    };
+
+    struct HdrOutput {
+        exr::PixelType pixelType = exr::PixelType::Half;
+        bool writeAOVs = false;
+    };
+
+    struct CreateInfo {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t queueDepth = 1;                // number of readback slots
+        std::unique_ptr<FrameSink> sink;        // nullptr: JPEG sequence
+        std::optional<HdrOutput> hdrOutput;     // EXR
+        std::unique_ptr<Denoiser> denoiser;     // CPU denoising before tone mapping
+        CompositeConstants compositeInfo = {};  // tone mapping of the denoised frame
+        std::vector<rv::BufferHandle> outputBuffers;  // CompositeTarget::Buffer (one per slot)
+        uint32_t workerCount = ThreadPool::getDefaultThreadCount() / 2;
+    };
+
+    ImageWriter(const rv::Context& context, CreateInfo createInfo)
+        : m_width{createInfo.width},
+          m_height{createInfo.height},
+          m_sink{createInfo.sink ? std::move(createInfo.sink)
+                                 : std::make_unique<JpegSequenceSink>(m_width, m_height)},
+          m_hdrOutput{createInfo.hdrOutput},
+          m_denoiser{std::move(createInfo.denoiser)},
+          m_encoders{createInfo.workerCount} {
+        if (m_denoiser) {
+            m_colorLut.bake(createInfo.compositeInfo, &ThreadPool::getShared());
+        }
+        const uint32_t queueDepth = createInfo.queueDepth;
+        if (!createInfo.outputBuffers.empty()) {
+            // CompositePass が直接書くバッファをそのままスロットにする (画像からのコピーが不要)
+            if (createInfo.outputBuffers.size() != queueDepth) {
+                throw std::runtime_error("ImageWriter: output buffer count != queue depth");
+            }
+            m_imageSavingBuffers = createInfo.outputBuffers;
+        } else {
+            m_imageSavingBuffers.resize(queueDepth);
+            for (uint32_t i = 0; i < queueDepth; i++) {
+                m_imageSavingBuffers[i] = context.createBuffer({
+                    .usage = rv::BufferUsage::Staging,
+                    .memory = rv::MemoryUsage::Host,
+                    .size = m_width * m_height * 4 * sizeof(uint8_t),
+                    .debugName = "imageSavingBuffer",
+                });
+            }
+        }
+        for (uint32_t i = 0; i < queueDepth; i++) {
+            m_freeSlots.push_back(i);
         }
+        if (getHdrLayerCount() > 0) {
+            m_hdrBuffers.resize(queueDepth);
+            for (auto& buffers : m_hdrBuffers) {
+                buffers.resize(getHdrLayerCount());
+                for (auto& buffer : buffers) {
+                    buffer = context.createBuffer({
+                        .usage = rv::BufferUsage::Staging,
+                        .memory = rv::MemoryUsage::Host,
+                        .size = m_width * m_height * 4 * sizeof(float),
+                        .debugName = "hdrSavingBuffer",
+                    });
+                }
+            }
+        }
+        m_writerThread = std::thread([this] { writerLoop(); });
     }
 
-    void writeImage(uint32_t index, uint32_t frame) {
-        auto* pixels = static_cast<uint8_t*>(m_imageSavingBuffers[index]->map());
-        std::string img = std::format("{:03}.jpg", frame);
-        m_writeTasks[index] = std::async(std::launch::async, [=]() {
-            stbi_write_jpg(img.c_str(), m_width, m_height, 4, pixels, 90);
-            spdlog::info("Saved: {}", frame);
-        });
+    ~ImageWriter() {
+        {
+            std::unique_lock lock{m_mutex};
+            m_allCommitted.wait(lock, [this] { return m_nextCommitSequence == m_nextSequence; });
+            m_stopping = true;
+        }
+        m_committable.notify_all();
+        m_writerThread.join();
+        if (!m_finished) {
+            try {
+                m_sink->finish();
+            } catch (const std::exception& e) {
+                spdlog::error(e.what());
+            }
+        }
     }
 
-    auto getBuffer(uint32_t imageIndex) { return m_imageSavingBuffers[imageIndex]; }
+    // 空いている読み戻し用スロットを返す。全スロットが使用中の場合のみ待つ
+    uint32_t acquireSlot() {
+        std::unique_lock lock{m_mutex};
+        const uint32_t inFlight = getQueueDepthLocked();
+        m_statistics.totalQueueDepth += inFlight;
+        m_statistics.maxQueueDepth = std::max(m_statistics.maxQueueDepth, inFlight);
+        if (m_freeSlots.empty()) {
+            rv::CPUTimer timer;
+            m_slotReleased.wait(lock, [this] { return !m_freeSlots.empty(); });
+            m_statistics.stallCount++;
+            m_statistics.totalStallTime += timer.elapsedInMilli();
+        }
+        const uint32_t slot = m_freeSlots.front();
+        m_freeSlots.pop_front();
+        return slot;
+    }
 
-    void wait(uint32_t imageIndex) {
-        if (m_writeTasks[imageIndex].valid()) {
-            m_writeTasks[imageIndex].get();
+    // GPUによる書き込みが完了したスロットをエンコーダーに渡す
+    void writeImage(uint32_t slot, uint32_t frame) {
+        auto* pixels = static_cast<uint8_t*>(m_imageSavingBuffers[slot]->map());
+        uint64_t sequence;
+        {
+            std::lock_guard lock{m_mutex};
+            sequence = m_nextSequence++;
+            m_statistics.submittedFrames++;
         }
+        m_encoders.submit([=, this] { encode(slot, sequence, frame, pixels); });
     }
 
+    const rv::BufferHandle& getBuffer(uint32_t slot) const { return m_imageSavingBuffers[slot]; }
+
+    // 読み戻しが必要な HdrLayer の数 (先頭から)。デノイザーはアルベドと法線・深度を使う
+    uint32_t getHdrLayerCount() const {
+        if (m_denoiser || (m_hdrOutput && m_hdrOutput->writeAOVs)) {
+            return 4;
+        }
+        return m_hdrOutput ? 1 : 0;
+    }
+
+    // RGBA32F. Only valid for layer < getHdrLayerCount()
+    const rv::BufferHandle& getHdrBuffer(uint32_t slot, HdrLayer layer) const {
+        return m_hdrBuffers[slot][static_cast<size_t>(layer)];
+    }
+
+    // すべてのフレームがディスクに書き込まれるまで待つ
     void waitAll() {
-        for (auto& task : m_writeTasks) {
-            if (task.valid()) {
-                task.get();
+        std::unique_lock lock{m_mutex};
+        m_allCommitted.wait(lock, [this] { return m_nextCommitSequence == m_nextSequence; });
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+    // すべてのフレームを書き込んだ後、出力先を閉じる (コンテナのインデックスなどを確定する)
+    void finish() {
+        waitAll();
+        if (!m_finished) {
+            m_finished = true;
+            m_sink->finish();
+        }
+    }
+
+    uint32_t getQueueDepth() {
+        std::lock_guard lock{m_mutex};
+        return getQueueDepthLocked();
+    }
+
+    Statistics getStatistics() {
+        std::lock_guard lock{m_mutex};
+        return m_statistics;
+    }
+
+    void logStatistics() {
+        const Statistics stats = getStatistics();
+        const uint32_t frames = std::max(stats.submittedFrames, 1u);
+        spdlog::info("Image writer: {} frames written to {} ({} duplicated)",
+                     stats.committedFrames, m_sink->getDescription(), stats.duplicatedFrames);
+        spdlog::info("Image writer: queue depth avg {:.2f} / max {} (capacity {})",
+                     static_cast<double>(stats.totalQueueDepth) / frames, stats.maxQueueDepth,
+                     m_imageSavingBuffers.size());
+        spdlog::info("Image writer: stalled {} times, {:.1f} ms total", stats.stallCount,
+                     stats.totalStallTime);
+        spdlog::info("Image writer: encode {:.2f} ms/frame on {} workers",
+                     stats.totalEncodeTime / frames, m_encoders.getThreadCount());
+    }
+
+private:
+    struct EncodedFrame {
+        uint32_t frame = 0;
+        std::optional<uint64_t> hash;  // nullopt: エンコードに失敗した
+        std::vector<uint8_t> bytes;    // 直前のフレームと同一と分かっていれば空
+    };
+
+    static uint64_t hashPixels(const uint8_t* pixels, size_t size) {
+        // 64bit単位の乗算ハッシュ (同一フレームの検出用で、暗号強度は不要)
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, pixels + i, sizeof(word));
+            hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+            hash ^= hash >> 32;
+        }
+        for (; i < size; i++) {
+            hash = (hash ^ pixels[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    void encode(uint32_t slot, uint64_t sequence, uint32_t frame, uint8_t* pixels) {
+        rv::CPUTimer timer;
+        EncodedFrame encoded{.frame = frame};
+        try {
+            std::vector<float> denoised;
+            if (m_denoiser) {
+                // GPUでトーンマップされたLDRを、デノイズしたHDRから作り直す (ブルームは含まない)
+                denoised.resize(static_cast<size_t>(m_width) * m_height * 4);
+                const auto getPixels = [&](HdrLayer layer) {
+                    return static_cast<const float*>(getHdrBuffer(slot, layer)->map());
+                };
+                m_denoiser->denoise(getPixels(HdrLayer::Beauty), getPixels(HdrLayer::Albedo),
+                                    getPixels(HdrLayer::NormalDepth), denoised.data(),
+                                    &ThreadPool::getShared());
+                m_colorLut.apply(denoised.data(), pixels, m_width, m_height,
+                                 &ThreadPool::getShared());
+            }
+
+            const uint64_t hash = hashPixels(pixels, m_width * m_height * 4);
+            bool knownDuplicate;
+            {
+                // 直前のフレームのハッシュが既に分かっていれば再エンコードを省略できる
+                // 同一かどうかの判定自体は writerLoop() がフレーム順に行う
+                std::lock_guard lock{m_mutex};
+                const auto prev = m_hashes.find(sequence - 1);
+                knownDuplicate = sequence > 0 && prev != m_hashes.end() && prev->second == hash;
+            }
+            if (!knownDuplicate) {
+                encoded.bytes = m_sink->encode(pixels);
+            }
+            encoded.hash = hash;
+            if (m_hdrOutput) {
+                // フレームごとに別ファイルなので、ライタースレッドを通さずここで書き出す
+                writeHdrImage(slot, frame, denoised.empty() ? nullptr : denoised.data());
+            }
+        } catch (...) {
+            setError(std::current_exception());
+        }
+
+        {
+            std::lock_guard lock{m_mutex};
+            m_statistics.totalEncodeTime += timer.elapsedInMilli();
+            m_freeSlots.push_back(slot);
+            // エンコードに失敗したフレームのハッシュは残さない (次の同一フレームはエンコードする)
+            if (encoded.hash) {
+                m_hashes[sequence] = *encoded.hash;
+            }
+            m_encodedFrames.emplace(sequence, std::move(encoded));
+        }
+        m_slotReleased.notify_one();
+        m_committable.notify_one();
+    }
+
+    // baseImage.a は適応サンプリングの相対誤差なので書き出さない
+    // AOV とデノイズ結果は別のパートとして同じファイルに書き出す (multi-part EXR)
+    void writeHdrImage(uint32_t slot, uint32_t frame, const float* denoised) const {
+        const auto getPixels = [&](HdrLayer layer) {
+            return static_cast<const float*>(getHdrBuffer(slot, layer)->map());
+        };
+        const exr::PixelType type = m_hdrOutput->pixelType;
+
+        const float* beauty = getPixels(HdrLayer::Beauty);
+        std::vector<exr::Part> parts{
+            {"beauty", type, {{"R", beauty + 0, 4}, {"G", beauty + 1, 4}, {"B", beauty + 2, 4}}},
+        };
+        if (denoised) {
+            parts.push_back(
+                {"denoised", type,
+                 {{"R", denoised + 0, 4}, {"G", denoised + 1, 4}, {"B", denoised + 2, 4}}});
+        }
+        if (m_hdrOutput->writeAOVs) {
+            // 深度・モーション・IDは精度が必要なので常にfloat
+            const float* albedo = getPixels(HdrLayer::Albedo);
+            const float* normalDepth = getPixels(HdrLayer::NormalDepth);
+            const float* motionId = getPixels(HdrLayer::MotionId);
+            const auto floatType = exr::PixelType::Float;
+            parts.push_back({"albedo", type,
+                             {{"R", albedo + 0, 4}, {"G", albedo + 1, 4}, {"B", albedo + 2, 4}}});
+            parts.push_back({"normal", type,
+                             {{"X", normalDepth + 0, 4},
+                              {"Y", normalDepth + 1, 4},
+                              {"Z", normalDepth + 2, 4}}});
+            parts.push_back({"depth", floatType, {{"Z", normalDepth + 3, 4}}});
+            parts.push_back(
+                {"motion", floatType, {{"X", motionId + 0, 4}, {"Y", motionId + 1, 4}}});
+            parts.push_back({"id", floatType,
+                             {{"instance", motionId + 2, 4}, {"material", motionId + 3, 4}}});
+        }
+        exr::writeImage(std::format("{:03}.exr", frame), m_width, m_height, parts,
+                        &ThreadPool::getShared());
+    }
+
+    // ライタースレッドだけが呼ぶ。直前にコミットしたフレームと同一なら true
+    // m_lastCommittedHash は書き込みに成功したときだけ残す (失敗したフレームは複製しない)
+    bool commit(const EncodedFrame& encoded) {
+        const std::optional<uint64_t> lastHash = std::exchange(m_lastCommittedHash, std::nullopt);
+        if (!encoded.hash) {
+            return false;
+        }
+        const bool duplicated = lastHash == encoded.hash;
+        if (duplicated) {
+            m_sink->writeDuplicate(encoded.frame);
+        } else if (!encoded.bytes.empty()) {
+            m_sink->write(encoded.frame, encoded.bytes);
+        } else {
+            // 同一と見てエンコードを省いたが、直前のフレームの書き込みに失敗していた
+            // 画素はもう無いので書けない (エラーは報告済み)
+            return false;
+        }
+        m_lastCommittedHash = encoded.hash;
+        return duplicated;
+    }
+
+    void writerLoop() {
+        std::unique_lock lock{m_mutex};
+        while (true) {
+            m_committable.wait(lock, [this] {
+                return m_stopping || m_encodedFrames.contains(m_nextCommitSequence);
+            });
+            const auto itr = m_encodedFrames.find(m_nextCommitSequence);
+            if (itr == m_encodedFrames.end()) {
+                return;  // stopping
+            }
+            EncodedFrame encoded = std::move(itr->second);
+            m_encodedFrames.erase(itr);
+
+            lock.unlock();
+            bool duplicated = false;
+            try {
+                duplicated = commit(encoded);
+            } catch (...) {
+                setError(std::current_exception());
+            }
+            lock.lock();
+
+            m_hashes.erase(m_nextCommitSequence - 1);
+            m_statistics.committedFrames++;
+            if (duplicated) {
+                m_statistics.duplicatedFrames++;
             }
+            m_nextCommitSequence++;
+            m_allCommitted.notify_all();
         }
     }
 
+    void setError(std::exception_ptr error) {
+        std::lock_guard lock{m_mutex};
+        if (!m_error) {
+            m_error = error;
+        }
+    }
+
+    uint32_t getQueueDepthLocked() const {
+        return static_cast<uint32_t>(m_imageSavingBuffers.size() - m_freeSlots.size());
+    }
+
     uint32_t m_width;
     uint32_t m_height;
     std::vector<rv::BufferHandle> m_imageSavingBuffers;
-    std::vector<std::future<void>> m_writeTasks;
+    std::unique_ptr<FrameSink> m_sink;
+    std::optional<HdrOutput> m_hdrOutput;
+    std::vector<std::vector<rv::BufferHandle>> m_hdrBuffers;  // [slot][HdrLayer]
+    std::unique_ptr<Denoiser> m_denoiser;
+    ColorLut m_colorLut;  // the same LUT as CompositePass
+    bool m_finished = false;
+
+    std::thread m_writerThread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_slotReleased;
+    std::condition_variable m_committable;
+    std::condition_variable m_allCommitted;
+    std::deque<uint32_t> m_freeSlots;
+    std::map<uint64_t, EncodedFrame> m_encodedFrames;
+    std::unordered_map<uint64_t, uint64_t> m_hashes;  // sequence -> hash (エンコード済み)
+    std::optional<uint64_t> m_lastCommittedHash;       // writer thread only
+    uint64_t m_nextSequence = 0;
+    uint64_t m_nextCommitSequence = 0;
+    bool m_stopping = false;
+    Statistics m_statistics;
+    std::exception_ptr m_error;
+
+    // 実行中のタスクが他のメンバーを参照するので最後に宣言する (最初に破棄される)
+    ThreadPool m_encoders;
 };
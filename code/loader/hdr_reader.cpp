@@ -0,0 +1,251 @@
+#include "hdr_reader.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "../simd.hpp"
+
+namespace {
+// 指数 e の RGBE は (r, g, b) * 2^(e - 136)。e == 0 は黒
+const std::array<float, 256> kExponentScales = [] {
+    std::array<float, 256> scales{};
+    for (int e = 1; e < 256; e++) {
+        scales[e] = std::ldexp(1.0f, e - (128 + 8));
+    }
+    return scales;
+}();
+}  // namespace
+
+HdrReader::HdrReader(const std::filesystem::path& filepath) {
+    map(filepath);
+    try {
+        indexScanlines(parseHeader());
+    } catch (const std::exception& e) {
+        unmap();
+        throw std::runtime_error(std::string{e.what()} + ": " + filepath.string());
+    }
+}
+
+HdrReader::~HdrReader() {
+    unmap();
+}
+
+void HdrReader::unmap() {
+    if (!m_data) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+}
+
+void HdrReader::map(const std::filesystem::path& filepath) {
+    const std::string error = "Failed to map HDR file: " + filepath.string();
+#ifdef _WIN32
+    HANDLE file = CreateFileW(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(error);
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    // ビューがマッピングを保持するので、ハンドルはすぐに閉じてよい
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+    if (!view) {
+        throw std::runtime_error(error);
+    }
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    const int file = open(filepath.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error(error);
+    }
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(file, &info) == 0 && info.st_size > 0) {
+        view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+    if (view == MAP_FAILED) {
+        throw std::runtime_error(error);
+    }
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = static_cast<size_t>(info.st_size);
+#endif
+}
+
+size_t HdrReader::parseHeader() {
+    size_t offset = 0;
+    const auto readLine = [&]() {
+        const size_t begin = offset;
+        while (offset < m_size && m_data[offset] != '\n') {
+            offset++;
+        }
+        if (offset == m_size) {
+            throw std::runtime_error("Truncated HDR header");
+        }
+        return std::string_view{reinterpret_cast<const char*>(m_data) + begin, offset++ - begin};
+    };
+
+    const std::string_view magic = readLine();
+    if (magic != "#?RADIANCE" && magic != "#?RGBE") {
+        throw std::runtime_error("Not a Radiance HDR file");
+    }
+    // 空行までがヘッダー (EXPOSURE などは stb と同じく無視する)
+    bool valid = false;
+    for (std::string_view line = readLine(); !line.empty(); line = readLine()) {
+        if (line == "FORMAT=32-bit_rle_rgbe") {
+            valid = true;
+        }
+    }
+    if (!valid) {
+        throw std::runtime_error("Unsupported HDR format");
+    }
+
+    // 上の行から順に並ぶ "-Y height +X width" だけに対応する
+    const std::string resolution{readLine()};
+    int width = 0;
+    int height = 0;
+    if (std::sscanf(resolution.c_str(), "-Y %d +X %d", &height, &width) != 2 ||
+        width <= 0 || height <= 0) {
+        throw std::runtime_error("Unsupported HDR orientation");
+    }
+    m_width = static_cast<uint32_t>(width);
+    m_height = static_cast<uint32_t>(height);
+    return offset;
+}
+
+void HdrReader::indexScanlines(size_t offset) {
+    // 幅が [8, 32768) でなければ RLE は使えない
+    const bool rle = m_width >= 8 && m_width < 32768;
+    m_flatBegin = rle ? m_height : 0;
+    m_offsets.resize(m_height + 1);
+
+    const size_t flatSize = static_cast<size_t>(m_width) * 4;
+    for (uint32_t y = 0; y < m_height; y++) {
+        m_offsets[y] = offset;
+        if (y < m_flatBegin) {
+            if (offset + 4 > m_size) {
+                throw std::runtime_error("Truncated HDR data");
+            }
+            const uint8_t* header = m_data + offset;
+            if (header[0] != 2 || header[1] != 2 || (header[2] & 0x80)) {
+                // RLE でないスキャンライン (先頭の 4 bytes も画素)。以降もそのまま並ぶ
+                m_flatBegin = y;
+            } else if (((header[2] << 8) | header[3]) != static_cast<int>(m_width)) {
+                throw std::runtime_error("Invalid HDR scanline width");
+            }
+        }
+        if (y >= m_flatBegin) {
+            offset += flatSize;
+            if (offset > m_size) {
+                throw std::runtime_error("Truncated HDR data");
+            }
+            continue;
+        }
+
+        // 画素は展開せずにランの長さだけを読んで次のスキャンラインを探す
+        offset += 4;
+        for (int c = 0; c < 4; c++) {
+            uint32_t x = 0;
+            while (x < m_width) {
+                if (offset >= m_size) {
+                    throw std::runtime_error("Truncated HDR data");
+                }
+                uint32_t count = m_data[offset++];
+                const bool run = count > 128;
+                if (run) {
+                    count -= 128;
+                }
+                if (count == 0 || count > m_width - x) {
+                    throw std::runtime_error("Invalid HDR RLE data");
+                }
+                offset += run ? 1 : count;
+                x += count;
+            }
+        }
+        if (offset > m_size) {
+            throw std::runtime_error("Truncated HDR data");
+        }
+    }
+    m_offsets[m_height] = offset;
+}
+
+void HdrReader::decode(float* dst, ThreadPool* pool) const {
+    const auto decodeRow = [&](uint32_t y) {
+        decodeScanline(y, dst + static_cast<size_t>(y) * m_width * 4);
+    };
+    if (pool) {
+        pool->parallelFor(m_height, decodeRow);
+    } else {
+        for (uint32_t y = 0; y < m_height; y++) {
+            decodeRow(y);
+        }
+    }
+}
+
+void HdrReader::decodeScanline(uint32_t y, float* row) const {
+    const uint8_t* src = m_data + m_offsets[y];
+    const uint8_t* rgbe = src;
+    if (y < m_flatBegin) {
+        // RGBE (4 bytes / pixel) を出力先の行 (16 bytes / pixel) の末尾 1/4 に展開する
+        // 画素 x の出力 [16x, 16x + 16) は、まだ読んでいない画素 (x より後ろ) の RGBE と重ならない
+        uint8_t* packed = reinterpret_cast<uint8_t*>(row) + static_cast<size_t>(m_width) * 12;
+        src += 4;
+        for (int c = 0; c < 4; c++) {
+            uint32_t x = 0;
+            while (x < m_width) {
+                uint32_t count = *src++;
+                if (count > 128) {
+                    count -= 128;
+                    const uint8_t value = *src++;
+                    for (uint32_t i = 0; i < count; i++) {
+                        packed[(x + i) * 4 + c] = value;
+                    }
+                } else {
+                    for (uint32_t i = 0; i < count; i++) {
+                        packed[(x + i) * 4 + c] = *src++;
+                    }
+                }
+                x += count;
+            }
+        }
+        rgbe = packed;
+    }
+
+    const simd::F4 alpha = simd::set(0.0f, 0.0f, 0.0f, 1.0f);
+    for (uint32_t x = 0; x < m_width; x++) {
+        // 書き込む前に読む (最後の画素は読む位置と書く位置が重なる)
+        const simd::F4 value = simd::loadBytes(rgbe + x * 4);
+        const float scale = kExponentScales[rgbe[x * 4 + 3]];
+        simd::store(row + x * 4, value * simd::set(scale, scale, scale, 0.0f) + alpha);
+    }
+}
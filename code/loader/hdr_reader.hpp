@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "../thread_pool.hpp"
+
+// Radiance HDR (.hdr, RGBE) のデコーダー
+// ファイルをメモリマップし、最初にスキャンラインの開始位置だけを調べてから
+// RLE の展開と RGBE -> float の変換をスキャンラインごとに並列に行う
+// RLE は出力先の行の末尾に RGBE のまま展開し、前から float に変換する (一時バッファを使わない)
+// 出力は stbi_loadf(..., 4) と同じ (ビット単位で一致する)
+class HdrReader {
+public:
+    // ヘッダーを読み、スキャンラインの位置を調べる。読めないファイルは例外
+    explicit HdrReader(const std::filesystem::path& filepath);
+    ~HdrReader();
+
+    HdrReader(const HdrReader&) = delete;
+    HdrReader& operator=(const HdrReader&) = delete;
+
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+
+    // dst: width * height * 4 float (RGBA, alpha = 1, row 0 = top)
+    // pool == nullptr は呼び出し元のスレッドだけで展開する
+    void decode(float* dst, ThreadPool* pool) const;
+
+private:
+    void map(const std::filesystem::path& filepath);
+    void unmap();
+    size_t parseHeader();
+    void indexScanlines(size_t offset);
+    void decodeScanline(uint32_t y, float* row) const;
+
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+
+    // [height + 1] 各スキャンラインの開始位置 (最後はデータの終わり)
+    std::vector<size_t> m_offsets;
+    // この行以降は RLE ではない (4 bytes / pixel)
+    uint32_t m_flatBegin = 0;
+};
@@ -145,6 +145,7 @@ void processMesh(std::vector<Mesh>& meshes, const rv::Context& context, IPolyMes
         });
 
         _mesh.keyFrames[i].vertexCount = static_cast<uint32_t>(vertices.size());
+        _mesh.keyFrames[i].storeGeometry(vertices, indices);
         _mesh.keyFrames[i].triangleCount = static_cast<uint32_t>(indices.size() / 3);
     }
 
@@ -1,5 +1,6 @@
 #include "loader_gltf.hpp"
 #include "../scene/scene.hpp"
+#include "texture_importer.hpp"
 
 #define TINYGLTF_IMPLEMENTATION
 #include <tiny_gltf.h>
@@ -214,6 +215,7 @@ void loadMeshes(std::vector<Mesh>& meshes, const rv::Context& context, tinygltf:
             });
 
             mesh.keyFrames[0].vertexCount = static_cast<uint32_t>(vertices.size());
+            mesh.keyFrames[0].storeGeometry(vertices, indices);
             mesh.keyFrames[0].triangleCount = static_cast<uint32_t>(indices.size() / 3);
             mesh.materialIndex = gltfPrimitive.material;
             meshIndex++;
@@ -221,15 +223,54 @@ void loadMeshes(std::vector<Mesh>& meshes, const rv::Context& context, tinygltf:
     }
 }
 
+// 画像はデコードせず、エンコードされたままのデータを images[image_idx] に取っておく
+// (デコードは TextureImporter がテクスチャごとに並列に行う)
+bool storeImageData(tinygltf::Image* image,
+                    const int imageIndex,
+                    std::string* err,
+                    std::string* warn,
+                    int reqWidth,
+                    int reqHeight,
+                    const unsigned char* bytes,
+                    int size,
+                    void* userData) {
+    auto& images = *static_cast<std::vector<std::vector<uint8_t>>*>(userData);
+    if (imageIndex >= static_cast<int>(images.size())) {
+        images.resize(imageIndex + 1);
+    }
+    images[imageIndex].assign(bytes, bytes + size);
+    return true;
+}
+
+// images: storeImageData() で集めたデータ
+// テクスチャの番号は TextureImporter の番号 (import() の後で remap() する)
 void loadMaterials(std::vector<Material>& materials,
-                   const rv::Context& context,
+                   TextureImporter& importer,
+                   const std::vector<std::vector<uint8_t>>& images,
                    tinygltf::Model& gltfModel) {
+    // glTF のテクスチャ番号 -> TextureImporter の番号 (同じ画像と用途は 1 つにまとまる)
+    const auto importTexture = [&](int textureIndex, MaterialTexture::Usage usage) {
+        if (textureIndex < 0 || textureIndex >= static_cast<int>(gltfModel.textures.size())) {
+            return -1;
+        }
+        const int source = gltfModel.textures[textureIndex].source;
+        if (source < 0 || source >= static_cast<int>(images.size()) || images[source].empty()) {
+            return -1;
+        }
+        const tinygltf::Image& image = gltfModel.images[source];
+        const std::string name = !image.uri.empty()    ? image.uri
+                                 : !image.name.empty() ? image.name
+                                                       : std::format("image{}", source);
+        return importer.add(images[source], usage, name);
+    };
+
     for (auto& mat : gltfModel.materials) {
         Material material;
 
         // Base color
         if (mat.values.contains("baseColorTexture")) {
-            material.baseColorTextureIndex = mat.values["baseColorTexture"].TextureIndex();
+            material.baseColorTextureIndex = importTexture(
+                mat.values["baseColorTexture"].TextureIndex(), MaterialTexture::Usage::Color);
         }
         if (mat.values.contains("baseColorFactor")) {
             material.baseColorFactor =
@@ -239,7 +280,8 @@ void loadMaterials(std::vector<Material>& materials,
         // Metallic / Roughness
         if (mat.values.contains("metallicRoughnessTexture")) {
             material.metallicRoughnessTextureIndex =
-                mat.values["metallicRoughnessTexture"].TextureIndex();
+                importTexture(mat.values["metallicRoughnessTexture"].TextureIndex(),
+                              MaterialTexture::Usage::Linear);
         }
         if (mat.values.contains("roughnessFactor")) {
             material.roughnessFactor = static_cast<float>(mat.values["roughnessFactor"].Factor());
@@ -250,7 +292,9 @@ void loadMaterials(std::vector<Material>& materials,
 
         // Normal
         if (mat.additionalValues.contains("normalTexture")) {
-            material.normalTextureIndex = mat.additionalValues["normalTexture"].TextureIndex();
+            material.normalTextureIndex =
+                importTexture(mat.additionalValues["normalTexture"].TextureIndex(),
+                              MaterialTexture::Usage::Normal);
         }
 
         // Emissive
@@ -258,13 +302,16 @@ void loadMaterials(std::vector<Material>& materials,
         material.emissiveFactor[1] = static_cast<float>(mat.emissiveFactor[1]);
         material.emissiveFactor[2] = static_cast<float>(mat.emissiveFactor[2]);
         if (mat.additionalValues.contains("emissiveTexture")) {
-            material.emissiveTextureIndex = mat.additionalValues["emissiveTexture"].TextureIndex();
+            material.emissiveTextureIndex =
+                importTexture(mat.additionalValues["emissiveTexture"].TextureIndex(),
+                              MaterialTexture::Usage::Color);
         }
 
         // Occlusion
         if (mat.additionalValues.contains("occlusionTexture")) {
             material.occlusionTextureIndex =
-                mat.additionalValues["occlusionTexture"].TextureIndex();
+                importTexture(mat.additionalValues["occlusionTexture"].TextureIndex(),
+                              MaterialTexture::Usage::Linear);
         }
 
         materials.push_back(material);
@@ -331,6 +378,8 @@ void LoaderGltf::loadFromFile(Scene& scene,
                               const std::filesystem::path& filepath) {
     tinygltf::Model model;
     tinygltf::TinyGLTF loader;
+    std::vector<std::vector<uint8_t>> images;
+    loader.SetImageLoader(storeImageData, &images);
     std::string err;
     std::string warn;
 
@@ -355,6 +404,15 @@ void LoaderGltf::loadFromFile(Scene& scene,
     spdlog::info("Meshes: {}", model.meshes.size());
     loadNodes(scene.m_nodes, scene.m_camera, context, model);
     loadMeshes(scene.m_meshes, context, model);
-    loadMaterials(scene.m_materials, context, model);
+    TextureImporter importer{scene.m_compressTextures, scene.m_packTextures};
+    const size_t materialOffset = scene.m_materials.size();
+    loadMaterials(scene.m_materials, importer, images, model);
+    const int textureOffset = static_cast<int>(scene.m_textures2d.size());
+    const std::vector<rv::ImageHandle> textures =
+        importer.import(context, &ThreadPool::getShared());
+    scene.m_textures2d.insert(scene.m_textures2d.end(), textures.begin(), textures.end());
+    for (size_t i = materialOffset; i < scene.m_materials.size(); i++) {
+        importer.remap(scene.m_materials[i], textureOffset);
+    }
     loadAnimation(scene.m_nodes, context, model);
 }
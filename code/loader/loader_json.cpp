@@ -24,6 +24,14 @@ void LoaderJson::loadFromFile(Scene& scene,
     nlohmann::json jsonData;
     file >> jsonData;
 
+    // テクスチャの圧縮 (default: true) とアトラス (default: false)。gltf より先に読む
+    if (const auto& value = jsonData.find("texture_compression"); value != jsonData.end()) {
+        scene.m_compressTextures = *value;
+    }
+    if (const auto& value = jsonData.find("texture_atlas"); value != jsonData.end()) {
+        scene.m_packTextures = *value;
+    }
+
     // "gltf"セクションのパース
     if (const auto& gltf = jsonData.find("gltf"); gltf != jsonData.end()) {
         std::filesystem::path gltfPath = filepath.parent_path() / *gltf;
@@ -177,6 +185,11 @@ void LoaderJson::loadFromFile(Scene& scene,
     // "environment_light"セクションのパース
     if (const auto& light = jsonData.find("environment_light"); light != jsonData.end()) {
         const auto& type = light->at("type");
+        // "bc6h" (default) or "rgba16f"
+        if (const auto& value = light->find("texture_format"); value != light->end()) {
+            scene.m_envLight.textureFormat =
+                *value == "rgba16f" ? EnvTexture::Format::RGBA16F : EnvTexture::Format::BC6H;
+        }
         if (type == "texture") {
             std::filesystem::path texPath = filepath.parent_path() / light->at("texture");
             scene.loadEnvLightTexture(context, texPath);
@@ -201,8 +214,8 @@ void LoaderJson::loadFromFile(Scene& scene,
                 scene.m_envLight.useTexture = true;
             }
         } else if (type == "solid") {
-            const float dummy = 0.0f;
-            scene.createEnvLightTexture(context, &dummy, 1, 1, 4);
+            const float dummy[4] = {};
+            scene.createEnvLightTexture(context, dummy, 1, 1, 4);
             scene.m_envLight.useTexture = false;
         }
         if (const auto& values = light->find("color"); values != light->end()) {
@@ -214,6 +227,10 @@ void LoaderJson::loadFromFile(Scene& scene,
         if (const auto& value = light->find("visible_texture"); value != light->end()) {
             scene.m_envLight.isVisible = static_cast<bool>(*value);
         }
+        // プレビュー向け: この深さ以降の拡散反射を SH の放射照度で打ち切る (0: 無効)
+        if (const auto& value = light->find("approximate_depth"); value != light->end()) {
+            scene.m_envLight.approximateDepth = static_cast<int>(*value);
+        }
     }
 
     if (const auto& light = jsonData.find("infinite_light"); light != jsonData.end()) {
@@ -232,6 +249,27 @@ void LoaderJson::loadFromFile(Scene& scene,
         }
     }
 
+    // "denoiser"セクションのパース
+    if (const auto& denoiser = jsonData.find("denoiser"); denoiser != jsonData.end()) {
+        auto& settings = scene.m_denoiserSettings;
+        settings.enabled = denoiser->value("enabled", true);
+        if (const auto& value = denoiser->find("iterations"); value != denoiser->end()) {
+            settings.iterations = *value;
+        }
+        if (const auto& value = denoiser->find("color_sigma"); value != denoiser->end()) {
+            settings.colorSigma = static_cast<float>(*value);
+        }
+        if (const auto& value = denoiser->find("normal_sigma"); value != denoiser->end()) {
+            settings.normalSigma = static_cast<float>(*value);
+        }
+        if (const auto& value = denoiser->find("depth_sigma"); value != denoiser->end()) {
+            settings.depthSigma = static_cast<float>(*value);
+        }
+        if (const auto& value = denoiser->find("albedo_sigma"); value != denoiser->end()) {
+            settings.albedoSigma = static_cast<float>(*value);
+        }
+    }
+
     if (const auto& textures = jsonData.find("3d_textures"); textures != jsonData.end()) {
         for (const auto& texture : *textures) {
             uint32_t width = texture["width"];
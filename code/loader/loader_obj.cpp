@@ -6,6 +6,7 @@
 #include <tiny_obj_loader.h>
 
 #include "../scene/scene.hpp"
+#include "texture_importer.hpp"
 
 void LoaderObj::loadFromFile(Scene& scene,
                              const rv::Context& context,
@@ -23,8 +24,8 @@ void LoaderObj::loadFromFile(Scene& scene,
         spdlog::error("Failed to load");
     }
 
-    int texCount = 0;
-    std::unordered_map<std::string, int> textureNames{};
+    // テクスチャは base_dir からの相対パス。同じ内容のファイルは 1 つにまとまる
+    TextureImporter importer{scene.m_compressTextures, scene.m_packTextures};
 
     // 最後の1つはデフォルトマテリアルとして確保しておく
     // マテリアルが空の場合でもバッファを作成できるように
@@ -43,25 +44,22 @@ void LoaderObj::loadFromFile(Scene& scene,
 
         // diffuse
         if (!mat.diffuse_texname.empty()) {
-            if (textureNames.contains(mat.diffuse_texname)) {
-                scene.m_materials[i].baseColorTextureIndex = textureNames[mat.diffuse_texname];
-            } else {
-                scene.m_materials[i].baseColorTextureIndex = texCount;
-                textureNames[mat.diffuse_texname] = texCount;
-                texCount++;
-            }
+            scene.m_materials[i].baseColorTextureIndex =
+                importer.addFile(base_dir / mat.diffuse_texname, MaterialTexture::Usage::Color);
         }
         // emission
         if (!mat.emissive_texname.empty()) {
-            if (textureNames.contains(mat.emissive_texname)) {
-                scene.m_materials[i].emissiveTextureIndex = textureNames[mat.emissive_texname];
-            } else {
-                scene.m_materials[i].emissiveTextureIndex = texCount;
-                textureNames[mat.emissive_texname] = texCount;
-                texCount++;
-            }
+            scene.m_materials[i].emissiveTextureIndex =
+                importer.addFile(base_dir / mat.emissive_texname, MaterialTexture::Usage::Color);
         }
     }
+    const int textureOffset = static_cast<int>(scene.m_textures2d.size());
+    const std::vector<rv::ImageHandle> textures =
+        importer.import(context, &ThreadPool::getShared());
+    scene.m_textures2d.insert(scene.m_textures2d.end(), textures.begin(), textures.end());
+    for (auto& material : scene.m_materials) {
+        importer.remap(material, textureOffset);
+    }
 
     scene.createMaterialBuffer(context);
 
@@ -123,6 +121,7 @@ void LoaderObj::loadFromFile(Scene& scene,
         });
 
         mesh.keyFrames[0].vertexCount = static_cast<uint32_t>(vertices.size());
+        mesh.keyFrames[0].storeGeometry(vertices, indices);
         mesh.keyFrames[0].triangleCount = static_cast<uint32_t>(indices.size() / 3);
         mesh.materialIndex = shape.mesh.material_ids[0];
         if (mesh.materialIndex == -1) {
@@ -201,6 +200,7 @@ void LoaderObj::loadMesh(Mesh& mesh,
     });
 
     mesh.keyFrames[0].vertexCount = static_cast<uint32_t>(vertices.size());
+    mesh.keyFrames[0].storeGeometry(vertices, indices);
     mesh.keyFrames[0].triangleCount = static_cast<uint32_t>(indices.size() / 3);
     mesh.materialIndex = -1;
 }
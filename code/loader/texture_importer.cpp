@@ -0,0 +1,383 @@
+#include "texture_importer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <fstream>
+
+#include <stb_image.h>
+
+#include "../filepath.hpp"
+
+namespace {
+constexpr const char* kUsageNames[] = {"color", "linear", "normal"};
+constexpr const char* kFormatNames[] = {"rgba8", "bc7", "bc5"};
+
+// ミップマップのレベルはブロック (16 bytes) 単位で詰める
+constexpr size_t kLevelAlignment = 16;
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+}  // namespace
+
+int TextureImporter::add(std::vector<uint8_t> bytes,
+                         MaterialTexture::Usage usage,
+                         std::string name) {
+    // 同じ画像でも用途が違えば形式や色空間が変わるので別のテクスチャにする
+    const uint64_t hash = hashBytes(bytes);
+    const uint64_t key = hash ^ (static_cast<uint64_t>(usage) * 0x9e3779b97f4a7c15ull);
+    if (const auto itr = m_indices.find(key); itr != m_indices.end()) {
+        m_duplicateCount++;
+        return itr->second;
+    }
+    const int index = static_cast<int>(m_sources.size());
+    m_sources.push_back({std::move(name), std::move(bytes), usage, hash});
+    m_indices[key] = index;
+    return index;
+}
+
+int TextureImporter::addFile(const std::filesystem::path& filepath, MaterialTexture::Usage usage) {
+    std::ifstream file{filepath, std::ios::binary | std::ios::ate};
+    if (!file) {
+        spdlog::warn("Failed to open texture: {}", filepath.string());
+        return -1;
+    }
+    std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(bytes.data()), bytes.size())) {
+        spdlog::warn("Failed to read texture: {}", filepath.string());
+        return -1;
+    }
+    return add(std::move(bytes), usage, filepath.filename().string());
+}
+
+std::vector<rv::ImageHandle> TextureImporter::import(const rv::Context& context,
+                                                     ThreadPool* pool) {
+    m_imageIndices.assign(m_sources.size(), -1);
+    m_rects.assign(m_sources.size(), glm::vec4{0.0f, 0.0f, 1.0f, 1.0f});
+    if (m_sources.empty()) {
+        return {};
+    }
+    rv::CPUTimer timer;
+    const uint32_t count = static_cast<uint32_t>(m_sources.size());
+
+    std::error_code error;
+    std::filesystem::create_directories(getExecutableDirectory() / "texture_cache", error);
+
+    // アトラスに詰めるテクスチャを用途ごとに選ぶ (ヘッダーの大きさだけ見る)
+    // 1 つだけなら詰めても減らないのでそのまま使う
+    std::vector<std::vector<uint32_t>> groups(std::size(kUsageNames));
+    std::vector<uint32_t> singles;
+    for (uint32_t i = 0; i < count; i++) {
+        const Source& source = m_sources[i];
+        int width = 0;
+        int height = 0;
+        int channel = 0;
+        if (m_pack &&
+            stbi_info_from_memory(source.bytes.data(), static_cast<int>(source.bytes.size()),
+                                  &width, &height, &channel) &&
+            TextureAtlas::canPack(width, height)) {
+            groups[static_cast<uint32_t>(source.usage)].push_back(i);
+        } else {
+            singles.push_back(i);
+        }
+    }
+    for (auto& group : groups) {
+        if (group.size() == 1) {
+            singles.push_back(group.front());
+            group.clear();
+        }
+    }
+    std::sort(singles.begin(), singles.end());
+
+    // テクスチャの中でもミップマップの生成や圧縮を行単位で並列にする (プールは入れ子にできる)
+    std::vector<Entry> entries(singles.size());
+    const auto importSingle = [&](uint32_t i) { importSource(singles[i], entries[i], pool); };
+    if (pool) {
+        pool->parallelFor(static_cast<uint32_t>(singles.size()), importSingle);
+    } else {
+        for (uint32_t i = 0; i < singles.size(); i++) {
+            importSingle(i);
+        }
+    }
+    for (uint32_t i = 0; i < singles.size(); i++) {
+        m_imageIndices[singles[i]] = static_cast<int>(i);
+    }
+    for (const auto& group : groups) {
+        if (!group.empty()) {
+            importAtlases(group, entries, pool);
+        }
+    }
+    const double buildTime = timer.elapsedInMilli();
+
+    // 全てのレベルを 1 つのステージングバッファに詰める
+    const uint32_t entryCount = static_cast<uint32_t>(entries.size());
+    std::vector<std::vector<vk::BufferImageCopy>> regions(entryCount);
+    size_t stagingSize = 0;
+    size_t deviceSize = 0;  // レベル 0 のみ
+    size_t mipSize = 0;
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const MaterialTexture& texture = entries[i].texture;
+        for (uint32_t level = 0; level < texture.getLevelCount(); level++) {
+            const MaterialTexture::Level& levelData = texture.getLevels()[level];
+            stagingSize = alignUp(stagingSize, kLevelAlignment);
+            regions[i].push_back(
+                vk::BufferImageCopy()
+                    .setBufferOffset(stagingSize)
+                    .setImageSubresource({vk::ImageAspectFlagBits::eColor, level, 0, 1})
+                    .setImageExtent({levelData.width, levelData.height, 1}));
+            stagingSize += levelData.data.size();
+        }
+        deviceSize += texture.getLevels().front().data.size();
+        mipSize += texture.getByteSize() - texture.getLevels().front().data.size();
+    }
+    std::vector<uint8_t> bytes(stagingSize);
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const MaterialTexture& texture = entries[i].texture;
+        for (uint32_t level = 0; level < texture.getLevelCount(); level++) {
+            const auto& data = texture.getLevels()[level].data;
+            std::memcpy(bytes.data() + regions[i][level].bufferOffset, data.data(), data.size());
+        }
+    }
+    rv::BufferHandle stagingBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Staging,
+        .memory = rv::MemoryUsage::Host,
+        .size = stagingSize,
+        .debugName = "stagingBuffer",
+    });
+    stagingBuffer->copy(bytes.data());
+
+    std::vector<rv::ImageHandle> images(entryCount);
+    for (uint32_t i = 0; i < entryCount; i++) {
+        const MaterialTexture& texture = entries[i].texture;
+        const MaterialTexture::Level& level = texture.getLevels().front();
+        images[i] = context.createImage({
+            .usage = rv::ImageUsage::Sampled,
+            .extent = {level.width, level.height, 1},
+            .format = getVkFormat(texture.getUsage(), texture.getFormat()),
+            .mipLevels = texture.getLevelCount(),
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .samplerInfo = rv::SamplerCreateInfo{},
+            .debugName = std::format("texture2d[{}]", entries[i].name),
+        });
+    }
+    context.oneTimeSubmit([&](auto commandBuffer) {
+        for (uint32_t i = 0; i < entryCount; i++) {
+            commandBuffer->transitionLayout(images[i], vk::ImageLayout::eTransferDstOptimal);
+            commandBuffer->commandBuffer.copyBufferToImage(stagingBuffer->getBuffer(),
+                                                           images[i]->getImage(),
+                                                           vk::ImageLayout::eTransferDstOptimal,
+                                                           regions[i]);
+            commandBuffer->transitionLayout(images[i], vk::ImageLayout::eShaderReadOnlyOptimal);
+        }
+    });
+
+    uint32_t cachedCount = 0;
+    for (const Entry& entry : entries) {
+        const MaterialTexture& texture = entry.texture;
+        const MaterialTexture::Level& level = texture.getLevels().front();
+        const std::string name =
+            entry.sourceCount > 1 ? std::format("{} ({} textures)", entry.name, entry.sourceCount)
+                                  : entry.name;
+        spdlog::info("Texture {} {}x{} ({} {}, {} levels, {:.1f} KB, {}): {:.2f} ms", name,
+                     level.width, level.height,
+                     kUsageNames[static_cast<uint32_t>(texture.getUsage())],
+                     kFormatNames[static_cast<uint32_t>(texture.getFormat())],
+                     texture.getLevelCount(), texture.getByteSize() / 1024.0,
+                     entry.cached ? "cached" : "built", entry.time);
+        cachedCount += entry.cached;
+    }
+    // ミップマップはカメラから直接見えるヒットだけが読むので別に出す
+    spdlog::info(
+        "Textures: {} ({} cached, {} duplicates), {:.1f} MB + mips {:.1f} MB: {:.2f} ms "
+        "(build {:.2f} ms)",
+        count, cachedCount, m_duplicateCount, deviceSize / (1024.0 * 1024.0),
+        mipSize / (1024.0 * 1024.0), timer.elapsedInMilli(), buildTime);
+    if (entryCount != count) {
+        spdlog::info("Texture descriptors: {} -> {} ({} textures in {} atlases)", count,
+                     entryCount, count - singles.size(), entryCount - singles.size());
+    }
+
+    // エンコードされたデータはもう要らない
+    m_sources.clear();
+    m_indices.clear();
+    m_duplicateCount = 0;
+    return images;
+}
+
+void TextureImporter::remap(Material& material, int textureOffset) const {
+    const auto remapSlot = [&](int& index, glm::vec4& rect) {
+        if (index < 0 || index >= static_cast<int>(m_imageIndices.size())) {
+            return;
+        }
+        rect = m_rects[index];
+        index = textureOffset + m_imageIndices[index];
+    };
+    remapSlot(material.baseColorTextureIndex, material.baseColorTextureRect);
+    remapSlot(material.metallicRoughnessTextureIndex, material.metallicRoughnessTextureRect);
+    remapSlot(material.normalTextureIndex, material.normalTextureRect);
+    remapSlot(material.occlusionTextureIndex, material.occlusionTextureRect);
+    remapSlot(material.emissiveTextureIndex, material.emissiveTextureRect);
+}
+
+void TextureImporter::importSource(uint32_t index, Entry& entry, ThreadPool* pool) const {
+    rv::CPUTimer timer;
+    const Source& source = m_sources[index];
+    const MaterialTexture::Format format = MaterialTexture::selectFormat(source.usage, m_compress);
+    const std::filesystem::path cachePath = getCachePath(source.hash, source.usage, format);
+    entry.name = source.name;
+    entry.cached = entry.texture.load(cachePath, source.hash, source.usage, format);
+    if (!entry.cached) {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<uint8_t> pixels;
+        const bool decoded = decode(source, width, height, pixels);
+        entry.texture.build(pixels.data(), width, height, source.usage, format, pool);
+        // 既定値はキャッシュしない
+        if (decoded) {
+            entry.texture.save(cachePath, source.hash);
+        }
+    }
+    entry.time = timer.elapsedInMilli();
+}
+
+void TextureImporter::importAtlases(const std::vector<uint32_t>& indices,
+                                    std::vector<Entry>& entries,
+                                    ThreadPool* pool) {
+    const MaterialTexture::Usage usage = m_sources[indices.front()].usage;
+    const MaterialTexture::Format format = MaterialTexture::selectFormat(usage, m_compress);
+    const uint32_t count = static_cast<uint32_t>(indices.size());
+
+    std::vector<TextureAtlas::Size> sizes(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const Source& source = m_sources[indices[i]];
+        int width = 0;
+        int height = 0;
+        int channel = 0;
+        stbi_info_from_memory(source.bytes.data(), static_cast<int>(source.bytes.size()), &width,
+                              &height, &channel);
+        sizes[i] = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+    }
+    TextureAtlas atlas;
+    atlas.pack(sizes, kAtlasSize);
+
+    for (uint32_t a = 0; a < atlas.getAtlasCount(); a++) {
+        rv::CPUTimer timer;
+        std::vector<uint32_t> members;
+        for (uint32_t i = 0; i < count; i++) {
+            if (atlas.getPlacements()[i].atlas == a) {
+                members.push_back(i);
+            }
+        }
+
+        // 配置は大きさだけで決まるので、中身のハッシュと詰め方の定数をキーにする
+        uint64_t key = 0xcbf29ce484222325ull;
+        const auto mix = [&](uint64_t value) { key = (key ^ value) * 0x100000001b3ull; };
+        mix(TextureAtlas::kPadding);
+        mix(TextureAtlas::kLevelCount);
+        mix(kAtlasSize);
+        for (uint32_t member : members) {
+            mix(m_sources[indices[member]].hash);
+        }
+
+        Entry& entry = entries.emplace_back();
+        entry.name = std::format("atlas[{}:{}]", kUsageNames[static_cast<uint32_t>(usage)], a);
+        entry.sourceCount = static_cast<uint32_t>(members.size());
+        const std::filesystem::path cachePath = getCachePath(key, usage, format);
+        entry.cached = entry.texture.load(cachePath, key, usage, format);
+        if (!entry.cached) {
+            std::vector<std::vector<uint8_t>> pixels(count);
+            std::vector<const uint8_t*> pointers(count, nullptr);
+            const auto decodeMember = [&](uint32_t m) {
+                const uint32_t i = members[m];
+                uint32_t width = sizes[i].width;
+                uint32_t height = sizes[i].height;
+                decode(m_sources[indices[i]], width, height, pixels[i]);
+                pointers[i] = pixels[i].data();
+            };
+            if (pool) {
+                pool->parallelFor(static_cast<uint32_t>(members.size()), decodeMember);
+            } else {
+                for (uint32_t m = 0; m < members.size(); m++) {
+                    decodeMember(m);
+                }
+            }
+            const TextureAtlas::Size& size = atlas.getAtlasSize(a);
+            const std::vector<uint8_t> rgba = atlas.compose(a, pointers, pool);
+            entry.texture.build(rgba.data(), size.width, size.height, usage, format, pool,
+                                TextureAtlas::kLevelCount);
+            entry.texture.save(cachePath, key);
+        }
+        entry.time = timer.elapsedInMilli();
+
+        const int imageIndex = static_cast<int>(entries.size() - 1);
+        for (uint32_t member : members) {
+            m_imageIndices[indices[member]] = imageIndex;
+            m_rects[indices[member]] = atlas.getRect(member);
+        }
+    }
+}
+
+bool TextureImporter::decode(const Source& source,
+                             uint32_t& width,
+                             uint32_t& height,
+                             std::vector<uint8_t>& rgba) const {
+    int w = 0;
+    int h = 0;
+    int channel = 0;
+    stbi_uc* pixels = stbi_load_from_memory(
+        source.bytes.data(), static_cast<int>(source.bytes.size()), &w, &h, &channel, 4);
+    if (pixels && (width == 0 || (w == static_cast<int>(width) && h == static_cast<int>(height)))) {
+        width = static_cast<uint32_t>(w);
+        height = static_cast<uint32_t>(h);
+        rgba.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+        stbi_image_free(pixels);
+        return true;
+    }
+    stbi_image_free(pixels);
+
+    // 法線マップは +Z、それ以外は白
+    spdlog::warn("Failed to decode texture: {}", source.name);
+    if (width == 0 || height == 0) {
+        width = 1;
+        height = 1;
+    }
+    const uint8_t flat = source.usage == MaterialTexture::Usage::Normal ? 128 : 255;
+    rgba.assign(static_cast<size_t>(width) * height * 4, 255);
+    for (size_t i = 0; i < rgba.size(); i += 4) {
+        rgba[i] = flat;
+        rgba[i + 1] = flat;
+    }
+    return false;
+}
+
+std::filesystem::path TextureImporter::getCachePath(uint64_t hash,
+                                                    MaterialTexture::Usage usage,
+                                                    MaterialTexture::Format format) {
+    return getExecutableDirectory() / "texture_cache" /
+           std::format("{:016x}_{}_{}.mtex", hash, kUsageNames[static_cast<uint32_t>(usage)],
+                       kFormatNames[static_cast<uint32_t>(format)]);
+}
+
+uint64_t TextureImporter::hashBytes(const std::vector<uint8_t>& bytes) {
+    // FNV-1a 64
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const uint8_t byte : bytes) {
+        hash = (hash ^ byte) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+vk::Format TextureImporter::getVkFormat(MaterialTexture::Usage usage,
+                                        MaterialTexture::Format format) {
+    const bool srgb = usage == MaterialTexture::Usage::Color;
+    switch (format) {
+        case MaterialTexture::Format::BC7:
+            return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+        case MaterialTexture::Format::BC5:
+            return vk::Format::eBc5UnormBlock;
+        default:
+            return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+    }
+}
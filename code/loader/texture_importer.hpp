@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <reactive/reactive.hpp>
+
+#include "../../shader/share.h"
+#include "../scene/material_texture.hpp"
+#include "../scene/texture_atlas.hpp"
+#include "../thread_pool.hpp"
+
+// マテリアルの 2D テクスチャ (PNG / JPEG など) を読み込む
+// ローダーはエンコードされたままのデータを add() し、返された番号をマテリアルに入れる
+// 同じ内容と用途のテクスチャは 1 つにまとめる (内容のハッシュで判定する)
+// import() はデコード、ミップマップの生成、BC7 / BC5 への圧縮をテクスチャごとに並列に行い、
+// 結果を texture_cache/ にキャッシュしてから、全てを 1 回のコマンドでアップロードする
+// 最後に remap() でマテリアルの番号を textures2d の番号とアトラスの UV の範囲に置き換える
+class TextureImporter {
+public:
+    // compress: 色などは BC7、法線マップは BC5 にする (false は RGBA8)
+    // pack: 小さなテクスチャを用途ごとにアトラスに詰める (TextureAtlas)
+    TextureImporter(bool compress, bool pack) : m_compress{compress}, m_pack{pack} {}
+
+    // マテリアルに入れる番号 (remap() で置き換える)
+    int add(std::vector<uint8_t> bytes, MaterialTexture::Usage usage, std::string name);
+
+    // 読めないファイルは -1
+    int addFile(const std::filesystem::path& filepath, MaterialTexture::Usage usage);
+
+    // textures2d に追加するイメージ。デコードできない画像は 1x1 の既定値になる
+    std::vector<rv::ImageHandle> import(const rv::Context& context, ThreadPool* pool);
+
+    // textureOffset: import() の結果を追加する前の textures2d の数
+    void remap(Material& material, int textureOffset) const;
+
+    // e.g. texture_cache/0123456789abcdef_color_bc7.mtex
+    static std::filesystem::path getCachePath(uint64_t hash,
+                                              MaterialTexture::Usage usage,
+                                              MaterialTexture::Format format);
+
+private:
+    struct Source {
+        std::string name;
+        std::vector<uint8_t> bytes;
+        MaterialTexture::Usage usage;
+        uint64_t hash;
+    };
+
+    // アップロードするイメージ (テクスチャ 1 つ、またはアトラス)
+    struct Entry {
+        std::string name;
+        MaterialTexture texture;
+        uint32_t sourceCount = 1;
+        bool cached = false;
+        double time = 0.0;
+    };
+
+    static constexpr uint32_t kAtlasSize = 2048;
+
+    // 1 つのテクスチャを読む (キャッシュがなければ作る)
+    void importSource(uint32_t index, Entry& entry, ThreadPool* pool) const;
+
+    // 同じ用途のテクスチャ (indices) をアトラスに詰め、entries に追加する
+    void importAtlases(const std::vector<uint32_t>& indices,
+                       std::vector<Entry>& entries,
+                       ThreadPool* pool);
+
+    // rgba: RGBA8。デコードできなければ既定値にして false
+    // width, height: 0 でなければ期待する大きさ (違えば既定値にする)
+    bool decode(const Source& source,
+                uint32_t& width,
+                uint32_t& height,
+                std::vector<uint8_t>& rgba) const;
+
+    static uint64_t hashBytes(const std::vector<uint8_t>& bytes);
+
+    static vk::Format getVkFormat(MaterialTexture::Usage usage, MaterialTexture::Format format);
+
+    bool m_compress;
+    bool m_pack;
+    std::vector<Source> m_sources;
+    // hash (+ usage) -> index
+    std::unordered_map<uint64_t, int> m_indices;
+    uint32_t m_duplicateCount = 0;
+
+    // import() の結果: add() の番号 -> import() が返す配列の番号、UV の範囲
+    std::vector<int> m_imageIndices;
+    std::vector<glm::vec4> m_rects;
+};
@@ -1,37 +1,108 @@
 ﻿#include <random>
 #include <reactive/reactive.hpp>
 
+#include "app/bench_app.hpp"
 #include "app/headless_app.hpp"
 #include "app/window_app.hpp"
 
 int main(int argc, char* argv[]) {
     try {
-        // 実行モード "window", "headless" は、
+        // 実行モード "window", "headless", "bench" は、
         // コマンドライン引数で与えるか、ランタイムのユーザー入力で与えることができる
         std::string mode;
         std::string sceneName;
-        if (argc == 3) {
+        std::string output;
+        std::optional<ImageWriter::HdrOutput> hdrOutput;
+        bool enableTemporal = false;
+        std::optional<TileScheduler::Settings> adaptiveSampling;
+        std::optional<ConvergenceMonitor::Settings> earlyTermination;
+        std::optional<uint32_t> maxPasses;
+        if (argc >= 2) {
             mode = argv[1];
-            sceneName = argv[2];
         } else {
-            std::cout << "Which mode? (\"window\" or \"headless\")\n";
+            std::cout << "Which mode? (\"window\", \"headless\" or \"bench\")\n";
             std::cin >> mode;
+        }
 
+        // ベンチマークはシーンを必要としない
+        // "--spp-ms=2.0" は 1280x720 で 1 spp にかかる GPU の時間 (デノイザーの等時間比較)
+        if (mode == "bench" || mode == "b") {
+            double gpuMilliPerSample = 2.0;
+            for (int i = 2; i < argc; i++) {
+                const std::string arg = argv[i];
+                if (arg.starts_with("--spp-ms=")) {
+                    gpuMilliPerSample = std::stod(arg.substr(9));
+                }
+            }
+            BenchApp app{1280, 720, gpuMilliPerSample};
+            return app.run() ? 0 : 1;
+        }
+
+        if (argc >= 3) {
+            sceneName = argv[2];
+        } else {
             std::cout << "Which scene?\n";
             std::cin >> sceneName;
         }
 
+        // headless の出力先: 省略時は連番JPEG、"*.avi", "*.y4m", "*.yuv", "|command"
+        // "--exr" / "--exr=float" を付けると蓄積バッファを EXR (half / float) でも書き出す
+        // "--aov" はアルベド・法線・深度・モーション・IDを EXR の別パートとして追加する
+        // "--temporal" は前フレームの蓄積結果をリプロジェクションして再利用する
+        // "--adaptive" / "--adaptive=0.01" は相対誤差が閾値以下になるまでタイルごとにサンプルを追加する
+        // "--target=0.02" はフレーム全体の相対誤差が目標を下回ったらそのフレームを終える
+        // "--max-passes=64" は上の2つで1フレームに使うパス数の上限
+        for (int i = 3; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--exr" || arg == "--exr=half") {
+                hdrOutput = hdrOutput.value_or(ImageWriter::HdrOutput{});
+                hdrOutput->pixelType = exr::PixelType::Half;
+            } else if (arg == "--exr=float") {
+                hdrOutput = hdrOutput.value_or(ImageWriter::HdrOutput{});
+                hdrOutput->pixelType = exr::PixelType::Float;
+            } else if (arg == "--aov") {
+                hdrOutput = hdrOutput.value_or(ImageWriter::HdrOutput{});
+                hdrOutput->writeAOVs = true;
+            } else if (arg == "--temporal") {
+                enableTemporal = true;
+            } else if (arg.starts_with("--adaptive")) {
+                adaptiveSampling = TileScheduler::Settings{};
+                if (arg.starts_with("--adaptive=")) {
+                    adaptiveSampling->threshold = std::stof(arg.substr(11));
+                }
+            } else if (arg.starts_with("--target=")) {
+                earlyTermination = ConvergenceMonitor::Settings{};
+                earlyTermination->targetError = std::stof(arg.substr(9));
+            } else if (arg.starts_with("--max-passes=")) {
+                maxPasses = static_cast<uint32_t>(std::stoul(arg.substr(13)));
+            } else {
+                output = arg;
+            }
+        }
+
+        if (maxPasses) {
+            if (adaptiveSampling) {
+                adaptiveSampling->maxPasses = *maxPasses;
+            }
+            if (earlyTermination) {
+                earlyTermination->maxPasses = *maxPasses;
+            }
+        }
+
         const auto scenePath = getAssetDirectory() / std::format("scenes/{}.json", sceneName);
         if (mode == "window" || mode == "w") {
             WindowApp app{true, 1920, 1080, scenePath};
             app.run();
         } else if (mode == "headless" || mode == "h") {
-            HeadlessApp app{false, 1280, 720, scenePath};
+            HeadlessApp app{false, 1280, 720, scenePath, output, hdrOutput, enableTemporal,
+                            adaptiveSampling, earlyTermination};
             app.run();
         } else {
-            throw std::runtime_error("Invalid mode. Please input \"window\" or \"headless\".");
+            throw std::runtime_error(
+                "Invalid mode. Please input \"window\", \"headless\" or \"bench\".");
         }
     } catch (const std::exception& e) {
         spdlog::error(e.what());
+        return 1;
     }
 }
@@ -0,0 +1,260 @@
+#include "exr_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <zlib.h>
+#include <Imath/half.h>
+
+namespace {
+constexpr uint32_t kMagic = 20000630;
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kMultiPartFlag = 0x1000;
+constexpr uint8_t kZipCompression = 3;
+constexpr uint32_t kLinesPerBlock = 16;  // ZIP_COMPRESSION
+constexpr int kZipLevel = 4;             // OpenEXR 3.x default
+
+// ------------------------------
+// Header
+// ------------------------------
+
+class ByteWriter {
+public:
+    template <typename T>
+    void write(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        m_bytes.insert(m_bytes.end(), bytes, bytes + sizeof(T));
+    }
+
+    void writeString(const std::string& value) {
+        m_bytes.insert(m_bytes.end(), value.begin(), value.end());
+        m_bytes.push_back(0);
+    }
+
+    void beginAttribute(const std::string& name, const std::string& type, uint32_t size) {
+        writeString(name);
+        writeString(type);
+        write(size);
+    }
+
+    // string attributes are not null-terminated
+    void writeStringAttribute(const std::string& name, const std::string& value) {
+        beginAttribute(name, "string", static_cast<uint32_t>(value.size()));
+        m_bytes.insert(m_bytes.end(), value.begin(), value.end());
+    }
+
+    std::vector<uint8_t> m_bytes;
+};
+
+uint32_t getChunkCount(uint32_t height) {
+    return (height + kLinesPerBlock - 1) / kLinesPerBlock;
+}
+
+uint32_t getPixelSize(exr::PixelType type) {
+    return type == exr::PixelType::Half ? 2 : 4;
+}
+
+// チャンネルはアルファベット順に並べる必要がある
+std::vector<exr::Channel> getSortedChannels(const exr::Part& part) {
+    std::vector<exr::Channel> channels = part.channels;
+    std::sort(channels.begin(), channels.end(),
+              [](const auto& a, const auto& b) { return a.name < b.name; });
+    return channels;
+}
+
+void writeHeader(ByteWriter& writer,
+                 const exr::Part& part,
+                 uint32_t width,
+                 uint32_t height,
+                 bool isMultiPart) {
+    if (isMultiPart) {
+        writer.writeStringAttribute("name", part.name);
+        writer.writeStringAttribute("type", "scanlineimage");
+        writer.beginAttribute("chunkCount", "int", 4);
+        writer.write(static_cast<int32_t>(getChunkCount(height)));
+    }
+
+    const std::vector<exr::Channel> channels = getSortedChannels(part);
+    uint32_t channelListSize = 1;
+    for (const auto& channel : channels) {
+        channelListSize += static_cast<uint32_t>(channel.name.size()) + 1 + 16;
+    }
+    writer.beginAttribute("channels", "chlist", channelListSize);
+    for (const auto& channel : channels) {
+        writer.writeString(channel.name);
+        writer.write(static_cast<int32_t>(part.pixelType));
+        writer.write(uint32_t{0});  // pLinear + reserved
+        writer.write(int32_t{1});   // xSampling
+        writer.write(int32_t{1});   // ySampling
+    }
+    writer.write(uint8_t{0});
+
+    writer.beginAttribute("compression", "compression", 1);
+    writer.write(kZipCompression);
+
+    const int32_t window[4] = {0, 0, static_cast<int32_t>(width) - 1,
+                               static_cast<int32_t>(height) - 1};
+    writer.beginAttribute("dataWindow", "box2i", 16);
+    writer.write(window);
+    writer.beginAttribute("displayWindow", "box2i", 16);
+    writer.write(window);
+
+    writer.beginAttribute("lineOrder", "lineOrder", 1);
+    writer.write(uint8_t{0});  // INCREASING_Y
+
+    writer.beginAttribute("pixelAspectRatio", "float", 4);
+    writer.write(1.0f);
+    writer.beginAttribute("screenWindowCenter", "v2f", 8);
+    writer.write(0.0f);
+    writer.write(0.0f);
+    writer.beginAttribute("screenWindowWidth", "float", 4);
+    writer.write(1.0f);
+
+    writer.write(uint8_t{0});  // end of header
+}
+
+// ------------------------------
+// Block
+// ------------------------------
+
+// 1ブロック分の非圧縮データ: 行ごとに、チャンネルごとの1行分の値を並べる
+std::vector<uint8_t> packBlock(const exr::Part& part,
+                               const std::vector<exr::Channel>& channels,
+                               uint32_t width,
+                               uint32_t y0,
+                               uint32_t y1) {
+    const uint32_t pixelSize = getPixelSize(part.pixelType);
+    std::vector<uint8_t> bytes(static_cast<size_t>(y1 - y0) * channels.size() * width *
+                               pixelSize);
+    uint8_t* dst = bytes.data();
+    for (uint32_t y = y0; y < y1; y++) {
+        for (const auto& channel : channels) {
+            const float* src = channel.data + static_cast<size_t>(y) * width * channel.stride;
+            if (part.pixelType == exr::PixelType::Half) {
+                for (uint32_t x = 0; x < width; x++) {
+                    const uint16_t bits = Imath::half{src[x * channel.stride]}.bits();
+                    std::memcpy(dst, &bits, sizeof(bits));
+                    dst += sizeof(bits);
+                }
+            } else {
+                for (uint32_t x = 0; x < width; x++) {
+                    std::memcpy(dst, &src[x * channel.stride], sizeof(float));
+                    dst += sizeof(float);
+                }
+            }
+        }
+    }
+    return bytes;
+}
+
+// ZIP_COMPRESSION: バイトの並べ替え + 差分予測 + zlib
+// 圧縮で小さくならなければ非圧縮のまま格納する (仕様で許されている)
+std::vector<uint8_t> compressBlock(std::vector<uint8_t> raw) {
+    const size_t size = raw.size();
+    std::vector<uint8_t> reordered(size);
+    uint8_t* even = reordered.data();
+    uint8_t* odd = reordered.data() + (size + 1) / 2;
+    for (size_t i = 0; i < size; i++) {
+        (i % 2 == 0 ? *even++ : *odd++) = raw[i];
+    }
+    for (size_t i = size; i-- > 1;) {
+        reordered[i] = static_cast<uint8_t>(reordered[i] - reordered[i - 1] + 128);
+    }
+
+    uLongf compressedSize = compressBound(static_cast<uLong>(size));
+    std::vector<uint8_t> compressed(compressedSize);
+    if (compress2(compressed.data(), &compressedSize, reordered.data(), static_cast<uLong>(size),
+                  kZipLevel) != Z_OK) {
+        throw std::runtime_error("Failed to compress EXR block");
+    }
+    if (compressedSize >= size) {
+        return raw;
+    }
+    compressed.resize(compressedSize);
+    return compressed;
+}
+}  // namespace
+
+namespace exr {
+void writeImage(const fs::path& path,
+                uint32_t width,
+                uint32_t height,
+                const std::vector<Part>& parts,
+                ThreadPool* pool) {
+    if (parts.empty()) {
+        throw std::runtime_error("EXR image has no parts: " + path.string());
+    }
+    const bool isMultiPart = parts.size() > 1;
+    const uint32_t chunkCount = getChunkCount(height);
+
+    ByteWriter header;
+    header.write(kMagic);
+    header.write(kVersion | (isMultiPart ? kMultiPartFlag : 0));
+    for (const auto& part : parts) {
+        writeHeader(header, part, width, height, isMultiPart);
+    }
+    if (isMultiPart) {
+        header.write(uint8_t{0});  // end of header list
+    }
+
+    std::ofstream file{path, std::ios::binary};
+    if (!file) {
+        throw std::runtime_error("Failed to open EXR image: " + path.string());
+    }
+    file.write(reinterpret_cast<const char*>(header.m_bytes.data()),
+               static_cast<std::streamsize>(header.m_bytes.size()));
+
+    // オフセットテーブルは領域だけ確保し、最後に書き戻す
+    const std::streampos offsetTablePosition = file.tellp();
+    std::vector<uint64_t> offsets(chunkCount * parts.size(), 0);
+    file.write(reinterpret_cast<const char*>(offsets.data()),
+               static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+
+    // ワーカー数の2倍のブロックを同時に圧縮し、完了したものから順に書き出す
+    const uint32_t batchSize = pool ? pool->getThreadCount() * 2 : 1;
+    std::vector<std::vector<uint8_t>> batch(batchSize);
+    for (uint32_t partIndex = 0; partIndex < parts.size(); partIndex++) {
+        const Part& part = parts[partIndex];
+        const std::vector<Channel> channels = getSortedChannels(part);
+        for (uint32_t first = 0; first < chunkCount; first += batchSize) {
+            const uint32_t count = std::min(batchSize, chunkCount - first);
+            const auto compressTask = [&](uint32_t i) {
+                const uint32_t y0 = (first + i) * kLinesPerBlock;
+                const uint32_t y1 = std::min(y0 + kLinesPerBlock, height);
+                batch[i] = compressBlock(packBlock(part, channels, width, y0, y1));
+            };
+            if (pool) {
+                pool->parallelFor(count, compressTask);
+            } else {
+                for (uint32_t i = 0; i < count; i++) {
+                    compressTask(i);
+                }
+            }
+
+            for (uint32_t i = 0; i < count; i++) {
+                offsets[partIndex * chunkCount + first + i] = static_cast<uint64_t>(file.tellp());
+                if (isMultiPart) {
+                    const int32_t partNumber = static_cast<int32_t>(partIndex);
+                    file.write(reinterpret_cast<const char*>(&partNumber), sizeof(partNumber));
+                }
+                const int32_t y = static_cast<int32_t>((first + i) * kLinesPerBlock);
+                const int32_t size = static_cast<int32_t>(batch[i].size());
+                file.write(reinterpret_cast<const char*>(&y), sizeof(y));
+                file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+                file.write(reinterpret_cast<const char*>(batch[i].data()), size);
+            }
+        }
+    }
+
+    file.seekp(offsetTablePosition);
+    file.write(reinterpret_cast<const char*>(offsets.data()),
+               static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+    if (!file) {
+        throw std::runtime_error("Failed to write EXR image: " + path.string());
+    }
+}
+}  // namespace exr
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../filepath.hpp"
+#include "../thread_pool.hpp"
+
+// OpenEXR writer (scanline images, ZIP compression)
+// 16行のブロック単位で並列に圧縮し、ブロックの順にファイルへ書き出す。
+// 保持するのは圧縮中のブロックとオフセットテーブルだけで、ファイル全体はメモリに載せない。
+// More than one part produces a multi-part file (OpenEXR 2.0).
+namespace exr {
+enum class PixelType : int32_t {
+    Half = 1,
+    Float = 2,
+};
+
+// Source pixels are always float. `stride` is the distance between neighbouring pixels
+// in floats, so interleaved RGBA can be written without a copy (R: data + 0, stride 4).
+struct Channel {
+    std::string name;
+    const float* data = nullptr;
+    uint32_t stride = 1;
+};
+
+struct Part {
+    std::string name;
+    PixelType pixelType = PixelType::Half;
+    std::vector<Channel> channels;
+};
+
+// pool == nullptr compresses on the calling thread
+void writeImage(const fs::path& path,
+                uint32_t width,
+                uint32_t height,
+                const std::vector<Part>& parts,
+                ThreadPool* pool);
+}  // namespace exr
@@ -0,0 +1,369 @@
+#include "frame_sink.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "yuv.hpp"
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+constexpr const char* kPipeWriteMode = "wb";
+#else
+constexpr const char* kPipeWriteMode = "w";  // POSIX popen() does not accept "b"
+#endif
+
+// ------------------------------
+// JPEG sequence
+// ------------------------------
+
+JpegSequenceSink::JpegSequenceSink(uint32_t width, uint32_t height, int quality)
+    : m_encoder{width, height, quality} {}
+
+std::vector<uint8_t> JpegSequenceSink::encode(const uint8_t* rgba) const {
+    // リスタート区間ごとのストリップを共有プールで並列にエンコードする
+    return m_encoder.encode(rgba, &ThreadPool::getShared());
+}
+
+void JpegSequenceSink::write(uint32_t frame, const std::vector<uint8_t>& payload) {
+    const fs::path path = getFramePath(frame);
+    std::ofstream file{path, std::ios::binary};
+    file.write(reinterpret_cast<const char*>(payload.data()),
+               static_cast<std::streamsize>(payload.size()));
+    if (!file) {
+        throw std::runtime_error("Failed to write image: " + path.string());
+    }
+    m_lastFrame = frame;
+}
+
+void JpegSequenceSink::writeDuplicate(uint32_t frame) {
+    // 書き込み順は保証されているので、直前のフレームのファイルは既に存在する
+    const fs::path prevPath = getFramePath(m_lastFrame);
+    const fs::path path = getFramePath(frame);
+    if (prevPath == path) {
+        return;
+    }
+    std::error_code error;
+    fs::remove(path, error);
+    fs::create_hard_link(prevPath, path, error);
+    if (error) {
+        fs::copy_file(prevPath, path, fs::copy_options::overwrite_existing);
+    }
+    m_lastFrame = frame;
+}
+
+// ------------------------------
+// Y4M / raw I420
+// ------------------------------
+
+Y4mSink::Y4mSink(const std::string& output,
+                 uint32_t width,
+                 uint32_t height,
+                 uint32_t frameRate,
+                 bool raw)
+    : m_output{output}, m_width{width}, m_height{height}, m_raw{raw} {
+    m_isPipe = !output.empty() && output.front() == '|';
+    if (m_isPipe) {
+        m_file = popen(output.substr(1).c_str(), kPipeWriteMode);
+    } else {
+        m_file = std::fopen(output.c_str(), "wb");
+    }
+    if (!m_file) {
+        throw std::runtime_error("Failed to open video output: " + output);
+    }
+
+    if (!m_raw) {
+        // C420jpeg + XCOLORRANGE=FULL: JPEGと同じBT.601フルレンジ
+        const std::string header =
+            std::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n", width,
+                        height, frameRate);
+        writeBytes(header.data(), header.size());
+    }
+}
+
+Y4mSink::~Y4mSink() {
+    if (m_file) {
+        m_isPipe ? pclose(m_file) : std::fclose(m_file);
+    }
+}
+
+std::vector<uint8_t> Y4mSink::encode(const uint8_t* rgba) const {
+    std::vector<uint8_t> payload(yuv::getI420Size(m_width, m_height));
+    yuv::convertRGBAToI420(rgba, m_width, m_height, payload.data(), &ThreadPool::getShared());
+    return payload;
+}
+
+void Y4mSink::write(uint32_t, const std::vector<uint8_t>& payload) {
+    writeFrame(payload);
+    m_lastPayload = payload;
+}
+
+void Y4mSink::writeDuplicate(uint32_t) {
+    writeFrame(m_lastPayload);
+}
+
+void Y4mSink::writeFrame(const std::vector<uint8_t>& payload) {
+    if (!m_raw) {
+        writeBytes("FRAME\n", 6);
+    }
+    writeBytes(payload.data(), payload.size());
+}
+
+void Y4mSink::finish() {
+    if (!m_file) {
+        return;
+    }
+    const int result = m_isPipe ? pclose(m_file) : std::fclose(m_file);
+    m_file = nullptr;
+    if (result != 0) {
+        throw std::runtime_error(std::format("Video output exited with {}: {}", result, m_output));
+    }
+}
+
+std::string Y4mSink::getDescription() const {
+    if (m_isPipe) {
+        return "Y4M pipe: " + m_output.substr(1);
+    }
+    return (m_raw ? "Raw I420: " : "Y4M: ") + m_output;
+}
+
+void Y4mSink::writeBytes(const void* data, size_t size) {
+    if (std::fwrite(data, 1, size, m_file) != size) {
+        throw std::runtime_error("Failed to write video output: " + m_output);
+    }
+}
+
+// ------------------------------
+// MJPEG AVI
+// ------------------------------
+
+namespace {
+void writeFourCC(std::ofstream& file, const char* fourcc) {
+    file.write(fourcc, 4);
+}
+
+void writeU32(std::ofstream& file, uint32_t value) {
+    const char bytes[4] = {static_cast<char>(value & 0xff), static_cast<char>((value >> 8) & 0xff),
+                           static_cast<char>((value >> 16) & 0xff),
+                           static_cast<char>((value >> 24) & 0xff)};
+    file.write(bytes, 4);
+}
+
+void writeU16(std::ofstream& file, uint16_t value) {
+    const char bytes[2] = {static_cast<char>(value & 0xff), static_cast<char>(value >> 8)};
+    file.write(bytes, 2);
+}
+
+void patchU32(std::ofstream& file, std::streampos position, uint32_t value) {
+    const std::streampos current = file.tellp();
+    file.seekp(position);
+    writeU32(file, value);
+    file.seekp(current);
+}
+
+// AVIのチャンクサイズは32bit
+uint32_t toChunkSize(std::streamoff size) {
+    if (size < 0 || size > 0xffffffffll) {
+        throw std::runtime_error("AVI output exceeds 4 GB");
+    }
+    return static_cast<uint32_t>(size);
+}
+
+// ヘッダ内の後から確定するフィールドの位置
+constexpr std::streamoff kRiffSizeOffset = 4;
+constexpr std::streamoff kAvihTotalFramesOffset = 48;
+constexpr std::streamoff kAvihBufferSizeOffset = 60;
+constexpr std::streamoff kStrhLengthOffset = 140;
+constexpr std::streamoff kStrhBufferSizeOffset = 144;
+constexpr std::streamoff kMoviSizeOffset = 216;
+}  // namespace
+
+AviMjpegSink::AviMjpegSink(const fs::path& path,
+                           uint32_t width,
+                           uint32_t height,
+                           uint32_t frameRate,
+                           int quality)
+    : m_path{path},
+      m_width{width},
+      m_height{height},
+      m_frameRate{frameRate},
+      m_encoder{width, height, quality} {
+    m_file.open(path, std::ios::binary);
+    if (!m_file) {
+        throw std::runtime_error("Failed to open video output: " + path.string());
+    }
+    writeHeaders();
+}
+
+AviMjpegSink::~AviMjpegSink() {
+    try {
+        finish();
+    } catch (const std::exception& e) {
+        spdlog::error(e.what());
+    }
+}
+
+std::vector<uint8_t> AviMjpegSink::encode(const uint8_t* rgba) const {
+    return m_encoder.encode(rgba, &ThreadPool::getShared());
+}
+
+void AviMjpegSink::writeHeaders() {
+    // RIFF 'AVI '
+    writeFourCC(m_file, "RIFF");
+    writeU32(m_file, 0);  // patched in finish()
+    writeFourCC(m_file, "AVI ");
+
+    // LIST 'hdrl'
+    writeFourCC(m_file, "LIST");
+    writeU32(m_file, 4 + (8 + 56) + (12 + (8 + 56) + (8 + 40)));
+    writeFourCC(m_file, "hdrl");
+
+    // MainAVIHeader
+    writeFourCC(m_file, "avih");
+    writeU32(m_file, 56);
+    writeU32(m_file, 1000000 / m_frameRate);  // dwMicroSecPerFrame
+    writeU32(m_file, 0);                      // dwMaxBytesPerSec
+    writeU32(m_file, 0);                      // dwPaddingGranularity
+    writeU32(m_file, 0x10);                   // dwFlags: AVIF_HASINDEX
+    writeU32(m_file, 0);                      // dwTotalFrames (patched)
+    writeU32(m_file, 0);                      // dwInitialFrames
+    writeU32(m_file, 1);                      // dwStreams
+    writeU32(m_file, 0);                      // dwSuggestedBufferSize (patched)
+    writeU32(m_file, m_width);
+    writeU32(m_file, m_height);
+    for (int i = 0; i < 4; i++) {
+        writeU32(m_file, 0);  // dwReserved
+    }
+
+    // LIST 'strl'
+    writeFourCC(m_file, "LIST");
+    writeU32(m_file, 4 + (8 + 56) + (8 + 40));
+    writeFourCC(m_file, "strl");
+
+    // AVIStreamHeader
+    writeFourCC(m_file, "strh");
+    writeU32(m_file, 56);
+    writeFourCC(m_file, "vids");
+    writeFourCC(m_file, "MJPG");
+    writeU32(m_file, 0);            // dwFlags
+    writeU16(m_file, 0);            // wPriority
+    writeU16(m_file, 0);            // wLanguage
+    writeU32(m_file, 0);            // dwInitialFrames
+    writeU32(m_file, 1);            // dwScale
+    writeU32(m_file, m_frameRate);  // dwRate
+    writeU32(m_file, 0);            // dwStart
+    writeU32(m_file, 0);            // dwLength (patched)
+    writeU32(m_file, 0);            // dwSuggestedBufferSize (patched)
+    writeU32(m_file, 0xffffffff);   // dwQuality
+    writeU32(m_file, 0);            // dwSampleSize
+    writeU16(m_file, 0);            // rcFrame
+    writeU16(m_file, 0);
+    writeU16(m_file, static_cast<uint16_t>(m_width));
+    writeU16(m_file, static_cast<uint16_t>(m_height));
+
+    // BITMAPINFOHEADER
+    writeFourCC(m_file, "strf");
+    writeU32(m_file, 40);
+    writeU32(m_file, 40);
+    writeU32(m_file, m_width);
+    writeU32(m_file, m_height);
+    writeU16(m_file, 1);   // biPlanes
+    writeU16(m_file, 24);  // biBitCount
+    writeFourCC(m_file, "MJPG");
+    writeU32(m_file, m_width * m_height * 3);
+    for (int i = 0; i < 4; i++) {
+        writeU32(m_file, 0);
+    }
+
+    // LIST 'movi'
+    writeFourCC(m_file, "LIST");
+    writeU32(m_file, 0);  // patched in finish()
+    m_moviPosition = m_file.tellp();
+    writeFourCC(m_file, "movi");
+    assert(static_cast<std::streamoff>(m_moviPosition) == kMoviSizeOffset + 4);
+}
+
+void AviMjpegSink::write(uint32_t frame, const std::vector<uint8_t>& payload) {
+    const std::streampos chunkPosition = m_file.tellp();
+    const uint32_t size = static_cast<uint32_t>(payload.size());
+    writeFourCC(m_file, "00dc");
+    writeU32(m_file, size);
+    m_file.write(reinterpret_cast<const char*>(payload.data()), size);
+    if (size % 2 == 1) {
+        m_file.put(0);  // チャンクは2バイト境界に揃える
+    }
+    if (!m_file) {
+        throw std::runtime_error("Failed to write video output: " + m_path.string());
+    }
+
+    m_index.push_back({toChunkSize(chunkPosition - m_moviPosition), size});
+    m_maxChunkSize = std::max(m_maxChunkSize, size);
+}
+
+void AviMjpegSink::writeDuplicate(uint32_t) {
+    if (m_index.empty()) {
+        throw std::runtime_error("No frame to duplicate: " + m_path.string());
+    }
+    m_index.push_back(m_index.back());
+}
+
+void AviMjpegSink::finish() {
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    const std::streampos indexPosition = m_file.tellp();
+    writeFourCC(m_file, "idx1");
+    writeU32(m_file, static_cast<uint32_t>(m_index.size() * 16));
+    for (const auto& entry : m_index) {
+        writeFourCC(m_file, "00dc");
+        writeU32(m_file, 0x10);  // AVIIF_KEYFRAME
+        writeU32(m_file, entry.offset);
+        writeU32(m_file, entry.size);
+    }
+    const std::streampos endPosition = m_file.tellp();
+
+    const auto frameCount = static_cast<uint32_t>(m_index.size());
+    patchU32(m_file, kRiffSizeOffset, toChunkSize(endPosition - std::streampos{8}));
+    patchU32(m_file, kAvihTotalFramesOffset, frameCount);
+    patchU32(m_file, kAvihBufferSizeOffset, m_maxChunkSize);
+    patchU32(m_file, kStrhLengthOffset, frameCount);
+    patchU32(m_file, kStrhBufferSizeOffset, m_maxChunkSize);
+    patchU32(m_file, kMoviSizeOffset, toChunkSize(indexPosition - m_moviPosition));
+
+    m_file.close();
+    if (!m_file) {
+        throw std::runtime_error("Failed to finish video output: " + m_path.string());
+    }
+}
+
+// ------------------------------
+// Factory
+// ------------------------------
+
+std::unique_ptr<FrameSink> createFrameSink(const std::string& output,
+                                           uint32_t width,
+                                           uint32_t height,
+                                           uint32_t frameRate) {
+    if (output.empty()) {
+        return std::make_unique<JpegSequenceSink>(width, height);
+    }
+    if (output.front() == '|') {
+        return std::make_unique<Y4mSink>(output, width, height, frameRate, false);
+    }
+    const std::string extension = fs::path(output).extension().string();
+    if (extension == ".avi") {
+        return std::make_unique<AviMjpegSink>(output, width, height, frameRate);
+    }
+    if (extension == ".y4m") {
+        return std::make_unique<Y4mSink>(output, width, height, frameRate, false);
+    }
+    if (extension == ".yuv") {
+        return std::make_unique<Y4mSink>(output, width, height, frameRate, true);
+    }
+    throw std::runtime_error("Unknown output format: " + output);
+}
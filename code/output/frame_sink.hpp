@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdio>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../filepath.hpp"
+#include "jpeg_encoder.hpp"
+
+// ImageWriter の出力先
+// encode() はエンコーダーワーカーから順不同で呼ばれ、
+// write() / writeDuplicate() はライタースレッドからフレーム順に呼ばれる
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+
+    virtual std::vector<uint8_t> encode(const uint8_t* rgba) const = 0;
+
+    virtual void write(uint32_t frame, const std::vector<uint8_t>& payload) = 0;
+
+    // 直前に書き込んだフレームと同一の画像
+    virtual void writeDuplicate(uint32_t frame) = 0;
+
+    // シーケンスの終了。コンテナのヘッダやインデックスを確定する
+    virtual void finish() {}
+
+    virtual std::string getDescription() const = 0;
+};
+
+// 000.jpg, 001.jpg, ...
+class JpegSequenceSink : public FrameSink {
+public:
+    JpegSequenceSink(uint32_t width, uint32_t height, int quality = 90);
+
+    std::vector<uint8_t> encode(const uint8_t* rgba) const override;
+
+    void write(uint32_t frame, const std::vector<uint8_t>& payload) override;
+
+    void writeDuplicate(uint32_t frame) override;
+
+    std::string getDescription() const override { return "JPEG sequence"; }
+
+    static fs::path getFramePath(uint32_t frame) { return std::format("{:03}.jpg", frame); }
+
+private:
+    JpegEncoder m_encoder;
+    uint32_t m_lastFrame = 0;
+};
+
+// YUV4MPEG2 (or headerless I420 when raw == true) to a file or to the stdin of a command
+// e.g. "out.y4m", "out.yuv", "|ffmpeg -y -i - -c:v libx264 out.mp4"
+class Y4mSink : public FrameSink {
+public:
+    Y4mSink(const std::string& output,
+            uint32_t width,
+            uint32_t height,
+            uint32_t frameRate,
+            bool raw);
+
+    ~Y4mSink() override;
+
+    std::vector<uint8_t> encode(const uint8_t* rgba) const override;
+
+    void write(uint32_t frame, const std::vector<uint8_t>& payload) override;
+
+    // Y4M にはフレーム番号がないので、直前のフレームを書き直すだけ
+    void writeDuplicate(uint32_t) override;
+
+    void finish() override;
+
+    std::string getDescription() const override;
+
+private:
+    void writeFrame(const std::vector<uint8_t>& payload);
+
+    void writeBytes(const void* data, size_t size);
+
+    std::string m_output;
+    uint32_t m_width;
+    uint32_t m_height;
+    bool m_raw;
+    bool m_isPipe;
+    std::FILE* m_file = nullptr;
+    std::vector<uint8_t> m_lastPayload;
+};
+
+// Motion JPEG in an AVI 1.0 container
+// 保持するのはフレームごとの8バイトのインデックスだけ
+// 同一のフレームはチャンクを書かず、idx1 で直前のチャンクをもう一度指す
+class AviMjpegSink : public FrameSink {
+public:
+    AviMjpegSink(const fs::path& path,
+                 uint32_t width,
+                 uint32_t height,
+                 uint32_t frameRate,
+                 int quality = 90);
+
+    ~AviMjpegSink() override;
+
+    std::vector<uint8_t> encode(const uint8_t* rgba) const override;
+
+    void write(uint32_t frame, const std::vector<uint8_t>& payload) override;
+
+    void writeDuplicate(uint32_t frame) override;
+
+    void finish() override;
+
+    std::string getDescription() const override { return "MJPEG AVI: " + m_path.string(); }
+
+private:
+    struct IndexEntry {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    void writeHeaders();
+
+    fs::path m_path;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_frameRate;
+    JpegEncoder m_encoder;
+
+    std::ofstream m_file;
+    std::streampos m_moviPosition;
+    std::vector<IndexEntry> m_index;
+    uint32_t m_maxChunkSize = 0;
+    bool m_finished = false;
+};
+
+// output: "" (JPEG sequence), "*.avi", "*.y4m", "*.yuv" or "|command" (Y4M to stdin)
+std::unique_ptr<FrameSink> createFrameSink(const std::string& output,
+                                           uint32_t width,
+                                           uint32_t height,
+                                           uint32_t frameRate);
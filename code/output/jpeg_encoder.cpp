@@ -0,0 +1,503 @@
+#include "jpeg_encoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include "../simd.hpp"
+
+using simd::F4;
+
+namespace {
+// zigzag index -> natural (row-major) index
+constexpr uint8_t kZigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+constexpr uint8_t kLumaQuant[64] = {
+    16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,
+    14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+    18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+constexpr uint8_t kChromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+constexpr float kAanScale[8] = {
+    1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+    1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+};
+
+// Standard Huffman tables (ITU-T T.81 Annex K.3)
+struct HuffmanSpec {
+    uint8_t bits[16];
+    std::vector<uint8_t> values;
+};
+
+const HuffmanSpec kLumaDcSpec = {
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+};
+
+const HuffmanSpec kChromaDcSpec = {
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11},
+};
+
+const HuffmanSpec kLumaAcSpec = {
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61,
+     0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52,
+     0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25,
+     0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45,
+     0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64,
+     0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83,
+     0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99,
+     0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+     0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3,
+     0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8,
+     0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa},
+};
+
+const HuffmanSpec kChromaAcSpec = {
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77},
+    {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61,
+     0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33,
+     0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18,
+     0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44,
+     0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63,
+     0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+     0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+     0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+     0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca,
+     0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+     0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa},
+};
+
+struct HuffmanTable {
+    explicit HuffmanTable(const HuffmanSpec& spec) {
+        uint32_t code = 0;
+        size_t k = 0;
+        for (uint32_t length = 1; length <= 16; length++) {
+            for (uint32_t i = 0; i < spec.bits[length - 1]; i++) {
+                const uint8_t symbol = spec.values[k++];
+                codes[symbol] = static_cast<uint16_t>(code++);
+                sizes[symbol] = static_cast<uint8_t>(length);
+            }
+            code <<= 1;
+        }
+    }
+
+    uint16_t codes[256] = {};
+    uint8_t sizes[256] = {};
+};
+
+const HuffmanTable kLumaDc{kLumaDcSpec};
+const HuffmanTable kChromaDc{kChromaDcSpec};
+const HuffmanTable kLumaAc{kLumaAcSpec};
+const HuffmanTable kChromaAc{kChromaAcSpec};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : m_out{out} {}
+
+    void write(uint32_t bits, uint32_t count) {
+        m_buffer = (m_buffer << count) | bits;
+        m_count += count;
+        while (m_count >= 8) {
+            const auto byte = static_cast<uint8_t>(m_buffer >> (m_count - 8));
+            m_out.push_back(byte);
+            if (byte == 0xff) {
+                m_out.push_back(0);  // byte stuffing
+            }
+            m_count -= 8;
+        }
+    }
+
+    // 残りのビットを1で埋めてバイト境界に揃える
+    void flush() {
+        if (m_count > 0) {
+            write((1u << (8 - m_count)) - 1, 8 - m_count);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_buffer = 0;
+    uint32_t m_count = 0;
+};
+
+// 8点AAN DCT。各レーンが独立した列として同時に変換される
+inline void fdct8(F4* d) {
+    const F4 tmp0 = d[0] + d[7];
+    const F4 tmp7 = d[0] - d[7];
+    const F4 tmp1 = d[1] + d[6];
+    const F4 tmp6 = d[1] - d[6];
+    const F4 tmp2 = d[2] + d[5];
+    const F4 tmp5 = d[2] - d[5];
+    const F4 tmp3 = d[3] + d[4];
+    const F4 tmp4 = d[3] - d[4];
+
+    // Even part
+    F4 tmp10 = tmp0 + tmp3;
+    const F4 tmp13 = tmp0 - tmp3;
+    F4 tmp11 = tmp1 + tmp2;
+    F4 tmp12 = tmp1 - tmp2;
+
+    d[0] = tmp10 + tmp11;
+    d[4] = tmp10 - tmp11;
+
+    const F4 z1 = (tmp12 + tmp13) * simd::splat(0.707106781f);
+    d[2] = tmp13 + z1;
+    d[6] = tmp13 - z1;
+
+    // Odd part
+    tmp10 = tmp4 + tmp5;
+    tmp11 = tmp5 + tmp6;
+    tmp12 = tmp6 + tmp7;
+
+    const F4 z5 = (tmp10 - tmp12) * simd::splat(0.382683433f);
+    const F4 z2 = tmp10 * simd::splat(0.541196100f) + z5;
+    const F4 z4 = tmp12 * simd::splat(1.306562965f) + z5;
+    const F4 z3 = tmp11 * simd::splat(0.707106781f);
+
+    const F4 z11 = tmp7 + z3;
+    const F4 z13 = tmp7 - z3;
+
+    d[5] = z13 + z2;
+    d[3] = z13 - z2;
+    d[1] = z11 + z4;
+    d[7] = z11 - z4;
+}
+
+// block: 8x8 row-major (level shifted)
+// scale: 転置レイアウトの量子化係数の逆数
+// out: zigzag order
+void transformBlock(const float* block, const float* scale, int16_t* out) {
+    F4 rows[8][2];
+    for (int y = 0; y < 8; y++) {
+        rows[y][0] = simd::load(block + y * 8);
+        rows[y][1] = simd::load(block + y * 8 + 4);
+    }
+
+    // Vertical pass
+    for (int h = 0; h < 2; h++) {
+        F4 column[8];
+        for (int y = 0; y < 8; y++) {
+            column[y] = rows[y][h];
+        }
+        fdct8(column);
+        for (int y = 0; y < 8; y++) {
+            rows[y][h] = column[y];
+        }
+    }
+
+    // Transpose 8x8
+    simd::transpose(rows[0][0], rows[1][0], rows[2][0], rows[3][0]);
+    simd::transpose(rows[4][1], rows[5][1], rows[6][1], rows[7][1]);
+    simd::transpose(rows[0][1], rows[1][1], rows[2][1], rows[3][1]);
+    simd::transpose(rows[4][0], rows[5][0], rows[6][0], rows[7][0]);
+    for (int i = 0; i < 4; i++) {
+        std::swap(rows[i][1], rows[4 + i][0]);
+    }
+
+    // Horizontal pass (as vertical on the transposed block)
+    for (int h = 0; h < 2; h++) {
+        F4 column[8];
+        for (int y = 0; y < 8; y++) {
+            column[y] = rows[y][h];
+        }
+        fdct8(column);
+        for (int y = 0; y < 8; y++) {
+            rows[y][h] = column[y];
+        }
+    }
+
+    // Quantize
+    int32_t quantized[64];
+    for (int y = 0; y < 8; y++) {
+        simd::storeRounded(quantized + y * 8, rows[y][0] * simd::load(scale + y * 8));
+        simd::storeRounded(quantized + y * 8 + 4, rows[y][1] * simd::load(scale + y * 8 + 4));
+    }
+
+    // 出力は転置されているので (v, u) -> u * 8 + v で参照する
+    for (int k = 0; k < 64; k++) {
+        const int natural = kZigzag[k];
+        out[k] = static_cast<int16_t>(quantized[(natural % 8) * 8 + natural / 8]);
+    }
+}
+
+// value -> (category, additional bits)
+void computeCategory(int value, uint32_t& category, uint32_t& bits) {
+    const int magnitude = value < 0 ? -value : value;
+    category = 0;
+    while ((magnitude >> category) != 0) {
+        category++;
+    }
+    bits = static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << category) - 1);
+}
+
+void encodeBlock(BitWriter& writer,
+                 const int16_t* coef,
+                 int& dcPred,
+                 const HuffmanTable& dc,
+                 const HuffmanTable& ac) {
+    uint32_t category, bits;
+
+    // DC
+    const int diff = coef[0] - dcPred;
+    dcPred = coef[0];
+    computeCategory(diff, category, bits);
+    writer.write(dc.codes[category], dc.sizes[category]);
+    if (category > 0) {
+        writer.write(bits, category);
+    }
+
+    // AC
+    int lastNonZero = 63;
+    while (lastNonZero > 0 && coef[lastNonZero] == 0) {
+        lastNonZero--;
+    }
+    int run = 0;
+    for (int k = 1; k <= lastNonZero; k++) {
+        if (coef[k] == 0) {
+            run++;
+            continue;
+        }
+        while (run >= 16) {
+            writer.write(ac.codes[0xf0], ac.sizes[0xf0]);  // ZRL
+            run -= 16;
+        }
+        computeCategory(coef[k], category, bits);
+        const uint32_t symbol = (run << 4) | category;
+        writer.write(ac.codes[symbol], ac.sizes[symbol]);
+        writer.write(bits, category);
+        run = 0;
+    }
+    if (lastNonZero < 63) {
+        writer.write(ac.codes[0x00], ac.sizes[0x00]);  // EOB
+    }
+}
+
+// 16ピクセル分のRGBAをYCbCrに変換する (Y, Cb, Cr は level shift 済み)
+void convertRow16(const uint8_t* rgba, float* y, float* cb, float* cr) {
+    for (int x = 0; x < 16; x += 4) {
+        F4 r, g, b;
+        simd::loadRGB(rgba + x * 4, r, g, b);
+        simd::store(y + x, r * simd::splat(0.299f) + g * simd::splat(0.587f) +
+                               b * simd::splat(0.114f) - simd::splat(128.0f));
+        simd::store(cb + x, b * simd::splat(0.5f) - r * simd::splat(0.168736f) -
+                                g * simd::splat(0.331264f));
+        simd::store(cr + x, r * simd::splat(0.5f) - g * simd::splat(0.418688f) -
+                                b * simd::splat(0.081312f));
+    }
+}
+
+// 2x2平均で16x2 -> 8x1 に縮小する
+void downsampleRow(const float* row0, const float* row1, float* out) {
+    for (int x = 0; x < 16; x += 8) {
+        const F4 a = simd::load(row0 + x) + simd::load(row1 + x);
+        const F4 b = simd::load(row0 + x + 4) + simd::load(row1 + x + 4);
+        simd::store(out + x / 2, simd::addPairs(a, b) * simd::splat(0.25f));
+    }
+}
+
+void writeMarker(std::vector<uint8_t>& out, uint8_t marker) {
+    out.push_back(0xff);
+    out.push_back(marker);
+}
+
+void writeU16(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value & 0xff));
+}
+}  // namespace
+
+JpegEncoder::JpegEncoder(uint32_t width, uint32_t height, int quality)
+    : m_width{width}, m_height{height} {
+    m_mcuCountX = (width + 15) / 16;
+    m_mcuCountY = (height + 15) / 16;
+
+    // リスタート間隔は画像サイズのみで決める (スレッド数に依存しない出力にするため)
+    m_mcuRowsPerStrip = 1;
+    m_stripCount = (m_mcuCountY + m_mcuRowsPerStrip - 1) / m_mcuRowsPerStrip;
+
+    quality = std::clamp(quality, 1, 100);
+    const int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    uint8_t luma[64];
+    uint8_t chroma[64];
+    for (int i = 0; i < 64; i++) {
+        luma[i] = static_cast<uint8_t>(std::clamp((kLumaQuant[i] * scale + 50) / 100, 1, 255));
+        chroma[i] = static_cast<uint8_t>(std::clamp((kChromaQuant[i] * scale + 50) / 100, 1, 255));
+    }
+    for (int k = 0; k < 64; k++) {
+        m_lumaTable[k] = luma[kZigzag[k]];
+        m_chromaTable[k] = chroma[kZigzag[k]];
+    }
+
+    // DCT出力は行=水平周波数u、列=垂直周波数v
+    for (int u = 0; u < 8; u++) {
+        for (int v = 0; v < 8; v++) {
+            const float aan = kAanScale[u] * kAanScale[v] * 8.0f;
+            m_lumaScale[u * 8 + v] = 1.0f / (luma[v * 8 + u] * aan);
+            m_chromaScale[u * 8 + v] = 1.0f / (chroma[v * 8 + u] * aan);
+        }
+    }
+}
+
+std::vector<uint8_t> JpegEncoder::encode(const uint8_t* rgba, ThreadPool* pool) const {
+    std::vector<std::vector<uint8_t>> strips(m_stripCount);
+    const auto encodeOne = [&](uint32_t strip) {
+        strips[strip].reserve(m_width * 16 * m_mcuRowsPerStrip / 4);
+        encodeStrip(rgba, strip, strips[strip]);
+    };
+    if (pool) {
+        pool->parallelFor(m_stripCount, encodeOne);
+    } else {
+        for (uint32_t strip = 0; strip < m_stripCount; strip++) {
+            encodeOne(strip);
+        }
+    }
+
+    size_t totalSize = 1024;
+    for (const auto& strip : strips) {
+        totalSize += strip.size() + 2;
+    }
+    std::vector<uint8_t> out;
+    out.reserve(totalSize);
+    writeHeaders(out);
+    for (uint32_t strip = 0; strip < m_stripCount; strip++) {
+        out.insert(out.end(), strips[strip].begin(), strips[strip].end());
+        if (strip + 1 < m_stripCount) {
+            writeMarker(out, static_cast<uint8_t>(0xd0 + strip % 8));  // RSTn
+        }
+    }
+    writeMarker(out, 0xd9);  // EOI
+    return out;
+}
+
+void JpegEncoder::writeHeaders(std::vector<uint8_t>& out) const {
+    // SOI
+    writeMarker(out, 0xd8);
+
+    // APP0 (JFIF)
+    writeMarker(out, 0xe0);
+    writeU16(out, 16);
+    for (const char c : {'J', 'F', 'I', 'F', '\0'}) {
+        out.push_back(static_cast<uint8_t>(c));
+    }
+    out.insert(out.end(), {1, 1, 0});  // version 1.1, no units
+    writeU16(out, 1);
+    writeU16(out, 1);
+    out.insert(out.end(), {0, 0});  // no thumbnail
+
+    // DQT
+    writeMarker(out, 0xdb);
+    writeU16(out, 2 + 2 * 65);
+    out.push_back(0);
+    out.insert(out.end(), std::begin(m_lumaTable), std::end(m_lumaTable));
+    out.push_back(1);
+    out.insert(out.end(), std::begin(m_chromaTable), std::end(m_chromaTable));
+
+    // SOF0 (Y: 2x2, Cb/Cr: 1x1)
+    writeMarker(out, 0xc0);
+    writeU16(out, 17);
+    out.push_back(8);
+    writeU16(out, m_height);
+    writeU16(out, m_width);
+    out.insert(out.end(), {3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1});
+
+    // DHT
+    const std::pair<uint8_t, const HuffmanSpec*> tables[] = {
+        {0x00, &kLumaDcSpec},
+        {0x10, &kLumaAcSpec},
+        {0x01, &kChromaDcSpec},
+        {0x11, &kChromaAcSpec},
+    };
+    uint32_t length = 2;
+    for (const auto& [id, spec] : tables) {
+        length += 1 + 16 + static_cast<uint32_t>(spec->values.size());
+    }
+    writeMarker(out, 0xc4);
+    writeU16(out, length);
+    for (const auto& [id, spec] : tables) {
+        out.push_back(id);
+        out.insert(out.end(), std::begin(spec->bits), std::end(spec->bits));
+        out.insert(out.end(), spec->values.begin(), spec->values.end());
+    }
+
+    // DRI
+    writeMarker(out, 0xdd);
+    writeU16(out, 4);
+    writeU16(out, m_mcuCountX * m_mcuRowsPerStrip);
+
+    // SOS
+    writeMarker(out, 0xda);
+    writeU16(out, 12);
+    out.insert(out.end(), {3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0});
+}
+
+void JpegEncoder::encodeStrip(const uint8_t* rgba,
+                              uint32_t strip,
+                              std::vector<uint8_t>& out) const {
+    BitWriter writer{out};
+    int dcPredY = 0;
+    int dcPredCb = 0;
+    int dcPredCr = 0;
+
+    alignas(16) float blockY[4][64];
+    alignas(16) float blockCb[64];
+    alignas(16) float blockCr[64];
+    alignas(16) float rowCb[2][16];
+    alignas(16) float rowCr[2][16];
+    alignas(16) float rowY[16];
+    alignas(16) uint8_t edge[16 * 4];
+    int16_t coef[64];
+
+    const uint32_t mcuYBegin = strip * m_mcuRowsPerStrip;
+    const uint32_t mcuYEnd = std::min(mcuYBegin + m_mcuRowsPerStrip, m_mcuCountY);
+    for (uint32_t mcuY = mcuYBegin; mcuY < mcuYEnd; mcuY++) {
+        for (uint32_t mcuX = 0; mcuX < m_mcuCountX; mcuX++) {
+            const uint32_t x0 = mcuX * 16;
+            for (uint32_t y = 0; y < 16; y++) {
+                // 画像外は端のピクセルを複製する
+                const uint32_t srcY = std::min(mcuY * 16 + y, m_height - 1);
+                const uint8_t* src = rgba + (static_cast<size_t>(srcY) * m_width + x0) * 4;
+                if (x0 + 16 > m_width) {
+                    for (uint32_t x = 0; x < 16; x++) {
+                        const uint32_t srcX = std::min(x0 + x, m_width - 1) - x0;
+                        std::memcpy(edge + x * 4, src + srcX * 4, 4);
+                    }
+                    src = edge;
+                }
+
+                convertRow16(src, rowY, rowCb[y % 2], rowCr[y % 2]);
+                float* dstY = blockY[(y / 8) * 2] + (y % 8) * 8;
+                std::memcpy(dstY, rowY, 8 * sizeof(float));
+                std::memcpy(blockY[(y / 8) * 2 + 1] + (y % 8) * 8, rowY + 8, 8 * sizeof(float));
+                if (y % 2 == 1) {
+                    downsampleRow(rowCb[0], rowCb[1], blockCb + (y / 2) * 8);
+                    downsampleRow(rowCr[0], rowCr[1], blockCr + (y / 2) * 8);
+                }
+            }
+
+            for (int i = 0; i < 4; i++) {
+                transformBlock(blockY[i], m_lumaScale, coef);
+                encodeBlock(writer, coef, dcPredY, kLumaDc, kLumaAc);
+            }
+            transformBlock(blockCb, m_chromaScale, coef);
+            encodeBlock(writer, coef, dcPredCb, kChromaDc, kChromaAc);
+            transformBlock(blockCr, m_chromaScale, coef);
+            encodeBlock(writer, coef, dcPredCr, kChromaDc, kChromaAc);
+        }
+    }
+    writer.flush();
+}
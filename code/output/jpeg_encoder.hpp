@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../thread_pool.hpp"
+
+// Baseline JPEG (4:2:0) encoder for RGBA8 readback buffers.
+// The image is split into restart intervals of whole MCU rows. Each interval is an
+// independent entropy-coded segment, so strips are encoded in parallel and concatenated
+// with RSTn markers. The output is identical regardless of the number of threads.
+class JpegEncoder {
+public:
+    JpegEncoder(uint32_t width, uint32_t height, int quality = 90);
+
+    // rgba: tightly packed RGBA8 (alpha is ignored)
+    // pool == nullptr encodes all strips on the calling thread
+    std::vector<uint8_t> encode(const uint8_t* rgba, ThreadPool* pool) const;
+
+    uint32_t getStripCount() const { return m_stripCount; }
+
+private:
+    void writeHeaders(std::vector<uint8_t>& out) const;
+
+    void encodeStrip(const uint8_t* rgba, uint32_t strip, std::vector<uint8_t>& out) const;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_mcuCountX;
+    uint32_t m_mcuCountY;
+    uint32_t m_mcuRowsPerStrip;
+    uint32_t m_stripCount;
+
+    // zigzag order, used for DQT
+    uint8_t m_lumaTable[64];
+    uint8_t m_chromaTable[64];
+
+    // DCT出力のレイアウト (転置済み) に合わせた量子化係数の逆数
+    alignas(16) float m_lumaScale[64];
+    alignas(16) float m_chromaScale[64];
+};
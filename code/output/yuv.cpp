@@ -0,0 +1,138 @@
+#include "yuv.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../simd.hpp"
+
+using simd::F4;
+
+namespace {
+uint8_t toByte(float value) {
+    return static_cast<uint8_t>(std::clamp(std::lrintf(value), 0l, 255l));
+}
+
+float computeY(const uint8_t* p) {
+    return 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+}
+
+F4 computeY(F4 r, F4 g, F4 b) {
+    return r * simd::splat(0.299f) + g * simd::splat(0.587f) + b * simd::splat(0.114f);
+}
+
+// U, V はベクトルの部分と同じ順に足す (端数の列でも同じバイトになるように)
+float computeU(float r, float g, float b) {
+    return 0.5f * b - (0.168736f * r + 0.331264f * g) + 128.0f;
+}
+
+float computeV(float r, float g, float b) {
+    return 0.5f * r - (0.418688f * g + 0.081312f * b) + 128.0f;
+}
+
+// 2x2 block sums of 8x2 pixels -> 4 averaged values
+F4 average2x2(F4 row0a, F4 row0b, F4 row1a, F4 row1b) {
+    return simd::addPairs(row0a + row1a, row0b + row1b) * simd::splat(0.25f);
+}
+
+// 2行分の輝度と1行分の色差を変換する
+void convertRowPair(const uint8_t* rgba,
+                    uint32_t width,
+                    uint32_t height,
+                    uint32_t chromaY,
+                    uint8_t* planeY,
+                    uint8_t* planeU,
+                    uint8_t* planeV) {
+    const uint32_t y0 = chromaY * 2;
+    const uint32_t y1 = std::min(y0 + 1, height - 1);
+    const bool hasSecondRow = y0 + 1 < height;
+    const uint8_t* row0 = rgba + static_cast<size_t>(y0) * width * 4;
+    const uint8_t* row1 = rgba + static_cast<size_t>(y1) * width * 4;
+    uint8_t* dstY0 = planeY + static_cast<size_t>(y0) * width;
+    uint8_t* dstY1 = planeY + static_cast<size_t>(y1) * width;
+    const uint32_t chromaWidth = yuv::getChromaWidth(width);
+    uint8_t* dstU = planeU + static_cast<size_t>(chromaY) * chromaWidth;
+    uint8_t* dstV = planeV + static_cast<size_t>(chromaY) * chromaWidth;
+
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        F4 r0a, g0a, b0a, r0b, g0b, b0b, r1a, g1a, b1a, r1b, g1b, b1b;
+        simd::loadRGB(row0 + x * 4, r0a, g0a, b0a);
+        simd::loadRGB(row0 + x * 4 + 16, r0b, g0b, b0b);
+        simd::loadRGB(row1 + x * 4, r1a, g1a, b1a);
+        simd::loadRGB(row1 + x * 4 + 16, r1b, g1b, b1b);
+
+        simd::storeBytes(dstY0 + x, computeY(r0a, g0a, b0a));
+        simd::storeBytes(dstY0 + x + 4, computeY(r0b, g0b, b0b));
+        if (hasSecondRow) {
+            simd::storeBytes(dstY1 + x, computeY(r1a, g1a, b1a));
+            simd::storeBytes(dstY1 + x + 4, computeY(r1b, g1b, b1b));
+        }
+
+        const F4 r = average2x2(r0a, r0b, r1a, r1b);
+        const F4 g = average2x2(g0a, g0b, g1a, g1b);
+        const F4 b = average2x2(b0a, b0b, b1a, b1b);
+        simd::storeBytes(dstU + x / 2, b * simd::splat(0.5f) -
+                                           (r * simd::splat(0.168736f) +
+                                            g * simd::splat(0.331264f)) +
+                                           simd::splat(128.0f));
+        simd::storeBytes(dstV + x / 2, r * simd::splat(0.5f) -
+                                           (g * simd::splat(0.418688f) +
+                                            b * simd::splat(0.081312f)) +
+                                           simd::splat(128.0f));
+    }
+
+    // Scalar tail
+    for (uint32_t i = x; i < width; i++) {
+        dstY0[i] = toByte(computeY(row0 + i * 4));
+        if (hasSecondRow) {
+            dstY1[i] = toByte(computeY(row1 + i * 4));
+        }
+    }
+    for (uint32_t cx = x / 2; cx < chromaWidth; cx++) {
+        const uint32_t x0 = cx * 2;
+        const uint32_t x1 = std::min(x0 + 1, width - 1);
+        float r = 0.0f, g = 0.0f, b = 0.0f;
+        for (const uint8_t* p : {row0 + x0 * 4, row0 + x1 * 4, row1 + x0 * 4, row1 + x1 * 4}) {
+            r += p[0];
+            g += p[1];
+            b += p[2];
+        }
+        r *= 0.25f;
+        g *= 0.25f;
+        b *= 0.25f;
+        dstU[cx] = toByte(computeU(r, g, b));
+        dstV[cx] = toByte(computeV(r, g, b));
+    }
+}
+}  // namespace
+
+namespace yuv {
+void convertRGBAToI420(const uint8_t* rgba,
+                       uint32_t width,
+                       uint32_t height,
+                       uint8_t* yuv,
+                       ThreadPool* pool) {
+    const uint32_t chromaHeight = getChromaHeight(height);
+    uint8_t* planeY = yuv;
+    uint8_t* planeU = planeY + static_cast<size_t>(width) * height;
+    uint8_t* planeV = planeU + static_cast<size_t>(getChromaWidth(width)) * chromaHeight;
+
+    // 16行単位のタスクに分割する
+    constexpr uint32_t kRowPairsPerTask = 8;
+    const uint32_t taskCount = (chromaHeight + kRowPairsPerTask - 1) / kRowPairsPerTask;
+    const auto convertTask = [&](uint32_t task) {
+        const uint32_t begin = task * kRowPairsPerTask;
+        const uint32_t end = std::min(begin + kRowPairsPerTask, chromaHeight);
+        for (uint32_t chromaY = begin; chromaY < end; chromaY++) {
+            convertRowPair(rgba, width, height, chromaY, planeY, planeU, planeV);
+        }
+    };
+    if (pool) {
+        pool->parallelFor(taskCount, convertTask);
+    } else {
+        for (uint32_t task = 0; task < taskCount; task++) {
+            convertTask(task);
+        }
+    }
+}
+}  // namespace yuv
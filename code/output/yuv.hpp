@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../thread_pool.hpp"
+
+// RGBA8 -> planar YUV 4:2:0 (I420) conversion
+// BT.601 full range, which matches JPEG and is tagged as such in the Y4M header.
+// Odd sizes are handled by replicating the last row/column for the chroma planes.
+namespace yuv {
+inline uint32_t getChromaWidth(uint32_t width) {
+    return (width + 1) / 2;
+}
+
+inline uint32_t getChromaHeight(uint32_t height) {
+    return (height + 1) / 2;
+}
+
+inline size_t getI420Size(uint32_t width, uint32_t height) {
+    return static_cast<size_t>(width) * height +
+           2 * static_cast<size_t>(getChromaWidth(width)) * getChromaHeight(height);
+}
+
+// yuv: Y plane, then U plane, then V plane (getI420Size() bytes)
+// pool == nullptr converts on the calling thread
+void convertRGBAToI420(const uint8_t* rgba,
+                       uint32_t width,
+                       uint32_t height,
+                       uint8_t* yuv,
+                       ThreadPool* pool);
+}  // namespace yuv
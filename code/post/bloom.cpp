@@ -0,0 +1,135 @@
+#include "bloom.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../render_pass.hpp"
+
+namespace {
+struct Color {
+    float r, g, b;
+};
+
+struct Level {
+    float* pixels;  // RGBA32F
+    uint32_t width;
+    uint32_t height;
+};
+
+Color load(const Level& level, int x, int y) {
+    const float* pixel = level.pixels + (static_cast<size_t>(y) * level.width + x) * 4;
+    return {pixel[0], pixel[1], pixel[2]};
+}
+
+Color mix(Color a, Color b, float t) {
+    return {a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t};
+}
+
+// bloom.comp: sampleBilinear
+Color sampleBilinear(const Level& source, float posX, float posY) {
+    const float px = posX - 0.5f;
+    const float py = posY - 0.5f;
+    const int x0 = static_cast<int>(std::floor(px));
+    const int y0 = static_cast<int>(std::floor(py));
+    const float fx = px - static_cast<float>(x0);
+    const float fy = py - static_cast<float>(y0);
+    const int maxX = static_cast<int>(source.width) - 1;
+    const int maxY = static_cast<int>(source.height) - 1;
+    const int loX = std::clamp(x0, 0, maxX);
+    const int hiX = std::clamp(x0 + 1, 0, maxX);
+    const int loY = std::clamp(y0, 0, maxY);
+    const int hiY = std::clamp(y0 + 1, 0, maxY);
+    return mix(mix(load(source, loX, loY), load(source, hiX, loY), fx),
+               mix(load(source, loX, hiY), load(source, hiX, hiY), fx), fy);
+}
+
+// bloom.comp: main
+void filterRow(const Level& source, const Level& dest, uint32_t y, bool upsample, float scatter) {
+    const float scale = upsample ? 0.5f : 2.0f;
+    const float cy = (static_cast<float>(y) + 0.5f) * scale;
+    for (uint32_t x = 0; x < dest.width; x++) {
+        const float cx = (static_cast<float>(x) + 0.5f) * scale;
+        const auto tap = [&](float dx, float dy, float weight, Color& sum) {
+            const Color c = sampleBilinear(source, cx + dx, cy + dy);
+            sum = {sum.r + c.r * weight, sum.g + c.g * weight, sum.b + c.b * weight};
+        };
+
+        Color color = {0.0f, 0.0f, 0.0f};
+        float* pixel = dest.pixels + (static_cast<size_t>(y) * dest.width + x) * 4;
+        if (!upsample) {
+            tap(0.0f, 0.0f, 4.0f, color);
+            tap(-1.0f, -1.0f, 1.0f, color);
+            tap(1.0f, -1.0f, 1.0f, color);
+            tap(-1.0f, 1.0f, 1.0f, color);
+            tap(1.0f, 1.0f, 1.0f, color);
+            color = {color.r / 8.0f, color.g / 8.0f, color.b / 8.0f};
+        } else {
+            tap(-1.0f, 0.0f, 1.0f, color);
+            tap(1.0f, 0.0f, 1.0f, color);
+            tap(0.0f, -1.0f, 1.0f, color);
+            tap(0.0f, 1.0f, 1.0f, color);
+            tap(-0.5f, -0.5f, 2.0f, color);
+            tap(0.5f, -0.5f, 2.0f, color);
+            tap(-0.5f, 0.5f, 2.0f, color);
+            tap(0.5f, 0.5f, 2.0f, color);
+            color = {color.r / 12.0f, color.g / 12.0f, color.b / 12.0f};
+            color = mix({pixel[0], pixel[1], pixel[2]}, color, scatter);
+        }
+        pixel[0] = color.r;
+        pixel[1] = color.g;
+        pixel[2] = color.b;
+        pixel[3] = 1.0f;
+    }
+}
+}  // namespace
+
+namespace bloom {
+uint32_t computeLevelCount(uint32_t width, uint32_t height) {
+    // 最小のレベルでも上下左右のタップが収まるように、短辺が4ピクセル以上のレベルまで
+    uint32_t count = 1;
+    while (count < kMaxLevelCount && (std::min(width, height) >> count) >= 4) {
+        count++;
+    }
+    return count;
+}
+
+uint32_t computeLevelSize(uint32_t size, uint32_t level) {
+    return std::max((size + (1u << level) - 1) >> level, 1u);
+}
+
+void filter(float* image,
+            uint32_t width,
+            uint32_t height,
+            const BloomConstants& info,
+            ThreadPool* pool) {
+    const uint32_t levelCount = std::clamp(static_cast<uint32_t>(std::max(info.levelCount, 1)), 1u,
+                                           computeLevelCount(width, height));
+    std::vector<std::vector<float>> storage(levelCount);
+    std::vector<Level> levels(levelCount);
+    levels[0] = {image, width, height};
+    for (uint32_t i = 1; i < levelCount; i++) {
+        const uint32_t levelWidth = computeLevelSize(width, i);
+        const uint32_t levelHeight = computeLevelSize(height, i);
+        storage[i].resize(static_cast<size_t>(levelWidth) * levelHeight * 4);
+        levels[i] = {storage[i].data(), levelWidth, levelHeight};
+    }
+
+    // GPU ではディスパッチごとにバリアを張る。ここではレベルごとに行を並列に処理する
+    const auto run = [&](const Level& source, const Level& dest, bool upsample) {
+        const auto row = [&](uint32_t y) { filterRow(source, dest, y, upsample, info.scatter); };
+        if (pool) {
+            pool->parallelFor(dest.height, row);
+        } else {
+            for (uint32_t y = 0; y < dest.height; y++) {
+                row(y);
+            }
+        }
+    };
+    for (uint32_t i = 0; i + 1 < levelCount; i++) {
+        run(levels[i], levels[i + 1], false);
+    }
+    for (uint32_t i = levelCount - 1; i > 0; i--) {
+        run(levels[i], levels[i - 1], true);
+    }
+}
+}  // namespace bloom
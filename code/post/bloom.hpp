@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../thread_pool.hpp"
+
+struct BloomConstants;
+
+// CPU port of the bloom pyramid (BloomPass, shader/bloom.comp)
+// Level 0 is the full-resolution bloom image, and each level halves the previous one.
+namespace bloom {
+constexpr uint32_t kMaxLevelCount = 8;
+
+// Levels (including level 0) that fit in the image, up to kMaxLevelCount
+uint32_t computeLevelCount(uint32_t width, uint32_t height);
+
+// ceil(size / 2^level), at least 1
+// 切り上げて縮小を常にちょうど 2 倍にする (比が 2 からずれるとタップの重みが偏り、明るさが保たれない)
+uint32_t computeLevelSize(uint32_t size, uint32_t level);
+
+// image: RGBA32F, filtered in place like the GPU chain (alpha = 1)
+// pool == nullptr filters on the calling thread
+void filter(float* image,
+            uint32_t width,
+            uint32_t height,
+            const BloomConstants& info,
+            ThreadPool* pool);
+}  // namespace bloom
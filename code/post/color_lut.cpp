@@ -0,0 +1,115 @@
+#include "color_lut.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../render_pass.hpp"
+#include "../simd.hpp"
+#include "composite.hpp"
+
+namespace {
+using simd::F4;
+
+// rgba8 UNORM への書き込みと同じ丸め (NaN は 0)
+uint8_t toUnorm8(float value) {
+    const float clamped = value >= 0.0f ? std::min(value, 1.0f) : 0.0f;
+    return static_cast<uint8_t>(std::lround(clamped * 255.0f));
+}
+
+F4 lerp(F4 a, F4 b, float t) {
+    return a + (b - a) * simd::splat(t);
+}
+
+// 1軸分のグリッド上の位置: 下のグリッド点と、そこからの距離
+struct Coord {
+    uint32_t index;
+    float fraction;
+};
+
+Coord toCoord(float x) {
+    const float u = color_lut::shapeLut(x) * static_cast<float>(ColorLut::kSize - 1);
+    const uint32_t index = std::min(static_cast<uint32_t>(u), ColorLut::kSize - 2);
+    return {index, u - static_cast<float>(index)};
+}
+}  // namespace
+
+void ColorLut::bake(const CompositeConstants& info, ThreadPool* pool) {
+    constexpr uint32_t size = kSize;
+    m_data.resize(static_cast<size_t>(size) * size * size * 4);
+
+    // 1スライス (b が同じ面) ずつ並列に焼く
+    const auto bakeSlice = [&](uint32_t b) {
+        for (uint32_t g = 0; g < size; g++) {
+            for (uint32_t r = 0; r < size; r++) {
+                const float scale = 1.0f / static_cast<float>(size - 1);
+                const float rgb[3] = {color_lut::unshapeLut(static_cast<float>(r) * scale),
+                                      color_lut::unshapeLut(static_cast<float>(g) * scale),
+                                      color_lut::unshapeLut(static_cast<float>(b) * scale)};
+                float* texel = m_data.data() + ((static_cast<size_t>(b) * size + g) * size + r) * 4;
+                composite::grade(rgb, texel, info);
+                texel[3] = 1.0f;
+            }
+        }
+    };
+    if (pool) {
+        pool->parallelFor(size, bakeSlice);
+    } else {
+        for (uint32_t b = 0; b < size; b++) {
+            bakeSlice(b);
+        }
+    }
+
+    m_key = makeKey(info);
+    m_baked = true;
+}
+
+bool ColorLut::isStale(const CompositeConstants& info) const {
+    return !m_baked || m_key != makeKey(info);
+}
+
+void ColorLut::apply(const float* rgba,
+                     uint8_t* output,
+                     uint32_t width,
+                     uint32_t height,
+                     ThreadPool* pool) const {
+    constexpr size_t strideG = kSize * 4;
+    constexpr size_t strideB = kSize * kSize * 4;
+    const auto convertRow = [&](uint32_t y) {
+        const float* src = rgba + static_cast<size_t>(y) * width * 4;
+        uint8_t* dst = output + static_cast<size_t>(y) * width * 4;
+        for (uint32_t x = 0; x < width; x++) {
+            const Coord r = toCoord(src[x * 4 + 0]);
+            const Coord g = toCoord(src[x * 4 + 1]);
+            const Coord b = toCoord(src[x * 4 + 2]);
+
+            // composite.comp の texture() と同じ trilinear 補間を RGBA の4成分まとめて行う
+            const float* t = m_data.data() + b.index * strideB + g.index * strideG + r.index * 4;
+            const F4 c00 = lerp(simd::load(t), simd::load(t + 4), r.fraction);
+            const F4 c10 = lerp(simd::load(t + strideG), simd::load(t + strideG + 4), r.fraction);
+            const F4 c01 = lerp(simd::load(t + strideB), simd::load(t + strideB + 4), r.fraction);
+            const F4 c11 = lerp(simd::load(t + strideB + strideG),
+                                simd::load(t + strideB + strideG + 4), r.fraction);
+            const F4 color = lerp(lerp(c00, c10, g.fraction), lerp(c01, c11, g.fraction),
+                                  b.fraction);
+
+            float graded[4];
+            simd::store(graded, color);
+            dst[x * 4 + 0] = toUnorm8(graded[0]);
+            dst[x * 4 + 1] = toUnorm8(graded[1]);
+            dst[x * 4 + 2] = toUnorm8(graded[2]);
+            dst[x * 4 + 3] = 255;
+        }
+    };
+    if (pool) {
+        pool->parallelFor(height, convertRow);
+    } else {
+        for (uint32_t y = 0; y < height; y++) {
+            convertRow(y);
+        }
+    }
+}
+
+ColorLut::Key ColorLut::makeKey(const CompositeConstants& info) {
+    return {info.saturation, info.exposure, info.gamma, info.enableToneMapping,
+            info.enableGammaCorrection};
+}
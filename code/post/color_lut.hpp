@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "../../shader/color_lut.h"
+#include "../thread_pool.hpp"
+
+struct CompositeConstants;
+
+// The grading chain of CompositeConstants (saturation, exposure, tone mapping, gamma) baked
+// into a 3D LUT (shader/color_lut.h). composite.comp and the CPU post-processing use the same
+// data, so both are a single trilinear lookup per pixel. Bloom is added before the lookup.
+class ColorLut {
+public:
+    static constexpr uint32_t kSize = COLOR_LUT_SIZE;
+
+    // Bake on the pool (rows of the LUT in parallel). pool == nullptr bakes on the calling thread
+    void bake(const CompositeConstants& info, ThreadPool* pool);
+
+    // bake() has not been called with the same grading parameters
+    bool isStale(const CompositeConstants& info) const;
+
+    // rgba: RGBA32F, output: RGBA8 (alpha = 255). pool == nullptr converts on the calling thread
+    void apply(const float* rgba,
+               uint8_t* output,
+               uint32_t width,
+               uint32_t height,
+               ThreadPool* pool) const;
+
+    // RGBA32F, kSize^3 texels, r is the fastest axis (the layout of the 3D image)
+    const float* getData() const { return m_data.data(); }
+    size_t getByteSize() const { return m_data.size() * sizeof(float); }
+
+private:
+    // bloomIntensity は LUT に含まれない
+    struct Key {
+        float saturation;
+        float exposure;
+        float gamma;
+        int enableToneMapping;
+        int enableGammaCorrection;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    static Key makeKey(const CompositeConstants& info);
+
+    std::vector<float> m_data;
+    Key m_key = {};
+    bool m_baked = false;
+};
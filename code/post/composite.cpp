@@ -0,0 +1,132 @@
+#include "composite.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "../render_pass.hpp"
+
+namespace {
+struct Color {
+    float r, g, b;
+};
+
+float fract(float x) {
+    return x - std::floor(x);
+}
+
+float mix(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+float step(float edge, float x) {
+    return x < edge ? 0.0f : 1.0f;
+}
+
+// color.glsl: rgb2hsv / hsv2rgb / saturate
+Color saturate(Color c, float saturation) {
+    // rgb2hsv
+    const float kx = 0.0f, ky = -1.0f / 3.0f, kz = 2.0f / 3.0f, kw = -1.0f;
+    const float s0 = step(c.b, c.g);
+    const float px = mix(c.b, c.g, s0);
+    const float py = mix(c.g, c.b, s0);
+    const float pz = mix(kw, kx, s0);
+    const float pw = mix(kz, ky, s0);
+    const float s1 = step(px, c.r);
+    const float qx = mix(px, c.r, s1);
+    const float qy = mix(py, py, s1);
+    const float qz = mix(pw, pz, s1);
+    const float qw = mix(c.r, px, s1);
+    const float d = qx - std::min(qw, qy);
+    const float e = 1.0e-10f;
+    const float h = std::abs(qz + (qw - qy) / (6.0f * d + e));
+    const float s = d / (qx + e) * saturation;
+    const float v = qx;
+
+    // hsv2rgb
+    const auto channel = [&](float k) {
+        const float p = std::abs(fract(h + k) * 6.0f - 3.0f);
+        return v * mix(1.0f, std::clamp(p - 1.0f, 0.0f, 1.0f), s);
+    };
+    return {channel(1.0f), channel(2.0f / 3.0f), channel(1.0f / 3.0f)};
+}
+
+float fitRRTAndODT(float v) {
+    const float a = v * (v + 0.0245786f) - 0.000090537f;
+    const float b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
+    return a / b;
+}
+
+// color.glsl: toneMappingACESFilmic
+Color toneMapACESFilmic(Color c, float exposure) {
+    const float scale = exposure / 0.6f;
+    c = {c.r * scale, c.g * scale, c.b * scale};
+
+    // GLSLのmat3は列優先なので、ここでは転置した形で書く
+    const Color in = {
+        0.59719f * c.r + 0.35458f * c.g + 0.04823f * c.b,
+        0.07600f * c.r + 0.90834f * c.g + 0.01566f * c.b,
+        0.02840f * c.r + 0.13383f * c.g + 0.83777f * c.b,
+    };
+    const Color fitted = {fitRRTAndODT(in.r), fitRRTAndODT(in.g), fitRRTAndODT(in.b)};
+    Color out = {
+        1.60475f * fitted.r - 0.53108f * fitted.g - 0.07367f * fitted.b,
+        -0.10208f * fitted.r + 1.10813f * fitted.g - 0.00605f * fitted.b,
+        -0.00327f * fitted.r - 0.07276f * fitted.g + 1.07602f * fitted.b,
+    };
+    out = saturate(out, 1.3f);
+    return {std::clamp(out.r, 0.0f, 1.0f), std::clamp(out.g, 0.0f, 1.0f),
+            std::clamp(out.b, 0.0f, 1.0f)};
+}
+
+// rgba8 UNORM への書き込みと同じ丸め (NaN は 0)
+uint8_t toUnorm8(float value) {
+    const float clamped = value >= 0.0f ? std::min(value, 1.0f) : 0.0f;
+    return static_cast<uint8_t>(std::lround(clamped * 255.0f));
+}
+}  // namespace
+
+namespace composite {
+void grade(const float* rgb, float* output, const CompositeConstants& info) {
+    Color color = {rgb[0], rgb[1], rgb[2]};
+    color = saturate(color, info.saturation);
+    if (info.enableToneMapping == 1) {
+        color = toneMapACESFilmic(color, info.exposure);
+    }
+    if (info.enableGammaCorrection == 1) {
+        const float invGamma = 1.0f / info.gamma;
+        color = {std::pow(std::max(color.r, 0.0f), invGamma),
+                 std::pow(std::max(color.g, 0.0f), invGamma),
+                 std::pow(std::max(color.b, 0.0f), invGamma)};
+    }
+    output[0] = color.r;
+    output[1] = color.g;
+    output[2] = color.b;
+}
+
+void toneMapToRGBA8(const float* rgba,
+                    uint8_t* output,
+                    uint32_t width,
+                    uint32_t height,
+                    const CompositeConstants& info,
+                    ThreadPool* pool) {
+    const auto convertRow = [&](uint32_t y) {
+        const float* src = rgba + static_cast<size_t>(y) * width * 4;
+        uint8_t* dst = output + static_cast<size_t>(y) * width * 4;
+        for (uint32_t x = 0; x < width; x++) {
+            float color[3];
+            grade(src + x * 4, color, info);
+            dst[x * 4 + 0] = toUnorm8(color[0]);
+            dst[x * 4 + 1] = toUnorm8(color[1]);
+            dst[x * 4 + 2] = toUnorm8(color[2]);
+            dst[x * 4 + 3] = 255;
+        }
+    };
+    if (pool) {
+        pool->parallelFor(height, convertRow);
+    } else {
+        for (uint32_t y = 0; y < height; y++) {
+            convertRow(y);
+        }
+    }
+}
+}  // namespace composite
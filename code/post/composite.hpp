@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#include "../thread_pool.hpp"
+
+struct CompositeConstants;
+
+// CPU port of shader/composite.comp for frames that are post-processed after readback
+// Bloom is not applied (the bloom image is not read back).
+namespace composite {
+// The grading chain of composite.comp for one color (saturation, tone mapping, gamma)
+// rgb, output: 3 floats, not clamped to [0, 1] and not quantized
+void grade(const float* rgb, float* output, const CompositeConstants& info);
+
+// rgba: RGBA32F, output: RGBA8 (alpha = 255)
+// pool == nullptr converts on the calling thread
+void toneMapToRGBA8(const float* rgba,
+                    uint8_t* output,
+                    uint32_t width,
+                    uint32_t height,
+                    const CompositeConstants& info,
+                    ThreadPool* pool);
+}  // namespace composite
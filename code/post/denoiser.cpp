@@ -0,0 +1,306 @@
+#include "denoiser.hpp"
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "../simd.hpp"
+
+using simd::F4;
+using simd::M4;
+
+namespace {
+constexpr uint32_t kTileSize = 64;
+constexpr float kKernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+constexpr float kMinAlbedo = 0.01f;
+
+// これより大きい指数の重みは無視できる (e^-16 ~ 1e-7)
+constexpr float kMaxExponent = 16.0f;
+
+// 作業バッファの平面。色は 2 組をレベルごとに入れ替える
+enum Plane : uint32_t {
+    NormalX,
+    NormalY,
+    NormalZ,
+    Depth,
+    AlbedoR,
+    AlbedoG,
+    AlbedoB,
+    Color0,
+    Color1 = Color0 + 3,
+    Compressed = Color1 + 3,
+    PlaneCount = Compressed + 3,
+};
+
+// exp(-x) for x >= 0, relative error < 1e-4
+F4 expNeg(F4 x) {
+    const F4 limit = simd::splat(80.0f);
+    const F4 t = simd::min(x, limit) * simd::splat(-1.44269504f);
+    const F4 integer = simd::floor(t);
+    const F4 f = t - integer;
+    const F4 p =
+        simd::splat(1.0f) +
+        f * (simd::splat(0.6931472f) +
+             f * (simd::splat(0.2402265f) +
+                  f * (simd::splat(0.0555041f) + f * simd::splat(0.0096181f))));
+    return simd::select(x > limit, simd::splat(0.0f), p * simd::exp2i(integer));
+}
+
+bool hasHit(const float* normalDepth) {
+    const F4 n = simd::load(normalDepth);
+    return simd::dot3(n, n) > 0.0f;
+}
+
+F4 getAlbedo(const float* albedo) {
+    return simd::max(simd::load(albedo), simd::splat(kMinAlbedo));
+}
+
+// HDRの色差をスケールに依らず比較するため x / (1 + x) で圧縮する
+F4 compress(F4 color) {
+    const F4 c = simd::max(color, simd::splat(0.0f));
+    return c / (simd::splat(1.0f) + c);
+}
+}  // namespace
+
+Denoiser::Denoiser(uint32_t width, uint32_t height, const DenoiserSettings& settings)
+    : m_width{width},
+      m_height{height},
+      m_tileCountX{(width + kTileSize - 1) / kTileSize},
+      m_tileCountY{(height + kTileSize - 1) / kTileSize},
+      m_padding{settings.iterations > 0 ? 2u << (settings.iterations - 1) : 0u},
+      m_stride{m_padding * 2 + (width + 3) / 4 * 4},
+      m_settings{settings} {}
+
+std::vector<float> Denoiser::acquirePlanes() const {
+    {
+        std::lock_guard lock{m_planesMutex};
+        if (!m_freePlanes.empty()) {
+            std::vector<float> planes = std::move(m_freePlanes.back());
+            m_freePlanes.pop_back();
+            return planes;
+        }
+    }
+    // 余白は 0 (法線が 0 なのでタップの重みも 0) のまま使う
+    return std::vector<float>(static_cast<size_t>(m_stride) * m_height * PlaneCount, 0.0f);
+}
+
+void Denoiser::releasePlanes(std::vector<float> planes) const {
+    std::lock_guard lock{m_planesMutex};
+    m_freePlanes.push_back(std::move(planes));
+}
+
+void Denoiser::denoise(const float* color,
+                       const float* albedo,
+                       const float* normalDepth,
+                       float* output,
+                       ThreadPool* pool) const {
+    const uint32_t tileCount = m_tileCountX * m_tileCountY;
+    const auto forEachTile = [&](const auto& func) {
+        if (pool) {
+            pool->parallelFor(tileCount, func);
+        } else {
+            for (uint32_t tile = 0; tile < tileCount; tile++) {
+                func(tile);
+            }
+        }
+    };
+    const auto forEachPixel = [&](uint32_t tile, const auto& func) {
+        const uint32_t x0 = (tile % m_tileCountX) * kTileSize;
+        const uint32_t y0 = (tile / m_tileCountX) * kTileSize;
+        const uint32_t x1 = std::min(x0 + kTileSize, m_width);
+        const uint32_t y1 = std::min(y0 + kTileSize, m_height);
+        for (uint32_t y = y0; y < y1; y++) {
+            for (uint32_t x = x0; x < x1; x++) {
+                func(static_cast<size_t>(y) * m_width + x, getIndex(x, y));
+            }
+        }
+    };
+
+    std::vector<float> buffer = acquirePlanes();
+    const size_t planeSize = static_cast<size_t>(m_stride) * m_height;
+    float* planes = buffer.data();
+    const auto plane = [&](uint32_t index) { return planes + planeSize * index; };
+
+    // ガイドを平面に分け、テクスチャの模様をぼかさないよう色をアルベドで割る (demodulate)
+    // NaN と負の値は 0 にする (重みが 0 のタップと掛けても NaN にならないように)
+    forEachTile([&](uint32_t tile) {
+        forEachPixel(tile, [&](size_t i, size_t p) {
+            for (uint32_t c = 0; c < 4; c++) {
+                plane(NormalX + c)[p] = normalDepth[i * 4 + c];
+            }
+            for (uint32_t c = 0; c < 3; c++) {
+                plane(AlbedoR + c)[p] = albedo[i * 4 + c];
+            }
+            F4 c = simd::load(color + i * 4);
+            if (hasHit(normalDepth + i * 4)) {
+                c = c / getAlbedo(albedo + i * 4);
+            }
+            c = simd::min(simd::max(c, simd::splat(0.0f)), simd::splat(FLT_MAX));
+            for (uint32_t channel = 0; channel < 3; channel++) {
+                plane(Color0 + channel)[p] = simd::get(c, channel);
+            }
+        });
+    });
+
+    uint32_t current = Color0;
+    for (uint32_t level = 0; level < m_settings.iterations; level++) {
+        // 各タップで割り算しないよう、圧縮した色を先に求めておく
+        forEachTile([&](uint32_t tile) {
+            const uint32_t x0 = (tile % m_tileCountX) * kTileSize;
+            const uint32_t y0 = (tile / m_tileCountX) * kTileSize;
+            const uint32_t x1 = std::min(x0 + kTileSize, m_width);
+            const uint32_t y1 = std::min(y0 + kTileSize, m_height);
+            for (uint32_t c = 0; c < 3; c++) {
+                for (uint32_t y = y0; y < y1; y++) {
+                    for (uint32_t x = x0; x < x1; x += 4) {
+                        const size_t p = getIndex(x, y);
+                        simd::store(plane(Compressed + c) + p,
+                                    compress(simd::load(plane(current + c) + p)));
+                    }
+                }
+            }
+        });
+        forEachTile([&](uint32_t tile) { filterTile(planes, current, tile, level); });
+        current = current == Color0 ? Color1 : Color0;
+    }
+
+    // Remodulate
+    forEachTile([&](uint32_t tile) {
+        forEachPixel(tile, [&](size_t i, size_t p) {
+            if (!hasHit(normalDepth + i * 4)) {
+                simd::store(output + i * 4, simd::load(color + i * 4));
+                return;
+            }
+            const F4 filtered = simd::set(plane(current)[p], plane(current + 1)[p],
+                                          plane(current + 2)[p], color[i * 4 + 3]);
+            const F4 scale = simd::set(std::max(albedo[i * 4 + 0], kMinAlbedo),
+                                       std::max(albedo[i * 4 + 1], kMinAlbedo),
+                                       std::max(albedo[i * 4 + 2], kMinAlbedo), 1.0f);
+            simd::store(output + i * 4, filtered * scale);
+        });
+    });
+
+    releasePlanes(std::move(buffer));
+}
+
+// 4 画素ずつ処理する。画像の右端を越えたレーンは余白 (ヒットなし) に書くだけ
+void Denoiser::filterTile(float* planes, uint32_t input, uint32_t tile, uint32_t level) const {
+    const size_t planeSize = static_cast<size_t>(m_stride) * m_height;
+    const auto plane = [&](uint32_t index) { return planes + planeSize * index; };
+    const uint32_t outputPlane = input == Color0 ? Color1 : Color0;
+
+    const int step = 1 << level;
+    const float colorSigma = m_settings.colorSigma / static_cast<float>(step);
+    const F4 invColorSigma2 = simd::splat(1.0f / std::max(colorSigma * colorSigma, 1e-8f));
+    const F4 invAlbedoSigma2 =
+        simd::splat(1.0f / std::max(m_settings.albedoSigma * m_settings.albedoSigma, 1e-8f));
+    const F4 normalSigma = simd::splat(m_settings.normalSigma);
+    const F4 depthSigma = simd::splat(m_settings.depthSigma * static_cast<float>(step));
+    const F4 zero = simd::splat(0.0f);
+    const F4 one = simd::splat(1.0f);
+    const F4 maxExponent = simd::splat(kMaxExponent);
+    const int height = static_cast<int>(m_height);
+
+    const float* normalX = plane(NormalX);
+    const float* normalY = plane(NormalY);
+    const float* normalZ = plane(NormalZ);
+    const float* depths = plane(Depth);
+    const float* albedoR = plane(AlbedoR);
+    const float* albedoG = plane(AlbedoG);
+    const float* albedoB = plane(AlbedoB);
+    const float* colorR = plane(input);
+    const float* colorG = plane(input + 1);
+    const float* colorB = plane(input + 2);
+    const float* compressedR = plane(Compressed);
+    const float* compressedG = plane(Compressed + 1);
+    const float* compressedB = plane(Compressed + 2);
+
+    const uint32_t x0 = (tile % m_tileCountX) * kTileSize;
+    const uint32_t y0 = (tile / m_tileCountX) * kTileSize;
+    const uint32_t x1 = std::min(x0 + kTileSize, m_width);
+    const uint32_t y1 = std::min(y0 + kTileSize, m_height);
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x += 4) {
+            const size_t i = getIndex(x, y);
+            const F4 centerR = simd::load(colorR + i);
+            const F4 centerG = simd::load(colorG + i);
+            const F4 centerB = simd::load(colorB + i);
+            const F4 nx = simd::load(normalX + i);
+            const F4 ny = simd::load(normalY + i);
+            const F4 nz = simd::load(normalZ + i);
+            const M4 hit = nx * nx + ny * ny + nz * nz > zero;
+            if (!simd::any(hit)) {
+                simd::store(plane(outputPlane) + i, centerR);
+                simd::store(plane(outputPlane + 1) + i, centerG);
+                simd::store(plane(outputPlane + 2) + i, centerB);
+                continue;
+            }
+            const F4 depth = simd::load(depths + i);
+            const F4 invDepthScale = one / simd::max(depthSigma * depth, simd::splat(1e-6f));
+            const F4 ar = simd::load(albedoR + i);
+            const F4 ag = simd::load(albedoG + i);
+            const F4 ab = simd::load(albedoB + i);
+            const F4 cr = simd::load(compressedR + i);
+            const F4 cg = simd::load(compressedG + i);
+            const F4 cb = simd::load(compressedB + i);
+
+            const F4 centerWeight = simd::splat(kKernel[2] * kKernel[2]);
+            F4 sumR = centerR * centerWeight;
+            F4 sumG = centerG * centerWeight;
+            F4 sumB = centerB * centerWeight;
+            F4 weightSum = centerWeight;
+            for (int ky = 0; ky < 5; ky++) {
+                const int qy = static_cast<int>(y) + (ky - 2) * step;
+                if (qy < 0 || qy >= height) {
+                    continue;
+                }
+                for (int kx = 0; kx < 5; kx++) {
+                    if (kx == 2 && ky == 2) {
+                        continue;
+                    }
+                    // 左右の余白は m_padding 以上あるので、x 方向は範囲を確かめなくてよい
+                    const size_t j = static_cast<size_t>(
+                        static_cast<std::ptrdiff_t>(i) +
+                        static_cast<std::ptrdiff_t>(qy - static_cast<int>(y)) * m_stride +
+                        (kx - 2) * step);
+                    const F4 normalDot = nx * simd::load(normalX + j) +
+                                         ny * simd::load(normalY + j) +
+                                         nz * simd::load(normalZ + j);
+
+                    // ガイド (法線・深度・アルベド) だけで重みが十分小さければ色を読まない
+                    const int distance = std::max(std::abs(kx - 2), std::abs(ky - 2));
+                    const F4 depthDiff = simd::abs(simd::load(depths + j) - depth);
+                    const F4 dr = simd::load(albedoR + j) - ar;
+                    const F4 dg = simd::load(albedoG + j) - ag;
+                    const F4 db = simd::load(albedoB + j) - ab;
+                    F4 exponent =
+                        normalSigma * (one - normalDot) +
+                        depthDiff * invDepthScale * simd::splat(1.0f / distance) +
+                        (dr * dr + dg * dg + db * db) * invAlbedoSigma2;
+                    // miss or facing away
+                    const M4 valid = (zero < normalDot) & (exponent <= maxExponent);
+                    if (!simd::any(valid)) {
+                        continue;
+                    }
+
+                    const F4 er = simd::load(compressedR + j) - cr;
+                    const F4 eg = simd::load(compressedG + j) - cg;
+                    const F4 eb = simd::load(compressedB + j) - cb;
+                    exponent = exponent + (er * er + eg * eg + eb * eb) * invColorSigma2;
+                    const F4 weight = simd::select(
+                        valid, simd::splat(kKernel[kx] * kKernel[ky]) * expNeg(exponent), zero);
+                    sumR = sumR + simd::load(colorR + j) * weight;
+                    sumG = sumG + simd::load(colorG + j) * weight;
+                    sumB = sumB + simd::load(colorB + j) * weight;
+                    weightSum = weightSum + weight;
+                }
+            }
+            simd::store(plane(outputPlane) + i, simd::select(hit, sumR / weightSum, centerR));
+            simd::store(plane(outputPlane + 1) + i, simd::select(hit, sumG / weightSum, centerG));
+            simd::store(plane(outputPlane + 2) + i, simd::select(hit, sumB / weightSum, centerB));
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "../thread_pool.hpp"
+
+// シーンのJSONの "denoiser" セクション
+struct DenoiserSettings {
+    bool enabled = false;
+    uint32_t iterations = 5;    // à-trous levels (filter footprint: 4 * 2^iterations + 1)
+    float colorSigma = 0.3f;    // on x / (1 + x) compressed irradiance, halved per level
+    float normalSigma = 64.0f;  // exp(normalSigma * (dot(n_p, n_q) - 1))
+    float depthSigma = 0.05f;   // relative to the center depth, per pixel of distance
+    float albedoSigma = 0.1f;
+};
+
+// Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) guided by the first-hit AOVs
+// The color is demodulated by albedo, so textures are not blurred. Each level is a 5x5
+// B3-spline kernel with holes, and tiles are filtered in parallel on the thread pool.
+// The inputs are split into planes so that 4 horizontally adjacent pixels share a vector.
+class Denoiser {
+public:
+    Denoiser(uint32_t width, uint32_t height, const DenoiserSettings& settings);
+
+    // All images are RGBA32F (ImageWriter::HdrLayer): color = baseImage,
+    // normalDepth.w == 0 or a zero normal marks pixels without a hit (left untouched).
+    // Alpha is copied from color. output may not alias the inputs.
+    // pool == nullptr filters on the calling thread. Safe to call from several threads.
+    void denoise(const float* color,
+                 const float* albedo,
+                 const float* normalDepth,
+                 float* output,
+                 ThreadPool* pool) const;
+
+    const DenoiserSettings& getSettings() const { return m_settings; }
+
+private:
+    // planes: 1 フレーム分の作業バッファ (denoiser.cpp の Plane)
+    void filterTile(float* planes, uint32_t input, uint32_t tile, uint32_t level) const;
+
+    // 平面 (x, y) の位置。各行の左右に余白があるので、タップは範囲を確かめずに読める
+    size_t getIndex(uint32_t x, uint32_t y) const {
+        return static_cast<size_t>(y) * m_stride + m_padding + x;
+    }
+
+    std::vector<float> acquirePlanes() const;
+
+    void releasePlanes(std::vector<float> planes) const;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_tileCountX;
+    uint32_t m_tileCountY;
+    uint32_t m_padding;  // the largest tap offset
+    uint32_t m_stride;   // padding + width (rounded up to 4) + padding
+    DenoiserSettings m_settings;
+
+    // 作業バッファはフレーム間で使い回す (同時に呼ばれた数だけ作られる)
+    mutable std::mutex m_planesMutex;
+    mutable std::vector<std::vector<float>> m_freePlanes;
+};
@@ -1,52 +1,110 @@
 #include "render_pass.hpp"
 
+#include <algorithm>
+#include <format>
+
+#include "post/bloom.hpp"
+
+namespace {
+// bloom.comp: BloomInfo
+struct BloomPushConstants {
+    int upsample;
+    float scatter;
+};
+}  // namespace
+
 CompositePass::CompositePass(const rv::Context& context,
                              rv::ImageHandle baseImage,
                              rv::ImageHandle bloomImage,
                              uint32_t width,
-                             uint32_t height) {
-    m_finalImageRGBA = context.createImage({
-        .usage = rv::ImageUsage::Storage,
-        .extent = {width, height, 1},
-        .imageType = vk::ImageType::e2D,
-        .format = vk::Format::eR8G8B8A8Unorm,
+                             uint32_t height,
+                             const std::vector<rv::BufferHandle>& outputBuffers)
+    : m_writesBuffer{!outputBuffers.empty()} {
+    // ヘッドレスでは出力画像を作らない (バッファに直接書くので画像からのコピーが不要)
+    if (!m_writesBuffer) {
+        m_finalImageRGBA = context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {width, height, 1},
+            .imageType = vk::ImageType::e2D,
+            .format = vk::Format::eR8G8B8A8Unorm,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = "finalImageRGBA",
+        });
+
+        m_finalImageBGRA = context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {width, height, 1},
+            .imageType = vk::ImageType::e2D,
+            .format = vk::Format::eB8G8R8A8Unorm,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = "finalImageBGRA",
+        });
+    }
+
+    m_colorLutImage = context.createImage({
+        .usage = rv::ImageUsage::Sampled,
+        .extent = {ColorLut::kSize, ColorLut::kSize, ColorLut::kSize},
+        .imageType = vk::ImageType::e3D,
+        .format = vk::Format::eR32G32B32A32Sfloat,
         .viewInfo = rv::ImageViewCreateInfo{},
-        .debugName = "finalImageRGBA",
+        .samplerInfo = rv::SamplerCreateInfo{},
+        .debugName = "colorLut",
     });
 
-    m_finalImageBGRA = context.createImage({
-        .usage = rv::ImageUsage::Storage,
-        .extent = {width, height, 1},
-        .imageType = vk::ImageType::e2D,
-        .format = vk::Format::eB8G8R8A8Unorm,
-        .viewInfo = rv::ImageViewCreateInfo{},
-        .debugName = "finalImageBGRA",
+    m_colorLutStagingBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Staging,
+        .memory = rv::MemoryUsage::Host,
+        .size = ColorLut::kSize * ColorLut::kSize * ColorLut::kSize * 4 * sizeof(float),
+        .debugName = "colorLutStagingBuffer",
     });
 
     context.oneTimeSubmit([&](auto commandBuffer) {
-        commandBuffer->transitionLayout(m_finalImageRGBA, vk::ImageLayout::eGeneral);
-        commandBuffer->transitionLayout(m_finalImageBGRA, vk::ImageLayout::eGeneral);
+        if (!m_writesBuffer) {
+            commandBuffer->transitionLayout(m_finalImageRGBA, vk::ImageLayout::eGeneral);
+            commandBuffer->transitionLayout(m_finalImageBGRA, vk::ImageLayout::eGeneral);
+        }
+        commandBuffer->transitionLayout(m_colorLutImage, vk::ImageLayout::eGeneral);
     });
 
     m_shader = context.createShader({
-        .code = readShader("composite.comp", "main"),
+        .code = readShader(m_writesBuffer ? "composite_buffer.comp" : "composite.comp"),
         .stage = vk::ShaderStageFlagBits::eCompute,
     });
 
-    m_descSet = context.createDescriptorSet({
-        .shaders = m_shader,
-        .images =
-            {
-                {"baseImage", baseImage},
-                {"bloomImage", bloomImage},
-                {"finalImageRGBA", m_finalImageRGBA},
-                {"finalImageBGRA", m_finalImageBGRA},
-            },
-    });
-    m_descSet->update();
+    if (m_writesBuffer) {
+        for (const auto& outputBuffer : outputBuffers) {
+            m_descSets.push_back(context.createDescriptorSet({
+                .shaders = m_shader,
+                .buffers =
+                    {
+                        {"OutputBuffer", outputBuffer},
+                    },
+                .images =
+                    {
+                        {"baseImage", baseImage},
+                        {"bloomImage", bloomImage},
+                        {"colorLut", m_colorLutImage},
+                    },
+            }));
+            m_descSets.back()->update();
+        }
+    } else {
+        m_descSets.push_back(context.createDescriptorSet({
+            .shaders = m_shader,
+            .images =
+                {
+                    {"baseImage", baseImage},
+                    {"bloomImage", bloomImage},
+                    {"finalImageRGBA", m_finalImageRGBA},
+                    {"finalImageBGRA", m_finalImageBGRA},
+                    {"colorLut", m_colorLutImage},
+                },
+        }));
+        m_descSets.back()->update();
+    }
 
     m_pipeline = context.createComputePipeline({
-        .descSetLayout = m_descSet->getLayout(),
+        .descSetLayout = m_descSets[0]->getLayout(),
         .pushSize = sizeof(CompositeConstants),
         .computeShader = m_shader,
     });
@@ -56,55 +114,312 @@ void CompositePass::render(const rv::CommandBufferHandle& commandBuffer,
                            uint32_t countX,
                            uint32_t countY,
                            CompositeConstants info) {
-    commandBuffer->bindDescriptorSet(m_pipeline, m_descSet);
+    if (m_colorLut.isStale(info)) {
+        updateColorLut(commandBuffer, info);
+    }
+    commandBuffer->bindDescriptorSet(m_pipeline, m_descSets[m_writesBuffer ? m_outputSlot : 0]);
     commandBuffer->bindPipeline(m_pipeline);
     commandBuffer->pushConstants(m_pipeline, &info);
     commandBuffer->dispatch(countX, countY, 1);
+    if (m_writesBuffer) {
+        commandBuffer->memoryBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                     vk::PipelineStageFlagBits::eHost,
+                                     vk::AccessFlagBits::eShaderWrite,
+                                     vk::AccessFlagBits::eHostRead);
+    }
 }
 
-BloomPass::BloomPass(const rv::Context& context, uint32_t width, uint32_t height) {
-    m_bloomImage = context.createImage({
-        .usage = rv::ImageUsage::Storage,
-        .extent = {width, height, 1},
-        .format = vk::Format::eR32G32B32A32Sfloat,
-        .viewInfo = rv::ImageViewCreateInfo{},
-        .debugName = "bloomImage",
+void CompositePass::updateColorLut(const rv::CommandBufferHandle& commandBuffer,
+                                   const CompositeConstants& info) {
+    // NOTE: ステージングバッファは1つなので、前のアップロードが完了している前提
+    m_colorLut.bake(info, &ThreadPool::getShared());
+    m_colorLutStagingBuffer->copy(m_colorLut.getData());
+    commandBuffer->transitionLayout(m_colorLutImage, vk::ImageLayout::eTransferDstOptimal);
+    commandBuffer->copyBufferToImage(m_colorLutStagingBuffer, m_colorLutImage);
+    commandBuffer->transitionLayout(m_colorLutImage, vk::ImageLayout::eShaderReadOnlyOptimal);
+}
+
+BloomPass::BloomPass(const rv::Context& context, uint32_t width, uint32_t height)
+    : m_width{width}, m_height{height} {
+    const uint32_t levelCount = bloom::computeLevelCount(width, height);
+    for (uint32_t i = 0; i < levelCount; i++) {
+        m_levelImages.push_back(context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {bloom::computeLevelSize(width, i), bloom::computeLevelSize(height, i), 1},
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = i == 0 ? "bloomImage" : std::format("bloomImage[{}]", i),
+        }));
+    }
+    // 画像が小さすぎてレベルが1つしかない場合はブルームをかけず、レベル0をそのまま使う
+    m_outputImage = levelCount > 1 ? context.createImage({
+                                         .usage = rv::ImageUsage::Storage,
+                                         .extent = {width, height, 1},
+                                         .format = vk::Format::eR32G32B32A32Sfloat,
+                                         .viewInfo = rv::ImageViewCreateInfo{},
+                                         .debugName = "bloomOutputImage",
+                                     })
+                                   : m_levelImages[0];
+
+    context.oneTimeSubmit([&](auto commandBuffer) {
+        for (const auto& image : m_levelImages) {
+            commandBuffer->transitionLayout(image, vk::ImageLayout::eGeneral);
+        }
+        if (levelCount > 1) {
+            commandBuffer->transitionLayout(m_outputImage, vk::ImageLayout::eGeneral);
+        }
     });
 
+    m_shader = context.createShader({
+        .code = readShader("bloom.comp"),
+        .stage = vk::ShaderStageFlagBits::eCompute,
+    });
+
+    for (uint32_t i = 0; i + 1 < levelCount; i++) {
+        m_downDescSets.push_back(context.createDescriptorSet({
+            .shaders = m_shader,
+            .images =
+                {
+                    {"sourceImage", m_levelImages[i]},
+                    {"destImage", m_levelImages[i + 1]},
+                    {"blendImage", m_levelImages[i + 1]},  // unused
+                },
+        }));
+        m_downDescSets.back()->update();
+
+        m_upDescSets.push_back(context.createDescriptorSet({
+            .shaders = m_shader,
+            .images =
+                {
+                    {"sourceImage", m_levelImages[i + 1]},
+                    {"destImage", i == 0 ? m_outputImage : m_levelImages[i]},
+                    {"blendImage", m_levelImages[i]},
+                },
+        }));
+        m_upDescSets.back()->update();
+    }
+
+    if (!m_downDescSets.empty()) {
+        m_pipeline = context.createComputePipeline({
+            .descSetLayout = m_downDescSets[0]->getLayout(),
+            .pushSize = sizeof(BloomPushConstants),
+            .computeShader = m_shader,
+        });
+    }
+}
+
+void BloomPass::render(const rv::CommandBufferHandle& commandBuffer, BloomConstants info) {
+    if (m_upDescSets.empty()) {
+        return;
+    }
+    const uint32_t levelCount = std::clamp(static_cast<uint32_t>(std::max(info.levelCount, 1)),
+                                           1u, static_cast<uint32_t>(m_levelImages.size()));
+    for (uint32_t i = 0; i + 1 < levelCount; i++) {
+        dispatch(commandBuffer, m_downDescSets[i], m_levelImages[i + 1], i + 1, false,
+                 info.scatter);
+    }
+    for (uint32_t i = levelCount - 1; i > 1; i--) {
+        dispatch(commandBuffer, m_upDescSets[i - 1], m_levelImages[i - 1], i - 1, true,
+                 info.scatter);
+    }
+    // レベル0は常に出力画像に書く (レベルが1つなら scatter 0 で bright-pass をそのまま写す)
+    dispatch(commandBuffer, m_upDescSets[0], m_outputImage, 0, true,
+             levelCount > 1 ? info.scatter : 0.0f);
+}
+
+void BloomPass::dispatch(const rv::CommandBufferHandle& commandBuffer,
+                         const rv::DescriptorSetHandle& descSet,
+                         const rv::ImageHandle& destImage,
+                         uint32_t destLevel,
+                         bool upsample,
+                         float scatter) {
+    const BloomPushConstants pushConstants{static_cast<int>(upsample), scatter};
+    const uint32_t width = bloom::computeLevelSize(m_width, destLevel);
+    const uint32_t height = bloom::computeLevelSize(m_height, destLevel);
+    commandBuffer->bindDescriptorSet(m_pipeline, descSet);
+    commandBuffer->bindPipeline(m_pipeline);
+    commandBuffer->pushConstants(m_pipeline, &pushConstants);
+    commandBuffer->dispatch((width + 7) / 8, (height + 7) / 8, 1);
+    commandBuffer->imageBarrier(destImage, vk::PipelineStageFlagBits::eComputeShader,
+                                vk::PipelineStageFlagBits::eComputeShader,
+                                vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+}
+
+TemporalPass::TemporalPass(const rv::Context& context,
+                           rv::ImageHandle baseImage,
+                           rv::ImageHandle normalDepthImage,
+                           rv::ImageHandle motionIdImage,
+                           uint32_t width,
+                           uint32_t height) {
+    for (int i = 0; i < 2; i++) {
+        m_historyImages[i] = context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {width, height, 1},
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = std::format("historyImage[{}]", i),
+        });
+        m_guideImages[i] = context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {width, height, 1},
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = std::format("guideImage[{}]", i),
+        });
+    }
+
     context.oneTimeSubmit([&](auto commandBuffer) {
-        commandBuffer->transitionLayout(m_bloomImage, vk::ImageLayout::eGeneral);
+        for (int i = 0; i < 2; i++) {
+            commandBuffer->transitionLayout(m_historyImages[i], vk::ImageLayout::eGeneral);
+            commandBuffer->transitionLayout(m_guideImages[i], vk::ImageLayout::eGeneral);
+        }
     });
 
     m_shader = context.createShader({
-        .code = readShader("blur.comp", "main"),
+        .code = readShader("temporal.comp"),
+        .stage = vk::ShaderStageFlagBits::eCompute,
+    });
+
+    // i 番目のセットは [1 - i] を読んで [i] に書く
+    for (int i = 0; i < 2; i++) {
+        m_descSets[i] = context.createDescriptorSet({
+            .shaders = m_shader,
+            .images =
+                {
+                    {"baseImage", baseImage},
+                    {"normalDepthImage", normalDepthImage},
+                    {"motionIdImage", motionIdImage},
+                    {"prevHistoryImage", m_historyImages[1 - i]},
+                    {"prevGuideImage", m_guideImages[1 - i]},
+                    {"historyImage", m_historyImages[i]},
+                    {"guideImage", m_guideImages[i]},
+                },
+        });
+        m_descSets[i]->update();
+    }
+
+    m_pipeline = context.createComputePipeline({
+        .descSetLayout = m_descSets[0]->getLayout(),
+        .pushSize = sizeof(TemporalConstants),
+        .computeShader = m_shader,
+    });
+}
+
+void TemporalPass::render(const rv::CommandBufferHandle& commandBuffer,
+                          uint32_t countX,
+                          uint32_t countY,
+                          TemporalConstants info) {
+    info.enableHistory = static_cast<int>(m_hasHistory);
+    commandBuffer->bindDescriptorSet(m_pipeline, m_descSets[m_current]);
+    commandBuffer->bindPipeline(m_pipeline);
+    commandBuffer->pushConstants(m_pipeline, &info);
+    commandBuffer->dispatch(countX, countY, 1);
+    for (const auto& image : {m_historyImages[m_current], m_guideImages[m_current]}) {
+        commandBuffer->imageBarrier(image, vk::PipelineStageFlagBits::eComputeShader,
+                                    vk::PipelineStageFlagBits::eComputeShader,
+                                    vk::AccessFlagBits::eShaderWrite,
+                                    vk::AccessFlagBits::eShaderRead);
+    }
+    m_current = 1 - m_current;
+    m_hasHistory = true;
+}
+
+ConvergencePass::ConvergencePass(const rv::Context& context,
+                                 rv::ImageHandle statsImage,
+                                 uint32_t tileCountX,
+                                 uint32_t tileCountY)
+    : m_tileCountX{tileCountX}, m_tileCountY{tileCountY} {
+    m_tileErrorBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Storage,
+        .memory = rv::MemoryUsage::DeviceHost,
+        .size = tileCountX * tileCountY * sizeof(float),
+        .debugName = "tileErrorBuffer",
+    });
+
+    // 最初の結果が書かれるまでは未収束として扱う
+    const std::vector<float> initialErrors(tileCountX * tileCountY, 1.0e4f);
+    m_tileErrorBuffer->copy(initialErrors.data());
+
+    m_shader = context.createShader({
+        .code = readShader("convergence.comp"),
         .stage = vk::ShaderStageFlagBits::eCompute,
     });
 
     m_descSet = context.createDescriptorSet({
         .shaders = m_shader,
+        .buffers =
+            {
+                {"TileErrorBuffer", m_tileErrorBuffer},
+            },
         .images =
             {
-                {"bloomImage", m_bloomImage},
+                {"statsImage", statsImage},
             },
     });
     m_descSet->update();
 
     m_pipeline = context.createComputePipeline({
         .descSetLayout = m_descSet->getLayout(),
-        .pushSize = sizeof(BloomConstants),
         .computeShader = m_shader,
     });
 }
 
-void BloomPass::render(const rv::CommandBufferHandle& commandBuffer,
-                       uint32_t countX,
-                       uint32_t countY,
-                       BloomConstants info) {
+void ConvergencePass::render(const rv::CommandBufferHandle& commandBuffer) {
     commandBuffer->bindDescriptorSet(m_pipeline, m_descSet);
     commandBuffer->bindPipeline(m_pipeline);
-    commandBuffer->pushConstants(m_pipeline, &info);
-    commandBuffer->dispatch(countX, countY, 1);
-    commandBuffer->imageBarrier(m_bloomImage, vk::PipelineStageFlagBits::eComputeShader,
-                                vk::PipelineStageFlagBits::eComputeShader,
-                                vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+    commandBuffer->dispatch(m_tileCountX, m_tileCountY, 1);
+    commandBuffer->memoryBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                 vk::PipelineStageFlagBits::eHost,
+                                 vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+}
+
+StridedReadbackPass::StridedReadbackPass(const rv::Context& context,
+                                         rv::ImageHandle sourceImage,
+                                         uint32_t width,
+                                         uint32_t height,
+                                         uint32_t stride) {
+    m_info.stride = static_cast<int>(stride);
+    m_info.countX = static_cast<int>(width / stride);
+    m_info.countY = static_cast<int>(height / stride);
+
+    m_buffer = context.createBuffer({
+        .usage = rv::BufferUsage::Storage,
+        .memory = rv::MemoryUsage::DeviceHost,
+        .size = getSampleCount() * 4 * sizeof(float),
+        .debugName = "stridedReadbackBuffer",
+    });
+
+    m_shader = context.createShader({
+        .code = readShader("readback.comp"),
+        .stage = vk::ShaderStageFlagBits::eCompute,
+    });
+
+    m_descSet = context.createDescriptorSet({
+        .shaders = m_shader,
+        .buffers =
+            {
+                {"ReadbackBuffer", m_buffer},
+            },
+        .images =
+            {
+                {"sourceImage", sourceImage},
+            },
+    });
+    m_descSet->update();
+
+    m_pipeline = context.createComputePipeline({
+        .descSetLayout = m_descSet->getLayout(),
+        .pushSize = sizeof(ReadbackConstants),
+        .computeShader = m_shader,
+    });
+}
+
+void StridedReadbackPass::render(const rv::CommandBufferHandle& commandBuffer) {
+    commandBuffer->bindDescriptorSet(m_pipeline, m_descSet);
+    commandBuffer->bindPipeline(m_pipeline);
+    commandBuffer->pushConstants(m_pipeline, &m_info);
+    commandBuffer->dispatch((m_info.countX + 7) / 8, (m_info.countY + 7) / 8, 1);
+    commandBuffer->memoryBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                 vk::PipelineStageFlagBits::eHost,
+                                 vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
 }
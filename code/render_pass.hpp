@@ -1,9 +1,12 @@
 #pragma once
+#include <array>
+#include <vector>
 #include <reactive/Compiler/Compiler.hpp>
 #include <reactive/Graphics/CommandBuffer.hpp>
 #include <reactive/Graphics/DescriptorSet.hpp>
 #include <reactive/Graphics/Pipeline.hpp>
 
+#include "post/color_lut.hpp"
 #include "shader.hpp"
 
 struct CompositeConstants {
@@ -17,53 +20,196 @@ struct CompositeConstants {
     int _dummy1;
 };
 
+// CompositePass の出力先 (Renderer の構築時に選ぶ)
+enum class CompositeTarget {
+    Images,  // finalImageRGBA + finalImageBGRA (WindowApp)
+    Buffer,  // packed RGBA8 in host-visible buffers, one per readback slot (HeadlessApp)
+};
+
 class CompositePass {
 public:
     CompositePass() = default;
 
+    // outputBuffers が空なら出力画像に、そうでなければバッファに書く (composite_buffer.comp)
     CompositePass(const rv::Context& context,
                   rv::ImageHandle baseImage,
                   rv::ImageHandle bloomImage,
                   uint32_t width,
-                  uint32_t height);
+                  uint32_t height,
+                  const std::vector<rv::BufferHandle>& outputBuffers = {});
 
+    // 色処理のパラメータが変わっていれば、先に LUT を焼き直してアップロードする
     void render(const rv::CommandBufferHandle& commandBuffer,
                 uint32_t countX,
                 uint32_t countY,
                 CompositeConstants info);
 
+    // CompositeTarget::Images only
     const rv::ImageHandle& getOutputImageRGBA() const { return m_finalImageRGBA; }
 
     const rv::ImageHandle& getOutputImageBGRA() const { return m_finalImageBGRA; }
 
+    // CompositeTarget::Buffer: 次の render() で書くバッファ
+    void setOutputSlot(uint32_t slot) { m_outputSlot = slot; }
+
+    const ColorLut& getColorLut() const { return m_colorLut; }
+
 private:
+    void updateColorLut(const rv::CommandBufferHandle& commandBuffer,
+                        const CompositeConstants& info);
+
     rv::ShaderHandle m_shader;
-    rv::DescriptorSetHandle m_descSet;
+    std::vector<rv::DescriptorSetHandle> m_descSets;  // Images: 1, Buffer: per output buffer
     rv::ComputePipelineHandle m_pipeline;
     rv::ImageHandle m_finalImageRGBA;
     rv::ImageHandle m_finalImageBGRA;
+    bool m_writesBuffer = false;
+    uint32_t m_outputSlot = 0;
+
+    ColorLut m_colorLut;
+    rv::ImageHandle m_colorLutImage;
+    rv::BufferHandle m_colorLutStagingBuffer;
 };
 
 struct BloomConstants {
-    int blurSize = 16;
+    int levelCount = 6;    // including the full-resolution level
+    float scatter = 0.7f;  // weight of the coarser level in each upsample
 };
 
+// Dual filter のブルームピラミッド (bloom.comp, CPU 版は post/bloom.cpp)
+// レベル0 (bloomImage) は base.rgen が書き、半分ずつ縮小してから拡大しながら混ぜ戻す
+// 最後の拡大は別の出力画像に書く (適応サンプリングで base.rgen が書かなかったピクセルに
+// 前のフレームのブルームが残り、毎フレームぼかされ続けないように)
+// コストはブラーの半径によらずピクセル数に比例する
 class BloomPass {
 public:
     BloomPass() = default;
 
     BloomPass(const rv::Context& context, uint32_t width, uint32_t height);
 
+    // bloomImage からブルームを作り、出力画像に書く
+    void render(const rv::CommandBufferHandle& commandBuffer, BloomConstants info);
+
+    // base.rgen が書く bright-pass (レベル0)
+    const rv::ImageHandle& getInputImage() const { return m_levelImages[0]; }
+
+    const rv::ImageHandle& getOutputImage() const { return m_outputImage; }
+
+private:
+    // destImage: destLevel の大きさの画像 (レベル0への拡大では出力画像)
+    void dispatch(const rv::CommandBufferHandle& commandBuffer,
+                  const rv::DescriptorSetHandle& descSet,
+                  const rv::ImageHandle& destImage,
+                  uint32_t destLevel,
+                  bool upsample,
+                  float scatter);
+
+    rv::ShaderHandle m_shader;
+    std::vector<rv::DescriptorSetHandle> m_downDescSets;  // [i]: level i -> i + 1
+    std::vector<rv::DescriptorSetHandle> m_upDescSets;    // [i]: level i + 1 -> i
+    rv::ComputePipelineHandle m_pipeline;
+    std::vector<rv::ImageHandle> m_levelImages;
+    rv::ImageHandle m_outputImage;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+};
+
+struct TemporalConstants {
+    int maxHistoryLength = 32;
+    float depthThreshold = 0.05f;
+    float normalThreshold = 0.9f;
+    int enableHistory = 0;
+};
+
+// 前フレームの蓄積結果をモーションベクトルでリプロジェクションして現在のフレームに混ぜる
+// 履歴 (色 + 履歴長) とガイド (法線・深度・ID) はピンポンの2枚ずつを交互に使う
+class TemporalPass {
+public:
+    TemporalPass() = default;
+
+    TemporalPass(const rv::Context& context,
+                 rv::ImageHandle baseImage,
+                 rv::ImageHandle normalDepthImage,
+                 rv::ImageHandle motionIdImage,
+                 uint32_t width,
+                 uint32_t height);
+
+    // baseImage を蓄積結果で上書きする
     void render(const rv::CommandBufferHandle& commandBuffer,
                 uint32_t countX,
                 uint32_t countY,
-                BloomConstants info);
+                TemporalConstants info);
+
+    // 次のフレームでは履歴を使わない (カメラやマテリアルが変わった場合)
+    void invalidateHistory() { m_hasHistory = false; }
+
+private:
+    rv::ShaderHandle m_shader;
+    std::array<rv::DescriptorSetHandle, 2> m_descSets;
+    rv::ComputePipelineHandle m_pipeline;
+    std::array<rv::ImageHandle, 2> m_historyImages;
+    std::array<rv::ImageHandle, 2> m_guideImages;
+    uint32_t m_current = 0;  // index of the image written by the next render()
+    bool m_hasHistory = false;
+};
+
+// 適応サンプリング: statsImage からタイルごとの相対誤差を求める (convergence.comp)
+// 結果はホストから読める TileErrorBuffer に書かれ、TileScheduler が読む
+class ConvergencePass {
+public:
+    ConvergencePass() = default;
+
+    ConvergencePass(const rv::Context& context,
+                    rv::ImageHandle statsImage,
+                    uint32_t tileCountX,
+                    uint32_t tileCountY);
+
+    void render(const rv::CommandBufferHandle& commandBuffer);
+
+    // Valid after the command buffer has completed
+    const float* getTileErrors() const {
+        return static_cast<const float*>(m_tileErrorBuffer->map());
+    }
+
+private:
+    rv::ShaderHandle m_shader;
+    rv::DescriptorSetHandle m_descSet;
+    rv::ComputePipelineHandle m_pipeline;
+    rv::BufferHandle m_tileErrorBuffer;
+    uint32_t m_tileCountX = 0;
+    uint32_t m_tileCountY = 0;
+};
+
+struct ReadbackConstants {
+    int stride = 8;
+    int countX = 0;
+    int countY = 0;
+    int _dummy0;
+};
+
+// 画像から stride ピクセルごとに1ピクセルを、ホストから読めるバッファに集める
+// (フレームごとの収束判定を、画像全体の読み戻しなしで行うため)
+class StridedReadbackPass {
+public:
+    StridedReadbackPass() = default;
+
+    StridedReadbackPass(const rv::Context& context,
+                        rv::ImageHandle sourceImage,
+                        uint32_t width,
+                        uint32_t height,
+                        uint32_t stride);
+
+    void render(const rv::CommandBufferHandle& commandBuffer);
+
+    // RGBA32F x getSampleCount(). Valid after the command buffer has completed
+    const float* getSamples() const { return static_cast<const float*>(m_buffer->map()); }
 
-    const rv::ImageHandle& getOutputImage() const { return m_bloomImage; }
+    uint32_t getSampleCount() const { return m_info.countX * m_info.countY; }
 
 private:
     rv::ShaderHandle m_shader;
     rv::DescriptorSetHandle m_descSet;
     rv::ComputePipelineHandle m_pipeline;
-    rv::ImageHandle m_bloomImage;
+    rv::BufferHandle m_buffer;
+    ReadbackConstants m_info;
 };
@@ -1,5 +1,7 @@
 ﻿#pragma once
 #include <stb_image_write.h>
+#include <array>
+#include <format>
 #include <future>
 #include <random>
 #include <reactive/reactive.hpp>
@@ -8,16 +10,35 @@
 #include "image_generator.hpp"
 #include "render_pass.hpp"
 #include "scene/scene.hpp"
+#include "shader_variant.hpp"
+#include "sobol_sampler.hpp"
+#include "spectrum_table.hpp"
+#include "tile_scheduler.hpp"
 
 class Renderer {
 public:
     Renderer(const rv::Context& context,
              uint32_t width,
              uint32_t height,
-             const std::filesystem::path& scenePath)
+             const std::filesystem::path& scenePath,
+             CompositeTarget compositeTarget = CompositeTarget::Images,
+             uint32_t outputSlotCount = 1)
         : m_width{width}, m_height{height} {
         m_scene.initialize(context, scenePath, width, height);
 
+        // CompositeTarget::Buffer: 合成結果 (packed RGBA8) を読み戻しスロットごとのバッファに直接書く
+        // Storage + Host (システムメモリ) なので、エンコーダーは BAR 越しではなく RAM から読める
+        if (compositeTarget == CompositeTarget::Buffer) {
+            for (uint32_t i = 0; i < outputSlotCount; i++) {
+                m_outputBuffers.push_back(context.createBuffer({
+                    .usage = rv::BufferUsage::Storage,
+                    .memory = rv::MemoryUsage::Host,
+                    .size = width * height * 4 * sizeof(uint8_t),
+                    .debugName = std::format("outputBuffer[{}]", i),
+                }));
+            }
+        }
+
         m_baseImage = context.createImage({
             .usage = rv::ImageUsage::Storage,
             .extent = {width, height, 1},
@@ -26,49 +47,140 @@ public:
             .debugName = "baseImage",
         });
 
+        // AOV (first hit). pc.enableAOV が 0 の間は書き込まれない
+        for (auto [image, name] : {std::pair{&m_albedoImage, "albedoImage"},
+                                   std::pair{&m_normalDepthImage, "normalDepthImage"},
+                                   std::pair{&m_motionIdImage, "motionIdImage"}}) {
+            *image = context.createImage({
+                .usage = rv::ImageUsage::Storage,
+                .extent = {width, height, 1},
+                .format = vk::Format::eR32G32B32A32Sfloat,
+                .viewInfo = rv::ImageViewCreateInfo{},
+                .debugName = name,
+            });
+        }
+
+        // 適応サンプリングのピクセルごとの統計とタイルのマスク
+        m_statsImage = context.createImage({
+            .usage = rv::ImageUsage::Storage,
+            .extent = {width, height, 1},
+            .format = vk::Format::eR32G32B32A32Sfloat,
+            .viewInfo = rv::ImageViewCreateInfo{},
+            .debugName = "statsImage",
+        });
+        m_tileScheduler = {width, height, {}};
+        m_tileMaskBuffer = context.createBuffer({
+            .usage = rv::BufferUsage::Storage,
+            .memory = rv::MemoryUsage::DeviceHost,
+            .size = m_tileScheduler.getTileCount() * sizeof(uint32_t),
+            .debugName = "tileMaskBuffer",
+        });
+        m_tileMaskBuffer->copy(m_tileScheduler.getTileMask().data());
+
+        m_sobolBuffer = context.createBuffer({
+            .usage = rv::BufferUsage::Storage,
+            .memory = rv::MemoryUsage::DeviceHost,
+            .size = SOBOL_DIMENSIONS * SOBOL_BITS * sizeof(uint32_t),
+            .debugName = "sobolBuffer",
+        });
+        m_sobolBuffer->copy(SobolSampler::generateMatrices().data());
+
+        m_spectrumBuffer = context.createBuffer({
+            .usage = rv::BufferUsage::Storage,
+            .memory = rv::MemoryUsage::DeviceHost,
+            .size = SPECTRUM_TABLE_SIZE * sizeof(glm::vec4),
+            .debugName = "spectrumBuffer",
+        });
+        m_spectrumBuffer->copy(SpectrumTable::build().data());
+
         context.oneTimeSubmit([&](auto commandBuffer) {
             commandBuffer->transitionLayout(m_baseImage, vk::ImageLayout::eGeneral);
+            commandBuffer->transitionLayout(m_statsImage, vk::ImageLayout::eGeneral);
+            for (const auto& image : getAOVImages()) {
+                commandBuffer->transitionLayout(image, vk::ImageLayout::eGeneral);
+            }
         });
 
+        m_shaderFeatures = m_scene.getShaderFeatures();
         createPipelines(context);
     }
 
+    // レンダラーが使う全てのシェーダー (render_pass.cpp のパスを含む)
+    static std::vector<ShaderSource> getShaderSources(uint32_t shaderFeatures) {
+        std::vector<ShaderSource> sources;
+        for (const char* fileName :
+             {"base.rgen", "base.rchit", "base.rmiss", "shadow.rmiss", "bloom.comp",
+              "composite.comp", "composite_buffer.comp", "temporal.comp", "convergence.comp",
+              "readback.comp"}) {
+            sources.push_back({.fileName = fileName});
+        }
+        if (shaderFeatures != SHADER_FEATURES_ALL) {
+            sources.push_back(getShaderVariantSource(shaderFeatures));
+        }
+        return sources;
+    }
+
+    // 変更のあったシェーダーはここで並列にコンパイルされる (起動時と再読み込み時)
     void createPipelines(const rv::Context& context) {
-        std::vector<rv::ShaderHandle> shaders(4);
+        ShaderCache::getShared().build(getShaderSources(m_shaderFeatures));
+
+        std::vector<rv::ShaderHandle> shaders(5);
         shaders[0] = context.createShader({
-            .code = readShader("base.rgen", "main"),
+            .code = readShader("base.rgen"),
             .stage = vk::ShaderStageFlagBits::eRaygenKHR,
         });
         shaders[1] = context.createShader({
-            .code = readShader("base.rmiss", "main"),
+            .code = readShader("base.rmiss"),
             .stage = vk::ShaderStageFlagBits::eMissKHR,
         });
         shaders[2] = context.createShader({
-            .code = readShader("shadow.rmiss", "main"),
+            .code = readShader("shadow.rmiss"),
             .stage = vk::ShaderStageFlagBits::eMissKHR,
         });
         shaders[3] = context.createShader({
-            .code = readShader("base.rchit", "main"),
+            .code = readShader("base.rchit"),
             .stage = vk::ShaderStageFlagBits::eClosestHitKHR,
         });
+        // ディスクリプタのレイアウトは全ての機能を含む base.rchit から作り、パイプラインは variant を使う
+        shaders[4] = context.createShader({
+            .code = ShaderCache::getShared().get(getShaderVariantSource(m_shaderFeatures)),
+            .stage = vk::ShaderStageFlagBits::eClosestHitKHR,
+        });
+        spdlog::info("Shader features: {}", getShaderVariantKey(m_shaderFeatures));
 
         m_bloomPass = {context, m_width, m_height};
-        m_compositePass = {context, m_baseImage, m_bloomPass.getOutputImage(), m_width, m_height};
+        m_compositePass = {context, m_baseImage, m_bloomPass.getOutputImage(), m_width, m_height,
+                           m_outputBuffers};
+        m_temporalPass = {context, m_baseImage, m_normalDepthImage, m_motionIdImage, m_width,
+                          m_height};
+        m_convergencePass = {context, m_statsImage, m_tileScheduler.getTileCountX(),
+                             m_tileScheduler.getTileCountY()};
+        m_noiseReadbackPass = {context, m_baseImage, m_width, m_height, 8};
 
         m_descSet = context.createDescriptorSet({
-            .shaders = shaders,
+            .shaders = {shaders[0], shaders[1], shaders[2], shaders[3]},
             .buffers =
                 {
                     {"NodeDataBuffer", m_scene.getNodeDataBuffer()},
                     {"MaterialBuffer", m_scene.getMaterialDataBuffer()},
+                    {"TileMaskBuffer", m_tileMaskBuffer},
+                    {"SobolBuffer", m_sobolBuffer},
+                    {"SpectrumBuffer", m_spectrumBuffer},
+                    {"EnvLightBuffer", m_scene.getEnvironmentLight().samplingBuffer},
+                    {"EmissiveTriangleBuffer", m_scene.getEmissiveTriangleBuffer()},
+                    {"LightChunkBuffer", m_scene.getLightChunkBuffer()},
                 },
             .images =
                 {
                     {"baseImage", m_baseImage},
-                    {"bloomImage", m_bloomPass.getOutputImage()},
+                    {"bloomImage", m_bloomPass.getInputImage()},
                     {"envLightTexture", m_scene.getEnvironmentLight().texture},
                     {"textures2d", m_scene.get2dTextures()},
                     {"textures3d", m_scene.get3dTextures()},
+                    {"albedoImage", m_albedoImage},
+                    {"normalDepthImage", m_normalDepthImage},
+                    {"motionIdImage", m_motionIdImage},
+                    {"statsImage", m_statsImage},
                 },
             .accels = {{"topLevelAS", m_scene.getTopAccel()}},
         });
@@ -77,13 +189,25 @@ public:
         m_rayTracingPipeline = context.createRayTracingPipeline({
             .rgenGroup = {shaders[0]},
             .missGroups = {{shaders[1]}, {shaders[2]}},
-            .hitGroups = {{shaders[3]}},
+            .hitGroups = {{shaders[4]}},
             .descSetLayout = m_descSet->getLayout(),
             .pushSize = sizeof(RayTracingConstants),
-            .maxRayRecursionDepth = 31,
+            .maxRayRecursionDepth = 2,  // パスは base.rgen のループ、rchit からは影のレイのみ
         });
     }
 
+    // マテリアルや光源の編集で variant に無い機能が必要になったらパイプラインを作り直す
+    // 機能は外さない (編集のたびにコンパイルし直さないように)
+    bool updateShaderVariant(const rv::Context& context) {
+        const uint32_t required = m_scene.getShaderFeatures();
+        if ((required & ~m_shaderFeatures) == 0) {
+            return false;
+        }
+        m_shaderFeatures |= required;
+        createPipelines(context);
+        return true;
+    }
+
     void update(glm::vec2 dragLeft, float scroll) {
         m_scene.update(dragLeft, scroll);
 
@@ -94,6 +218,7 @@ public:
         m_pushConstants.envLightIntensity = envLight.intensity;
         m_pushConstants.useEnvLightTexture = envLight.useTexture;
         m_pushConstants.isEnvLightTextureVisible = static_cast<int>(envLight.isVisible);
+        m_pushConstants.envLightApproxDepth = envLight.approximateDepth;
 
         // Infinite light
         auto& infLight = m_scene.getInfiniteLight();
@@ -112,12 +237,64 @@ public:
         m_pushConstants.cameraObjectDistance = camera.m_objectDistance;
     }
 
-    void reset() { m_pushConstants.accumCount = 0; }
+    void reset() {
+        m_pushConstants.accumCount = 0;
+        m_temporalPass.invalidateHistory();
+        resetTileScheduler();
+    }
+
+    // 新しいアニメーションフレームの蓄積を始める (テンポラル蓄積の履歴は残す)
+    // 次のパスは全ピクセルをトレースし、baseImage と statsImage を上書きする
+    void restartAccumulation() {
+        m_pushConstants.accumCount = 0;
+        resetTileScheduler();
+    }
+
+    void setAOVEnabled(bool enabled) {
+        m_enableAOV = enabled;
+        m_pushConstants.enableAOV = static_cast<int>(m_enableAOV || m_enableTemporal);
+    }
+
+    // テンポラル蓄積: 毎フレーム新しいサンプルだけでトレースし、前フレームの蓄積結果を
+    // リプロジェクションして混ぜる。アニメーションのフレームが変わってもリセット不要
+    void setTemporalEnabled(bool enabled) {
+        m_enableTemporal = enabled;
+        m_pushConstants.enableAOV = static_cast<int>(m_enableAOV || m_enableTemporal);
+        reset();
+    }
+
+    bool isTemporalEnabled() const { return m_enableTemporal; }
+
+    // 適応サンプリング: 収束していないタイルだけに追加のパスを割り当てる
+    void setAdaptiveSamplingEnabled(bool enabled, const TileScheduler::Settings& settings = {}) {
+        m_pushConstants.enableAdaptiveSampling = static_cast<int>(enabled);
+        m_tileScheduler = {m_width, m_height, settings};
+        reset();
+    }
+
+    bool isAdaptiveSamplingEnabled() const { return m_pushConstants.enableAdaptiveSampling == 1; }
 
-    void render(const rv::CommandBufferHandle& commandBuffer,
-                int frame,
-                bool enableBloom,
-                int blurIteration) {
+    // SAMPLER_PCG or SAMPLER_SOBOL (sampler.h)
+    void setSamplerType(int type) {
+        m_pushConstants.samplerType = type;
+        reset();
+    }
+
+    int getSamplerType() const { return m_pushConstants.samplerType; }
+
+    // albedo, normal + depth, motion + IDs (ImageWriter::HdrLayer の順)
+    std::array<rv::ImageHandle, 3> getAOVImages() const {
+        return {m_albedoImage, m_normalDepthImage, m_motionIdImage};
+    }
+
+    void render(const rv::CommandBufferHandle& commandBuffer, int frame, bool enableBloom) {
+        m_pushConstants.enableBloom = static_cast<int>(enableBloom);
+        trace(commandBuffer, frame);
+        postProcess(commandBuffer, enableBloom);
+    }
+
+    // 1パス分のサンプルを baseImage に蓄積する。適応サンプリングでは同じフレームで複数回呼ぶ
+    void trace(const rv::CommandBufferHandle& commandBuffer, int frame) {
         // Update
         m_scene.updateMaterialBuffer(commandBuffer);
 
@@ -139,37 +316,111 @@ public:
             m_lastFrame = frame;
         }
 
-        // Ray tracing
+        // 発光三角形 (アニメーションしていれば updateTopAccel() で作り直されている)
+        const LightSampler& lightSampler = m_scene.getLightSampler();
+        m_pushConstants.lightChunkCount = static_cast<int>(lightSampler.getChunkCount());
+        m_pushConstants.lightPower = lightSampler.getTotalPower();
+
+        // Ray tracing (蓄積の最初のパスはマスクに関係なく全ピクセル)
+        // 蓄積中は Sobol のスクランブルを変えない (サンプル番号が続きになる)
+        if (m_pushConstants.accumCount == 0) {
+            resetTileScheduler();
+            m_pushConstants.frame = frame;
+        }
         commandBuffer->bindDescriptorSet(m_rayTracingPipeline, m_descSet);
         commandBuffer->bindPipeline(m_rayTracingPipeline);
         commandBuffer->pushConstants(m_rayTracingPipeline, &m_pushConstants);
         commandBuffer->traceRays(m_rayTracingPipeline, m_width, m_height, 1);
 
+        // Convergence
+        if (m_pushConstants.enableAdaptiveSampling == 1) {
+            commandBuffer->imageBarrier(m_statsImage,  //
+                                        vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                                        vk::PipelineStageFlagBits::eComputeShader,
+                                        vk::AccessFlagBits::eShaderWrite,
+                                        vk::AccessFlagBits::eShaderRead);
+            m_convergencePass.render(commandBuffer);
+        }
+
+        if (m_pushConstants.enableAccum) {
+            m_pushConstants.accumCount++;
+        }
+    }
+
+    // テンポラル蓄積・ブルーム・トーンマップ。フレームごとに1回
+    // enableBloom はトレースした時の m_pushConstants.enableBloom と合わせる
+    void postProcess(const rv::CommandBufferHandle& commandBuffer, bool enableBloom) {
         commandBuffer->imageBarrier(m_baseImage,  //
                                     vk::PipelineStageFlagBits::eRayTracingShaderKHR,
                                     vk::PipelineStageFlagBits::eComputeShader,
                                     vk::AccessFlagBits::eShaderWrite,
                                     vk::AccessFlagBits::eShaderRead);
-        commandBuffer->imageBarrier(m_bloomPass.getOutputImage(),  //
+        commandBuffer->imageBarrier(m_bloomPass.getInputImage(),  //
                                     vk::PipelineStageFlagBits::eRayTracingShaderKHR,
                                     vk::PipelineStageFlagBits::eComputeShader,
                                     vk::AccessFlagBits::eShaderWrite,
                                     vk::AccessFlagBits::eShaderRead);
 
-        // Blur
-        if (enableBloom) {
-            for (int i = 0; i < blurIteration; i++) {
-                m_bloomPass.render(commandBuffer, m_width / 8, m_height / 8, m_bloomInfo);
+        // Temporal accumulation
+        if (m_enableTemporal) {
+            for (const auto& image : {m_normalDepthImage, m_motionIdImage}) {
+                commandBuffer->imageBarrier(image,  //
+                                            vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                                            vk::PipelineStageFlagBits::eComputeShader,
+                                            vk::AccessFlagBits::eShaderWrite,
+                                            vk::AccessFlagBits::eShaderRead);
             }
+            m_temporalPass.render(commandBuffer, m_width / 8, m_height / 8, m_temporalInfo);
+            commandBuffer->imageBarrier(m_baseImage,  //
+                                        vk::PipelineStageFlagBits::eComputeShader,
+                                        vk::PipelineStageFlagBits::eComputeShader,
+                                        vk::AccessFlagBits::eShaderWrite,
+                                        vk::AccessFlagBits::eShaderRead);
+
+            // 次のフレームは新しいサンプルだけでトレースする
+            m_pushConstants.accumCount = 0;
         }
 
-        m_compositePass.render(commandBuffer, m_width / 8, m_height / 8, m_compositeInfo);
-
-        if (m_pushConstants.enableAccum) {
-            m_pushConstants.accumCount++;
+        // Bloom (無効なら bloomImage は書かれていないので合成しない)
+        CompositeConstants compositeInfo = m_compositeInfo;
+        if (enableBloom) {
+            m_bloomPass.render(commandBuffer, m_bloomInfo);
+        } else {
+            compositeInfo.bloomIntensity = 0.0f;
         }
+
+        m_compositePass.render(commandBuffer, m_width / 8, m_height / 8, compositeInfo);
+    }
+
+    // 適応サンプリング: 完了したパスのタイル誤差から次のパスのマスクを作る
+    // 戻り値はフレームが完了したか (全タイルが収束したか、パス数の上限に達した)
+    // NOTE: ウィンドウモードでは GPU の完了を待たないので、1フレーム前の結果を読むことがある
+    bool updateConvergence() {
+        m_tileScheduler.update(m_convergencePass.getTileErrors());
+        m_tileMaskBuffer->copy(m_tileScheduler.getTileMask().data());
+        return m_tileScheduler.isFrameDone();
     }
 
+    TileScheduler& getTileScheduler() { return m_tileScheduler; }
+
+    // フレーム単位の早期終了用: baseImage (a: 相対誤差) を間引いて読み戻す。trace() の後に呼ぶ
+    void readbackNoiseSamples(const rv::CommandBufferHandle& commandBuffer) {
+        commandBuffer->imageBarrier(m_baseImage,  //
+                                    vk::PipelineStageFlagBits::eRayTracingShaderKHR,
+                                    vk::PipelineStageFlagBits::eComputeShader,
+                                    vk::AccessFlagBits::eShaderWrite,
+                                    vk::AccessFlagBits::eShaderRead);
+        m_noiseReadbackPass.render(commandBuffer);
+    }
+
+    const StridedReadbackPass& getNoiseReadback() const { return m_noiseReadbackPass; }
+
+    // CompositeTarget::Buffer の出力 (ImageWriter のスロットとして使う)
+    const std::vector<rv::BufferHandle>& getOutputBuffers() const { return m_outputBuffers; }
+
+    // CompositeTarget::Buffer: 次のフレームの合成結果を書くスロット
+    void setOutputSlot(uint32_t slot) { m_compositePass.setOutputSlot(slot); }
+
     uint32_t m_width;
     uint32_t m_height;
 
@@ -179,13 +430,36 @@ public:
     CompositePass m_compositePass;
     BloomConstants m_bloomInfo;
     BloomPass m_bloomPass;
+    TemporalConstants m_temporalInfo;
+    TemporalPass m_temporalPass;
+    ConvergencePass m_convergencePass;
+    StridedReadbackPass m_noiseReadbackPass;
 
     rv::ImageHandle m_baseImage;
+    rv::ImageHandle m_albedoImage;
+    rv::ImageHandle m_normalDepthImage;
+    rv::ImageHandle m_motionIdImage;
+    rv::ImageHandle m_statsImage;
+    std::vector<rv::BufferHandle> m_outputBuffers;  // CompositeTarget::Buffer
+
+    TileScheduler m_tileScheduler;
+    rv::BufferHandle m_tileMaskBuffer;
+    rv::BufferHandle m_sobolBuffer;
+    rv::BufferHandle m_spectrumBuffer;
 
     rv::DescriptorSetHandle m_descSet;
     rv::RayTracingPipelineHandle m_rayTracingPipeline;
 
     RayTracingConstants m_pushConstants;
+    uint32_t m_shaderFeatures = SHADER_FEATURES_ALL;
+    bool m_enableAOV = false;
+    bool m_enableTemporal = false;
 
     int m_lastFrame = 0;
+
+private:
+    void resetTileScheduler() {
+        m_tileScheduler.reset();
+        m_tileMaskBuffer->copy(m_tileScheduler.getTileMask().data());
+    }
 };
@@ -0,0 +1,170 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../../shader/env_light.h"
+#include "../thread_pool.hpp"
+
+// 環境マップの重点サンプリングテーブル (輝度 x sinθ に比例する区分定数分布)
+// 周辺 CDF (行) と条件付き CDF (行内) を CPU で作り、EnvLightBuffer として GPU に渡す
+// envLightPhi の回転は方向への変換時にかけるので、回転を変えても作り直す必要はない
+// sample() / getPdf() は env_light.glsl の CPU 版
+class EnvLightSampler {
+public:
+    EnvLightSampler() = default;
+
+    // pixels: RGB(A) float, row 0 = top (+Y)
+    void build(const float* pixels,
+               uint32_t width,
+               uint32_t height,
+               uint32_t channel,
+               ThreadPool* pool) {
+        m_width = std::min(width, static_cast<uint32_t>(ENV_LIGHT_MAX_TABLE_WIDTH));
+        m_height = std::min(height, static_cast<uint32_t>(ENV_LIGHT_MAX_TABLE_HEIGHT));
+        m_table.assign(env_light::envLightPdfOffset(0, m_height, m_width, m_height), 0.0f);
+
+        // 行ごとに重みを求めて条件付き CDF を作る
+        std::vector<double> rowWeights(m_height);
+        const auto buildRow = [&](uint32_t y) {
+            const uint32_t y0 = y * height / m_height;
+            const uint32_t y1 = std::max((y + 1) * height / m_height, y0 + 1);
+            const double sinTheta = std::sin(ENV_LIGHT_PI * (y + 0.5) / m_height);
+            float* cdf =
+                m_table.data() + env_light::envLightConditionalOffset(y, m_width, m_height);
+            float* pdf = m_table.data() + env_light::envLightPdfOffset(0, y, m_width, m_height);
+
+            double sum = 0.0;
+            for (uint32_t x = 0; x < m_width; x++) {
+                const uint32_t x0 = x * width / m_width;
+                const uint32_t x1 = std::max((x + 1) * width / m_width, x0 + 1);
+                double luminance = 0.0;
+                for (uint32_t sy = y0; sy < y1; sy++) {
+                    const float* row = pixels + static_cast<size_t>(sy) * width * channel;
+                    for (uint32_t sx = x0; sx < x1; sx++) {
+                        const float* pixel = row + sx * channel;
+                        luminance += 0.2126 * pixel[0] + 0.7152 * pixel[1] + 0.0722 * pixel[2];
+                    }
+                }
+                // 負の値や NaN はサンプルしない
+                const double weight = luminance > 0.0 ? luminance / ((x1 - x0) * (y1 - y0)) : 0.0;
+                pdf[x] = static_cast<float>(weight * sinTheta);
+                cdf[x] = static_cast<float>(sum);
+                sum += pdf[x];
+            }
+            rowWeights[y] = sum;
+            normalize(cdf, pdf, m_width, sum);
+        };
+        if (pool) {
+            pool->parallelFor(m_height, buildRow);
+        } else {
+            for (uint32_t y = 0; y < m_height; y++) {
+                buildRow(y);
+            }
+        }
+
+        // 周辺 CDF。pdf は条件付き pdf から同時 pdf (uv 上) にする
+        float* marginal = m_table.data();
+        std::vector<float> marginalPdf(m_height);
+        double sum = 0.0;
+        for (uint32_t y = 0; y < m_height; y++) {
+            marginalPdf[y] = static_cast<float>(rowWeights[y]);
+            marginal[y] = static_cast<float>(sum);
+            sum += rowWeights[y];
+        }
+        normalize(marginal, marginalPdf.data(), m_height, sum);
+        m_totalWeight = sum / (static_cast<double>(m_width) * m_height);
+
+        const auto scaleRow = [&](uint32_t y) {
+            float* pdf = m_table.data() + env_light::envLightPdfOffset(0, y, m_width, m_height);
+            for (uint32_t x = 0; x < m_width; x++) {
+                pdf[x] *= marginalPdf[y];
+            }
+        };
+        if (pool) {
+            pool->parallelFor(m_height, scaleRow);
+        } else {
+            for (uint32_t y = 0; y < m_height; y++) {
+                scaleRow(y);
+            }
+        }
+    }
+
+    // u: uniform random numbers -> texture uv. pdf is over uv
+    glm::vec2 sample(glm::vec2 u, float& pdf) const {
+        const uint32_t y = findInterval(m_table.data(), m_height, u.y);
+        const float* marginal = m_table.data();
+        const float dv = (u.y - marginal[y]) / std::max(marginal[y + 1] - marginal[y], 1e-20f);
+
+        const float* cdf =
+            m_table.data() + env_light::envLightConditionalOffset(y, m_width, m_height);
+        const uint32_t x = findInterval(cdf, m_width, u.x);
+        const float du = (u.x - cdf[x]) / std::max(cdf[x + 1] - cdf[x], 1e-20f);
+
+        pdf = m_table[env_light::envLightPdfOffset(x, y, m_width, m_height)];
+        return {std::min((x + du) / m_width, 1.0f), std::min((y + dv) / m_height, 1.0f)};
+    }
+
+    float getPdf(glm::vec2 uv) const {
+        const uint32_t x = std::min(static_cast<uint32_t>(uv.x * m_width), m_width - 1);
+        const uint32_t y = std::min(static_cast<uint32_t>(uv.y * m_height), m_height - 1);
+        return m_table[env_light::envLightPdfOffset(x, y, m_width, m_height)];
+    }
+
+    // EnvLightBuffer の内容 (table width, table height, table)
+    std::vector<float> getBufferData() const {
+        std::vector<float> data(2 + m_table.size());
+        data[0] = std::bit_cast<float>(m_width);
+        data[1] = std::bit_cast<float>(m_height);
+        std::copy(m_table.begin(), m_table.end(), data.begin() + 2);
+        return data;
+    }
+
+    uint32_t getWidth() const { return m_width; }
+    uint32_t getHeight() const { return m_height; }
+
+    // mean of luminance x sinθ over the table (0: black environment)
+    double getTotalWeight() const { return m_totalWeight; }
+
+private:
+    // cdf[0..count] の中で cdf[i] <= u < cdf[i + 1] となる i (env_light.glsl と同じ二分探索)
+    static uint32_t findInterval(const float* cdf, uint32_t count, float u) {
+        uint32_t first = 0;
+        uint32_t remaining = count;
+        while (remaining > 0) {
+            const uint32_t halfLength = remaining / 2;
+            if (cdf[first + halfLength + 1] <= u) {
+                first += halfLength + 1;
+                remaining -= halfLength + 1;
+            } else {
+                remaining = halfLength;
+            }
+        }
+        return std::min(first, count - 1);
+    }
+
+    // 重みの合計で割って CDF と pdf にする。合計が 0 なら一様分布
+    static void normalize(float* cdf, float* pdf, uint32_t count, double sum) {
+        if (sum <= 0.0) {
+            for (uint32_t i = 0; i < count; i++) {
+                cdf[i] = static_cast<float>(i) / count;
+                pdf[i] = 1.0f;
+            }
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                cdf[i] = static_cast<float>(cdf[i] / sum);
+                pdf[i] = static_cast<float>(pdf[i] * count / sum);
+            }
+        }
+        cdf[count] = 1.0f;
+    }
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::vector<float> m_table;
+    double m_totalWeight = 0.0;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../../shader/env_light.h"
+#include "../thread_pool.hpp"
+
+// 環境マップの放射輝度を SH9 に射影する (EnvLightBuffer の末尾に置く)
+// 深いバウンスの拡散反射は、レイを続ける代わりにこの放射照度で打ち切れる (approximateDepth)
+// 各画素の立体角は行の sinθ を厳密に積分した値を使う。行ごとに並列に足し、最後に順に合計する
+class EnvLightSH {
+public:
+    // pixels: RGB(A) float, row 0 = top (+Y)
+    void project(const float* pixels,
+                 uint32_t width,
+                 uint32_t height,
+                 uint32_t channel,
+                 ThreadPool* pool) {
+        std::vector<std::array<glm::dvec3, ENV_LIGHT_SH_COUNT>> rows(height);
+        const auto projectRow = [&](uint32_t y) {
+            // dω = dφ (cosθ0 - cosθ1)
+            const double theta0 = ENV_LIGHT_PI * y / height;
+            const double theta1 = ENV_LIGHT_PI * (y + 1) / height;
+            const double solidAngle =
+                (std::cos(theta0) - std::cos(theta1)) * (2.0 * ENV_LIGHT_PI / width);
+            auto& sum = rows[y];
+            sum.fill(glm::dvec3{0.0});
+            for (uint32_t x = 0; x < width; x++) {
+                const float* pixel = pixels + (static_cast<size_t>(y) * width + x) * channel;
+                glm::dvec3 radiance;
+                for (int c = 0; c < 3; c++) {
+                    // NaN も 0 になる
+                    radiance[c] = pixel[c] > 0.0f ? pixel[c] : 0.0;
+                }
+                const glm::vec2 uv{(x + 0.5f) / width, (y + 0.5f) / height};
+                const glm::vec3 direction = env_light::envLightUvToDirection(uv, 0.0f);
+                for (uint32_t i = 0; i < ENV_LIGHT_SH_COUNT; i++) {
+                    sum[i] += radiance * static_cast<double>(
+                                             env_light::envLightShBasis(i, direction));
+                }
+            }
+            for (auto& coefficient : sum) {
+                coefficient *= solidAngle;
+            }
+        };
+        if (pool) {
+            pool->parallelFor(height, projectRow);
+        } else {
+            for (uint32_t y = 0; y < height; y++) {
+                projectRow(y);
+            }
+        }
+
+        std::array<glm::dvec3, ENV_LIGHT_SH_COUNT> total;
+        total.fill(glm::dvec3{0.0});
+        for (const auto& row : rows) {
+            for (uint32_t i = 0; i < ENV_LIGHT_SH_COUNT; i++) {
+                total[i] += row[i];
+            }
+        }
+        for (uint32_t i = 0; i < ENV_LIGHT_SH_COUNT; i++) {
+            m_coefficients[i] = glm::vec3{total[i]};
+        }
+    }
+
+    // env_light.glsl getEnvLightIrradiance() (direction is in the unrotated texture frame)
+    glm::vec3 getIrradiance(glm::vec3 normal) const {
+        glm::vec3 irradiance{0.0f};
+        for (uint32_t i = 0; i < ENV_LIGHT_SH_COUNT; i++) {
+            irradiance += m_coefficients[i] * env_light::envLightShIrradianceWeight(i, normal);
+        }
+        return glm::max(irradiance, glm::vec3{0.0f});
+    }
+
+    // EnvLightBuffer に追加する内容 (rgb x 9)
+    std::vector<float> getBufferData() const {
+        std::vector<float> data;
+        for (const auto& coefficient : m_coefficients) {
+            data.insert(data.end(), {coefficient.r, coefficient.g, coefficient.b});
+        }
+        return data;
+    }
+
+    const std::array<glm::vec3, ENV_LIGHT_SH_COUNT>& getCoefficients() const {
+        return m_coefficients;
+    }
+
+private:
+    std::array<glm::vec3, ENV_LIGHT_SH_COUNT> m_coefficients = {};
+};
@@ -0,0 +1,423 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include <Imath/half.h>
+#include <glm/glm.hpp>
+
+#include "../thread_pool.hpp"
+
+// 環境マップのテクスチャ (ミップマップ付きの RGBA16F または BC6H)
+// RGBA32F のままだと 4K で 128 MB になり、ミスシェーダーのフェッチもキャッシュに乗らない
+// RGBA16F は 1/2、BC6H (1 texel 1 byte) は 1/16 のサイズになる
+// ミップマップは 2x2 の平均で作り、エンコードと合わせて行/ブロック行ごとに並列に処理する
+// ファイルから読んだ環境マップは、結果をソースの隣にキャッシュする (save / load)
+class EnvTexture {
+public:
+    enum class Format : uint32_t {
+        RGBA16F = 0,
+        BC6H = 1,  // BC6H_UFLOAT (負の値は 0)
+    };
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> data;
+    };
+
+    // half の最大値。これより明るい画素は飽和させる (inf にしない)
+    static constexpr float kMaxValue = 65504.0f;
+
+    // pixels: RGB(A) float, row 0 = top
+    void build(const float* pixels,
+               uint32_t width,
+               uint32_t height,
+               uint32_t channel,
+               Format format,
+               ThreadPool* pool) {
+        m_format = format;
+        m_levels.clear();
+
+        std::vector<glm::vec4> level(static_cast<size_t>(width) * height);
+        forEach(height, pool, [&](uint32_t y) {
+            for (uint32_t x = 0; x < width; x++) {
+                const float* pixel = pixels + (static_cast<size_t>(y) * width + x) * channel;
+                glm::vec4& texel = level[static_cast<size_t>(y) * width + x];
+                for (int c = 0; c < 3; c++) {
+                    // NaN も 0 になる
+                    texel[c] = pixel[c] > 0.0f ? std::min(pixel[c], kMaxValue) : 0.0f;
+                }
+                texel.a = 1.0f;
+            }
+        });
+
+        while (true) {
+            m_levels.push_back(encode(level, width, height, pool));
+            if (width == 1 && height == 1) {
+                break;
+            }
+            level = downsample(level, width, height, pool);
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+    }
+
+    Format getFormat() const { return m_format; }
+
+    const std::vector<Level>& getLevels() const { return m_levels; }
+
+    uint32_t getLevelCount() const { return static_cast<uint32_t>(m_levels.size()); }
+
+    size_t getByteSize() const {
+        size_t size = 0;
+        for (const auto& level : m_levels) {
+            size += level.data.size();
+        }
+        return size;
+    }
+
+    // ソースのファイルが変わったらキャッシュを使わない
+    static uint64_t getSourceKey(const std::filesystem::path& source) {
+        const uint64_t size = std::filesystem::file_size(source);
+        const uint64_t time = static_cast<uint64_t>(
+            std::filesystem::last_write_time(source).time_since_epoch().count());
+        return (size * 0x9e3779b97f4a7c15ull) ^ time;
+    }
+
+    // e.g. sky.hdr -> sky.hdr.envtex
+    static std::filesystem::path getCachePath(const std::filesystem::path& source) {
+        return source.string() + ".envtex";
+    }
+
+    void save(const std::filesystem::path& path, uint64_t sourceKey) const {
+        const std::filesystem::path tempPath = path.string() + ".tmp";
+        {
+            std::ofstream file{tempPath, std::ios::binary};
+            const CacheHeader header{kCacheMagic, kCacheVersion, static_cast<uint32_t>(m_format),
+                                     getLevelCount(), sourceKey};
+            write(file, header);
+            for (const auto& level : m_levels) {
+                write(file, level.width);
+                write(file, level.height);
+                write(file, static_cast<uint64_t>(level.data.size()));
+                file.write(reinterpret_cast<const char*>(level.data.data()), level.data.size());
+            }
+            if (!file) {
+                return;
+            }
+        }
+        std::filesystem::rename(tempPath, path);
+    }
+
+    // 形式やソースが違う、または壊れていれば false
+    bool load(const std::filesystem::path& path, uint64_t sourceKey, Format format) {
+        std::ifstream file{path, std::ios::binary};
+        CacheHeader header;
+        if (!file || !read(file, header) || header.magic != kCacheMagic ||
+            header.version != kCacheVersion || header.format != static_cast<uint32_t>(format) ||
+            header.sourceKey != sourceKey || header.levelCount == 0 || header.levelCount > 32) {
+            return false;
+        }
+        std::vector<Level> levels(header.levelCount);
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            Level& level = levels[i];
+            uint64_t size = 0;
+            if (!read(file, level.width) || !read(file, level.height) || !read(file, size) ||
+                size != getLevelByteSize(format, level.width, level.height)) {
+                return false;
+            }
+            level.data.resize(size);
+            if (!file.read(reinterpret_cast<char*>(level.data.data()), size)) {
+                return false;
+            }
+        }
+        m_format = format;
+        m_levels = std::move(levels);
+        return true;
+    }
+
+    static size_t getLevelByteSize(Format format, uint32_t width, uint32_t height) {
+        if (format == Format::BC6H) {
+            return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 16;
+        }
+        return static_cast<size_t>(width) * height * 4 * sizeof(uint16_t);
+    }
+
+    // ------------------------------
+    // BC6H_UFLOAT mode 11 (1 region, 10 bit endpoints, 4 bit indices)
+    // ------------------------------
+    // 分割なしのモードのみ使う。エンドポイントは half のビット列 (対数に近い) 空間での主成分の両端
+    // インデックスも同じ空間の誤差で選ぶので、HDR の明るさの比に対して誤差が均等になる
+    static void encodeBc6hBlock(const glm::vec3* texels, uint8_t* block) {
+        std::array<glm::vec3, 16> points;
+        glm::vec3 mean{0.0f};
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                points[i][c] = static_cast<float>(toHalfBits(texels[i][c]));
+            }
+            mean += points[i] / 16.0f;
+        }
+
+        // 共分散行列の主成分 (べき乗法)
+        float covariance[3][3] = {};
+        for (const auto& point : points) {
+            const glm::vec3 d = point - mean;
+            for (int r = 0; r < 3; r++) {
+                for (int c = 0; c < 3; c++) {
+                    covariance[r][c] += d[r] * d[c];
+                }
+            }
+        }
+        glm::vec3 axis{0.57735f};  // normalize(1, 1, 1)
+        for (int iteration = 0; iteration < 8; iteration++) {
+            glm::vec3 next;
+            for (int r = 0; r < 3; r++) {
+                next[r] = covariance[r][0] * axis.x + covariance[r][1] * axis.y +
+                          covariance[r][2] * axis.z;
+            }
+            const float length = glm::length(next);
+            if (length < 1e-6f) {
+                break;
+            }
+            axis = next / length;
+        }
+        float minT = 0.0f;
+        float maxT = 0.0f;
+        for (const auto& point : points) {
+            const float t = glm::dot(point - mean, axis);
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        std::array<std::array<uint32_t, 3>, 2> endpoints;
+        std::array<std::array<uint32_t, 3>, 2> palette;
+        for (int e = 0; e < 2; e++) {
+            const glm::vec3 point = mean + axis * (e == 0 ? minT : maxT);
+            for (int c = 0; c < 3; c++) {
+                endpoints[e][c] = quantizeBc6h(point[c]);
+                palette[e][c] = unquantizeBc6h(endpoints[e][c]);
+            }
+        }
+
+        std::array<uint32_t, 16> indices;
+        for (int i = 0; i < 16; i++) {
+            float bestError = std::numeric_limits<float>::max();
+            for (uint32_t index = 0; index < 16; index++) {
+                float error = 0.0f;
+                for (int c = 0; c < 3; c++) {
+                    const float d =
+                        static_cast<float>(interpolateBc6h(palette[0][c], palette[1][c], index)) -
+                        points[i][c];
+                    error += d * d;
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    indices[i] = index;
+                }
+            }
+        }
+
+        // 最初の texel のインデックスの最上位ビットは 0 (3 bit で格納される)
+        if (indices[0] >= 8) {
+            std::swap(endpoints[0], endpoints[1]);
+            for (auto& index : indices) {
+                index = 15 - index;
+            }
+        }
+
+        std::memset(block, 0, 16);
+        uint32_t offset = 0;
+        putBits(block, offset, 0x03, 5);
+        for (int e = 0; e < 2; e++) {
+            for (int c = 0; c < 3; c++) {
+                putBits(block, offset, endpoints[e][c], 10);
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            putBits(block, offset, indices[i], i == 0 ? 3 : 4);
+        }
+    }
+
+    // encodeBc6hBlock() が書くモードのみ
+    static void decodeBc6hBlock(const uint8_t* block, glm::vec3* texels) {
+        uint32_t offset = 0;
+        if (getBits(block, offset, 5) != 0x03) {
+            std::fill(texels, texels + 16, glm::vec3{0.0f});
+            return;
+        }
+        std::array<std::array<uint32_t, 3>, 2> palette;
+        for (int e = 0; e < 2; e++) {
+            for (int c = 0; c < 3; c++) {
+                palette[e][c] = unquantizeBc6h(getBits(block, offset, 10));
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            const uint32_t index = getBits(block, offset, i == 0 ? 3 : 4);
+            for (int c = 0; c < 3; c++) {
+                Imath::half value;
+                value.setBits(
+                    static_cast<uint16_t>(interpolateBc6h(palette[0][c], palette[1][c], index)));
+                texels[i][c] = value;
+            }
+        }
+    }
+
+private:
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t levelCount;
+        uint64_t sourceKey;
+    };
+
+    // エンコーダーやキャッシュの形式を変えたら更新する
+    static constexpr uint32_t kCacheMagic = 0x5445'4c43;  // "CLET"
+    static constexpr uint32_t kCacheVersion = 1;
+
+    template <typename Func>
+    static void forEach(uint32_t count, ThreadPool* pool, const Func& func) {
+        if (pool) {
+            pool->parallelFor(count, func);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                func(i);
+            }
+        }
+    }
+
+    // 2x2 の平均 (奇数の幅や高さは端の texel を繰り返す)
+    static std::vector<glm::vec4> downsample(const std::vector<glm::vec4>& source,
+                                             uint32_t width,
+                                             uint32_t height,
+                                             ThreadPool* pool) {
+        const uint32_t nextWidth = std::max(width / 2, 1u);
+        const uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<glm::vec4> level(static_cast<size_t>(nextWidth) * nextHeight);
+        forEach(nextHeight, pool, [&](uint32_t y) {
+            const uint32_t y0 = std::min(y * 2, height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t x = 0; x < nextWidth; x++) {
+                const uint32_t x0 = std::min(x * 2, width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                level[static_cast<size_t>(y) * nextWidth + x] =
+                    (source[static_cast<size_t>(y0) * width + x0] +
+                     source[static_cast<size_t>(y0) * width + x1] +
+                     source[static_cast<size_t>(y1) * width + x0] +
+                     source[static_cast<size_t>(y1) * width + x1]) *
+                    0.25f;
+            }
+        });
+        return level;
+    }
+
+    Level encode(const std::vector<glm::vec4>& texels,
+                 uint32_t width,
+                 uint32_t height,
+                 ThreadPool* pool) const {
+        Level level{width, height};
+        level.data.resize(getLevelByteSize(m_format, width, height));
+        if (m_format == Format::RGBA16F) {
+            uint16_t* dst = reinterpret_cast<uint16_t*>(level.data.data());
+            forEach(height, pool, [&](uint32_t y) {
+                for (uint32_t x = 0; x < width; x++) {
+                    const size_t i = static_cast<size_t>(y) * width + x;
+                    for (int c = 0; c < 4; c++) {
+                        dst[i * 4 + c] = Imath::half{texels[i][c]}.bits();
+                    }
+                }
+            });
+            return level;
+        }
+
+        // 4x4 ブロック。はみ出す部分は端の texel を繰り返す
+        const uint32_t blockCountX = (width + 3) / 4;
+        const uint32_t blockCountY = (height + 3) / 4;
+        forEach(blockCountY, pool, [&](uint32_t by) {
+            std::array<glm::vec3, 16> block;
+            for (uint32_t bx = 0; bx < blockCountX; bx++) {
+                for (uint32_t i = 0; i < 16; i++) {
+                    const uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+                    const uint32_t y = std::min(by * 4 + i / 4, height - 1);
+                    block[i] = glm::vec3{texels[static_cast<size_t>(y) * width + x]};
+                }
+                const size_t blockIndex = static_cast<size_t>(by) * blockCountX + bx;
+                encodeBc6hBlock(block.data(), level.data.data() + blockIndex * 16);
+            }
+        });
+        return level;
+    }
+
+    static uint32_t toHalfBits(float value) {
+        return Imath::half{std::clamp(value, 0.0f, kMaxValue)}.bits();
+    }
+
+    // 10 bit のエンドポイント -> 16 bit (BC6H_UFLOAT の unquantize)
+    static uint32_t unquantizeBc6h(uint32_t value) {
+        if (value == 0) {
+            return 0;
+        }
+        if (value == 1023) {
+            return 0xffff;
+        }
+        return ((value << 16) + 0x8000) >> 10;
+    }
+
+    // 補間して half のビット列に戻す (finish_unquantize)
+    static uint32_t interpolateBc6h(uint32_t a, uint32_t b, uint32_t index) {
+        constexpr uint32_t kWeights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                           34, 38, 43, 47, 51, 55, 60, 64};
+        const uint32_t value = ((64 - kWeights[index]) * a + kWeights[index] * b + 32) >> 6;
+        return (value * 31) >> 6;
+    }
+
+    // half のビット列に最も近く戻るエンドポイント
+    static uint32_t quantizeBc6h(float halfBits) {
+        const int guess = static_cast<int>(std::round((halfBits - 15.5f) / 31.0f));
+        uint32_t best = 0;
+        float bestError = std::numeric_limits<float>::max();
+        for (int value = std::max(guess - 1, 0); value <= std::min(guess + 1, 1023); value++) {
+            const float error = std::abs(
+                static_cast<float>(interpolateBc6h(unquantizeBc6h(value), 0, 0)) - halfBits);
+            if (error < bestError) {
+                bestError = error;
+                best = value;
+            }
+        }
+        return best;
+    }
+
+    static void putBits(uint8_t* block, uint32_t& offset, uint32_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, offset++) {
+            block[offset / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (offset % 8));
+        }
+    }
+
+    static uint32_t getBits(const uint8_t* block, uint32_t& offset, uint32_t count) {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < count; i++, offset++) {
+            value |= ((block[offset / 8] >> (offset % 8)) & 1u) << i;
+        }
+        return value;
+    }
+
+    template <typename T>
+    static void write(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool read(std::ifstream& file, T& value) {
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    Format m_format = Format::BC6H;
+    std::vector<Level> m_levels;
+};
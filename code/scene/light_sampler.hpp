@@ -0,0 +1,171 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../../shader/share.h"
+#include "../thread_pool.hpp"
+
+// 発光三角形の直接光サンプリング (mesh_light.glsl の CPU 側)
+// ワールド空間の三角形をパワー (放射輝度の輝度 x 面積) に比例して選ぶ
+// 三角形を kChunkSize 個ずつのチャンクに分けてチャンク内のエイリアステーブルを並列に作り、
+// チャンクの選択にもう 1 段のエイリアステーブルを使う。選ばれる確率は power / total で
+// 1 段のテーブルと同じなので、シェーダーは面積あたりの pdf を luminance / total で求められる
+class LightSampler {
+public:
+    static constexpr uint32_t kChunkSize = 1024;
+
+    // 1 つのノード (インスタンス) の発光三角形
+    struct Source {
+        glm::mat4 transform;
+        const glm::vec3* positions;
+        const uint32_t* indices;
+        uint32_t triangleCount;
+        glm::vec3 emission;
+    };
+
+    // アニメーションするフレームでも同じ手順で作り直す (変換と面積が変わるため)
+    void build(const std::vector<Source>& sources, ThreadPool* pool) {
+        std::vector<uint32_t> offsets(sources.size() + 1, 0);
+        for (size_t i = 0; i < sources.size(); i++) {
+            offsets[i + 1] = offsets[i] + sources[i].triangleCount;
+        }
+        const uint32_t triangleCount = offsets.back();
+        const uint32_t chunkCount = (triangleCount + kChunkSize - 1) / kChunkSize;
+        m_triangles.resize(triangleCount);
+        m_powers.resize(triangleCount);
+        m_chunks.resize(chunkCount);
+
+        std::vector<float> chunkPowers(chunkCount);
+        const auto buildChunk = [&](uint32_t chunk) {
+            const uint32_t first = chunk * kChunkSize;
+            const uint32_t count = std::min(kChunkSize, triangleCount - first);
+            size_t source = std::upper_bound(offsets.begin(), offsets.end(), first) -
+                            offsets.begin() - 1;
+            double power = 0.0;
+            for (uint32_t i = first; i < first + count; i++) {
+                while (i >= offsets[source + 1]) {
+                    source++;
+                }
+                const Source& src = sources[source];
+                const uint32_t* index = src.indices + (i - offsets[source]) * 3;
+                const auto transform = [&](uint32_t vertex) {
+                    return glm::vec3{src.transform * glm::vec4{src.positions[vertex], 1.0f}};
+                };
+                EmissiveTriangle& triangle = m_triangles[i];
+                triangle.position0 = transform(index[0]);
+                triangle.position1 = transform(index[1]);
+                triangle.position2 = transform(index[2]);
+                triangle.emission = src.emission;
+                const glm::vec3 edge1 = triangle.position1 - triangle.position0;
+                const glm::vec3 edge2 = triangle.position2 - triangle.position0;
+                const float area = 0.5f * glm::length(glm::cross(edge1, edge2));
+                m_powers[i] = computeLuminance(src.emission) * area;
+                power += m_powers[i];
+            }
+            chunkPowers[chunk] = static_cast<float>(power);
+
+            std::vector<float> probabilities(count);
+            std::vector<uint32_t> aliases(count);
+            buildAliasTable(&m_powers[first], count, probabilities.data(), aliases.data());
+            for (uint32_t i = 0; i < count; i++) {
+                m_triangles[first + i].probability = probabilities[i];
+                m_triangles[first + i].alias = static_cast<int>(aliases[i]);
+            }
+            m_chunks[chunk].first = static_cast<int>(first);
+            m_chunks[chunk].count = static_cast<int>(count);
+        };
+        if (pool) {
+            pool->parallelFor(chunkCount, buildChunk);
+        } else {
+            for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+                buildChunk(chunk);
+            }
+        }
+
+        std::vector<float> probabilities(chunkCount);
+        std::vector<uint32_t> aliases(chunkCount);
+        buildAliasTable(chunkPowers.data(), chunkCount, probabilities.data(), aliases.data());
+        m_totalPower = 0.0;
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+            m_chunks[chunk].probability = probabilities[chunk];
+            m_chunks[chunk].alias = static_cast<int>(aliases[chunk]);
+            m_totalPower += chunkPowers[chunk];
+        }
+    }
+
+    // mesh_light.glsl と同じ手順で三角形を選ぶ (u0: チャンク, u1: チャンク内)
+    uint32_t sample(float u0, float u1) const {
+        const LightChunk& chunk = m_chunks[sampleAlias(m_chunks.data(), getChunkCount(), u0)];
+        return chunk.first + sampleAlias(m_triangles.data() + chunk.first, chunk.count, u1);
+    }
+
+    // 三角形が選ばれる確率
+    double getProbability(uint32_t triangle) const { return m_powers[triangle] / m_totalPower; }
+
+    static float computeLuminance(const glm::vec3& color) {
+        return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+    }
+
+    const std::vector<EmissiveTriangle>& getTriangles() const { return m_triangles; }
+    const std::vector<LightChunk>& getChunks() const { return m_chunks; }
+    uint32_t getTriangleCount() const { return static_cast<uint32_t>(m_triangles.size()); }
+    uint32_t getChunkCount() const { return static_cast<uint32_t>(m_chunks.size()); }
+    float getTotalPower() const { return static_cast<float>(m_totalPower); }
+
+private:
+    // Vose's alias method. 重みが全て 0 なら一様
+    static void buildAliasTable(const float* weights,
+                                uint32_t count,
+                                float* probabilities,
+                                uint32_t* aliases) {
+        double sum = 0.0;
+        for (uint32_t i = 0; i < count; i++) {
+            sum += weights[i];
+        }
+        std::vector<double> scaled(count);
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+        for (uint32_t i = 0; i < count; i++) {
+            scaled[i] = sum > 0.0 ? weights[i] * count / sum : 1.0;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            const uint32_t s = small.back();
+            const uint32_t l = large.back();
+            small.pop_back();
+            probabilities[s] = static_cast<float>(scaled[s]);
+            aliases[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // 残りは (丸め誤差を除いて) 確率 1
+        for (const uint32_t i : large) {
+            probabilities[i] = 1.0f;
+            aliases[i] = i;
+        }
+        for (const uint32_t i : small) {
+            probabilities[i] = 1.0f;
+            aliases[i] = i;
+        }
+    }
+
+    // u の整数部でエントリを、小数部で本体か別名かを選ぶ
+    template <typename Entry>
+    static uint32_t sampleAlias(const Entry* entries, uint32_t count, float u) {
+        const float scaled = u * count;
+        const uint32_t index = std::min(static_cast<uint32_t>(scaled), count - 1);
+        const float fraction = scaled - index;
+        return fraction < entries[index].probability ? index : entries[index].alias;
+    }
+
+    std::vector<EmissiveTriangle> m_triangles;
+    std::vector<float> m_powers;
+    std::vector<LightChunk> m_chunks;
+    double m_totalPower = 0.0;
+};
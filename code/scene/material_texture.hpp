@@ -0,0 +1,593 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../thread_pool.hpp"
+
+// マテリアルのテクスチャ (ミップマップ付きの RGBA8 / BC7 / BC5)
+// BC7 (RGBA) と BC5 (法線の XY) は 1 texel 1 byte で、RGBA8 の 1/4 のサイズになる
+// 色のテクスチャは sRGB なので、ミップマップは線形空間で平均してから sRGB に戻す
+// 法線マップは平均してから正規化し直す
+class MaterialTexture {
+public:
+    enum class Format : uint32_t {
+        RGBA8 = 0,
+        BC7 = 1,  // mode 6 (1 subset, RGBA)
+        BC5 = 2,  // RG
+    };
+
+    enum class Usage : uint32_t {
+        Color = 0,   // base color, emissive (sRGB)
+        Linear = 1,  // metallic roughness, occlusion
+        Normal = 2,
+    };
+
+    struct Level {
+        uint32_t width;
+        uint32_t height;
+        std::vector<uint8_t> data;
+    };
+
+    static Format selectFormat(Usage usage, bool compress) {
+        if (!compress) {
+            return Format::RGBA8;
+        }
+        return usage == Usage::Normal ? Format::BC5 : Format::BC7;
+    }
+
+    // rgba: RGBA8, row 0 = top
+    // maxLevelCount: 0 は 1x1 まで (アトラスは余白が残る数に制限する)
+    void build(const uint8_t* rgba,
+               uint32_t width,
+               uint32_t height,
+               Usage usage,
+               Format format,
+               ThreadPool* pool,
+               uint32_t maxLevelCount = 0) {
+        m_format = format;
+        m_usage = usage;
+        m_levels.clear();
+
+        // レベル 0 は元の画素をそのままエンコードする
+        std::vector<uint8_t> bytes(rgba, rgba + static_cast<size_t>(width) * height * 4);
+        std::vector<glm::vec4> level;
+        while (true) {
+            m_levels.push_back(encode(bytes, width, height, pool));
+            if ((width == 1 && height == 1) || m_levels.size() == maxLevelCount) {
+                break;
+            }
+            if (level.empty()) {
+                level = toLinear(bytes, width, height, pool);
+            }
+            level = downsample(level, width, height, pool);
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+            bytes = toBytes(level, width, height, pool);
+        }
+    }
+
+    Format getFormat() const { return m_format; }
+
+    Usage getUsage() const { return m_usage; }
+
+    const std::vector<Level>& getLevels() const { return m_levels; }
+
+    uint32_t getLevelCount() const { return static_cast<uint32_t>(m_levels.size()); }
+
+    size_t getByteSize() const {
+        size_t size = 0;
+        for (const auto& level : m_levels) {
+            size += level.data.size();
+        }
+        return size;
+    }
+
+    void save(const std::filesystem::path& path, uint64_t sourceKey) const {
+        const std::filesystem::path tempPath = path.string() + ".tmp";
+        {
+            std::ofstream file{tempPath, std::ios::binary};
+            const CacheHeader header{kCacheMagic,
+                                     kCacheVersion,
+                                     static_cast<uint32_t>(m_format),
+                                     static_cast<uint32_t>(m_usage),
+                                     getLevelCount(),
+                                     0,
+                                     sourceKey};
+            write(file, header);
+            for (const auto& level : m_levels) {
+                write(file, level.width);
+                write(file, level.height);
+                write(file, static_cast<uint64_t>(level.data.size()));
+                file.write(reinterpret_cast<const char*>(level.data.data()), level.data.size());
+            }
+            if (!file) {
+                return;
+            }
+        }
+        std::filesystem::rename(tempPath, path);
+    }
+
+    // 形式やソースが違う、または壊れていれば false
+    bool load(const std::filesystem::path& path, uint64_t sourceKey, Usage usage, Format format) {
+        std::ifstream file{path, std::ios::binary};
+        CacheHeader header;
+        if (!file || !read(file, header) || header.magic != kCacheMagic ||
+            header.version != kCacheVersion || header.format != static_cast<uint32_t>(format) ||
+            header.usage != static_cast<uint32_t>(usage) || header.sourceKey != sourceKey ||
+            header.levelCount == 0 || header.levelCount > 32) {
+            return false;
+        }
+        std::vector<Level> levels(header.levelCount);
+        for (uint32_t i = 0; i < header.levelCount; i++) {
+            Level& level = levels[i];
+            uint64_t size = 0;
+            if (!read(file, level.width) || !read(file, level.height) || !read(file, size) ||
+                size != getLevelByteSize(format, level.width, level.height)) {
+                return false;
+            }
+            level.data.resize(size);
+            if (!file.read(reinterpret_cast<char*>(level.data.data()), size)) {
+                return false;
+            }
+        }
+        m_format = format;
+        m_usage = usage;
+        m_levels = std::move(levels);
+        return true;
+    }
+
+    static size_t getLevelByteSize(Format format, uint32_t width, uint32_t height) {
+        if (format == Format::RGBA8) {
+            return static_cast<size_t>(width) * height * 4;
+        }
+        return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 16;
+    }
+
+    // ------------------------------
+    // BC7 mode 6 (1 subset, RGBA 7 bit + p-bit endpoints, 4 bit indices)
+    // ------------------------------
+    // エンドポイントは RGBA の主成分の両端から始め、インデックスを決めてから最小二乗で 1 回合わせ直す
+    static void encodeBc7Block(const uint8_t* texels, uint8_t* block) {
+        std::array<glm::vec4, 16> points;
+        glm::vec4 mean{0.0f};
+        for (int i = 0; i < 16; i++) {
+            points[i] = glm::vec4{texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2],
+                                  texels[i * 4 + 3]};
+            mean += points[i] / 16.0f;
+        }
+
+        // 共分散行列の主成分 (べき乗法)
+        float covariance[4][4] = {};
+        for (const auto& point : points) {
+            const glm::vec4 d = point - mean;
+            for (int r = 0; r < 4; r++) {
+                for (int c = 0; c < 4; c++) {
+                    covariance[r][c] += d[r] * d[c];
+                }
+            }
+        }
+        glm::vec4 axis{0.5f};  // normalize(1, 1, 1, 1)
+        for (int iteration = 0; iteration < 8; iteration++) {
+            glm::vec4 next{0.0f};
+            for (int r = 0; r < 4; r++) {
+                for (int c = 0; c < 4; c++) {
+                    next[r] += covariance[r][c] * axis[c];
+                }
+            }
+            const float length = glm::length(next);
+            if (length < 1e-6f) {
+                break;
+            }
+            axis = next / length;
+        }
+        float minT = 0.0f;
+        float maxT = 0.0f;
+        for (const auto& point : points) {
+            const float t = glm::dot(point - mean, axis);
+            minT = std::min(minT, t);
+            maxT = std::max(maxT, t);
+        }
+
+        Bc7Endpoints best = quantizeBc7(mean + axis * minT, mean + axis * maxT);
+        std::array<uint32_t, 16> bestIndices;
+        float bestError = selectBc7Indices(best, points, bestIndices);
+
+        // 決まったインデックスの重みで、誤差が最小になるエンドポイントを解き直す
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        glm::vec4 ax{0.0f};
+        glm::vec4 bx{0.0f};
+        for (int i = 0; i < 16; i++) {
+            const float w = kBc7Weights[bestIndices[i]] / 64.0f;
+            aa += (1.0f - w) * (1.0f - w);
+            ab += (1.0f - w) * w;
+            bb += w * w;
+            ax += (1.0f - w) * points[i];
+            bx += w * points[i];
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) > 1e-6f) {
+            const Bc7Endpoints refined = quantizeBc7((ax * bb - bx * ab) / determinant,
+                                                     (bx * aa - ax * ab) / determinant);
+            std::array<uint32_t, 16> indices;
+            const float error = selectBc7Indices(refined, points, indices);
+            if (error < bestError) {
+                best = refined;
+                bestIndices = indices;
+            }
+        }
+
+        // 最初の texel のインデックスの最上位ビットは 0 (3 bit で格納される)
+        if (bestIndices[0] >= 8) {
+            std::swap(best.values[0], best.values[1]);
+            std::swap(best.pBits[0], best.pBits[1]);
+            for (auto& index : bestIndices) {
+                index = 15 - index;
+            }
+        }
+
+        std::memset(block, 0, 16);
+        uint32_t offset = 0;
+        putBits(block, offset, 1 << 6, 7);
+        for (int c = 0; c < 4; c++) {
+            for (int e = 0; e < 2; e++) {
+                putBits(block, offset, best.values[e][c] >> 1, 7);
+            }
+        }
+        putBits(block, offset, best.pBits[0], 1);
+        putBits(block, offset, best.pBits[1], 1);
+        for (int i = 0; i < 16; i++) {
+            putBits(block, offset, bestIndices[i], i == 0 ? 3 : 4);
+        }
+    }
+
+    // encodeBc7Block() が書くモードのみ
+    static void decodeBc7Block(const uint8_t* block, uint8_t* texels) {
+        uint32_t offset = 0;
+        if (getBits(block, offset, 7) != 1 << 6) {
+            std::fill(texels, texels + 64, uint8_t{0});
+            return;
+        }
+        uint32_t endpoints[2][4];
+        for (int c = 0; c < 4; c++) {
+            for (int e = 0; e < 2; e++) {
+                endpoints[e][c] = getBits(block, offset, 7) << 1;
+            }
+        }
+        for (int e = 0; e < 2; e++) {
+            const uint32_t pBit = getBits(block, offset, 1);
+            for (int c = 0; c < 4; c++) {
+                endpoints[e][c] |= pBit;
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            const uint32_t index = getBits(block, offset, i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; c++) {
+                texels[i * 4 + c] = static_cast<uint8_t>(
+                    interpolateBc7(endpoints[0][c], endpoints[1][c], index));
+            }
+        }
+    }
+
+    // ------------------------------
+    // BC5 (2 x BC4: R, G)
+    // ------------------------------
+    static void encodeBc5Block(const uint8_t* texels, uint8_t* block) {
+        for (int c = 0; c < 2; c++) {
+            encodeBc4Block(texels + c, block + c * 8);
+        }
+    }
+
+    // B = 0, A = 255
+    static void decodeBc5Block(const uint8_t* block, uint8_t* texels) {
+        for (int c = 0; c < 2; c++) {
+            uint8_t palette[8];
+            getBc4Palette(block[c * 8], block[c * 8 + 1], palette);
+            uint32_t offset = 16;
+            for (int i = 0; i < 16; i++) {
+                texels[i * 4 + c] = palette[getBits(block + c * 8, offset, 3)];
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            texels[i * 4 + 2] = 0;
+            texels[i * 4 + 3] = 255;
+        }
+    }
+
+private:
+    struct CacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t usage;
+        uint32_t levelCount;
+        uint32_t padding;
+        uint64_t sourceKey;
+    };
+
+    // 両端の値 (8 bit, 最下位ビットは p-bit)
+    struct Bc7Endpoints {
+        std::array<std::array<uint32_t, 4>, 2> values;
+        std::array<uint32_t, 2> pBits;
+    };
+
+    // エンコーダーやキャッシュの形式を変えたら更新する
+    static constexpr uint32_t kCacheMagic = 0x544d'4c43;  // "CLMT"
+    static constexpr uint32_t kCacheVersion = 1;
+
+    static constexpr uint32_t kBc7Weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                                 34, 38, 43, 47, 51, 55, 60, 64};
+
+    template <typename Func>
+    static void forEach(uint32_t count, ThreadPool* pool, const Func& func) {
+        if (pool) {
+            pool->parallelFor(count, func);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                func(i);
+            }
+        }
+    }
+
+    static float srgbToLinear(float value) {
+        return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static float linearToSrgb(float value) {
+        return value <= 0.0031308f ? value * 12.92f
+                                   : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+    }
+
+    // ミップマップを作る空間 (色は線形、法線は [-1, 1]、それ以外は [0, 1])
+    std::vector<glm::vec4> toLinear(const std::vector<uint8_t>& bytes,
+                                    uint32_t width,
+                                    uint32_t height,
+                                    ThreadPool* pool) const {
+        std::array<float, 256> table;
+        for (int i = 0; i < 256; i++) {
+            const float value = i / 255.0f;
+            table[i] = m_usage == Usage::Color    ? srgbToLinear(value)
+                       : m_usage == Usage::Normal ? value * 2.0f - 1.0f
+                                                  : value;
+        }
+        std::vector<glm::vec4> texels(static_cast<size_t>(width) * height);
+        forEach(height, pool, [&](uint32_t y) {
+            for (uint32_t x = 0; x < width; x++) {
+                const size_t i = static_cast<size_t>(y) * width + x;
+                texels[i] = {table[bytes[i * 4]], table[bytes[i * 4 + 1]],
+                             table[bytes[i * 4 + 2]], bytes[i * 4 + 3] / 255.0f};
+            }
+        });
+        return texels;
+    }
+
+    std::vector<uint8_t> toBytes(const std::vector<glm::vec4>& texels,
+                                 uint32_t width,
+                                 uint32_t height,
+                                 ThreadPool* pool) const {
+        const auto toByte = [](float value) {
+            return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+        };
+        std::vector<uint8_t> bytes(static_cast<size_t>(width) * height * 4);
+        forEach(height, pool, [&](uint32_t y) {
+            for (uint32_t x = 0; x < width; x++) {
+                const size_t i = static_cast<size_t>(y) * width + x;
+                glm::vec3 rgb{texels[i]};
+                if (m_usage == Usage::Color) {
+                    rgb = {linearToSrgb(rgb.r), linearToSrgb(rgb.g), linearToSrgb(rgb.b)};
+                } else if (m_usage == Usage::Normal) {
+                    const float length = glm::length(rgb);
+                    rgb = (length > 0.0f ? rgb / length : glm::vec3{0.0f, 0.0f, 1.0f}) * 0.5f +
+                          0.5f;
+                }
+                for (int c = 0; c < 3; c++) {
+                    bytes[i * 4 + c] = toByte(rgb[c]);
+                }
+                bytes[i * 4 + 3] = toByte(texels[i].a);
+            }
+        });
+        return bytes;
+    }
+
+    // 2x2 の平均 (奇数の幅や高さは端の texel を繰り返す)
+    static std::vector<glm::vec4> downsample(const std::vector<glm::vec4>& source,
+                                             uint32_t width,
+                                             uint32_t height,
+                                             ThreadPool* pool) {
+        const uint32_t nextWidth = std::max(width / 2, 1u);
+        const uint32_t nextHeight = std::max(height / 2, 1u);
+        std::vector<glm::vec4> level(static_cast<size_t>(nextWidth) * nextHeight);
+        forEach(nextHeight, pool, [&](uint32_t y) {
+            const uint32_t y0 = std::min(y * 2, height - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+            for (uint32_t x = 0; x < nextWidth; x++) {
+                const uint32_t x0 = std::min(x * 2, width - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                level[static_cast<size_t>(y) * nextWidth + x] =
+                    (source[static_cast<size_t>(y0) * width + x0] +
+                     source[static_cast<size_t>(y0) * width + x1] +
+                     source[static_cast<size_t>(y1) * width + x0] +
+                     source[static_cast<size_t>(y1) * width + x1]) *
+                    0.25f;
+            }
+        });
+        return level;
+    }
+
+    Level encode(const std::vector<uint8_t>& bytes,
+                 uint32_t width,
+                 uint32_t height,
+                 ThreadPool* pool) const {
+        Level level{width, height};
+        if (m_format == Format::RGBA8) {
+            level.data = bytes;
+            return level;
+        }
+        level.data.resize(getLevelByteSize(m_format, width, height));
+
+        // 4x4 ブロック。はみ出す部分は端の texel を繰り返す
+        const uint32_t blockCountX = (width + 3) / 4;
+        const uint32_t blockCountY = (height + 3) / 4;
+        forEach(blockCountY, pool, [&](uint32_t by) {
+            std::array<uint8_t, 64> block;
+            for (uint32_t bx = 0; bx < blockCountX; bx++) {
+                for (uint32_t i = 0; i < 16; i++) {
+                    const uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+                    const uint32_t y = std::min(by * 4 + i / 4, height - 1);
+                    std::memcpy(&block[i * 4], &bytes[(static_cast<size_t>(y) * width + x) * 4],
+                                4);
+                }
+                const size_t blockIndex = static_cast<size_t>(by) * blockCountX + bx;
+                uint8_t* dst = level.data.data() + blockIndex * 16;
+                if (m_format == Format::BC7) {
+                    encodeBc7Block(block.data(), dst);
+                } else {
+                    encodeBc5Block(block.data(), dst);
+                }
+            }
+        });
+        return level;
+    }
+
+    static uint32_t interpolateBc7(uint32_t a, uint32_t b, uint32_t index) {
+        return ((64 - kBc7Weights[index]) * a + kBc7Weights[index] * b + 32) >> 6;
+    }
+
+    // 各エンドポイントで誤差の小さい方の p-bit を選ぶ
+    static Bc7Endpoints quantizeBc7(glm::vec4 a, glm::vec4 b) {
+        Bc7Endpoints endpoints;
+        for (int e = 0; e < 2; e++) {
+            const glm::vec4 point = e == 0 ? a : b;
+            float bestError = std::numeric_limits<float>::max();
+            for (uint32_t pBit = 0; pBit < 2; pBit++) {
+                std::array<uint32_t, 4> values;
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++) {
+                    const float target = std::clamp(point[c], 0.0f, 255.0f);
+                    const int q = std::clamp(static_cast<int>(std::round((target - pBit) / 2.0f)),
+                                             0, 127);
+                    values[c] = (static_cast<uint32_t>(q) << 1) | pBit;
+                    error += (values[c] - target) * (values[c] - target);
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    endpoints.values[e] = values;
+                    endpoints.pBits[e] = pBit;
+                }
+            }
+        }
+        return endpoints;
+    }
+
+    // 二乗誤差の和を返す
+    static float selectBc7Indices(const Bc7Endpoints& endpoints,
+                                  const std::array<glm::vec4, 16>& points,
+                                  std::array<uint32_t, 16>& indices) {
+        std::array<glm::vec4, 16> palette;
+        for (uint32_t index = 0; index < 16; index++) {
+            for (int c = 0; c < 4; c++) {
+                palette[index][c] = static_cast<float>(
+                    interpolateBc7(endpoints.values[0][c], endpoints.values[1][c], index));
+            }
+        }
+        float total = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            float bestError = std::numeric_limits<float>::max();
+            for (uint32_t index = 0; index < 16; index++) {
+                const glm::vec4 d = palette[index] - points[i];
+                const float error = glm::dot(d, d);
+                if (error < bestError) {
+                    bestError = error;
+                    indices[i] = index;
+                }
+            }
+            total += bestError;
+        }
+        return total;
+    }
+
+    // a > b: 両端 + 6 つの補間
+    // a <= b: 両端 + 4 つの補間 + 0, 255 (エンコーダーは a == b のときだけ使う)
+    static void getBc4Palette(uint32_t a, uint32_t b, uint8_t* palette) {
+        palette[0] = static_cast<uint8_t>(a);
+        palette[1] = static_cast<uint8_t>(b);
+        if (a > b) {
+            for (uint32_t k = 2; k < 8; k++) {
+                palette[k] = static_cast<uint8_t>(((8 - k) * a + (k - 1) * b + 3) / 7);
+            }
+            return;
+        }
+        for (uint32_t k = 2; k < 6; k++) {
+            palette[k] = static_cast<uint8_t>(((6 - k) * a + (k - 1) * b + 2) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    // texels: stride 4 bytes
+    static void encodeBc4Block(const uint8_t* texels, uint8_t* block) {
+        uint32_t maxValue = 0;
+        uint32_t minValue = 255;
+        for (int i = 0; i < 16; i++) {
+            maxValue = std::max<uint32_t>(maxValue, texels[i * 4]);
+            minValue = std::min<uint32_t>(minValue, texels[i * 4]);
+        }
+        uint8_t palette[8];
+        getBc4Palette(maxValue, minValue, palette);
+
+        std::memset(block, 0, 8);
+        block[0] = static_cast<uint8_t>(maxValue);
+        block[1] = static_cast<uint8_t>(minValue);
+        uint32_t offset = 16;
+        for (int i = 0; i < 16; i++) {
+            uint32_t best = 0;
+            int bestError = std::numeric_limits<int>::max();
+            for (uint32_t index = 0; index < 8; index++) {
+                const int error = std::abs(static_cast<int>(palette[index]) - texels[i * 4]);
+                if (error < bestError) {
+                    bestError = error;
+                    best = index;
+                }
+            }
+            putBits(block, offset, best, 3);
+        }
+    }
+
+    static void putBits(uint8_t* block, uint32_t& offset, uint32_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, offset++) {
+            block[offset / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (offset % 8));
+        }
+    }
+
+    static uint32_t getBits(const uint8_t* block, uint32_t& offset, uint32_t count) {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < count; i++, offset++) {
+            value |= ((block[offset / 8] >> (offset % 8)) & 1u) << i;
+        }
+        return value;
+    }
+
+    template <typename T>
+    static void write(std::ofstream& file, const T& value) {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool read(std::ifstream& file, T& value) {
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    Format m_format = Format::RGBA8;
+    Usage m_usage = Usage::Color;
+    std::vector<Level> m_levels;
+};
@@ -16,6 +16,25 @@ struct Mesh {
         rv::BufferHandle indexBuffer;
         uint32_t vertexCount;
         uint32_t triangleCount;
+
+        // CPU 側のコピー (発光三角形のサンプリング用)
+        // 発光しないメッシュの分は Scene::createLightBuffers() で解放する
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+
+        void storeGeometry(const std::vector<rv::Vertex>& vertices,
+                           const std::vector<uint32_t>& srcIndices) {
+            positions.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++) {
+                positions[i] = vertices[i].pos;
+            }
+            indices = srcIndices;
+        }
+
+        void releaseGeometry() {
+            positions = {};
+            indices = {};
+        }
     };
 
     uint32_t getMaxVertexCount() const {
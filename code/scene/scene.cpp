@@ -1,8 +1,13 @@
 ﻿#include "scene.hpp"
 
+#include <stb_image.h>
+
+#include "../../shader/bsdf.h"
+#include "../loader/hdr_reader.hpp"
 #include "../loader/loader_gltf.hpp"
 #include "../loader/loader_json.hpp"
 #include "../loader/loader_obj.hpp"
+#include "../shader_variant.hpp"
 
 void Scene::initialize(const rv::Context& context,
                        const std::filesystem::path& scenePath,
@@ -13,6 +18,7 @@ void Scene::initialize(const rv::Context& context,
     loadFromFile(context, scenePath);
     createMaterialBuffer(context);
     createNodeDataBuffer(context);
+    createLightBuffers(context);
     createDummyTextures(context);
     m_camera.setAspect(width / static_cast<float>(height));
     spdlog::info("Load scene: {} ms", timer.elapsedInMilli());
@@ -63,6 +69,7 @@ void Scene::createNodeDataBuffer(const rv::Context& context) {
                                      ? mesh.materialIndex
                                      : node.overrideMaterialIndex;  // マテリアルオーバーライド
             data.normalMatrix = node.computeNormalMatrix(0);
+            data.prevTransformMatrix = node.computeTransformMatrix(0);
         }
         m_nodeData.push_back(data);
     }
@@ -75,8 +82,136 @@ void Scene::createNodeDataBuffer(const rv::Context& context) {
     m_nodeDataBuffer->copy(m_nodeData.data());
 }
 
+glm::vec3 Scene::getNodeEmission(const Node& node) const {
+    if (node.meshIndex == -1) {
+        return glm::vec3{0.0f};
+    }
+    const int materialIndex = node.overrideMaterialIndex == -1
+                                  ? m_meshes[node.meshIndex].materialIndex
+                                  : node.overrideMaterialIndex;
+    if (materialIndex == -1) {
+        return glm::vec3{0.0f};
+    }
+    // 透過 (非metallic) のマテリアルは base.rchit で emissive を無視するので光源にしない
+    const Material& material = m_materials[materialIndex];
+    if (material.metallicFactor == 0.0f && material.baseColorFactor.a < 1.0f) {
+        return glm::vec3{0.0f};
+    }
+    return material.emissiveFactor;
+}
+
+std::vector<LightSampler::Source> Scene::collectLightSources(int frame) {
+    std::vector<LightSampler::Source> sources;
+    for (const auto& node : m_nodes) {
+        const glm::vec3 emission = getNodeEmission(node);
+        if (LightSampler::computeLuminance(emission) <= 0.0f) {
+            continue;
+        }
+        const auto& keyFrame = m_meshes[node.meshIndex].getKeyFrameMesh(frame);
+        sources.push_back({
+            .transform = node.computeTransformMatrix(frame),
+            .positions = keyFrame.positions.data(),
+            .indices = keyFrame.indices.data(),
+            .triangleCount = static_cast<uint32_t>(keyFrame.indices.size() / 3),
+            .emission = emission,
+        });
+    }
+    return sources;
+}
+
+void Scene::createLightBuffers(const rv::Context& context) {
+    rv::CPUTimer timer;
+
+    // バッファはアニメーション中の最大の三角形数で確保する
+    std::vector<bool> isEmissiveMesh(m_meshes.size(), false);
+    uint32_t maxTriangleCount = 0;
+    const int maxFrame = static_cast<int>(getMaxFrame());
+    for (const auto& node : m_nodes) {
+        if (LightSampler::computeLuminance(getNodeEmission(node)) <= 0.0f) {
+            continue;
+        }
+        const auto& mesh = m_meshes[node.meshIndex];
+        isEmissiveMesh[node.meshIndex] = true;
+        maxTriangleCount += mesh.getMaxTriangleCount();
+        m_hasAnimatedLights = m_hasAnimatedLights || mesh.hasAnimation();
+        const glm::mat4 transform = node.computeTransformMatrix(0);
+        for (int frame = 1; frame < maxFrame && !m_hasAnimatedLights; frame++) {
+            m_hasAnimatedLights = node.computeTransformMatrix(frame) != transform;
+        }
+    }
+
+    // 発光しないメッシュの CPU 側の三角形は不要
+    for (size_t i = 0; i < m_meshes.size(); i++) {
+        if (!isEmissiveMesh[i]) {
+            for (auto& keyFrame : m_meshes[i].keyFrames) {
+                keyFrame.releaseGeometry();
+            }
+        }
+    }
+
+    m_lightTriangleCapacity = std::max(maxTriangleCount, 1u);
+    m_lightChunkCapacity =
+        (m_lightTriangleCapacity + LightSampler::kChunkSize - 1) / LightSampler::kChunkSize;
+    m_emissiveTriangleBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Storage,
+        .memory = rv::MemoryUsage::DeviceHost,
+        .size = sizeof(EmissiveTriangle) * m_lightTriangleCapacity,
+        .debugName = "emissiveTriangleBuffer",
+    });
+    m_lightChunkBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Storage,
+        .memory = rv::MemoryUsage::DeviceHost,
+        .size = sizeof(LightChunk) * m_lightChunkCapacity,
+        .debugName = "lightChunkBuffer",
+    });
+
+    m_lightFrame = -1;
+    updateLights(0);
+    spdlog::info("Emissive triangles: {} in {} chunks{}, {:.2f} ms",
+                 m_lightSampler.getTriangleCount(), m_lightSampler.getChunkCount(),
+                 m_hasAnimatedLights ? " (animated)" : "", timer.elapsedInMilli());
+}
+
+void Scene::updateLights(int frame) {
+    if (frame == m_lightFrame || (m_lightFrame != -1 && !m_hasAnimatedLights)) {
+        return;
+    }
+    m_lightSampler.build(collectLightSources(frame), &ThreadPool::getShared());
+    m_lightFrame = frame;
+
+    // バッファの大きさに合わせてコピーする
+    std::vector<EmissiveTriangle> triangles(m_lightTriangleCapacity);
+    std::vector<LightChunk> chunks(m_lightChunkCapacity);
+    std::ranges::copy(m_lightSampler.getTriangles(), triangles.begin());
+    std::ranges::copy(m_lightSampler.getChunks(), chunks.begin());
+    m_emissiveTriangleBuffer->copy(triangles.data());
+    m_lightChunkBuffer->copy(chunks.data());
+}
+
 void Scene::loadEnvLightTexture(const rv::Context& context, const std::filesystem::path& filepath) {
-    m_envLight.texture = rv::Image::loadFromFileHDR(context, filepath.string());
+    // サンプリングテーブルを作るために CPU 側でも画素が必要
+    if (filepath.extension() == ".hdr") {
+        // stb より速い並列のデコーダー (出力は同じ)
+        rv::CPUTimer timer;
+        const HdrReader reader{filepath};
+        const uint32_t width = reader.getWidth();
+        const uint32_t height = reader.getHeight();
+        const auto pixels =
+            std::make_unique_for_overwrite<float[]>(static_cast<size_t>(width) * height * 4);
+        reader.decode(pixels.get(), &ThreadPool::getShared());
+        spdlog::info("Decode HDR {}x{}: {:.2f} ms", width, height, timer.elapsedInMilli());
+        createEnvLightTexture(context, pixels.get(), width, height, 4, filepath);
+        return;
+    }
+    int width = 0;
+    int height = 0;
+    int channel = 0;
+    float* pixels = stbi_loadf(filepath.string().c_str(), &width, &height, &channel, 4);
+    if (!pixels) {
+        throw std::runtime_error("Failed to load env light texture: " + filepath.string());
+    }
+    createEnvLightTexture(context, pixels, width, height, 4, filepath);
+    stbi_image_free(pixels);
 }
 
 void Scene::createDummyTextures(const rv::Context& context) {
@@ -115,30 +250,88 @@ void Scene::createEnvLightTexture(const rv::Context& context,
                                   const float* data,
                                   uint32_t width,
                                   uint32_t height,
-                                  uint32_t channel) {
+                                  uint32_t channel,
+                                  const std::filesystem::path& source) {
+    // ミップマップ付きの RGBA16F / BC6H にする。ファイルから読んだものはキャッシュを使う
+    rv::CPUTimer timer;
+    const EnvTexture::Format format = m_envLight.textureFormat;
+    EnvTexture envTexture;
+    bool cached = false;
+    if (!source.empty()) {
+        const uint64_t sourceKey = EnvTexture::getSourceKey(source);
+        const std::filesystem::path cachePath = EnvTexture::getCachePath(source);
+        cached = envTexture.load(cachePath, sourceKey, format);
+        if (!cached) {
+            envTexture.build(data, width, height, channel, format, &ThreadPool::getShared());
+            envTexture.save(cachePath, sourceKey);
+        }
+    } else {
+        envTexture.build(data, width, height, channel, format, &ThreadPool::getShared());
+    }
+    spdlog::info("Env light texture {}x{} ({}, {} levels, {:.1f} MB, {}): {:.2f} ms", width,
+                 height, format == EnvTexture::Format::BC6H ? "BC6H" : "RGBA16F",
+                 envTexture.getLevelCount(), envTexture.getByteSize() / (1024.0 * 1024.0),
+                 cached ? "cached" : "built", timer.elapsedInMilli());
+
     m_envLight.texture = context.createImage({
         .usage = rv::ImageUsage::Sampled,
         .extent = {width, height, 1},
-        .format = channel == 3 ? vk::Format::eR32G32B32Sfloat : vk::Format::eR32G32B32A32Sfloat,
+        .format = format == EnvTexture::Format::BC6H ? vk::Format::eBc6HUfloatBlock
+                                                     : vk::Format::eR16G16B16A16Sfloat,
+        .mipLevels = envTexture.getLevelCount(),
         .viewInfo = rv::ImageViewCreateInfo{},
         .samplerInfo = rv::SamplerCreateInfo{},
         .debugName = "envLightTexture",
     });
 
+    // 全てのレベルを 1 つのステージングバッファに詰めて、レベルごとにコピーする
     rv::BufferHandle stagingBuffer = context.createBuffer({
         .usage = rv::BufferUsage::Staging,
         .memory = rv::MemoryUsage::Host,
-        .size = width * height * channel * sizeof(float),
+        .size = envTexture.getByteSize(),
         .debugName = "stagingBuffer",
     });
-    stagingBuffer->copy(data);
+    std::vector<uint8_t> bytes;
+    bytes.reserve(envTexture.getByteSize());
+    std::vector<vk::BufferImageCopy> regions;
+    for (uint32_t level = 0; level < envTexture.getLevelCount(); level++) {
+        const EnvTexture::Level& levelData = envTexture.getLevels()[level];
+        regions.push_back(vk::BufferImageCopy()
+                              .setBufferOffset(bytes.size())
+                              .setImageSubresource({vk::ImageAspectFlagBits::eColor, level, 0, 1})
+                              .setImageExtent({levelData.width, levelData.height, 1}));
+        bytes.insert(bytes.end(), levelData.data.begin(), levelData.data.end());
+    }
+    stagingBuffer->copy(bytes.data());
 
     context.oneTimeSubmit([&](auto commandBuffer) {
         const auto& texture = m_envLight.texture;
         commandBuffer->transitionLayout(texture, vk::ImageLayout::eTransferDstOptimal);
-        commandBuffer->copyBufferToImage(stagingBuffer, texture);
+        commandBuffer->commandBuffer.copyBufferToImage(stagingBuffer->getBuffer(),
+                                                       texture->getImage(),
+                                                       vk::ImageLayout::eTransferDstOptimal,
+                                                       regions);
         commandBuffer->transitionLayout(texture, vk::ImageLayout::eShaderReadOnlyOptimal);
     });
+
+    // Importance sampling table + SH9 (近似モードの打ち切り)
+    timer.restart();
+    EnvLightSampler sampler;
+    sampler.build(data, width, height, channel, &ThreadPool::getShared());
+    EnvLightSH sh;
+    sh.project(data, width, height, channel, &ThreadPool::getShared());
+    std::vector<float> tableData = sampler.getBufferData();
+    const std::vector<float> shData = sh.getBufferData();
+    tableData.insert(tableData.end(), shData.begin(), shData.end());
+    m_envLight.samplingBuffer = context.createBuffer({
+        .usage = rv::BufferUsage::Storage,
+        .memory = rv::MemoryUsage::DeviceHost,
+        .size = tableData.size() * sizeof(float),
+        .debugName = "envLightSamplingBuffer",
+    });
+    m_envLight.samplingBuffer->copy(tableData.data());
+    spdlog::info("Env light sampling table {}x{} and SH9: {:.2f} ms", sampler.getWidth(),
+                 sampler.getHeight(), timer.elapsedInMilli());
 }
 
 void Scene::buildAccels(const rv::Context& context) {
@@ -196,6 +389,7 @@ void Scene::updateAccelInstances(int frame) {
             }
 
             m_nodeData[i].normalMatrix = node.computeNormalMatrix(frame);
+            m_nodeData[i].prevTransformMatrix = node.computeTransformMatrix(std::max(frame - 1, 0));
             m_accelInstances.push_back({
                 .bottomAccel = m_bottomAccels[node.meshIndex],
                 .transform = node.computeTransformMatrix(frame),
@@ -220,6 +414,7 @@ void Scene::updateTopAccel(const rv::CommandBufferHandle& commandBuffer, int fra
     updateAccelInstances(frame);
     m_topAccel->updateInstances(m_accelInstances);
     m_nodeDataBuffer->copy(m_nodeData.data());
+    updateLights(frame);
     commandBuffer->updateTopAccel(m_topAccel);
 }
 
@@ -238,6 +433,11 @@ uint32_t Scene::getMaxFrame() const {
     return frame;
 }
 
+uint32_t Scene::getShaderFeatures() const {
+    return detectShaderFeatures(m_materials, m_infiniteLight.intensity > 0.0f,
+                                m_envLight.useTexture, m_lightSampler.getTriangleCount() > 0);
+}
+
 void Scene::update(glm::vec2 dragLeft, float scroll) {
     if (dragLeft != glm::vec2(0.0f) || scroll != 0.0f) {
         m_camera.processMouseDragLeft(dragLeft);
@@ -282,6 +482,11 @@ bool Scene::drawAttributes() {
         if (ImGui::SliderFloat("Env light intensity", &m_envLight.intensity, 0.0f, 10.0f)) {
             changed = true;
         }
+        // 0: 無効。プレビュー向けに深い拡散反射を SH の放射照度で打ち切る
+        if (ImGui::SliderInt("Env light approx depth", &m_envLight.approximateDepth, 0,
+                             PATH_MAX_DEPTH)) {
+            changed = true;
+        }
 
         // Infinite light
         if (ImGui::SliderFloat("Infinite light theta", &m_infiniteLight.theta, -1.0, 1.0)) {
@@ -2,6 +2,11 @@
 #include <glm/gtc/matrix_inverse.hpp>
 #include <reactive/reactive.hpp>
 
+#include "../post/denoiser.hpp"
+#include "env_light_sampler.hpp"
+#include "env_light_sh.hpp"
+#include "env_texture.hpp"
+#include "light_sampler.hpp"
 #include "mesh.hpp"
 #include "node.hpp"
 #include "physical_camera.hpp"
@@ -23,6 +28,10 @@ struct InfiniteLight {
 
 struct EnvironmentLight {
     rv::ImageHandle texture;
+    rv::BufferHandle samplingBuffer;  // EnvLightBuffer (EnvLightSampler, EnvLightSH)
+    EnvTexture::Format textureFormat = EnvTexture::Format::BC6H;
+    // この深さ以降の拡散反射は環境光の放射照度 (SH9、遮蔽なし) で打ち切る (0: 無効)
+    int approximateDepth = 0;
     glm::vec3 color = {0.0f, 0.0f, 0.0f};
     float intensity = 1.0f;
     float phi = 0.0f;
@@ -50,15 +59,19 @@ public:
 
     void createNodeDataBuffer(const rv::Context& context);
 
+    void createLightBuffers(const rv::Context& context);
+
     void loadEnvLightTexture(const rv::Context& context, const std::filesystem::path& filepath);
 
     void createDummyTextures(const rv::Context& context);
 
+    // source: 読み込んだファイル (空でなければテクスチャをソースの隣にキャッシュする)
     void createEnvLightTexture(const rv::Context& context,
                                const float* data,
                                uint32_t width,
                                uint32_t height,
-                               uint32_t channel);
+                               uint32_t channel,
+                               const std::filesystem::path& source = {});
 
     void buildAccels(const rv::Context& context);
 
@@ -72,10 +85,17 @@ public:
 
     void updateMaterialBuffer(const rv::CommandBufferHandle& commandBuffer);
 
+    void updateLights(int frame);
+
     uint32_t getMaxFrame() const;
 
+    // closest hit の variant に必要な機能 (shader_features.h)
+    uint32_t getShaderFeatures() const;
+
     const PhysicalCamera& getCamera() const { return m_camera; }
 
+    const DenoiserSettings& getDenoiserSettings() const { return m_denoiserSettings; }
+
     EnvironmentLight& getEnvironmentLight() { return m_envLight; }
 
     InfiniteLight& getInfiniteLight() { return m_infiniteLight; }
@@ -84,6 +104,12 @@ public:
 
     const rv::BufferHandle& getMaterialDataBuffer() const { return m_materialBuffer; }
 
+    const rv::BufferHandle& getEmissiveTriangleBuffer() const { return m_emissiveTriangleBuffer; }
+
+    const rv::BufferHandle& getLightChunkBuffer() const { return m_lightChunkBuffer; }
+
+    const LightSampler& getLightSampler() const { return m_lightSampler; }
+
     const rv::TopAccelHandle& getTopAccel() const { return m_topAccel; }
 
     const std::vector<rv::ImageHandle>& get2dTextures() const { return m_textures2d; }
@@ -95,11 +121,21 @@ public:
     bool drawAttributes();
 
 private:
+    // 発光しないノードは 0
+    glm::vec3 getNodeEmission(const Node& node) const;
+
+    // 発光するノードの三角形 (フレームの変換を適用する)
+    std::vector<LightSampler::Source> collectLightSources(int frame);
+
     //  Scene
     std::vector<Node> m_nodes;
     std::vector<Mesh> m_meshes;
     std::vector<rv::ImageHandle> m_textures2d;
     std::vector<rv::ImageHandle> m_textures3d;
+    // glTF / OBJ のテクスチャを BC7 / BC5 にする (TextureImporter)
+    bool m_compressTextures = true;
+    // 小さなテクスチャをアトラスに詰める (TextureAtlas)
+    bool m_packTextures = false;
 
     // Accel
     std::vector<rv::BottomAccelHandle> m_bottomAccels;
@@ -109,6 +145,13 @@ private:
     // Light
     EnvironmentLight m_envLight;
     InfiniteLight m_infiniteLight;
+    LightSampler m_lightSampler;
+    rv::BufferHandle m_emissiveTriangleBuffer;
+    rv::BufferHandle m_lightChunkBuffer;
+    uint32_t m_lightTriangleCapacity = 0;
+    uint32_t m_lightChunkCapacity = 0;
+    bool m_hasAnimatedLights = false;
+    int m_lightFrame = -1;
 
     // Buffer
     std::vector<NodeData> m_nodeData;
@@ -119,4 +162,7 @@ private:
 
     // Camera
     PhysicalCamera m_camera;
+
+    // Post process (headless only)
+    DenoiserSettings m_denoiserSettings;
 };
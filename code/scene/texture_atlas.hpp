@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../thread_pool.hpp"
+
+// 小さな 2D テクスチャを大きなアトラスに詰める (textures2d の数を減らす)
+// 各テクスチャはセル (kAlignment の倍数) に置き、周りをテクスチャ自身の反対側の texel で埋める
+// シェーダーは uv = rect.xy + fract(uv) * rect.zw で引くので、セルの中では repeat と同じになる
+// ミップマップはアトラス全体を 2x2 で縮小する。kLevelCount までなら、
+// 縮小しても隣のセルと混ざらず、余白が 1 texel 以上、BC のブロックがセルをまたがない
+class TextureAtlas {
+public:
+    struct Size {
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Placement {
+        uint32_t atlas;
+        // テクスチャの左上 (セルの左上 + kPadding)
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    // レベル 0 の余白 (レベル L では kPadding >> L)
+    static constexpr uint32_t kPadding = 8;
+    static constexpr uint32_t kLevelCount = 3;
+    // 最後のレベルでセルが 4x4 ブロックに揃う
+    static constexpr uint32_t kAlignment = 4 << (kLevelCount - 1);
+    // これより大きいテクスチャはそのまま使う
+    static constexpr uint32_t kMaxTextureSize = 512;
+
+    static bool canPack(uint32_t width, uint32_t height) {
+        return width > 0 && height > 0 && width <= kMaxTextureSize && height <= kMaxTextureSize;
+    }
+
+    static uint32_t getCellSize(uint32_t size) {
+        return (size + kPadding * 2 + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    // シェルフ (行) に高い順に並べる。入らなければ次のアトラスにする
+    // 結果は入力の順序だけで決まる (キャッシュのキーに使える)
+    void pack(const std::vector<Size>& sizes, uint32_t atlasSize) {
+        m_placements.assign(sizes.size(), {});
+        m_atlasSizes.clear();
+
+        std::vector<uint32_t> order(sizes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            const uint32_t heightA = getCellSize(sizes[a].height);
+            const uint32_t heightB = getCellSize(sizes[b].height);
+            if (heightA != heightB) {
+                return heightA > heightB;
+            }
+            return getCellSize(sizes[a].width) > getCellSize(sizes[b].width);
+        });
+
+        uint32_t shelfX = 0;
+        uint32_t shelfY = 0;
+        uint32_t shelfHeight = 0;
+        for (uint32_t index : order) {
+            const uint32_t cellWidth = getCellSize(sizes[index].width);
+            const uint32_t cellHeight = getCellSize(sizes[index].height);
+            if (m_atlasSizes.empty()) {
+                m_atlasSizes.push_back({0, 0});
+            }
+            if (shelfX + cellWidth > atlasSize) {
+                shelfX = 0;
+                shelfY += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (shelfY + cellHeight > atlasSize) {
+                m_atlasSizes.push_back({0, 0});
+                shelfX = 0;
+                shelfY = 0;
+                shelfHeight = 0;
+            }
+            const uint32_t atlas = static_cast<uint32_t>(m_atlasSizes.size() - 1);
+            m_placements[index] = {atlas, shelfX + kPadding, shelfY + kPadding,
+                                   sizes[index].width, sizes[index].height};
+            shelfX += cellWidth;
+            shelfHeight = std::max(shelfHeight, cellHeight);
+
+            // 使った範囲だけの大きさにする
+            Size& size = m_atlasSizes.back();
+            size.width = std::max(size.width, shelfX);
+            size.height = std::max(size.height, shelfY + cellHeight);
+        }
+    }
+
+    uint32_t getAtlasCount() const { return static_cast<uint32_t>(m_atlasSizes.size()); }
+
+    const Size& getAtlasSize(uint32_t atlas) const { return m_atlasSizes[atlas]; }
+
+    const std::vector<Placement>& getPlacements() const { return m_placements; }
+
+    // アトラスの UV での範囲 (xy: offset, zw: scale)
+    glm::vec4 getRect(uint32_t index) const {
+        const Placement& placement = m_placements[index];
+        const Size& size = m_atlasSizes[placement.atlas];
+        return {static_cast<float>(placement.x) / size.width,
+                static_cast<float>(placement.y) / size.height,
+                static_cast<float>(placement.width) / size.width,
+                static_cast<float>(placement.height) / size.height};
+    }
+
+    // pixels[i]: テクスチャ i の RGBA8 (このアトラスに置かれたものだけ参照する)
+    std::vector<uint8_t> compose(uint32_t atlas,
+                                 const std::vector<const uint8_t*>& pixels,
+                                 ThreadPool* pool) const {
+        const Size& size = m_atlasSizes[atlas];
+        std::vector<uint8_t> rgba(static_cast<size_t>(size.width) * size.height * 4, 0);
+        std::vector<uint32_t> members;
+        for (uint32_t i = 0; i < m_placements.size(); i++) {
+            if (m_placements[i].atlas == atlas) {
+                members.push_back(i);
+            }
+        }
+        const auto composeCell = [&](uint32_t member) {
+            const uint32_t index = members[member];
+            const Placement& placement = m_placements[index];
+            const uint32_t cellX = placement.x - kPadding;
+            const uint32_t cellY = placement.y - kPadding;
+            const uint32_t cellWidth = getCellSize(placement.width);
+            const uint32_t cellHeight = getCellSize(placement.height);
+            for (uint32_t y = 0; y < cellHeight; y++) {
+                // セルの端までテクスチャを繰り返す
+                const uint32_t sourceY =
+                    (y + placement.height - kPadding % placement.height) % placement.height;
+                for (uint32_t x = 0; x < cellWidth; x++) {
+                    const uint32_t sourceX =
+                        (x + placement.width - kPadding % placement.width) % placement.width;
+                    const uint8_t* src =
+                        pixels[index] +
+                        (static_cast<size_t>(sourceY) * placement.width + sourceX) * 4;
+                    uint8_t* dst =
+                        &rgba[(static_cast<size_t>(cellY + y) * size.width + cellX + x) * 4];
+                    std::copy(src, src + 4, dst);
+                }
+            }
+        };
+        const uint32_t count = static_cast<uint32_t>(members.size());
+        if (pool) {
+            pool->parallelFor(count, composeCell);
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                composeCell(i);
+            }
+        }
+        return rgba;
+    }
+
+private:
+    std::vector<Placement> m_placements;
+    std::vector<Size> m_atlasSizes;
+};
@@ -2,37 +2,189 @@
 
 #include <spdlog/spdlog.h>
 #include <cassert>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <reactive/Compiler/Compiler.hpp>
 
 #include "filepath.hpp"
+#include "thread_pool.hpp"
 
-inline bool shouldRecompile(const std::string& shaderFileName, const std::string& entryPoint) {
-    assert(!shaderFileName.empty());
-    auto glslFile = getShaderSourceDirectory() / shaderFileName;
-    if (!fs::exists(glslFile)) {
-        spdlog::warn("GLSL file doesn't exists: {}", glslFile.string());
-        return false;
+// シェーダーのビルド単位
+// defines が空でなければ、defines を定義して bodyFileName (#version を含まない) を include する
+// ステージのファイルを生成してコンパイルする (ステージは fileName の拡張子で決まる)
+struct ShaderSource {
+    std::string fileName;
+    std::string bodyFileName;
+    std::vector<std::string> defines;
+};
+
+// ソースと include するファイルの内容、define からハッシュを作り、SPIR-V を spv/cache/ に保存する
+// タイムスタンプに頼らないので、ソースと一致しない古い SPIR-V が使われることはない
+// 内容が同じなら別のビルドディレクトリやブランチの切り替え後でもキャッシュが使える
+class ShaderCache {
+public:
+    struct Statistics {
+        uint32_t hitCount = 0;
+        uint32_t compileCount = 0;
+        double milliseconds = 0.0;
+    };
+
+    static ShaderCache& getShared() {
+        static ShaderCache cache;
+        return cache;
     }
-    auto spvFile = getSpvFilePath(shaderFileName, entryPoint);
-    auto glslWriteTime = rv::Compiler::getLastWriteTimeWithIncludeFiles(glslFile);
-    return !fs::exists(spvFile) || glslWriteTime > fs::last_write_time(spvFile);
-}
 
-inline std::vector<uint32_t> compileShader(const std::string& shaderFileName,
-                                           const std::string& entryPoint) {
-    auto glslFile = getShaderSourceDirectory() / shaderFileName;
-    auto spvFile = getSpvFilePath(shaderFileName, entryPoint);
-    spdlog::info("Compile shader: {}", spvFile.string());
-    std::vector<uint32_t> spvCode = rv::Compiler::compileToSPV(glslFile.string());
-    rv::File::writeBinary(spvFile, spvCode);
-    return spvCode;
-}
+    // 足りない SPIR-V を並列にコンパイルする (起動時とシェーダーの再読み込み時)
+    Statistics build(const std::vector<ShaderSource>& sources) {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<uint8_t> compiled(sources.size(), 0);
+        const auto buildSource = [&](uint32_t i) { load(sources[i], &compiled[i]); };
+        ThreadPool::getShared().parallelFor(static_cast<uint32_t>(sources.size()), buildSource);
+
+        Statistics stats;
+        for (uint8_t c : compiled) {
+            (c ? stats.compileCount : stats.hitCount)++;
+        }
+        stats.milliseconds = std::chrono::duration<double, std::milli>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        spdlog::info("Shader cache: {} hits, {} compiled ({:.1f} ms)", stats.hitCount,
+                     stats.compileCount, stats.milliseconds);
+        return stats;
+    }
+
+    std::vector<uint32_t> get(const ShaderSource& source) { return load(source, nullptr); }
+
+    // ソースと include するファイルの内容、define のハッシュ
+    static uint64_t computeHash(const ShaderSource& source) {
+        uint64_t hash = kFnvOffset;
+        const auto append = [&hash](const std::string& text) {
+            for (const char c : text) {
+                hash = (hash ^ static_cast<uint8_t>(c)) * kFnvPrime;
+            }
+            hash = (hash ^ 0xff) * kFnvPrime;  // 区切り
+        };
+        append(kCacheVersion);
+        append(source.fileName);
+        for (const auto& define : source.defines) {
+            append(define);
+        }
+        const std::string& root = source.defines.empty() ? source.fileName : source.bodyFileName;
+        std::set<fs::path> visited;
+        appendSourceTree(getShaderSourceDirectory() / root, visited, append);
+        return hash;
+    }
+
+    // e.g. spv/cache/base_0123456789abcdef.rchit.spv
+    static fs::path getCachePath(const ShaderSource& source, uint64_t hash) {
+        const fs::path path = source.fileName;
+        return getSpvDirectory() / "cache" /
+               std::format("{}_{:016x}{}.spv", path.stem().string(), hash,
+                           path.extension().string());
+    }
 
-inline std::vector<uint32_t> readShader(const std::string& shaderFileName,
-                                        const std::string& entryPoint) {
-    auto glslFile = getShaderSourceDirectory() / shaderFileName;
-    auto spvFile = getSpvFilePath(shaderFileName, entryPoint);
-    std::vector<uint32_t> spvCode;
-    rv::File::readBinary(spvFile, spvCode);
-    return spvCode;
+private:
+    static constexpr uint64_t kFnvOffset = 0xcbf29ce484222325ull;
+    static constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+
+    // コンパイラや生成するラッパーの形式を変えたら更新する
+    static constexpr const char* kCacheVersion = "1";
+
+    template <typename Append>
+    static void appendSourceTree(const fs::path& file,
+                                 std::set<fs::path>& visited,
+                                 const Append& append) {
+        const fs::path path = file.lexically_normal();
+        if (!visited.insert(path).second) {
+            return;
+        }
+        std::ifstream stream{path};
+        if (!stream) {
+            throw std::runtime_error("Shader source doesn't exist: " + path.string());
+        }
+        std::stringstream buffer;
+        buffer << stream.rdbuf();
+        const std::string text = buffer.str();
+        append(fs::relative(path, getShaderSourceDirectory()).generic_string());
+        append(text);
+
+        // #include "..." は include するファイルからの相対パス
+        std::istringstream lines{text};
+        std::string line;
+        while (std::getline(lines, line)) {
+            const size_t directive = line.find_first_not_of(" \t");
+            if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0) {
+                continue;
+            }
+            const size_t first = line.find('"', directive);
+            const size_t last = line.find('"', first + 1);
+            if (first != std::string::npos && last != std::string::npos) {
+                const std::string name = line.substr(first + 1, last - first - 1);
+                appendSourceTree(path.parent_path() / name, visited, append);
+            }
+        }
+    }
+
+    std::vector<uint32_t> load(const ShaderSource& source, uint8_t* compiled) {
+        const uint64_t hash = computeHash(source);
+        {
+            std::lock_guard lock{m_mutex};
+            if (auto it = m_codes.find(hash); it != m_codes.end()) {
+                return it->second;
+            }
+        }
+
+        std::vector<uint32_t> spvCode;
+        const fs::path spvFile = getCachePath(source, hash);
+        if (fs::exists(spvFile)) {
+            rv::File::readBinary(spvFile, spvCode);
+        } else {
+            fs::create_directories(spvFile.parent_path());
+            const auto start = std::chrono::steady_clock::now();
+            fs::path glslFile = getShaderSourceDirectory() / source.fileName;
+            if (!source.defines.empty()) {
+                // ラッパーは spv/cache/ に置き、本体は絶対パスで include する
+                glslFile = spvFile.parent_path() / spvFile.stem();
+                std::ofstream file{glslFile};
+                file << "#version 460\n";
+                for (const auto& define : source.defines) {
+                    file << "#define " << define << "\n";
+                }
+                const fs::path body = getShaderSourceDirectory() / source.bodyFileName;
+                file << std::format("#include \"{}\"\n", body.generic_string());
+            }
+            spvCode = rv::Compiler::compileToSPV(glslFile.string());
+
+            // 途中で終了しても壊れたファイルが残らないように、書き終えてから置き換える
+            const fs::path tempFile = spvFile.string() + ".tmp";
+            rv::File::writeBinary(tempFile, spvCode);
+            fs::rename(tempFile, spvFile);
+            spdlog::info("Compile shader: {} ({:.1f} ms)", spvFile.filename().string(),
+                         std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count());
+            if (compiled) {
+                *compiled = 1;
+            }
+        }
+
+        std::lock_guard lock{m_mutex};
+        m_codes[hash] = spvCode;
+        return spvCode;
+    }
+
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> m_codes;
+};
+
+inline std::vector<uint32_t> readShader(const std::string& shaderFileName) {
+    assert(!shaderFileName.empty());
+    return ShaderCache::getShared().get({.fileName = shaderFileName});
 }
@@ -0,0 +1,65 @@
+#pragma once
+#include <format>
+#include <string>
+#include <vector>
+
+#include "../shader/share.h"
+#include "../shader/shader_features.h"
+#include "shader.hpp"
+
+// シーンに合わせた closest hit の variant (shader_features.h)
+// 使わない材質や光源の分岐をコンパイル時に外す。variant は機能のビットごとに SPIR-V をキャッシュする
+
+// マテリアルと光源から必要な機能を求める
+// テクスチャの alpha や metallic は係数を小さくするだけなので、係数で判定できる
+inline uint32_t detectShaderFeatures(const std::vector<Material>& materials,
+                                     bool hasInfiniteLight,
+                                     bool hasEnvLightTexture,
+                                     bool hasMeshLights) {
+    uint32_t features = 0;
+    for (const auto& material : materials) {
+        for (int index : {material.baseColorTextureIndex, material.metallicRoughnessTextureIndex}) {
+            if (index != -1) {
+                features |= index < TEXTURE_TYPE_OFFSET ? SHADER_FEATURE_TEXTURE_2D
+                                                        : SHADER_FEATURE_TEXTURE_3D;
+            }
+        }
+        if (material.metallicFactor > 0.0f) {
+            features |= SHADER_FEATURE_METAL;
+        }
+        // metallic のテクスチャで 0 になるとガラスの分岐に入るので metallic によらない
+        if (material.baseColorFactor.a < 1.0f) {
+            features |= SHADER_FEATURE_GLASS;
+            if (material.dispersion > 0.0f) {
+                features |= SHADER_FEATURE_DISPERSION;
+            }
+        }
+    }
+    if (hasInfiniteLight) {
+        features |= SHADER_FEATURE_INFINITE_LIGHT;
+    }
+    if (hasEnvLightTexture) {
+        features |= SHADER_FEATURE_ENV_LIGHT;
+    }
+    if (hasMeshLights) {
+        features |= SHADER_FEATURE_MESH_LIGHT;
+    }
+    return features;
+}
+
+inline std::string getShaderVariantKey(uint32_t features) {
+    return std::format("{:02x}", features);
+}
+
+// closest_hit.glsl を SHADER_FEATURES を定義して include する base.rchit の variant
+// 全ての機能なら base.rchit そのもの。SPIR-V は ShaderCache が define を含めたハッシュでキャッシュする
+inline ShaderSource getShaderVariantSource(uint32_t features) {
+    if (features == SHADER_FEATURES_ALL) {
+        return {.fileName = "base.rchit"};
+    }
+    return {
+        .fileName = "base.rchit",
+        .bodyFileName = "closest_hit.glsl",
+        .defines = {"SHADER_FEATURES 0x" + getShaderVariantKey(features)},
+    };
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// 4-wide float vector for the CPU-side image passes (SSE2, or scalar fallback)
+// Loads and stores are unaligned so that readback buffers can be used directly.
+// M4 is a per-lane mask from comparisons (for select())
+// Rounding to integers is to nearest even in both paths (cvtps / lrintf)
+namespace simd {
+#ifdef SIMD_SSE2
+struct F4 {
+    __m128 v;
+};
+struct M4 {
+    __m128 v;
+};
+inline F4 operator+(F4 a, F4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline F4 operator-(F4 a, F4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline F4 operator*(F4 a, F4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline F4 operator/(F4 a, F4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline F4 min(F4 a, F4 b) { return {_mm_min_ps(a.v, b.v)}; }
+inline F4 max(F4 a, F4 b) { return {_mm_max_ps(a.v, b.v)}; }
+inline F4 splat(float x) { return {_mm_set1_ps(x)}; }
+inline F4 set(float x, float y, float z, float w) { return {_mm_setr_ps(x, y, z, w)}; }
+inline F4 load(const float* p) { return {_mm_loadu_ps(p)}; }
+inline void store(float* p, F4 a) { _mm_storeu_ps(p, a.v); }
+// 4 bytes -> 4 floats
+inline F4 loadBytes(const uint8_t* p) {
+    int32_t bytes;
+    std::memcpy(&bytes, p, sizeof(bytes));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+    return {_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero))};
+}
+// 4 RGBA8 pixels -> r, g, b (alpha is ignored)
+inline void loadRGB(const uint8_t* p, F4& r, F4& g, F4& b) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    r = {_mm_cvtepi32_ps(_mm_and_si128(px, mask))};
+    g = {_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask))};
+    b = {_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask))};
+}
+inline void storeRounded(int32_t* p, F4 a) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvtps_epi32(a.v));
+}
+// 4 floats -> 4 bytes (rounded, saturated to [0, 255])
+inline void storeBytes(uint8_t* p, F4 a) {
+    const __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a.v), _mm_setzero_si128());
+    const int32_t bytes = _mm_cvtsi128_si32(_mm_packus_epi16(packed, packed));
+    std::memcpy(p, &bytes, sizeof(bytes));
+}
+inline float get(F4 a, int i) {
+    alignas(16) float v[4];
+    _mm_store_ps(v, a.v);
+    return v[i];
+}
+// x + y + z (w is ignored)
+inline float sum3(F4 a) {
+    const __m128 y = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 z = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(a.v, y), z));
+}
+inline F4 abs(F4 a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+// {a0 + a1, a2 + a3, b0 + b1, b2 + b3}
+inline F4 addPairs(F4 a, F4 b) {
+    return {_mm_add_ps(_mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(2, 0, 2, 0)),
+                       _mm_shuffle_ps(a.v, b.v, _MM_SHUFFLE(3, 1, 3, 1)))};
+}
+// rows a, b, c, d -> columns
+inline void transpose(F4& a, F4& b, F4& c, F4& d) { _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v); }
+// |a| < 2^31
+inline F4 floor(F4 a) {
+    const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return {_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f)))};
+}
+// 2^n for integral n in [-126, 127]
+inline F4 exp2i(F4 n) {
+    const __m128i bits = _mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127));
+    return {_mm_castsi128_ps(_mm_slli_epi32(bits, 23))};
+}
+inline M4 operator<(F4 a, F4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline M4 operator<=(F4 a, F4 b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline M4 operator>(F4 a, F4 b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+inline M4 operator&(M4 a, M4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline bool any(M4 m) { return _mm_movemask_ps(m.v) != 0; }
+// m ? a : b
+inline F4 select(M4 m, F4 a, F4 b) {
+    return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+}
+#else
+struct F4 {
+    float v[4];
+};
+struct M4 {
+    bool v[4];
+};
+template <typename Op>
+inline F4 apply(F4 a, F4 b, Op op) {
+    return {op(a.v[0], b.v[0]), op(a.v[1], b.v[1]), op(a.v[2], b.v[2]), op(a.v[3], b.v[3])};
+}
+inline F4 operator+(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+inline F4 operator-(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+inline F4 operator*(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+inline F4 operator/(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+inline F4 min(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return std::min(x, y); }); }
+inline F4 max(F4 a, F4 b) { return apply(a, b, [](float x, float y) { return std::max(x, y); }); }
+inline F4 splat(float x) { return {x, x, x, x}; }
+inline F4 set(float x, float y, float z, float w) { return {x, y, z, w}; }
+inline F4 load(const float* p) { return {p[0], p[1], p[2], p[3]}; }
+inline void store(float* p, F4 a) { std::memcpy(p, a.v, sizeof(a.v)); }
+inline F4 loadBytes(const uint8_t* p) {
+    return {static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2]),
+            static_cast<float>(p[3])};
+}
+inline void loadRGB(const uint8_t* p, F4& r, F4& g, F4& b) {
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = p[i * 4 + 0];
+        g.v[i] = p[i * 4 + 1];
+        b.v[i] = p[i * 4 + 2];
+    }
+}
+inline void storeRounded(int32_t* p, F4 a) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<int32_t>(std::lrintf(a.v[i]));
+    }
+}
+inline void storeBytes(uint8_t* p, F4 a) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<uint8_t>(std::clamp(std::lrintf(a.v[i]), 0l, 255l));
+    }
+}
+inline float get(F4 a, int i) { return a.v[i]; }
+inline float sum3(F4 a) { return a.v[0] + a.v[1] + a.v[2]; }
+inline F4 abs(F4 a) {
+    return {std::abs(a.v[0]), std::abs(a.v[1]), std::abs(a.v[2]), std::abs(a.v[3])};
+}
+inline F4 addPairs(F4 a, F4 b) {
+    return {a.v[0] + a.v[1], a.v[2] + a.v[3], b.v[0] + b.v[1], b.v[2] + b.v[3]};
+}
+inline void transpose(F4& a, F4& b, F4& c, F4& d) {
+    F4* rows[4] = {&a, &b, &c, &d};
+    for (int i = 0; i < 4; i++) {
+        for (int j = i + 1; j < 4; j++) {
+            std::swap(rows[i]->v[j], rows[j]->v[i]);
+        }
+    }
+}
+inline F4 floor(F4 a) {
+    return {std::floor(a.v[0]), std::floor(a.v[1]), std::floor(a.v[2]), std::floor(a.v[3])};
+}
+inline F4 exp2i(F4 n) {
+    return {std::ldexp(1.0f, static_cast<int>(n.v[0])), std::ldexp(1.0f, static_cast<int>(n.v[1])),
+            std::ldexp(1.0f, static_cast<int>(n.v[2])), std::ldexp(1.0f, static_cast<int>(n.v[3]))};
+}
+template <typename Op>
+inline M4 compare(F4 a, F4 b, Op op) {
+    return {op(a.v[0], b.v[0]), op(a.v[1], b.v[1]), op(a.v[2], b.v[2]), op(a.v[3], b.v[3])};
+}
+inline M4 operator<(F4 a, F4 b) { return compare(a, b, [](float x, float y) { return x < y; }); }
+inline M4 operator<=(F4 a, F4 b) { return compare(a, b, [](float x, float y) { return x <= y; }); }
+inline M4 operator>(F4 a, F4 b) { return compare(a, b, [](float x, float y) { return x > y; }); }
+inline M4 operator&(M4 a, M4 b) {
+    return {a.v[0] && b.v[0], a.v[1] && b.v[1], a.v[2] && b.v[2], a.v[3] && b.v[3]};
+}
+inline bool any(M4 m) { return m.v[0] || m.v[1] || m.v[2] || m.v[3]; }
+inline F4 select(M4 m, F4 a, F4 b) {
+    return {m.v[0] ? a.v[0] : b.v[0], m.v[1] ? a.v[1] : b.v[1], m.v[2] ? a.v[2] : b.v[2],
+            m.v[3] ? a.v[3] : b.v[3]};
+}
+#endif
+
+inline float dot3(F4 a, F4 b) {
+    return sum3(a * b);
+}
+}  // namespace simd
@@ -0,0 +1,73 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "../shader/sampler.h"
+
+// Owen-scrambled Sobol sequence (CPU side of random.glsl)
+// generateMatrices() は GPU に SobolBuffer としてアップロードするテーブルを作る
+class SobolSampler {
+public:
+    SobolSampler() : m_matrices{generateMatrices()} {}
+
+    // Sobol generator matrices, [dimension * SOBOL_BITS + bit] (direction numbers, Joe & Kuo)
+    static std::vector<uint32_t> generateMatrices() {
+        // primitive polynomial (degree s, coefficients a) and initial m_k for dimensions 1..
+        struct DirectionNumbers {
+            uint32_t s;
+            uint32_t a;
+            std::array<uint32_t, 3> m;
+        };
+        constexpr std::array<DirectionNumbers, SOBOL_DIMENSIONS - 1> kDirectionNumbers = {{
+            {1, 0, {1, 0, 0}},
+            {2, 1, {1, 3, 0}},
+            {3, 1, {1, 3, 1}},
+        }};
+
+        std::vector<uint32_t> matrices(SOBOL_DIMENSIONS * SOBOL_BITS);
+        // dimension 0: van der Corput
+        for (uint32_t bit = 0; bit < SOBOL_BITS; bit++) {
+            matrices[bit] = 1u << (31 - bit);
+        }
+        for (uint32_t dim = 1; dim < SOBOL_DIMENSIONS; dim++) {
+            const auto& [s, a, m] = kDirectionNumbers[dim - 1];
+            uint32_t* v = matrices.data() + dim * SOBOL_BITS;
+            for (uint32_t k = 0; k < SOBOL_BITS; k++) {
+                if (k < s) {
+                    v[k] = m[k] << (31 - k);
+                    continue;
+                }
+                v[k] = v[k - s] ^ (v[k - s] >> s);
+                for (uint32_t j = 1; j < s; j++) {
+                    v[k] ^= ((a >> (s - 1 - j)) & 1u) * v[k - j];
+                }
+            }
+        }
+        return matrices;
+    }
+
+    // random.glsl: rand() with SAMPLER_SOBOL
+    float sample(uint32_t index, uint32_t dimension, uint32_t seed) const {
+        const uint32_t shuffled = sampler::shuffleSampleIndex(index, dimension, seed);
+        return sampler::scrambleSobol(sobol(shuffled, dimension % SOBOL_DIMENSIONS), dimension,
+                                      seed);
+    }
+
+    // Unscrambled Sobol point (32-bit fixed point)
+    uint32_t sobol(uint32_t index, uint32_t dimension) const {
+        uint32_t x = 0;
+        const uint32_t* v = m_matrices.data() + dimension * SOBOL_BITS;
+        for (uint32_t bit = 0; index != 0; bit++, index >>= 1) {
+            if (index & 1u) {
+                x ^= v[bit];
+            }
+        }
+        return x;
+    }
+
+    const std::vector<uint32_t>& getMatrices() const { return m_matrices; }
+
+private:
+    std::vector<uint32_t> m_matrices;
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "../shader/spectrum.h"
+
+// 波長 -> 線形 sRGB の応答 (spectrum.glsl の CPU 側)
+// build() は GPU に SpectrumBuffer としてアップロードするテーブルを作る
+// CIE 1931 の等色関数を sRGB にして負の値を 0 にし、平坦なスペクトルが白 (1, 1, 1) になるように
+// チャンネルごとに正規化する (分散のないパスの RGB と明るさ・色が揃う)
+// 波長は RGB の応答の和に比例してサンプルする (一様だと青や赤の狭い山で分散が大きくなる)
+class SpectrumTable {
+public:
+    SpectrumTable() : m_table{build()} {}
+
+    // [SPECTRUM_TABLE_SIZE], rgb: response, a: inverse CDF of the wavelength sampling
+    static std::vector<glm::vec4> build() {
+        std::vector<glm::vec4> table(SPECTRUM_TABLE_SIZE);
+        glm::dvec3 sum{0.0};
+        for (int i = 0; i < SPECTRUM_TABLE_SIZE; i++) {
+            const float wavelength =
+                SPECTRUM_MIN_WAVELENGTH +
+                (SPECTRUM_MAX_WAVELENGTH - SPECTRUM_MIN_WAVELENGTH) * i / (SPECTRUM_TABLE_SIZE - 1);
+            const glm::dvec3 xyz = computeCieXyz(wavelength);
+            const glm::dvec3 rgb = {
+                3.2404542 * xyz.x - 1.5371385 * xyz.y - 0.4985314 * xyz.z,
+                -0.9692660 * xyz.x + 1.8760108 * xyz.y + 0.0415560 * xyz.z,
+                0.0556434 * xyz.x - 0.2040259 * xyz.y + 1.0572252 * xyz.z,
+            };
+            table[i] = glm::vec4{glm::max(glm::vec3{rgb}, glm::vec3{0.0f}), 0.0f};
+
+            // 線形補間した関数の平均 (台形公式)
+            const double weight = (i == 0 || i == SPECTRUM_TABLE_SIZE - 1) ? 0.5 : 1.0;
+            sum += weight * glm::dvec3{table[i]};
+        }
+        const glm::dvec3 mean = sum / static_cast<double>(SPECTRUM_TABLE_SIZE - 1);
+        for (auto& entry : table) {
+            entry = glm::vec4{glm::dvec3{entry} / mean, 0.0};
+        }
+
+        // サンプリングの密度 (応答の和、線形補間) の CDF を細かく積分して逆関数を表にする
+        constexpr int kStepCount = 64 * (SPECTRUM_TABLE_SIZE - 1);
+        std::vector<double> cdf(kStepCount + 1, 0.0);
+        const auto density = [&](int step) {
+            const int i = step / 64;
+            const double t = (step % 64) / 64.0;
+            const glm::vec4& a = table[i];
+            const glm::vec4& b = table[std::min(i + 1, SPECTRUM_TABLE_SIZE - 1)];
+            return (1.0 - t) * (a.r + a.g + a.b) + t * (b.r + b.g + b.b);
+        };
+        for (int step = 0; step < kStepCount; step++) {
+            cdf[step + 1] = cdf[step] + 0.5 * (density(step) + density(step + 1));
+        }
+        int step = 0;
+        for (int i = 0; i < SPECTRUM_TABLE_SIZE; i++) {
+            const double u = cdf.back() * i / (SPECTRUM_TABLE_SIZE - 1);
+            while (step < kStepCount - 1 && cdf[step + 1] < u) {
+                step++;
+            }
+            const double t = std::clamp((u - cdf[step]) / (cdf[step + 1] - cdf[step]), 0.0, 1.0);
+            const double x = (step + t) / kStepCount;
+            table[i].a = static_cast<float>(
+                SPECTRUM_MIN_WAVELENGTH + (SPECTRUM_MAX_WAVELENGTH - SPECTRUM_MIN_WAVELENGTH) * x);
+        }
+        return table;
+    }
+
+    // spectrum.glsl sampleHeroWavelengths()
+    glm::vec4 sampleHeroWavelengths(float u, glm::vec4& weights) const {
+        const float scale = static_cast<float>(SPECTRUM_TABLE_SIZE - 1);
+        glm::vec4 wavelengths;
+        for (int i = 0; i < SPECTRUM_WAVELENGTHS; i++) {
+            const float shifted = u + static_cast<float>(i) / SPECTRUM_WAVELENGTHS;
+            const float x = (shifted - std::floor(shifted)) * scale;
+            const int k = std::min(static_cast<int>(x), SPECTRUM_TABLE_SIZE - 2);
+            const float l0 = m_table[k].a;
+            const float l1 = m_table[k + 1].a;
+            wavelengths[i] = l0 + (l1 - l0) * (x - k);
+            weights[i] = (l1 - l0) * scale / (SPECTRUM_MAX_WAVELENGTH - SPECTRUM_MIN_WAVELENGTH);
+        }
+        return wavelengths;
+    }
+
+    // spectrum.glsl getSpectrumRgb()
+    glm::vec3 getRgb(float wavelength) const {
+        const float x = std::clamp(spectrum::getSpectrumTableCoordinate(wavelength), 0.0f,
+                                   static_cast<float>(SPECTRUM_TABLE_SIZE - 1));
+        const int i = std::min(static_cast<int>(x), SPECTRUM_TABLE_SIZE - 2);
+        const float t = x - i;
+        return glm::vec3{m_table[i]} * (1.0f - t) + glm::vec3{m_table[i + 1]} * t;
+    }
+
+    // spectrum.glsl spectrumToRgb()
+    glm::vec3 toRgb(const glm::vec4& wavelengths, const glm::vec4& weights) const {
+        glm::vec3 rgb{0.0f};
+        for (int i = 0; i < SPECTRUM_WAVELENGTHS; i++) {
+            if (weights[i] != 0.0f) {
+                rgb += weights[i] * getRgb(wavelengths[i]);
+            }
+        }
+        return rgb / static_cast<float>(SPECTRUM_WAVELENGTHS);
+    }
+
+    const std::vector<glm::vec4>& getTable() const { return m_table; }
+
+private:
+    // CIE 1931 2° color matching functions
+    // Wyman et al. 2013, "Simple Analytic Approximations to the CIE XYZ Color Matching Functions"
+    static glm::dvec3 computeCieXyz(double wavelength) {
+        const auto lobe = [wavelength](double mu, double sigma1, double sigma2) {
+            const double t = (wavelength - mu) / (wavelength < mu ? sigma1 : sigma2);
+            return std::exp(-0.5 * t * t);
+        };
+        return {
+            1.056 * lobe(599.8, 37.9, 31.0) + 0.362 * lobe(442.0, 16.0, 26.7) -
+                0.065 * lobe(501.1, 20.4, 26.2),
+            0.821 * lobe(568.8, 46.9, 40.5) + 0.286 * lobe(530.9, 16.3, 31.1),
+            1.217 * lobe(437.0, 11.8, 36.0) + 0.681 * lobe(459.0, 26.0, 13.8),
+        };
+    }
+
+    std::vector<glm::vec4> m_table;
+};
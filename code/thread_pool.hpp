@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+public:
+    explicit ThreadPool(uint32_t threadCount = getDefaultThreadCount()) {
+        threadCount = std::max(threadCount, 1u);
+        m_threads.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++) {
+            m_threads.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock{m_mutex};
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        for (auto& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Func>
+    auto submit(Func&& func) -> std::future<std::invoke_result_t<Func>> {
+        using Result = std::invoke_result_t<Func>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+        std::future<Result> future = task->get_future();
+        {
+            std::lock_guard lock{m_mutex};
+            m_tasks.emplace_back([task] { (*task)(); });
+        }
+        m_condition.notify_one();
+        return future;
+    }
+
+    // func(i) を [0, count) について並列に呼ぶ
+    // 呼び出し元スレッドも処理に参加するため、ワーカー内から呼んでもデッドロックしない
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& func) {
+        if (count == 0) {
+            return;
+        }
+        if (count == 1 || m_threads.size() == 1) {
+            for (uint32_t i = 0; i < count; i++) {
+                func(i);
+            }
+            return;
+        }
+
+        struct State {
+            std::atomic<uint32_t> next{0};
+            std::atomic<uint32_t> done{0};
+            uint32_t count = 0;
+            const std::function<void(uint32_t)>* func = nullptr;
+            std::mutex mutex;
+            std::condition_variable finished;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        state->count = count;
+        state->func = &func;
+
+        // 残りの処理がなくなった時点で func は参照されなくなるので、
+        // 遅れて起動したヘルパーが呼び出し元のスタックに触れることはない
+        auto drain = [](State& s) {
+            uint32_t index;
+            while ((index = s.next.fetch_add(1)) < s.count) {
+                try {
+                    (*s.func)(index);
+                } catch (...) {
+                    std::lock_guard lock{s.mutex};
+                    if (!s.error) {
+                        s.error = std::current_exception();
+                    }
+                }
+                if (s.done.fetch_add(1) + 1 == s.count) {
+                    std::lock_guard lock{s.mutex};
+                    s.finished.notify_all();
+                }
+            }
+        };
+
+        const uint32_t helperCount =
+            std::min(count - 1, static_cast<uint32_t>(m_threads.size()));
+        {
+            std::lock_guard lock{m_mutex};
+            for (uint32_t i = 0; i < helperCount; i++) {
+                m_tasks.emplace_back([state, drain] { drain(*state); });
+            }
+        }
+        m_condition.notify_all();
+
+        drain(*state);
+
+        std::unique_lock lock{state->mutex};
+        state->finished.wait(lock, [&] { return state->done.load() == state->count; });
+        if (state->error) {
+            std::rethrow_exception(state->error);
+        }
+    }
+
+    uint32_t getThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+    static uint32_t getDefaultThreadCount() {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    // CPU側の後処理やテーブル構築で共有するプール
+    static ThreadPool& getShared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock{m_mutex};
+                m_condition.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_stopping && m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+};
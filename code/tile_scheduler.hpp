@@ -0,0 +1,134 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "../shader/convergence.h"
+
+// 適応サンプリングのタイルスケジューラー
+// GPU (convergence.comp) がタイルごとの相対誤差を書き込み、ここで閾値を超えたタイルだけを
+// 次のパスでトレースするマスクを作る。全タイルが収束したらそのフレームは完了
+class TileScheduler {
+public:
+    struct Settings {
+        float threshold = 0.02f;  // relative standard error of the mean luminance
+        uint32_t maxPasses = 64;  // per frame, including the first full pass
+    };
+
+    struct Statistics {
+        uint32_t passes = 0;
+        uint64_t tracedTiles = 0;  // summed over passes
+        uint32_t convergedTiles = 0;
+        float maxError = 0.0f;
+        float meanError = 0.0f;
+    };
+
+    TileScheduler() = default;
+
+    TileScheduler(uint32_t width, uint32_t height, const Settings& settings)
+        : m_tileCountX{computeTileCount(width)},
+          m_tileCountY{computeTileCount(height)},
+          m_settings{settings} {
+        reset();
+    }
+
+    static uint32_t computeTileCount(uint32_t size) {
+        return (size + CONVERGENCE_TILE_SIZE - 1) / CONVERGENCE_TILE_SIZE;
+    }
+
+    // 蓄積がリセットされた: 全タイルをトレースし直す
+    void reset() {
+        m_tileMask.assign(getTileCount(), 1);
+        m_activeTileCount = getTileCount();
+    }
+
+    // フレームの統計を開始する。蓄積をやり直してから呼ぶ (Renderer::restartAccumulation())
+    // 前のフレームで収束したタイルのマスクを残すと、動いた物体がトレースされない
+    void beginFrame() { m_statistics = {}; }
+
+    // 直前のパスでトレースしたタイルを数え、その結果の誤差から次のパスのマスクを作る
+    void update(const float* tileErrors) {
+        m_statistics.passes++;
+        m_statistics.tracedTiles += m_activeTileCount;
+
+        double errorSum = 0.0;
+        float maxError = 0.0f;
+        m_activeTileCount = 0;
+        for (uint32_t tile = 0; tile < getTileCount(); tile++) {
+            const bool active = tileErrors[tile] > m_settings.threshold;
+            m_tileMask[tile] = static_cast<uint32_t>(active);
+            m_activeTileCount += static_cast<uint32_t>(active);
+            errorSum += tileErrors[tile];
+            maxError = std::max(maxError, tileErrors[tile]);
+        }
+        m_statistics.convergedTiles = getTileCount() - m_activeTileCount;
+        m_statistics.maxError = maxError;
+        m_statistics.meanError = static_cast<float>(errorSum / getTileCount());
+    }
+
+    // 全タイルが収束したか、パス数の上限に達した
+    bool isFrameDone() const {
+        return m_activeTileCount == 0 || m_statistics.passes >= m_settings.maxPasses;
+    }
+
+    void logStatistics(int frame) const {
+        const uint32_t tileCount = getTileCount();
+        const double fullCost = static_cast<double>(m_statistics.passes) * tileCount;
+        spdlog::info(
+            "Convergence {}: {} passes, {}/{} tiles converged, error mean {:.4f} / max {:.4f}, "
+            "traced {:.1f}% of uniform",
+            frame, m_statistics.passes, m_statistics.convergedTiles, tileCount,
+            m_statistics.meanError, m_statistics.maxError,
+            fullCost > 0.0 ? 100.0 * m_statistics.tracedTiles / fullCost : 0.0);
+    }
+
+    // CPU reference of convergence.comp. stats: RGBA32F (see convergence.h)
+    static void computeTileErrors(const float* stats,
+                                  uint32_t width,
+                                  uint32_t height,
+                                  float* tileErrors) {
+        const uint32_t tileCountX = computeTileCount(width);
+        const uint32_t tileCountY = computeTileCount(height);
+        for (uint32_t ty = 0; ty < tileCountY; ty++) {
+            for (uint32_t tx = 0; tx < tileCountX; tx++) {
+                const uint32_t x0 = tx * CONVERGENCE_TILE_SIZE;
+                const uint32_t y0 = ty * CONVERGENCE_TILE_SIZE;
+                const uint32_t x1 = std::min(x0 + CONVERGENCE_TILE_SIZE, width);
+                const uint32_t y1 = std::min(y0 + CONVERGENCE_TILE_SIZE, height);
+                double squaredErrorSum = 0.0;
+                for (uint32_t y = y0; y < y1; y++) {
+                    for (uint32_t x = x0; x < x1; x++) {
+                        const float* pixel = stats + (static_cast<size_t>(y) * width + x) * 4;
+                        const float error = convergence::relativeError(
+                            {pixel[0], pixel[1], pixel[2], pixel[3]});
+                        squaredErrorSum += error * error;
+                    }
+                }
+                const double pixelCount = static_cast<double>((x1 - x0) * (y1 - y0));
+                tileErrors[ty * tileCountX + tx] =
+                    static_cast<float>(std::sqrt(squaredErrorSum / pixelCount));
+            }
+        }
+    }
+
+    uint32_t getTileCountX() const { return m_tileCountX; }
+    uint32_t getTileCountY() const { return m_tileCountY; }
+    uint32_t getTileCount() const { return m_tileCountX * m_tileCountY; }
+
+    // 1: trace in the next pass, 0: converged
+    const std::vector<uint32_t>& getTileMask() const { return m_tileMask; }
+
+    const Settings& getSettings() const { return m_settings; }
+    const Statistics& getStatistics() const { return m_statistics; }
+
+private:
+    uint32_t m_tileCountX = 0;
+    uint32_t m_tileCountY = 0;
+    Settings m_settings;
+
+    std::vector<uint32_t> m_tileMask;
+    uint32_t m_activeTileCount = 0;
+    Statistics m_statistics;
+};
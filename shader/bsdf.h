@@ -0,0 +1,213 @@
+// ------------------------------
+// BSDF sampling and path termination (shared by base.rchit, base.rgen and the CPU bench)
+// ------------------------------
+// Directions are in the local shading frame (z: normal on the side of the incoming ray).
+// i: toward the previous vertex, o: sampled direction, m: half vector.
+// weight = f * cos / pdf. rgen multiplies it into the path throughput.
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <glm/glm.hpp>
+
+    #define BSDF_FUNC inline
+
+namespace bsdf {
+using vec2 = glm::vec2;
+using vec3 = glm::vec3;
+using vec4 = glm::vec4;
+using glm::abs;
+using glm::atan;
+using glm::clamp;
+using glm::cos;
+using glm::dot;
+using glm::max;
+using glm::pow;
+using glm::reflect;
+using glm::refract;
+using glm::sin;
+using glm::sqrt;
+using glm::step;
+#else
+    #define BSDF_FUNC /* nothing */
+#endif
+
+#define BSDF_PI 3.14159265358979
+
+// これ以上のバウンスは発光のみ返して終える
+#define PATH_MAX_DEPTH 24
+
+// ロシアンルーレット: この深さからスループットに比例した確率で打ち切る
+#define ROULETTE_START_DEPTH 3
+#define ROULETTE_MIN_PROBABILITY 0.05f
+
+struct BsdfSample {
+    vec3 direction;  // local
+    vec3 weight;     // f * cos / pdf
+    float pdf;       // solid angle pdf for MIS with light sampling (0: no MIS)
+};
+
+struct SpectralBsdfSample {
+    vec3 direction;  // local
+    vec4 weight;     // per wavelength (x: hero, spectrum.h)
+};
+
+BSDF_FUNC float cosTheta(vec3 w) {
+    return w.z;
+}
+
+BSDF_FUNC float cos2Theta(vec3 w) {
+    return w.z * w.z;
+}
+
+BSDF_FUNC float absCosTheta(vec3 w) {
+    return abs(w.z);
+}
+
+BSDF_FUNC float sin2Theta(vec3 w) {
+    return max(0.0f, 1.0f - cos2Theta(w));
+}
+
+BSDF_FUNC float sinTheta(vec3 w) {
+    return sqrt(sin2Theta(w));
+}
+
+BSDF_FUNC float tanTheta(vec3 w) {
+    return sinTheta(w) / (cosTheta(w) + 0.001f);
+}
+
+BSDF_FUNC float tan2Theta(vec3 w) {
+    return sin2Theta(w) / cos2Theta(w);
+}
+
+BSDF_FUNC float ggxGeometry1(vec3 v, vec3 m, float a) {
+    float t = tanTheta(v);
+    float x = step(0.0f, dot(v, m) / cosTheta(v));
+    return x * 2.0f / (1.0f + sqrt(1.0f + a * a * t * t));
+}
+
+BSDF_FUNC float ggxGeometry(vec3 i, vec3 o, vec3 m, float roughness) {
+    float a = roughness * roughness;
+    return ggxGeometry1(i, m, a) * ggxGeometry1(o, m, a);
+}
+
+BSDF_FUNC float fresnelSchlick(float mi, float F0) {
+    return F0 + (1.0f - F0) * pow(1.0f - mi, 5.0f);
+}
+
+BSDF_FUNC vec3 sampleGGX(float roughness, vec2 u) {
+    // NOTE: This function obeys D(m) * dot(m, n)
+    // NOTE: if roughness == 0.0, return vec3(0, 0, 1)
+    float alpha = roughness * roughness;
+    float theta = atan(alpha * sqrt(u.y) / sqrt(1.0f - u.y));
+    float phi = float(2.0 * BSDF_PI) * u.x;
+    return vec3(sin(phi) * sin(theta), cos(phi) * sin(theta), cos(theta));
+}
+
+// Lambert (cosine-weighted hemisphere)
+// Lo = Le + brdf * Li * cos / pdf = Le + (color / PI) * Li * cos / (cos / PI) = Le + color * Li
+BSDF_FUNC BsdfSample sampleDiffuseBsdf(vec3 baseColor, vec2 u) {
+    float phi = float(2.0 * BSDF_PI) * u.x;
+    float cosine = sqrt(1.0f - u.y);
+    float sine = sqrt(1.0f - cosine * cosine);
+
+    BsdfSample s;
+    s.direction = vec3(cos(phi) * sine, sin(phi) * sine, cosine);
+    s.weight = baseColor;
+    s.pdf = cosine / float(BSDF_PI);
+    return s;
+}
+
+// GGX reflection (Walter 2007). metallic は基本的に 2 値であると考えていい
+BSDF_FUNC BsdfSample sampleMetalBsdf(vec3 i, vec3 baseColor, float roughness, vec2 u) {
+    vec3 m = sampleGGX(roughness, u);
+    vec3 o = reflect(-i, m);
+    float ni = absCosTheta(i);
+    float nm = absCosTheta(m);
+    float mi = abs(dot(i, m));
+    float G = ggxGeometry(i, o, m, roughness);
+
+    BsdfSample s;
+    s.direction = o;
+    // NOTE: max(x, 0.1) is greatly affects the appearance.
+    // Smaller values make it too bright.
+    s.weight = baseColor * (G * mi / max(ni * nm, 0.1f));
+    s.pdf = 0.0f;
+    return s;
+}
+
+// Rough dielectric. eta = n1 / n2 (incoming side / other side)
+// u.z で反射か屈折かを Fresnel に比例して選ぶ (全反射なら常に反射)
+BSDF_FUNC BsdfSample sampleGlassBsdf(vec3 i, float roughness, float eta, vec3 u) {
+    vec3 m = sampleGGX(roughness, vec2(u.x, u.y));
+    vec3 o = refract(-i, m, eta);
+    float ni = absCosTheta(i);
+    float nm = absCosTheta(m);
+    float mi = abs(dot(i, m));
+
+    // if n = 1.5, F0 = 0.04
+    float F0 = ((1.0f - eta) * (1.0f - eta)) / ((1.0f + eta) * (1.0f + eta));
+    bool totalReflection = o == vec3(0.0f);
+    if (totalReflection || u.z < fresnelSchlick(mi, F0)) {
+        o = reflect(-i, m);
+    }
+
+    BsdfSample s;
+    s.direction = o;
+    s.weight = vec3(ggxGeometry(i, o, m, roughness) * mi / max(ni * nm, 0.1f));
+    s.pdf = 0.0f;
+    return s;
+}
+
+// Dispersive rough dielectric (hero wavelength sampling). eta: n1 / n2 per wavelength
+// 反射方向は波長によらないので全ての波長で使い、波長の MIS (balance heuristic) の重みをかける
+// 屈折方向は波長ごとに違うので hero 以外の波長を打ち切る
+// companions: companion 波長がまだ有効か (一度屈折したパスは hero のみ)
+BSDF_FUNC SpectralBsdfSample sampleDispersiveGlassBsdf(vec3 i,
+                                                      float roughness,
+                                                      vec4 eta,
+                                                      bool companions,
+                                                      vec3 u) {
+    vec3 m = sampleGGX(roughness, vec2(u.x, u.y));
+    float ni = absCosTheta(i);
+    float nm = absCosTheta(m);
+    float mi = abs(dot(i, m));
+
+    // 波長ごとの反射を選ぶ確率 (全反射なら 1)
+    vec4 reflectance;
+    for (int k = 0; k < 4; k++) {
+        float F0 = ((1.0f - eta[k]) * (1.0f - eta[k])) / ((1.0f + eta[k]) * (1.0f + eta[k]));
+        bool totalReflection = refract(-i, m, eta[k]) == vec3(0.0f);
+        reflectance[k] = totalReflection ? 1.0f : fresnelSchlick(mi, F0);
+    }
+
+    SpectralBsdfSample s;
+    if (u.z < reflectance.x) {
+        s.direction = reflect(-i, m);
+        float g = ggxGeometry(i, s.direction, m, roughness) * mi / max(ni * nm, 0.1f);
+        if (companions) {
+            s.weight = reflectance * (g / dot(reflectance, vec4(0.25f)));
+        } else {
+            s.weight = vec4(g, 0.0f, 0.0f, 0.0f);
+        }
+    } else {
+        s.direction = refract(-i, m, eta.x);
+        float g = ggxGeometry(i, s.direction, m, roughness) * mi / max(ni * nm, 0.1f);
+        s.weight = vec4(companions ? 4.0f * g : g, 0.0f, 0.0f, 0.0f);
+    }
+    return s;
+}
+
+// パスを続ける確率。浅いパスは常に続け、以降はスループットの最大成分に比例させる
+// 生き残ったパスのスループットをこの確率で割れば期待値は変わらない
+BSDF_FUNC float getRouletteProbability(vec3 throughput, int depth) {
+    if (depth < ROULETTE_START_DEPTH) {
+        return 1.0f;
+    }
+    float maxThroughput = max(throughput.x, max(throughput.y, throughput.z));
+    return clamp(maxThroughput, ROULETTE_MIN_PROBABILITY, 1.0f);
+}
+
+#ifdef __cplusplus
+}  // namespace bsdf
+#endif
@@ -0,0 +1,422 @@
+#extension GL_EXT_ray_tracing : enable
+#extension GL_EXT_debug_printf : enable
+
+// NOTE: ステージのファイル (base.rchit または生成された variant) から include する
+#include "./shader_features.h"
+#include "./share.h"
+#include "./random.glsl"
+#include "./bsdf.h"
+#include "./spectrum.h"
+#include "./color.glsl"
+#include "./env_light.glsl"
+#include "./mesh_light.glsl"
+
+layout(location = 0) rayPayloadInEXT HitPayload payload;
+layout(location = 1) rayPayloadEXT bool shadowed;
+
+hitAttributeEXT vec3 attribs;
+
+// Global space
+vec3 sampleHemisphereUniform(in vec3 normal, inout RandomState rng) {
+    float u = rand(rng);
+    float v = rand(rng);
+
+    float r = sqrt(1.0 - u * u);
+    float phi = 2.0 * PI * v;
+    
+    vec3 localDir;
+    localDir.x = cos(phi) * r;
+    localDir.y = sin(phi) * r;
+    localDir.z = u;
+
+    vec3 up = abs(normal.z) < 0.999 ? vec3(0,0,1) : vec3(1,0,0);
+    vec3 tangent = normalize(cross(up, normal));
+    vec3 bitangent = cross(normal, tangent);
+
+    vec3 sampledDir = localDir.x * tangent + localDir.y * bitangent + localDir.z * normal;
+    return normalize(sampledDir);
+}
+
+// Tangent space (Z-up)
+vec3 sampleHemisphereUniformLocal(inout RandomState rng) {
+    float u = rand(rng);
+    float v = rand(rng);
+
+    float r = sqrt(1.0 - u * u);
+    float phi = 2.0 * PI * v;
+    
+    vec3 localDir;
+    localDir.x = cos(phi) * r;
+    localDir.y = sin(phi) * r;
+    localDir.z = u;
+
+    return localDir;
+}
+
+vec3 sampleSphereUniformLocal(inout RandomState rng) {
+    float u = rand(rng);
+    float v = rand(rng);
+
+    float theta = 2.0 * PI * u;
+    float phi = acos(2.0 * v - 1.0);
+
+    vec3 localDir;
+    localDir.x = sin(phi) * cos(theta);
+    localDir.y = sin(phi) * sin(theta);
+    localDir.z = cos(phi);
+
+    return localDir;
+}
+
+vec3 localToWorld(in vec3 localDir, in vec3 normal) {
+    vec3 up = abs(normal.z) < 0.999 ? vec3(0,0,1) : vec3(1,0,0);
+    vec3 tangent = normalize(cross(up, normal));
+    vec3 bitangent = cross(normal, tangent);
+    return normalize(localDir.x * tangent + localDir.y * bitangent + localDir.z * normal);
+}
+
+vec3 worldToLocal(in vec3 worldDir, in vec3 normal) {
+    vec3 up = abs(normal.z) < 0.999 ? vec3(0,0,1) : vec3(1,0,0);
+    vec3 tangent = normalize(cross(up, normal));
+    vec3 bitangent = cross(normal, tangent);
+
+    vec3 localDir;
+    localDir.x = dot(worldDir, tangent);
+    localDir.y = dot(worldDir, bitangent);
+    localDir.z = dot(worldDir, normal);
+    return localDir;
+}
+
+void traceShadowRay(vec3 pos, vec3 direction, float tmin, float tmax){
+    traceRayEXT(
+        topLevelAS,
+        gl_RayFlagsTerminateOnFirstHitEXT | gl_RayFlagsOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT,
+        0xff, // cullMask
+        0,    // sbtRecordOffset
+        0,    // sbtRecordStride
+        1,    // missIndex
+        pos,
+        tmin,
+        direction,
+        tmax,
+        1     // payloadLocation
+    );
+}
+
+vec3 getInfiniteLightRadiance(vec3 pos) {
+    if (pc.infiniteLightIntensity == 0.0) {
+        return vec3(0.0);
+    }
+
+    shadowed = true;
+    traceShadowRay(pos, pc.infiniteLightDirection.xyz, 0.001, 1000.0);
+    if(shadowed){
+        return vec3(0.0);
+    }
+
+    // return Li
+    return pc.infiniteLightColor.xyz * pc.infiniteLightIntensity;
+}
+
+vec3 LambertBRDF(vec3 baseColor) {
+    return baseColor / PI;
+}
+
+// Material の *TextureRect でアトラス内の UV にする (アトラスでないテクスチャは (0, 0, 1, 1))
+// セルの余白はテクスチャの反対側なので、fract でも境界は repeat と同じようにフィルタされる
+vec2 getTextureUv(vec4 rect, vec2 texCoord) {
+    return rect.xy + fract(texCoord) * rect.zw;
+}
+
+// カメラから直接見えるヒットの、テクスチャによらない ray cones の LOD の項
+// log2(円錐の幅 / cos) + 0.5 log2(UV の面積 / 面積)
+float getPrimaryTextureFootprint(Vertex v0, Vertex v1, Vertex v2) {
+    vec3 edge1 = gl_ObjectToWorldEXT * vec4(v1.pos - v0.pos, 0.0);
+    vec3 edge2 = gl_ObjectToWorldEXT * vec4(v2.pos - v0.pos, 0.0);
+    vec3 faceNormal = cross(edge1, edge2);
+    float area = length(faceNormal);
+    vec2 uvEdge1 = v1.texCoord - v0.texCoord;
+    vec2 uvEdge2 = v2.texCoord - v0.texCoord;
+    float uvArea = abs(uvEdge1.x * uvEdge2.y - uvEdge1.y * uvEdge2.x);
+    float cosTheta = max(abs(dot(faceNormal / area, gl_WorldRayDirectionEXT)), 1e-4);
+    float coneWidth = getPrimaryPixelAngle() * gl_HitTEXT;
+    return log2(coneWidth / cosTheta) + 0.5 * log2(uvArea / area);
+}
+
+// footprint に textures2d[index] (アトラスなら rect の範囲) の texel 数を足す
+// UV が縮退した三角形は -inf になり、レベル 0 に丸められる
+float getTextureLod(float footprint, int index, vec4 rect) {
+    vec2 size = vec2(textureSize(textures2d[index], 0)) * rect.zw;
+    return max(footprint + 0.5 * log2(size.x * size.y), 0.0);
+}
+
+// ピンホールカメラとしてスクリーン座標 [px] に投影する
+vec2 projectToScreen(vec3 worldPos) {
+    vec3 d = worldPos - pc.cameraPos.xyz;
+    float z = max(dot(d, pc.cameraForward.xyz), 1e-6);
+    float aspect = float(gl_LaunchSizeEXT.x) / float(gl_LaunchSizeEXT.y);
+    vec2 uv;
+    uv.x = dot(d, pc.cameraRight.xyz) / z * pc.cameraImageDistance / aspect;
+    uv.y = dot(d, pc.cameraUp.xyz) / z * pc.cameraImageDistance;
+    return vec2((uv.x + 1.0) * 0.5, 1.0 - (uv.y + 1.0) * 0.5) * vec2(gl_LaunchSizeEXT.xy);
+}
+
+// 最初のヒットの情報をAOVとして書き込む
+// モーションベクトルはノードの変換の差分のみ (カメラは現在のものを使う)
+void writeAOV(vec3 pos, vec3 localPos, vec3 normal, vec3 albedo, NodeData data) {
+    const ivec2 pixel = ivec2(gl_LaunchIDEXT.xy);
+    float depth = dot(pos - pc.cameraPos.xyz, pc.cameraForward.xyz);
+    vec3 prevPos = (data.prevTransformMatrix * vec4(localPos, 1.0)).xyz;
+    vec2 motion = projectToScreen(prevPos) - projectToScreen(pos);
+    imageStore(albedoImage, pixel, vec4(albedo, 1.0));
+    imageStore(normalDepthImage, pixel, vec4(normal, depth));
+    imageStore(motionIdImage, pixel, vec4(motion, float(gl_InstanceCustomIndexEXT), float(data.materialIndex)));
+}
+
+void main()
+{
+    NodeData data = nodeData[gl_InstanceCustomIndexEXT];
+
+    VertexBuffer vertexBuffer = VertexBuffer(data.vertexBufferAddress);
+    IndexBuffer indexBuffer = IndexBuffer(data.indexBufferAddress);
+
+    uvec3 index = indexBuffer.indices[gl_PrimitiveID];
+    Vertex v0 = vertexBuffer.vertices[index[0]];
+    Vertex v1 = vertexBuffer.vertices[index[1]];
+    Vertex v2 = vertexBuffer.vertices[index[2]];
+    
+    const vec3 barycentricCoords = vec3(1.0 - attribs.x - attribs.y, attribs.x, attribs.y);
+    float t = gl_HitTEXT;
+    vec3 pos = gl_WorldRayOriginEXT + gl_WorldRayDirectionEXT * gl_HitTEXT;
+    vec3 normal = normalize(v0.normal * barycentricCoords.x + v1.normal * barycentricCoords.y + v2.normal * barycentricCoords.z);
+    vec2 texCoord = v0.texCoord * barycentricCoords.x + v1.texCoord * barycentricCoords.y + v2.texCoord * barycentricCoords.z;
+
+    // Mesh AABB 内でのUVW座標を計算
+    vec3 localPos = v0.pos * barycentricCoords.x + v1.pos * barycentricCoords.y + v2.pos * barycentricCoords.z;
+    vec3 localUvw = (localPos - data.meshAabbMin) / (data.meshAabbMax - data.meshAabbMin);
+
+    mat3 normalMatrix = mat3(data.normalMatrix);
+    normal = normalize(normalMatrix * normal);
+
+    // Get material
+    vec3 baseColor = vec3(0.8);
+    float transmission = 0.0;
+    float metallic = 0.0;
+    float roughness = 0.0;
+    vec3 emissive = vec3(0.0);
+    float ior = 1.51;
+    float dispersion = 0.0;
+
+    int materialIndex = data.materialIndex;
+    if(materialIndex != -1){
+        Material material = materials[materialIndex];
+        baseColor = material.baseColorFactor.rgb;
+        transmission = 1.0 - material.baseColorFactor.a;
+        metallic = material.metallicFactor;
+        roughness = material.roughnessFactor;
+        emissive = material.emissiveFactor.rgb;
+        ior = material.ior;
+        dispersion = material.dispersion;
+
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_TEXTURE_2D)
+        // ミップマップはカメラから直接見えるヒットだけ使う (2 次以降はレベル 0)
+        float footprint = payload.depth == 0 ? getPrimaryTextureFootprint(v0, v1, v2) : -1e9;
+        if (material.baseColorTextureIndex != -1
+            && material.baseColorTextureIndex < TEXTURE_TYPE_OFFSET) {
+            int index = material.baseColorTextureIndex;
+            vec4 rect = material.baseColorTextureRect;
+            float lod = getTextureLod(footprint, index, rect);
+            vec4 color = textureLod(textures2d[index], getTextureUv(rect, texCoord), lod);
+            baseColor *= color.rgb;
+            transmission *= 1.0 - color.a;
+        }
+        if (material.metallicRoughnessTextureIndex != -1
+            && material.metallicRoughnessTextureIndex < TEXTURE_TYPE_OFFSET) {
+            // glTF: G = roughness, B = metallic
+            int index = material.metallicRoughnessTextureIndex;
+            vec4 rect = material.metallicRoughnessTextureRect;
+            float lod = getTextureLod(footprint, index, rect);
+            vec2 metalRough =
+                textureLod(textures2d[index], getTextureUv(rect, texCoord), lod).bg;
+            metallic *= metalRough.x;
+            roughness *= metalRough.y;
+        }
+#endif
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_TEXTURE_3D)
+        if (material.baseColorTextureIndex >= TEXTURE_TYPE_OFFSET) {
+            int index = material.baseColorTextureIndex - TEXTURE_TYPE_OFFSET;
+            vec4 color = texture(textures3d[index], localUvw);
+            baseColor *= color.rgb;
+            transmission *= 1.0 - color.a;
+        }
+        if (material.metallicRoughnessTextureIndex >= TEXTURE_TYPE_OFFSET) {
+            int index = material.metallicRoughnessTextureIndex - TEXTURE_TYPE_OFFSET;
+            vec2 metalRough = texture(textures3d[index], localUvw).rg;
+            metallic *= metalRough.x;
+            roughness *= metalRough.y;
+        }
+#endif
+    }
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_MESH_LIGHT)
+    // MIS: 拡散反射のサンプリングで当たった発光三角形は、光源サンプリング (メッシュライトの
+    // NEE) でも届く放射なので重みをかける
+    if (pc.enableNEE == 1 && pc.lightChunkCount > 0 && payload.bsdfPdf > 0.0
+        && emissive != vec3(0.0)) {
+        vec3 edge1 = gl_ObjectToWorldEXT * vec4(v1.pos - v0.pos, 0.0);
+        vec3 edge2 = gl_ObjectToWorldEXT * vec4(v2.pos - v0.pos, 0.0);
+        float cosLight = abs(dot(normalize(cross(edge1, edge2)), gl_WorldRayDirectionEXT));
+        float lightPdf = getMeshLightPdf(emissive, gl_HitTEXT, cosLight);
+        emissive *= powerHeuristic(payload.bsdfPdf, lightPdf);
+    }
+#endif
+
+    if(payload.writeAOV){
+        // 透過物体のアルベドは1とする (デノイザーの慣例)
+        vec3 albedo = (metallic == 0.0 && transmission > 0.0) ? vec3(1.0) : baseColor;
+        writeAOV(pos, localPos, normal, albedo, data);
+        payload.writeAOV = false;
+    }
+
+    payload.t = t;
+    payload.depth += 1;
+    if(payload.depth >= PATH_MAX_DEPTH){
+        payload.radiance = emissive;
+        payload.done = true;
+        return;
+    }
+    beginBounce(payload.rng, payload.depth - 1);
+
+    // 次のレイ (BSDF サンプリング) は rgen がトレースする
+    vec3 radiance = emissive;
+    BsdfSample bsdfSample;
+    vec3 n = normal;
+    payload.absorption = vec3(0.0);
+    // シーンに無い分岐は variant から外す (最後の拡散反射は常にある)
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_METAL)
+    if(metallic > 0.0){
+        vec3 i = worldToLocal(-gl_WorldRayDirectionEXT, n);
+        vec2 u = vec2(rand(payload.rng), rand(payload.rng));
+        bsdfSample = sampleMetalBsdf(i, baseColor, roughness, u);
+    }else
+#endif
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_GLASS)
+    if(transmission > 0.0){
+        // 非metallicの場合にのみtransmissionは有効となる
+        // emissiveは無視
+        radiance = vec3(0.0);
+        bool into = dot(gl_WorldRayDirectionEXT, normal) < 0.0;
+        n = into ? normal : -normal;
+        vec3 i = worldToLocal(-gl_WorldRayDirectionEXT, n);
+        vec3 u = vec3(rand(payload.rng), rand(payload.rng), rand(payload.rng));
+
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_DISPERSION)
+        if (dispersion != 0.0) {
+            // Hero wavelength: 波長ごとの重みは rgen が RGB にする
+            vec4 iors = computeCauchyIor(ior, dispersion, payload.wavelengths);
+            vec4 eta = into ? 1.0 / iors : iors;
+            bool companions = payload.wavelengthCount != 1;
+            SpectralBsdfSample spectralSample =
+                sampleDispersiveGlassBsdf(i, roughness, eta, companions, u);
+            bsdfSample.direction = spectralSample.direction;
+            bsdfSample.weight = vec3(1.0);
+            bsdfSample.pdf = 0.0;
+            payload.spectralWeight *= spectralSample.weight;
+            bool refracted = cosTheta(spectralSample.direction) < 0.0;
+            payload.wavelengthCount = (companions && !refracted) ? SPECTRUM_WAVELENGTHS : 1;
+        } else
+#endif
+        {
+            float eta = into ? 1.0 / ior : ior;
+            bsdfSample = sampleGlassBsdf(i, roughness, eta, u);
+        }
+
+        // 媒質の内側を進むレイ (入って屈折、または内側で反射) は吸収される
+        bool transmitted = cosTheta(bsdfSample.direction) < 0.0;
+        if (transmitted == into) {
+            payload.absorption = vec3(1.0) - baseColor;
+        }
+    }else
+#endif
+    {
+        // 近似モード: 深い拡散反射は環境光の放射照度 (SH9) で打ち切る (環境光の NEE は不要)
+        bool approximate = pc.envLightApproxDepth > 0 && payload.depth >= pc.envLightApproxDepth;
+
+        // Infinite light NEE
+        vec3 infLightTerm = vec3(0.0);
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_INFINITE_LIGHT)
+        {
+            float cosTheta = max(dot(normal, pc.infiniteLightDirection.xyz), 0.0);
+            if (cosTheta > 0.0) {
+                float pdf = 1.0;
+                vec3 incoming = getInfiniteLightRadiance(pos);
+                vec3 brdf = LambertBRDF(baseColor);
+                infLightTerm = brdf * incoming * cosTheta / pdf;
+            }
+        }
+#endif
+
+        // Environment light NEE (MIS with the diffuse IS below)
+        vec3 envLightTerm = vec3(0.0);
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_ENV_LIGHT)
+        if (pc.enableNEE == 1 && pc.useEnvLightTexture == 1 && !approximate) {
+            vec3 direction;
+            float lightPdf;
+            vec2 u = vec2(rand(payload.rng), rand(payload.rng));
+            vec3 incoming = sampleEnvLight(u, direction, lightPdf);
+            float cosTheta = dot(normal, direction);
+            if (cosTheta > 0.0 && lightPdf > 0.0) {
+                shadowed = true;
+                traceShadowRay(pos, direction, 0.001, 1000.0);
+                if (!shadowed) {
+                    float weight = powerHeuristic(lightPdf, cosTheta / PI);
+                    envLightTerm = LambertBRDF(baseColor) * incoming * cosTheta / lightPdf * weight;
+                }
+            }
+        }
+#endif
+
+        // Mesh light NEE (MIS with the diffuse IS below)
+        vec3 meshLightTerm = vec3(0.0);
+#if HAS_SHADER_FEATURE(SHADER_FEATURE_MESH_LIGHT)
+        if (pc.enableNEE == 1 && pc.lightChunkCount > 0) {
+            vec3 direction;
+            float distance;
+            float lightPdf;
+            vec4 u;
+            for (int i = 0; i < 4; i++) {
+                u[i] = rand(payload.rng);
+            }
+            vec3 incoming = sampleMeshLight(pos, u, direction, distance, lightPdf);
+            float cosTheta = dot(normal, direction);
+            if (cosTheta > 0.0 && lightPdf > 0.0) {
+                shadowed = true;
+                traceShadowRay(pos, direction, 0.001, distance * 0.999);
+                if (!shadowed) {
+                    float weight = powerHeuristic(lightPdf, cosTheta / PI);
+                    meshLightTerm = LambertBRDF(baseColor) * incoming * cosTheta * weight / lightPdf;
+                }
+            }
+        }
+#endif
+
+        if (approximate) {
+            vec3 envLightIrradianceTerm = LambertBRDF(baseColor) * getEnvLightIrradiance(normal);
+            payload.radiance = emissive + infLightTerm + meshLightTerm + envLightIrradianceTerm;
+            payload.done = true;
+            return;
+        }
+
+        // Diffuse IS (MIS は拡散反射のサンプリングのみ)
+        vec2 u = vec2(rand(payload.rng), rand(payload.rng));
+        bsdfSample = sampleDiffuseBsdf(baseColor, u);
+
+        radiance = emissive + infLightTerm + envLightTerm + meshLightTerm;
+    }
+
+    payload.radiance = radiance;
+    payload.weight = bsdfSample.weight;
+    payload.bsdfPdf = bsdfSample.pdf;
+    payload.origin = pos;
+    payload.direction = localToWorld(bsdfSample.direction, n);
+    payload.done = false;
+}
@@ -0,0 +1,39 @@
+// ------------------------------
+// 3D color LUT coordinates (shared by composite.comp and ColorLut)
+// ------------------------------
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <algorithm>
+    #include <cmath>
+
+    #define COLOR_LUT_FUNC inline
+
+namespace color_lut {
+using std::max;
+using std::min;
+using std::pow;
+#else
+    #define COLOR_LUT_FUNC /* nothing */
+#endif
+
+// Grid points per axis
+#define COLOR_LUT_SIZE 33
+
+// HDR value -> [0, 1] LUT coordinate
+// x / (1 + x) で [0, inf) を収め、さらにガンマ 2.2 相当で暗部にグリッドを寄せる
+COLOR_LUT_FUNC float shapeLut(float x) {
+    x = max(x, 0.0f);
+    return pow(x / (1.0f + x), 1.0f / 2.2f);
+}
+
+// Inverse of shapeLut (u = 1 is clamped to x = 999)
+COLOR_LUT_FUNC float unshapeLut(float u) {
+    float c = min(pow(u, 2.2f), 0.999f);
+    return c / (1.0f - c);
+}
+
+#ifdef __cplusplus
+}  // namespace color_lut
+#endif
@@ -0,0 +1,32 @@
+#include "./color_lut.h"
+
+layout(binding = 0, rgba32f) uniform image2D baseImage;
+layout(binding = 1, rgba32f) uniform image2D bloomImage;
+layout(binding = 4) uniform sampler3D colorLut;
+
+layout(push_constant) uniform CompositeInfo {
+    float bloomIntensity;
+    float saturation;
+    float exposure;
+    float gamma;
+    int enableToneMapping;
+    int enableGammaCorrection;
+    int _dummy0;
+    int _dummy1;
+};
+
+// composite.comp と composite_buffer.comp で共通の合成
+vec3 compositeColor(ivec2 st)
+{
+    vec3 baseColor = imageLoad(baseImage, st).rgb;
+    vec3 bloomColor = imageLoad(bloomImage, st).rgb;
+
+    vec3 color = baseColor;
+    if (bloomIntensity > 0.0) { // enable boolm
+        color += bloomColor * bloomIntensity;
+    }
+
+    // 彩度・露出・トーンマップ・ガンマは ColorLut に焼き込まれている
+    const vec3 uvw = vec3(shapeLut(color.r), shapeLut(color.g), shapeLut(color.b));
+    return texture(colorLut, (uvw * (COLOR_LUT_SIZE - 1) + 0.5) / COLOR_LUT_SIZE).rgb;
+}
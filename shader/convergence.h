@@ -0,0 +1,49 @@
+// ------------------------------
+// Adaptive sampling estimator (shared by base.rgen, convergence.comp and TileScheduler)
+// ------------------------------
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <algorithm>
+    #include <cmath>
+
+    #include <glm/glm.hpp>
+
+    #define CONVERGENCE_FUNC inline
+
+namespace convergence {
+using vec4 = glm::vec4;
+using std::max;
+using std::sqrt;
+#else
+    #define CONVERGENCE_FUNC /* nothing */
+#endif
+
+// Pixels per side of a scheduling tile (= workgroup size of convergence.comp)
+#define CONVERGENCE_TILE_SIZE 16
+
+// stats: x = mean luminance, y = M2 (sum of squared deviations), z = sample count, w = pass count
+// Welford's online update with one luminance sample
+CONVERGENCE_FUNC vec4 welfordUpdate(vec4 stats, float x) {
+    stats.z += 1.0f;
+    float delta = x - stats.x;
+    stats.x += delta / stats.z;
+    stats.y += delta * (x - stats.x);
+    return stats;
+}
+
+// Standard error of the mean relative to the mean. Dark pixels are compared against
+// a luminance floor so that they do not dominate. Fewer than 2 samples: not converged
+CONVERGENCE_FUNC float relativeError(vec4 stats) {
+    if (stats.z < 2.0f) {
+        return 1.0e4f;
+    }
+    float variance = stats.y / (stats.z - 1.0f);
+    float standardError = sqrt(max(variance, 0.0f) / stats.z);
+    return standardError / max(stats.x, 0.01f);
+}
+
+#ifdef __cplusplus
+}  // namespace convergence
+#endif
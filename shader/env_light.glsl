@@ -0,0 +1,82 @@
+#include "./env_light.h"
+
+// 環境マップの重点サンプリング (EnvLightSampler の GPU 版)
+// NOTE: share.h の後に include する
+
+// lod: ミップマップのレベル (光の計算に使う値はレベル 0)
+vec3 getEnvLightRadiance(vec3 direction, float lod) {
+    vec2 uv = envLightDirectionToUv(direction, pc.envLightPhi);
+    return textureLod(envLightTexture, uv, lod).rgb * pc.envLightIntensity;
+}
+
+// カメラのレイ 1 本が受け持つ角度 (ray cones の広がり。マテリアルのテクスチャでも使う)
+float getPrimaryPixelAngle() {
+    return 2.0 / (pc.cameraImageDistance * float(gl_LaunchSizeEXT.y));
+}
+
+// カメラから直接見える環境マップは、ピクセルの大きさに合うレベルを使う
+// (ピクセルあたりの texel が多いほどフェッチがキャッシュに乗らず、エイリアスも出る)
+float getEnvLightPrimaryLod() {
+    float texelAngle = PI / float(textureSize(envLightTexture, 0).y);
+    return max(log2(getPrimaryPixelAngle() / texelAngle), 0.0);
+}
+
+// 遮蔽を考えない放射照度 (SH9, EnvLightSH)。テクスチャを使わなければ一様な envLightColor
+vec3 getEnvLightIrradiance(vec3 normal) {
+    if (pc.useEnvLightTexture == 0) {
+        return PI * pc.envLightColor.rgb;
+    }
+    vec3 n = envLightShDirection(normal, pc.envLightPhi);
+    uint offset = envLightShOffset(envLightTableWidth, envLightTableHeight);
+    vec3 irradiance = vec3(0.0);
+    for (uint i = 0; i < ENV_LIGHT_SH_COUNT; i++) {
+        vec3 coefficient = vec3(envLightTable[offset + i * 3],
+                                envLightTable[offset + i * 3 + 1],
+                                envLightTable[offset + i * 3 + 2]);
+        irradiance += coefficient * envLightShIrradianceWeight(i, n);
+    }
+    return max(irradiance, vec3(0.0)) * pc.envLightIntensity;
+}
+
+uint findEnvLightInterval(uint offset, uint count, float u) {
+    uint first = 0;
+    uint remaining = count;
+    while (remaining > 0) {
+        uint halfLength = remaining / 2;
+        if (envLightTable[offset + first + halfLength + 1] <= u) {
+            first += halfLength + 1;
+            remaining -= halfLength + 1;
+        } else {
+            remaining = halfLength;
+        }
+    }
+    return min(first, count - 1);
+}
+
+// pdf over solid angle
+float getEnvLightPdf(vec3 direction) {
+    vec2 uv = envLightDirectionToUv(direction, pc.envLightPhi);
+    uint x = min(uint(uv.x * envLightTableWidth), envLightTableWidth - 1);
+    uint y = min(uint(uv.y * envLightTableHeight), envLightTableHeight - 1);
+    float pdf = envLightTable[envLightPdfOffset(x, y, envLightTableWidth, envLightTableHeight)];
+    return envLightUvPdfToSolidAngle(pdf, uv.y);
+}
+
+// u: uniform random numbers. pdf is over solid angle (0 if the direction can't be sampled)
+vec3 sampleEnvLight(vec2 u, out vec3 direction, out float pdf) {
+    const uint width = envLightTableWidth;
+    const uint height = envLightTableHeight;
+
+    uint y = findEnvLightInterval(0, height, u.y);
+    float dv = (u.y - envLightTable[y]) / max(envLightTable[y + 1] - envLightTable[y], 1e-20);
+
+    uint offset = envLightConditionalOffset(y, width, height);
+    uint x = findEnvLightInterval(offset, width, u.x);
+    float cdf0 = envLightTable[offset + x];
+    float du = (u.x - cdf0) / max(envLightTable[offset + x + 1] - cdf0, 1e-20);
+
+    vec2 uv = min(vec2((float(x) + du) / width, (float(y) + dv) / height), vec2(1.0));
+    direction = envLightUvToDirection(uv, pc.envLightPhi);
+    pdf = envLightUvPdfToSolidAngle(envLightTable[envLightPdfOffset(x, y, width, height)], uv.y);
+    return textureLod(envLightTexture, uv, 0.0).rgb * pc.envLightIntensity;
+}
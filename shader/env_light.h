@@ -0,0 +1,110 @@
+// ------------------------------
+// Environment light (shared by base.rmiss, env_light.glsl and EnvLightSampler)
+// ------------------------------
+// Equirectangular parameterization of envLightTexture and the layout of EnvLightBuffer.
+// u: azimuth (rotated by envLightPhi), v: polar angle from +Y (v = 0 is straight up)
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <cstdint>
+
+    #include <glm/glm.hpp>
+
+    #define ENV_LIGHT_FUNC inline
+
+namespace env_light {
+using uint = uint32_t;
+using vec2 = glm::vec2;
+using vec3 = glm::vec3;
+using glm::asin;
+using glm::atan;
+using glm::clamp;
+using glm::cos;
+using glm::fract;
+using glm::sin;
+#else
+    #define ENV_LIGHT_FUNC /* nothing */
+#endif
+
+#define ENV_LIGHT_PI 3.14159265358979
+
+// サンプリングテーブルの最大解像度 (これより大きいテクスチャは平均して縮小する)
+#define ENV_LIGHT_MAX_TABLE_WIDTH 2048
+#define ENV_LIGHT_MAX_TABLE_HEIGHT 1024
+
+// phi: envLightPhi [deg]
+ENV_LIGHT_FUNC vec2 envLightDirectionToUv(vec3 direction, float phi) {
+    float u = atan(direction.z, direction.x) / float(2.0 * ENV_LIGHT_PI) + 0.5f;
+    float v = 0.5f - asin(clamp(direction.y, -1.0f, 1.0f)) / float(ENV_LIGHT_PI);
+    return vec2(fract(u + phi / 360.0f), v);
+}
+
+ENV_LIGHT_FUNC vec3 envLightUvToDirection(vec2 uv, float phi) {
+    float azimuth = (fract(uv.x - phi / 360.0f) - 0.5f) * float(2.0 * ENV_LIGHT_PI);
+    float theta = uv.y * float(ENV_LIGHT_PI);
+    float sinTheta = sin(theta);
+    return vec3(sinTheta * cos(azimuth), cos(theta), sinTheta * sin(azimuth));
+}
+
+// pdf over [0, 1]^2 -> pdf over solid angle (dω = 2π^2 sinθ du dv)
+ENV_LIGHT_FUNC float envLightUvPdfToSolidAngle(float pdf, float v) {
+    float sinTheta = sin(v * float(ENV_LIGHT_PI));
+    return sinTheta > 0.0f ? pdf / (float(2.0 * ENV_LIGHT_PI * ENV_LIGHT_PI) * sinTheta) : 0.0f;
+}
+
+// EnvLightBuffer: [marginal CDF (height + 1)] [conditional CDF (width + 1) x height]
+//                 [pdf over uv (width x height)] [SH9 radiance (rgb x 9)]
+ENV_LIGHT_FUNC uint envLightConditionalOffset(uint row, uint width, uint height) {
+    return height + 1u + row * (width + 1u);
+}
+
+ENV_LIGHT_FUNC uint envLightPdfOffset(uint x, uint y, uint width, uint height) {
+    return height + 1u + height * (width + 1u) + y * width + x;
+}
+
+// ------------------------------
+// SH9 (l <= 2) projection of the radiance for the approximate path termination
+// ------------------------------
+// 放射照度は Ramamoorthi and Hanrahan 2001, "An Efficient Representation for Irradiance
+// Environment Maps" (cos のローブとの畳み込みは帯域ごとに A_l 倍するだけ)
+
+#define ENV_LIGHT_SH_COUNT 9
+
+ENV_LIGHT_FUNC uint envLightShOffset(uint width, uint height) {
+    return envLightPdfOffset(0u, height, width, height);
+}
+
+// envLightPhi で回した方向 -> 回転前のテクスチャの方向 (SH は回転前に射影する)
+ENV_LIGHT_FUNC vec3 envLightShDirection(vec3 direction, float phi) {
+    float angle = phi * float(ENV_LIGHT_PI / 180.0);
+    float c = cos(angle);
+    float s = sin(angle);
+    return vec3(c * direction.x - s * direction.z, direction.y, s * direction.x + c * direction.z);
+}
+
+// real SH basis Y_i (i = l * (l + 1) + m)
+ENV_LIGHT_FUNC float envLightShBasis(uint i, vec3 d) {
+    switch (i) {
+        case 0u: return 0.282095f;
+        case 1u: return 0.488603f * d.y;
+        case 2u: return 0.488603f * d.z;
+        case 3u: return 0.488603f * d.x;
+        case 4u: return 1.092548f * d.x * d.y;
+        case 5u: return 1.092548f * d.y * d.z;
+        case 6u: return 0.315392f * (3.0f * d.z * d.z - 1.0f);
+        case 7u: return 1.092548f * d.x * d.z;
+        default: return 0.546274f * (d.x * d.x - d.y * d.y);
+    }
+}
+
+// 放射照度 E(n) = sum_i A_l L_i Y_i(n) の A_l Y_i(n)
+ENV_LIGHT_FUNC float envLightShIrradianceWeight(uint i, vec3 n) {
+    float band = i == 0u ? float(ENV_LIGHT_PI) : (i < 4u ? float(2.0 * ENV_LIGHT_PI / 3.0)
+                                                         : float(ENV_LIGHT_PI / 4.0));
+    return band * envLightShBasis(i, n);
+}
+
+#ifdef __cplusplus
+}  // namespace env_light
+#endif
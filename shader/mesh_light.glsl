@@ -0,0 +1,52 @@
+// 発光三角形の直接光サンプリング (LightSampler の GPU 版)
+// NOTE: share.h, color.glsl の後に include する
+
+// u の整数部でエントリを、小数部で本体か別名かを選ぶ
+uint sampleLightChunk(float u) {
+    uint count = uint(pc.lightChunkCount);
+    float scaled = u * float(count);
+    uint index = min(uint(scaled), count - 1);
+    LightChunk chunk = lightChunks[index];
+    return scaled - float(index) < chunk.probability ? index : uint(chunk.alias);
+}
+
+uint sampleEmissiveTriangle(LightChunk chunk, float u) {
+    uint count = uint(chunk.count);
+    float scaled = u * float(count);
+    uint index = min(uint(scaled), count - 1);
+    EmissiveTriangle triangle = emissiveTriangles[chunk.first + index];
+    uint local = scaled - float(index) < triangle.probability ? index : uint(triangle.alias);
+    return uint(chunk.first) + local;
+}
+
+// 面積あたりの pdf は luminance / lightPower (三角形はパワーに比例して選び、三角形上は一様)
+// cosLight: 光源の法線とシャドウレイの角度
+float getMeshLightPdf(vec3 emission, float distance, float cosLight) {
+    if (pc.lightPower <= 0.0 || cosLight <= 0.0) {
+        return 0.0;
+    }
+    float areaPdf = computeLuminance(emission) / pc.lightPower;
+    return areaPdf * distance * distance / cosLight;
+}
+
+// u: uniform random numbers. pdf is over solid angle (0 if the direction can't be sampled)
+vec3 sampleMeshLight(vec3 pos, vec4 u, out vec3 direction, out float distance, out float pdf) {
+    LightChunk chunk = lightChunks[sampleLightChunk(u.x)];
+    EmissiveTriangle triangle = emissiveTriangles[sampleEmissiveTriangle(chunk, u.y)];
+
+    // 三角形上の一様な点
+    float su = sqrt(u.z);
+    vec3 point = triangle.position0 * (1.0 - su)
+               + triangle.position1 * (su * (1.0 - u.w))
+               + triangle.position2 * (su * u.w);
+    vec3 lightNormal = cross(triangle.position1 - triangle.position0,
+                             triangle.position2 - triangle.position0);
+
+    vec3 toLight = point - pos;
+    distance = length(toLight);
+    direction = toLight / max(distance, 1e-6);
+    // 光源は両面に放射する (base.rchit と同じ)
+    float cosLight = abs(dot(normalize(lightNormal), direction));
+    pdf = getMeshLightPdf(triangle.emission, distance, cosLight);
+    return triangle.emission;
+}
@@ -1,3 +1,6 @@
+#include "./sampler.h"
+
+// NOTE: share.h (pc, SobolBuffer, RandomState) の後に include する
 
 uint pcg(inout uint state)
 {
@@ -24,16 +27,69 @@ uvec2 pcg2d(uvec2 v)
     return v;
 }
 
-float rand(inout uint seed)
+// PCG: ピクセルと蓄積回数からシードを作る
+// Sobol: シードはピクセルとフレームごとのスクランブル、サンプル番号は beginSample() で与える
+RandomState initRandom(uvec2 pixel, uint accumCount, uint frame)
+{
+    RandomState rng;
+    if (pc.samplerType == SAMPLER_SOBOL) {
+        rng.seed = hashUint(hashCombine(hashCombine(hashUint(pixel.x), pixel.y), frame));
+    } else {
+        uvec2 s = pcg2d(pixel * (accumCount + 1));
+        rng.seed = s.x + s.y;
+    }
+    rng.index = 0;
+    rng.dimension = 0;
+    return rng;
+}
+
+void beginSample(inout RandomState rng, uint index)
+{
+    rng.index = index;
+    rng.dimension = 0;
+}
+
+// バウンスごとに次元の範囲を固定する (パスごとに使う乱数の数が違っても次元がずれない)
+void beginBounce(inout RandomState rng, int depth)
+{
+    rng.dimension = getBounceDimension(depth);
+}
+
+uint sobol(uint index, uint dimension)
+{
+    uint x = 0;
+    for (uint bit = 0; index != 0; bit++, index >>= 1) {
+        if ((index & 1u) != 0) {
+            x ^= sobolMatrices[dimension * SOBOL_BITS + bit];
+        }
+    }
+    return x;
+}
+
+float rand(inout RandomState rng)
 {
-    uint val = pcg(seed);
+    if (pc.samplerType == SAMPLER_SOBOL) {
+        uint index = shuffleSampleIndex(rng.index, rng.dimension, rng.seed);
+        uint x = sobol(index, rng.dimension % SOBOL_DIMENSIONS);
+        float value = scrambleSobol(x, rng.dimension, rng.seed);
+        rng.dimension++;
+        return value;
+    }
+    uint val = pcg(rng.seed);
     return (float(val) * (1.0 / float(0xffffffffu)));
 }
 
-vec2 sampleDisk(inout uint seed) {
+// ロシアンルーレット用の乱数 (バウンスの最後の次元)
+float randRoulette(inout RandomState rng, int depth)
+{
+    rng.dimension = getBounceDimension(depth) + SAMPLER_ROULETTE_DIMENSION;
+    return rand(rng);
+}
+
+vec2 sampleDisk(inout RandomState rng) {
     const float PI = 3.1415926535;
-    float u = rand(seed);
-    float v = rand(seed);
+    float u = rand(rng);
+    float v = rand(rng);
     vec2 pos;
     pos.x = sqrt(u) * cos(2.0 * PI * v);
     pos.y = sqrt(u) * sin(2.0 * PI * v);
@@ -0,0 +1,91 @@
+// ------------------------------
+// Owen-scrambled Sobol sampler (shared by random.glsl and SobolSampler)
+// ------------------------------
+// Burley 2020, "Practical Hash-based Owen Scrambling"
+// Dimensions are grouped into SOBOL_DIMENSIONS-D Sobol points, and each group uses its own
+// shuffled sample index (padding), so any number of dimensions can be drawn.
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <cstdint>
+
+    #define SAMPLER_FUNC inline
+
+namespace sampler {
+using uint = uint32_t;
+
+inline uint bitfieldReverse(uint x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+#else
+    #define SAMPLER_FUNC /* nothing */
+#endif
+
+// RayTracingConstants::samplerType
+#define SAMPLER_PCG 0
+#define SAMPLER_SOBOL 1
+
+// Dimensions of one Sobol point (generator matrices in SobolBuffer)
+#define SOBOL_DIMENSIONS 4
+#define SOBOL_BITS 32
+
+// 次元の割り当て: カメラ (レンズ) の後に、バウンスごとに固定の範囲を使う
+// バウンス: 光源サンプリング 6, BSDF 2, ロシアンルーレット 1
+#define SAMPLER_CAMERA_DIMENSIONS 4
+#define SAMPLER_BOUNCE_DIMENSIONS 9
+#define SAMPLER_ROULETTE_DIMENSION 8
+
+// MurmurHash3 finalizer
+SAMPLER_FUNC uint hashUint(uint x) {
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+SAMPLER_FUNC uint hashCombine(uint seed, uint v) {
+    return seed ^ (v + (seed << 6) + (seed >> 2));
+}
+
+SAMPLER_FUNC uint laineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// Owen scrambling (base 2) of the bits of x
+SAMPLER_FUNC uint nestedUniformScramble(uint x, uint seed) {
+    x = bitfieldReverse(x);
+    x = laineKarrasPermutation(x, seed);
+    return bitfieldReverse(x);
+}
+
+// The sample index of the group that contains the dimension (decorrelates the groups)
+SAMPLER_FUNC uint shuffleSampleIndex(uint index, uint dimension, uint seed) {
+    uint group = dimension / SOBOL_DIMENSIONS;
+    return nestedUniformScramble(index, hashUint(hashCombine(seed, group)));
+}
+
+// Owen-scrambled Sobol value in [0, 1) (24 bits, exactly representable)
+SAMPLER_FUNC float scrambleSobol(uint sobol, uint dimension, uint seed) {
+    uint x = nestedUniformScramble(sobol, hashUint(hashCombine(seed, dimension + 0x9e3779b9u)));
+    return float(x >> 8) * (1.0f / 16777216.0f);
+}
+
+SAMPLER_FUNC uint getBounceDimension(int depth) {
+    return SAMPLER_CAMERA_DIMENSIONS + uint(depth) * SAMPLER_BOUNCE_DIMENSIONS;
+}
+
+#ifdef __cplusplus
+}  // namespace sampler
+#endif
@@ -0,0 +1,26 @@
+// ------------------------------
+// Shader variants (shared by closest_hit.glsl and shader_variant.hpp)
+// ------------------------------
+// SHADER_FEATURES is a bit mask of the features that closest_hit.glsl compiles in.
+// シーンが使わない機能の分岐をコンパイルしないことで、レジスタの使用量を減らす
+
+#ifdef __cplusplus
+    #pragma once
+#endif
+
+#define SHADER_FEATURE_TEXTURE_2D (1 << 0)
+#define SHADER_FEATURE_TEXTURE_3D (1 << 1)
+#define SHADER_FEATURE_METAL (1 << 2)
+#define SHADER_FEATURE_GLASS (1 << 3)
+#define SHADER_FEATURE_DISPERSION (1 << 4)
+#define SHADER_FEATURE_INFINITE_LIGHT (1 << 5)
+#define SHADER_FEATURE_ENV_LIGHT (1 << 6)  // env light texture NEE
+#define SHADER_FEATURE_MESH_LIGHT (1 << 7)
+#define SHADER_FEATURES_ALL 0xff
+
+// 指定がなければ全ての機能 (base.rchit)
+#ifndef SHADER_FEATURES
+    #define SHADER_FEATURES SHADER_FEATURES_ALL
+#endif
+
+#define HAS_SHADER_FEATURE(feature) ((SHADER_FEATURES & (feature)) != 0)
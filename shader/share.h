@@ -68,6 +68,13 @@ struct RayTracingConstants {
     FIELD(float, cameraLensRadius, 0.1f);
 
     FIELD(int, isEnvLightTextureVisible, 0);
+    FIELD(int, enableAOV, 0);
+    FIELD(int, enableBloom, 0);
+    FIELD(int, samplerType, 1);  // SAMPLER_SOBOL (sampler.h)
+    FIELD(int, frame, 0);  // 蓄積を始めたフレーム (Sobol のスクランブル)
+    FIELD(int, lightChunkCount, 0);  // 発光三角形のサンプリング (LightSampler)
+    FIELD(float, lightPower, 0.0f);  // sum of luminance x area of the emissive triangles
+    FIELD(int, envLightApproxDepth, 0);  // 拡散反射を SH の放射照度で打ち切る深さ (0: 無効)
 };
 
 struct Material {
@@ -90,6 +97,14 @@ struct Material {
     FIELD(vec4, baseColorFactor, vec4(1.0f));
     FIELD(vec3, emissiveFactor, vec4(0.0f));
     FIELD(float, dispersion, 0.0f);
+
+    // 2D テクスチャの UV の範囲 (xy: offset, zw: scale)
+    // アトラスに詰めたテクスチャは uv = xy + fract(uv) * zw で引く (TextureAtlas)
+    FIELD(vec4, baseColorTextureRect, vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    FIELD(vec4, metallicRoughnessTextureRect, vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    FIELD(vec4, normalTextureRect, vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    FIELD(vec4, occlusionTextureRect, vec4(0.0f, 0.0f, 1.0f, 1.0f));
+    FIELD(vec4, emissiveTextureRect, vec4(0.0f, 0.0f, 1.0f, 1.0f));
 };
 
 struct NodeData {
@@ -106,6 +121,29 @@ struct NodeData {
     FIELD(int, _dummy3, 0);
     FIELD(vec3, meshAabbMax, vec3(0.0f));
     FIELD(int, _dummy4, 0);
+    FIELD(mat4, prevTransformMatrix, mat4(1.0f));  // モーションベクトル用 (前フレームの変換)
+};
+
+// 発光三角形 (ワールド空間) と、チャンク内のエイリアステーブルのエントリ
+struct EmissiveTriangle {
+    USING_GLM
+
+    FIELD(vec3, position0, vec3(0.0f));
+    FIELD(float, probability, 1.0f);
+    FIELD(vec3, position1, vec3(0.0f));
+    FIELD(int, alias, 0);  // index in the chunk
+    FIELD(vec3, position2, vec3(0.0f));
+    FIELD(int, _dummy0, 0);
+    FIELD(vec3, emission, vec3(0.0f));
+    FIELD(int, _dummy1, 0);
+};
+
+// kChunkSize 個の三角形をまとめたもの。チャンクの選択にもエイリアステーブルを使う
+struct LightChunk {
+    FIELD(float, probability, 1.0f);
+    FIELD(int, alias, 0);
+    FIELD(int, first, 0);  // first EmissiveTriangle
+    FIELD(int, count, 0);
 };
 
 #ifndef __cplusplus
@@ -114,17 +152,36 @@ struct NodeData {
 
 const float PI = 3.1415926535;
 
+// MIS: Veach's power heuristic (β = 2)
+float powerHeuristic(float pdf, float otherPdf) {
+    float a = pdf * pdf;
+    float b = otherPdf * otherPdf;
+    return a + b > 0.0 ? a / (a + b) : 0.0;
+}
+
+// random.glsl
+struct RandomState {
+    uint seed;
+    uint index;      // sample index (Sobol)
+    uint dimension;  // next dimension (Sobol)
+};
+
+// パスのループは base.rgen にあり、base.rchit は 1 頂点分の結果と次のレイを返す
 struct HitPayload {
-    vec3 radiance;
+    vec3 radiance;  // emission + NEE at this vertex (rgen multiplies the path throughput)
     int depth;
-    uint seed;
-    int component;  // selected RGB (-1 means unselected)
-    float t;
-    // vec3 position;
-    // vec3 normal;
-    // vec3 emission;
-    // vec3 brdf;
-    // bool done;
+    vec3 weight;  // BSDF weight of the next ray (bsdf.h)
+    float bsdfPdf;  // pdf of the sampled direction for MIS with light sampling (0: no MIS)
+    vec3 origin;  // next ray
+    float t;  // hit distance (0: miss)
+    vec3 direction;
+    int wavelengthCount;  // active wavelengths (0: not dispersed yet, 1: hero only)
+    vec3 absorption;  // absorption coefficient along the next ray (inside glass)
+    bool done;  // miss or terminated
+    vec4 wavelengths;  // hero (x) and companion wavelengths [nm] (spectrum.h)
+    vec4 spectralWeight;  // per-wavelength weight from dispersive glass
+    RandomState rng;
+    bool writeAOV;  // 最初のヒットでAOVを書き込む
 };
 
 struct Vertex {
@@ -144,6 +201,14 @@ layout(binding = 2) uniform sampler2D envLightTexture;
 layout(binding = 3) uniform sampler2D textures2d[];
 layout(binding = 4) uniform sampler3D textures3d[];
 
+// AOV (first hit)
+layout(binding = 5, rgba32f) uniform image2D albedoImage;       // rgb: albedo
+layout(binding = 6, rgba32f) uniform image2D normalDepthImage;  // xyz: shading normal, w: linear depth
+layout(binding = 7, rgba32f) uniform image2D motionIdImage;     // xy: motion [px], z: instance, w: material
+
+// Adaptive sampling (convergence.h)
+layout(binding = 8, rgba32f) uniform image2D statsImage;  // luminance mean, M2, sample count, pass count
+
 // Accel
 layout(binding = 10) uniform accelerationStructureEXT topLevelAS;
 
@@ -156,6 +221,32 @@ layout(binding = 21) buffer MaterialBuffer {
     Material materials[];
 };
 
+layout(binding = 22) buffer TileMaskBuffer {
+    uint tileMask[];  // 1: trace, 0: converged (TileScheduler)
+};
+
+layout(binding = 23) buffer SobolBuffer {
+    uint sobolMatrices[];  // SOBOL_DIMENSIONS * SOBOL_BITS (SobolSampler::generateMatrices)
+};
+
+layout(binding = 24) buffer EnvLightBuffer {
+    uint envLightTableWidth;
+    uint envLightTableHeight;
+    float envLightTable[];  // CDFs and pdf (env_light.h, EnvLightSampler)
+};
+
+layout(binding = 25) buffer EmissiveTriangleBuffer {
+    EmissiveTriangle emissiveTriangles[];
+};
+
+layout(binding = 26) buffer LightChunkBuffer {
+    LightChunk lightChunks[];
+};
+
+layout(binding = 27) buffer SpectrumBuffer {
+    vec4 spectrumRgb[];  // SPECTRUM_TABLE_SIZE (SpectrumTable::build)
+};
+
 // Buffer reference
 layout(buffer_reference, scalar) buffer VertexBuffer {
     Vertex vertices[];
@@ -0,0 +1,40 @@
+#include "./spectrum.h"
+
+// NOTE: share.h (SpectrumBuffer) の後に include する
+
+// hero (x) と companion の波長 [nm] を RGB の応答の和に比例した分布でサンプルする
+// companion は u を等間隔にずらすので、どの波長も周辺分布は同じ
+// weights: 1 / (pdf * range) (一様なサンプリングなら 1)
+vec4 sampleHeroWavelengths(float u, out vec4 weights)
+{
+    const float scale = float(SPECTRUM_TABLE_SIZE - 1);
+    vec4 wavelengths;
+    for (int i = 0; i < SPECTRUM_WAVELENGTHS; i++) {
+        float x = fract(u + float(i) / float(SPECTRUM_WAVELENGTHS)) * scale;
+        int k = min(int(x), SPECTRUM_TABLE_SIZE - 2);
+        float l0 = spectrumRgb[k].a;
+        float l1 = spectrumRgb[k + 1].a;
+        wavelengths[i] = mix(l0, l1, x - float(k));
+        weights[i] = (l1 - l0) * scale / (SPECTRUM_MAX_WAVELENGTH - SPECTRUM_MIN_WAVELENGTH);
+    }
+    return wavelengths;
+}
+
+vec3 getSpectrumRgb(float wavelength)
+{
+    float x = clamp(getSpectrumTableCoordinate(wavelength), 0.0, float(SPECTRUM_TABLE_SIZE - 1));
+    int i = min(int(x), SPECTRUM_TABLE_SIZE - 2);
+    return mix(spectrumRgb[i].rgb, spectrumRgb[i + 1].rgb, x - float(i));
+}
+
+// 波長ごとの重み -> RGB (波長の平均。平坦なスペクトルの期待値は白)
+vec3 spectrumToRgb(vec4 wavelengths, vec4 weights)
+{
+    vec3 rgb = vec3(0.0);
+    for (int i = 0; i < SPECTRUM_WAVELENGTHS; i++) {
+        if (weights[i] != 0.0) {
+            rgb += weights[i] * getSpectrumRgb(wavelengths[i]);
+        }
+    }
+    return rgb / float(SPECTRUM_WAVELENGTHS);
+}
@@ -0,0 +1,45 @@
+// ------------------------------
+// Hero wavelength sampling (shared by base.rgen, base.rchit, spectrum.glsl and SpectrumTable)
+// ------------------------------
+// Wilkie et al. 2014, "Hero Wavelength Spectral Sampling"
+// A path carries a hero wavelength and companions shifted by equal steps of the sampling CDF.
+// RGB のパスはそのままで、分散するガラスに当たった後だけ波長ごとの重みを使う
+
+#ifdef __cplusplus
+    #pragma once
+
+    #include <glm/glm.hpp>
+
+    #define SPECTRUM_FUNC inline
+
+namespace spectrum {
+using vec4 = glm::vec4;
+#else
+    #define SPECTRUM_FUNC /* nothing */
+#endif
+
+#define SPECTRUM_MIN_WAVELENGTH 380.0f
+#define SPECTRUM_MAX_WAVELENGTH 780.0f
+
+// hero + companions (vec4)
+#define SPECTRUM_WAVELENGTHS 4
+
+// SpectrumBuffer: rgb: RGB response every 5 nm,
+//                 a: inverse CDF of the wavelength sampling at u = i / (SPECTRUM_TABLE_SIZE - 1)
+#define SPECTRUM_TABLE_SIZE 81
+
+// Cauchy's equation. b: Material::dispersion [μm^2]
+SPECTRUM_FUNC vec4 computeCauchyIor(float a, float b, vec4 wavelengths) {
+    vec4 micrometers = wavelengths * 0.001f;
+    return a + b / (micrometers * micrometers);
+}
+
+// wavelength [nm] -> continuous index of SpectrumBuffer
+SPECTRUM_FUNC float getSpectrumTableCoordinate(float wavelength) {
+    float range = SPECTRUM_MAX_WAVELENGTH - SPECTRUM_MIN_WAVELENGTH;
+    return (wavelength - SPECTRUM_MIN_WAVELENGTH) / range * float(SPECTRUM_TABLE_SIZE - 1);
+}
+
+#ifdef __cplusplus
+}  // namespace spectrum
+#endif